@@ -6,8 +6,17 @@
 [org 0x7C00]
 [bits 16]
 
-KERNEL_OFFSET equ 0x1000        ; Kernel di-load ke sini
-KERNEL_SECTORS equ 20           ; Jumlah sector kernel (sesuaikan jika perlu)
+KERNEL_OFFSET equ 0x100000      ; Kernel di-load ke sini (1 MB)
+BOUNCE_SEG equ 0x1000           ; Buffer sementara di 0x10000 untuk int 0x13
+BATCH_SECTORS equ 127           ; Maksimum sector per panggilan AH=42h
+
+; Jumlah sector kernel, dihitung Makefile dari ukuran kernel.bin
+%ifndef KERNEL_SECTORS
+%define KERNEL_SECTORS 128
+%endif
+E820_MAP equ 0x500              ; Memory map untuk kernel: count, lalu entries
+E820_MAX equ 32
+E820_SMAP equ 0x534D4150        ; 'SMAP'
 
 start:
     ; Setup segments
@@ -18,11 +27,21 @@ start:
     mov ss, ax
     mov sp, 0x7C00
     sti
+    mov [boot_drive], dl        ; BIOS memberi nomor drive boot di DL
 
     ; Print loading message
     mov si, msg_loading
     call print_string
 
+    ; Minta memory map ke BIOS (E820)
+    call detect_memory
+
+    ; Buka A20 (fast A20 gate) supaya memory di atas 1 MB bisa diakses
+    in al, 0x92
+    or al, 2
+    and al, 0xFE                ; Jangan reset CPU
+    out 0x92, al
+
     ; Load kernel dari disk
     call load_kernel
 
@@ -41,19 +60,100 @@ start:
     jmp CODE_SEG:init_pm
 
 ; ---------------------------------------------------------
-; Load kernel dari disk ke memory
+; Unreal mode: masuk protected mode sebentar untuk mengisi cache
+; descriptor DS/ES dengan limit 4 GB, lalu kembali ke real mode
+; ---------------------------------------------------------
+enter_unreal:
+    cli
+    push ds
+    push es
+    lgdt [gdt_descriptor]
+    mov eax, cr0
+    or al, 1
+    mov cr0, eax
+    jmp $+2
+    mov bx, DATA_SEG
+    mov ds, bx
+    mov es, bx
+    and al, 0xFE
+    mov cr0, eax
+    pop es
+    pop ds
+    sti
+    ret
+
+; ---------------------------------------------------------
+; Load kernel dari disk ke 1 MB: int 0x13 AH=42h (LBA) per
+; BATCH_SECTORS ke buffer sementara, lalu copy ke atas 1 MB
 ; ---------------------------------------------------------
 load_kernel:
-    mov ah, 0x02                ; BIOS read sectors
-    mov al, KERNEL_SECTORS      ; Jumlah sectors
-    mov ch, 0                   ; Cylinder 0
-    mov cl, 2                   ; Start dari sector 2 (setelah bootloader)
-    mov dh, 0                   ; Head 0
-    mov dl, 0x80                ; First hard disk
-    mov bx, KERNEL_OFFSET       ; ES:BX = destinasi buffer
+    mov ah, 0x41                ; Cek BIOS extensions
+    mov bx, 0x55AA
+    mov dl, [boot_drive]
     int 0x13
-    
-    jc disk_error               ; Jump jika error
+    jc disk_error
+    cmp bx, 0xAA55
+    jne disk_error
+
+    mov edi, KERNEL_OFFSET
+.next:
+    mov cx, [sectors_left]
+    jcxz .done
+    cmp cx, BATCH_SECTORS
+    jbe .read
+    mov cx, BATCH_SECTORS
+.read:
+    mov [dap_count], cx
+    mov si, dap
+    mov ah, 0x42
+    mov dl, [boot_drive]
+    int 0x13
+    jc disk_error
+
+    ; BIOS bisa me-reset limit segment, jadi masuk unreal mode
+    ; lagi sebelum setiap copy
+    call enter_unreal
+
+    movzx ecx, word [dap_count]
+    sub [sectors_left], cx
+    add [dap_lba], ecx
+
+    ; Copy ke EDI dengan alamat 32-bit (unreal mode)
+    shl ecx, 7                  ; Sector -> dword
+    mov esi, BOUNCE_SEG * 16
+    a32 rep movsd
+    jmp .next
+.done:
+    ret
+
+; ---------------------------------------------------------
+; Ambil memory map BIOS (int 0x15, EAX=E820)
+; Hasil: dword count di E820_MAP, 24-byte entries mulai E820_MAP+8
+; ---------------------------------------------------------
+detect_memory:
+    mov di, E820_MAP + 8
+    xor ebx, ebx                ; Continuation value, 0 = awal
+    xor bp, bp                  ; Jumlah entry
+.next:
+    mov eax, 0xE820
+    mov edx, E820_SMAP
+    mov ecx, 24
+    mov dword [di + 20], 1      ; ACPI attr valid jika BIOS tidak mengisinya
+    int 0x15
+    jc .done                    ; Carry = tidak didukung / akhir list
+    cmp eax, E820_SMAP
+    jne .done
+    jcxz .skip                  ; Entry kosong
+    inc bp
+    add di, 24
+    cmp bp, E820_MAX
+    jae .done
+.skip:
+    test ebx, ebx
+    jnz .next
+.done:
+    mov [E820_MAP], bp
+    mov word [E820_MAP + 2], 0
     ret
 
 disk_error:
@@ -91,8 +191,10 @@ init_pm:
     mov ss, ax
     mov esp, 0x9FC00
 
-    ; Jump ke kernel
-    call KERNEL_OFFSET
+    ; Jump ke kernel, EBX = pointer ke memory map
+    mov ebx, E820_MAP
+    mov eax, KERNEL_OFFSET
+    call eax
 
     ; Jika kernel return, hang
     jmp $
@@ -132,6 +234,21 @@ gdt_descriptor:
 CODE_SEG equ gdt_code - gdt_start
 DATA_SEG equ gdt_data - gdt_start
 
+; ---------------------------------------------------------
+; Disk address packet untuk int 0x13 AH=42h
+; ---------------------------------------------------------
+dap:
+    db 0x10, 0                  ; Ukuran packet, reserved
+dap_count:
+    dw 0                        ; Jumlah sector
+    dw 0, BOUNCE_SEG            ; Buffer (offset, segment)
+dap_lba:
+    dd 1                        ; LBA awal (setelah bootloader)
+    dd 0
+
+sectors_left dw KERNEL_SECTORS
+boot_drive db 0
+
 ; ---------------------------------------------------------
 ; Messages
 ; ---------------------------------------------------------
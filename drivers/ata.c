@@ -0,0 +1,462 @@
+#include "ata.h"
+#include "io.h"
+#include "pci.h"
+#include "timer.h"
+#include "../kernel/interrupt.h"
+#include "../kernel/mutex.h"
+#include "../kernel/paging.h"
+#include "../kernel/pmm.h"
+#include "../kernel/sched.h"
+#include "../kernel/smp.h"
+
+#define ATA_IO_BASE 0x1F0
+#define ATA_CTRL 0x3F6
+
+#define ATA_REG_DATA (ATA_IO_BASE + 0)
+#define ATA_REG_ERROR (ATA_IO_BASE + 1)
+#define ATA_REG_SECCOUNT (ATA_IO_BASE + 2)
+#define ATA_REG_LBA0 (ATA_IO_BASE + 3)
+#define ATA_REG_LBA1 (ATA_IO_BASE + 4)
+#define ATA_REG_LBA2 (ATA_IO_BASE + 5)
+#define ATA_REG_DRIVE (ATA_IO_BASE + 6)
+#define ATA_REG_STATUS (ATA_IO_BASE + 7)
+#define ATA_REG_COMMAND (ATA_IO_BASE + 7)
+
+#define ATA_SR_ERR 0x01
+#define ATA_SR_DRQ 0x08
+#define ATA_SR_DF 0x20
+#define ATA_SR_BSY 0x80
+
+#define ATA_CMD_READ_PIO 0x20
+#define ATA_CMD_WRITE_PIO 0x30
+#define ATA_CMD_READ_DMA 0xC8
+#define ATA_CMD_WRITE_DMA 0xCA
+#define ATA_CMD_CACHE_FLUSH 0xE7
+#define ATA_CMD_IDENTIFY 0xEC
+
+// Device interrupts stay masked except while a DMA command is in flight;
+// PIO transfers and cache flushes poll, so IRQ 14 would go unanswered
+#define ATA_CTRL_NIEN 0x02
+
+#define ATA_ID_CAPABILITIES 49
+#define ATA_CAP_DMA (1 << 8)
+
+// LBA28 transfers at most 256 sectors; a count byte of 0 means 256
+#define ATA_MAX_SECTORS 256
+#define ATA_TIMEOUT 1000000
+#define ATA_DMA_TIMEOUT_MS 5000
+#define ATA_IRQ 14
+
+// Bus-master IDE registers, primary channel, relative to BAR4
+#define BM_REG_COMMAND 0
+#define BM_REG_STATUS 2
+#define BM_REG_PRDT 4
+
+#define BM_CMD_START 0x01
+#define BM_CMD_READ 0x08 // device to memory
+#define BM_STATUS_ERROR 0x02
+#define BM_STATUS_IRQ 0x04
+
+// Physical region descriptor: a buffer that must not cross a 64 KB
+// boundary; a byte count of 0 means 64 KB
+struct prd {
+	uint32_t addr;
+	uint16_t bytes;
+	uint16_t flags;
+};
+
+#define PRD_EOT 0x8000
+#define PRD_MAX (PAGE_SIZE / sizeof(struct prd))
+
+// transfer() result when the buffers cannot be described to the DMA
+// engine; the caller falls back to PIO
+#define ATA_NO_DMA -2
+
+struct ata_drive {
+	int present;
+	int drive;
+	int dma;
+	struct blockdev dev;
+};
+
+static struct ata_drive drives[2];
+static const char *drive_names[2] = {"ata0", "ata1"};
+
+// One command at a time on the channel: the task file, the PRDT and the
+// DMA completion state below are shared by both drives
+static struct mutex channel_lock;
+static uint16_t bm_base = 0; // 0 without a bus-master controller
+static struct prd *prdt = 0;
+static volatile int dma_done = 0;
+static volatile uint8_t dma_bm_status = 0;
+// CPU halting in ata_wait_dma(); IRQ 14 may be routed elsewhere
+static volatile int dma_cpu = 0;
+
+// Reading the alternate status port four times gives the drive the 400 ns
+// it needs after a select or command
+static void ata_delay(void)
+{
+	for (int i = 0; i < 4; i++)
+		inb(ATA_CTRL);
+}
+
+static int ata_wait_idle(void)
+{
+	for (int i = 0; i < ATA_TIMEOUT; i++) {
+		uint8_t status = inb(ATA_REG_STATUS);
+		if (!(status & ATA_SR_BSY))
+			return (status & (ATA_SR_ERR | ATA_SR_DF)) ? -1 : 0;
+	}
+	return -1;
+}
+
+static int ata_wait_drq(void)
+{
+	for (int i = 0; i < ATA_TIMEOUT; i++) {
+		uint8_t status = inb(ATA_REG_STATUS);
+		if (status & (ATA_SR_ERR | ATA_SR_DF))
+			return -1;
+		if (!(status & ATA_SR_BSY) && (status & ATA_SR_DRQ))
+			return 0;
+	}
+	return -1;
+}
+
+static void ata_select(int drive, uint32_t lba)
+{
+	outb(ATA_REG_DRIVE, 0xE0 | (drive << 4) | ((lba >> 24) & 0x0F));
+	ata_delay();
+}
+
+static void ata_identify(struct ata_drive *d)
+{
+	uint16_t id[256];
+
+	ata_select(d->drive, 0);
+	outb(ATA_REG_SECCOUNT, 0);
+	outb(ATA_REG_LBA0, 0);
+	outb(ATA_REG_LBA1, 0);
+	outb(ATA_REG_LBA2, 0);
+	outb(ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
+	ata_delay();
+
+	uint8_t status = inb(ATA_REG_STATUS);
+	if (status == 0 || status == 0xFF)
+		return;
+	if (ata_wait_idle() != 0)
+		return;
+	// ATAPI and SATA devices set a signature here; not supported
+	if (inb(ATA_REG_LBA1) || inb(ATA_REG_LBA2))
+		return;
+	if (ata_wait_drq() != 0)
+		return;
+
+	insw(ATA_REG_DATA, id, 256);
+
+	d->present = 1;
+	d->dma = bm_base && (id[ATA_ID_CAPABILITIES] & ATA_CAP_DMA);
+	d->dev.sector_count = id[60] | ((uint32_t)id[61] << 16);
+}
+
+static void ata_issue(struct ata_drive *d, uint32_t lba, uint32_t count,
+                      uint8_t command)
+{
+	ata_select(d->drive, lba);
+	outb(ATA_REG_SECCOUNT, count & 0xFF);
+	outb(ATA_REG_LBA0, lba & 0xFF);
+	outb(ATA_REG_LBA1, (lba >> 8) & 0xFF);
+	outb(ATA_REG_LBA2, (lba >> 16) & 0xFF);
+	outb(ATA_REG_COMMAND, command);
+}
+
+static void ata_irq(struct regs *r)
+{
+	(void)r;
+
+	uint8_t bm = inb(bm_base + BM_REG_STATUS);
+	if (!(bm & BM_STATUS_IRQ))
+		return;
+
+	// Reading the status register acknowledges the drive
+	inb(ATA_REG_STATUS);
+	outb(bm_base + BM_REG_STATUS, BM_STATUS_IRQ);
+	dma_bm_status |= bm;
+	dma_done = 1;
+	if (dma_cpu != smp_cpu_id())
+		smp_send_resched(dma_cpu);
+}
+
+// Describe the segments to the DMA engine, splitting at page boundaries
+// and merging physically contiguous pages
+static int build_prdt(const struct blk_segment *segs, uint32_t nsegs)
+{
+	uint32_t n = 0;
+	uint32_t len = 0; // bytes in prdt[n - 1]
+
+	for (uint32_t i = 0; i < nsegs; i++) {
+		uint8_t *p = segs[i].buffer;
+		uint32_t left = segs[i].count * SECTOR_SIZE;
+
+		while (left) {
+			uint32_t phys = paging_virt_to_phys(p);
+			if (!phys || (phys & 1))
+				return -1;
+
+			uint32_t chunk = PAGE_SIZE - (phys & (PAGE_SIZE - 1));
+			if (chunk > left)
+				chunk = left;
+
+			if (n && prdt[n - 1].addr + len == phys &&
+			    (prdt[n - 1].addr >> 16) == ((phys + chunk - 1) >> 16)) {
+				len += chunk;
+			} else {
+				if (n == PRD_MAX)
+					return -1;
+				prdt[n].addr = phys;
+				prdt[n].flags = 0;
+				n++;
+				len = chunk;
+			}
+			prdt[n - 1].bytes = len & 0xFFFF;
+
+			p += chunk;
+			left -= chunk;
+		}
+	}
+	if (!n)
+		return -1;
+	prdt[n - 1].flags = PRD_EOT;
+	return 0;
+}
+
+// Halt until IRQ 14 once interrupts are up; during boot, poll the
+// bus-master status instead. When another CPU takes the IRQ, its handler
+// interrupts this one, which would otherwise sleep to the next tick.
+static int ata_wait_dma(void)
+{
+	if (!interrupts_enabled()) {
+		for (int i = 0; i < ATA_TIMEOUT; i++) {
+			uint8_t bm = inb(bm_base + BM_REG_STATUS);
+			if (bm & BM_STATUS_IRQ) {
+				dma_bm_status |= bm;
+				return 0;
+			}
+		}
+		return -1;
+	}
+
+	uint64_t deadline =
+	    timer_ticks() + (uint64_t)ATA_DMA_TIMEOUT_MS * TIMER_HZ / 1000;
+	while (1) {
+		interrupts_disable();
+		if (dma_done)
+			break;
+		if (timer_ticks() >= deadline) {
+			interrupts_enable();
+			return -1;
+		}
+		interrupts_wait();
+	}
+	interrupts_enable();
+	return 0;
+}
+
+static int ata_dma_transfer(struct ata_drive *d, uint32_t lba, uint32_t count,
+                            const struct blk_segment *segs, uint32_t nsegs,
+                            int write)
+{
+	if (build_prdt(segs, nsegs) != 0)
+		return ATA_NO_DMA;
+	if (ata_wait_idle() != 0)
+		return -1;
+
+	uint8_t direction = write ? 0 : BM_CMD_READ;
+
+	outb(bm_base + BM_REG_COMMAND, 0);
+	outl(bm_base + BM_REG_PRDT, (uint32_t)prdt);
+	outb(bm_base + BM_REG_STATUS, BM_STATUS_ERROR | BM_STATUS_IRQ);
+	outb(bm_base + BM_REG_COMMAND, direction);
+
+	// Stay on this CPU until the IRQ handler has found it
+	sched_preempt_disable();
+	dma_cpu = smp_cpu_id();
+	dma_done = 0;
+	dma_bm_status = 0;
+	outb(ATA_CTRL, 0);
+	ata_issue(d, lba, count, write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA);
+	outb(bm_base + BM_REG_COMMAND, direction | BM_CMD_START);
+
+	int ret = ata_wait_dma();
+	sched_preempt_enable();
+
+	outb(ATA_CTRL, ATA_CTRL_NIEN);
+	outb(bm_base + BM_REG_COMMAND, 0);
+	uint8_t bm = inb(bm_base + BM_REG_STATUS) | dma_bm_status;
+	outb(bm_base + BM_REG_STATUS, BM_STATUS_ERROR | BM_STATUS_IRQ);
+	uint8_t status = inb(ATA_REG_STATUS);
+
+	if (ret != 0 || (bm & BM_STATUS_ERROR) ||
+	    (status & (ATA_SR_ERR | ATA_SR_DF)))
+		return -1;
+	return 0;
+}
+
+static int ata_pio_transfer(struct ata_drive *d, uint32_t lba, uint32_t count,
+                            const struct blk_segment *segs, int write)
+{
+	if (ata_wait_idle() != 0)
+		return -1;
+	ata_issue(d, lba, count, write ? ATA_CMD_WRITE_PIO : ATA_CMD_READ_PIO);
+
+	uint8_t *p = segs->buffer;
+	uint32_t left = segs->count;
+
+	for (uint32_t i = 0; i < count; i++) {
+		if (!left) {
+			segs++;
+			p = segs->buffer;
+			left = segs->count;
+		}
+		if (ata_wait_drq() != 0)
+			return -1;
+		if (write)
+			outsw(ATA_REG_DATA, p, SECTOR_SIZE / 2);
+		else
+			insw(ATA_REG_DATA, p, SECTOR_SIZE / 2);
+		p += SECTOR_SIZE;
+		left--;
+	}
+	return write ? ata_wait_idle() : 0;
+}
+
+static int ata_transfer(struct blockdev *dev, uint32_t lba,
+                        const struct blk_segment *segs, uint32_t nsegs,
+                        int write)
+{
+	struct ata_drive *d = dev->priv;
+	uint32_t count = 0;
+
+	for (uint32_t i = 0; i < nsegs; i++)
+		count += segs[i].count;
+	if (!count || count > ATA_MAX_SECTORS || lba + count > dev->sector_count)
+		return -1;
+
+	mutex_lock(&channel_lock);
+	int ret = ATA_NO_DMA;
+	if (d->dma)
+		ret = ata_dma_transfer(d, lba, count, segs, nsegs, write);
+	if (ret == ATA_NO_DMA)
+		ret = ata_pio_transfer(d, lba, count, segs, write);
+	mutex_unlock(&channel_lock);
+	return ret;
+}
+
+static int ata_flush(struct blockdev *dev)
+{
+	struct ata_drive *d = dev->priv;
+	int ret = -1;
+
+	mutex_lock(&channel_lock);
+	if (ata_wait_idle() == 0) {
+		ata_select(d->drive, 0);
+		outb(ATA_REG_COMMAND, ATA_CMD_CACHE_FLUSH);
+		ata_delay();
+		ret = ata_wait_idle();
+	}
+	mutex_unlock(&channel_lock);
+	return ret;
+}
+
+static int ata_rw(struct blockdev *dev, uint32_t sector, uint32_t count,
+                  void *buffer, int write)
+{
+	uint8_t *p = buffer;
+
+	while (count > 0) {
+		struct blk_segment seg;
+		seg.buffer = p;
+		seg.count = (count > ATA_MAX_SECTORS) ? ATA_MAX_SECTORS : count;
+
+		if (ata_transfer(dev, sector, &seg, 1, write) != 0)
+			return -1;
+
+		p += seg.count * SECTOR_SIZE;
+		sector += seg.count;
+		count -= seg.count;
+	}
+	return write ? ata_flush(dev) : 0;
+}
+
+static int ata_read(struct blockdev *dev, uint32_t sector, uint32_t count,
+                    void *buffer)
+{
+	return ata_rw(dev, sector, count, buffer, 0);
+}
+
+static int ata_write(struct blockdev *dev, uint32_t sector, uint32_t count,
+                     const void *buffer)
+{
+	return ata_rw(dev, sector, count, (void *)buffer, 1);
+}
+
+// Locate the PCI IDE controller's bus-master registers; without them
+// every transfer uses PIO
+static void ata_init_dma(void)
+{
+	struct pci_device pci;
+
+	if (pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &pci) != 0)
+		return;
+
+	uint32_t bar4 = pci_read32(&pci, PCI_REG_BAR0 + 4 * 4);
+	if (!(bar4 & 1)) // must be an I/O BAR
+		return;
+
+	prdt = (struct prd *)pmm_alloc_page();
+	if (!prdt)
+		return;
+
+	pci_write16(&pci, PCI_REG_COMMAND,
+	            pci_read16(&pci, PCI_REG_COMMAND) | PCI_COMMAND_IO |
+	                PCI_COMMAND_MASTER);
+	bm_base = bar4 & ~3u;
+	irq_register(ATA_IRQ, ata_irq);
+}
+
+void ata_init(void)
+{
+	outb(ATA_CTRL, ATA_CTRL_NIEN);
+
+	// Floating bus: no controller at all
+	if (inb(ATA_REG_STATUS) == 0xFF)
+		return;
+
+	ata_init_dma();
+
+	for (int i = 0; i < 2; i++) {
+		struct ata_drive *d = &drives[i];
+
+		d->present = 0;
+		d->drive = i;
+		d->dev.name = drive_names[i];
+		d->dev.read = ata_read;
+		d->dev.write = ata_write;
+		d->dev.transfer = ata_transfer;
+		d->dev.flush = ata_flush;
+		d->dev.max_sectors = ATA_MAX_SECTORS;
+		d->dev.priv = d;
+		ata_identify(d);
+	}
+}
+
+int ata_uses_dma(struct blockdev *dev)
+{
+	return ((struct ata_drive *)dev->priv)->dma;
+}
+
+struct blockdev *ata_get_device(int drive)
+{
+	if (drive < 0 || drive > 1 || !drives[drive].present)
+		return 0;
+	return &drives[drive].dev;
+}
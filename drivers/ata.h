@@ -0,0 +1,16 @@
+#ifndef ATA_H
+#define ATA_H
+
+#include "blockdev.h"
+
+// Primary channel: drive 0 holds the boot image, drive 1 the data disk
+#define ATA_DRIVE_MASTER 0
+#define ATA_DRIVE_SLAVE 1
+
+void ata_init(void);
+// Returns the block device for a detected drive, or 0
+struct blockdev *ata_get_device(int drive);
+// Nonzero if transfers on this ATA device use bus-master DMA
+int ata_uses_dma(struct blockdev *dev);
+
+#endif
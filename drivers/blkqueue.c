@@ -0,0 +1,154 @@
+#include "blkqueue.h"
+
+static struct blk_stats stats;
+
+void blk_queue_init(struct blk_queue *q, struct blockdev *dev)
+{
+	q->dev = dev;
+	q->head = 0;
+	q->count = 0;
+}
+
+void blk_queue_add(struct blk_queue *q, struct blk_request *req)
+{
+	req->status = -1;
+	req->next = q->head;
+	q->head = req;
+	q->count++;
+}
+
+// Merge sort of a request list by starting sector
+static struct blk_request *sort_requests(struct blk_request *list)
+{
+	if (!list || !list->next)
+		return list;
+
+	struct blk_request *slow = list, *fast = list->next;
+	while (fast && fast->next) {
+		slow = slow->next;
+		fast = fast->next->next;
+	}
+	struct blk_request *right = slow->next;
+	slow->next = 0;
+
+	struct blk_request *a = sort_requests(list);
+	struct blk_request *b = sort_requests(right);
+	struct blk_request *head = 0, **tail = &head;
+
+	while (a && b) {
+		if (a->sector <= b->sector) {
+			*tail = a;
+			a = a->next;
+		} else {
+			*tail = b;
+			b = b->next;
+		}
+		tail = &(*tail)->next;
+	}
+	*tail = a ? a : b;
+	return head;
+}
+
+// Issue first..last (adjacent, same direction) as one command
+static int issue(struct blockdev *dev, struct blk_request *first,
+                 struct blk_request *last)
+{
+	if (!dev->transfer) {
+		for (struct blk_request *r = first;; r = r->next) {
+			int ret = r->write ? dev->write(dev, r->sector, r->count,
+			                                r->buffer)
+			                   : dev->read(dev, r->sector, r->count,
+			                               r->buffer);
+			stats.commands++;
+			if (ret != 0)
+				return -1;
+			if (r == last)
+				return 0;
+		}
+	}
+
+	struct blk_segment segs[BLK_MAX_SEGMENTS];
+	uint32_t nsegs = 0;
+
+	for (struct blk_request *r = first;; r = r->next) {
+		segs[nsegs].buffer = r->buffer;
+		segs[nsegs].count = r->count;
+		nsegs++;
+		if (r == last)
+			break;
+	}
+	stats.commands++;
+	return dev->transfer(dev, first->sector, segs, nsegs, first->write);
+}
+
+// Dispatch a sorted list front to back, merging as it goes
+static int dispatch(struct blockdev *dev, struct blk_request *list,
+                    int *wrote)
+{
+	uint32_t max = dev->max_sectors ? dev->max_sectors : 0xFFFFFFFF;
+	int ret = 0;
+
+	while (list) {
+		struct blk_request *first = list, *last = list;
+		uint32_t count = first->count;
+		uint32_t nsegs = 1;
+
+		while (last->next && last->next->write == first->write &&
+		       last->next->sector == last->sector + last->count &&
+		       count + last->next->count <= max &&
+		       nsegs < BLK_MAX_SEGMENTS) {
+			last = last->next;
+			count += last->count;
+			nsegs++;
+		}
+		list = last->next;
+
+		int status = issue(dev, first, last);
+		for (struct blk_request *r = first;; r = r->next) {
+			r->status = status;
+			if (r == last)
+				break;
+		}
+
+		if (status != 0)
+			ret = -1;
+		if (first->write)
+			*wrote = 1;
+		stats.sectors += count;
+		dev->head_sector = first->sector + count;
+	}
+	return ret;
+}
+
+int blk_queue_run(struct blk_queue *q)
+{
+	struct blockdev *dev = q->dev;
+	struct blk_request *sorted = sort_requests(q->head);
+
+	stats.requests += q->count;
+	q->head = 0;
+	q->count = 0;
+
+	// Requests behind the head wait for the wrap-around
+	struct blk_request *behind = 0, **behind_tail = &behind;
+	while (sorted && sorted->sector < dev->head_sector) {
+		*behind_tail = sorted;
+		behind_tail = &sorted->next;
+		sorted = sorted->next;
+	}
+	*behind_tail = 0;
+
+	int wrote = 0;
+	int ret = dispatch(dev, sorted, &wrote);
+	if (dispatch(dev, behind, &wrote) != 0)
+		ret = -1;
+
+	if (wrote && dev->flush && dev->flush(dev) != 0)
+		ret = -1;
+	return ret;
+}
+
+void blk_get_stats(struct blk_stats *out)
+{
+	*out = stats;
+}
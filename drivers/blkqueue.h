@@ -0,0 +1,40 @@
+#ifndef BLKQUEUE_H
+#define BLKQUEUE_H
+
+#include "blockdev.h"
+
+// Most buffers gathered into one merged command
+#define BLK_MAX_SEGMENTS 128
+
+struct blk_request {
+	uint32_t sector;
+	uint32_t count;
+	void *buffer;
+	int write;
+	int status; // set by blk_queue_run(): 0 or -1
+	struct blk_request *next;
+};
+
+// Requests for one device, dispatched together in elevator order
+struct blk_queue {
+	struct blockdev *dev;
+	struct blk_request *head;
+	uint32_t count;
+};
+
+struct blk_stats {
+	uint32_t requests;
+	uint32_t commands; // device commands after merging
+	uint32_t sectors;
+};
+
+void blk_queue_init(struct blk_queue *q, struct blockdev *dev);
+void blk_queue_add(struct blk_queue *q, struct blk_request *req);
+// Sort the queued requests into one C-LOOK sweep starting at the
+// device's head position, merge adjacent runs in the same direction into
+// single commands, and issue them. Returns -1 if any request failed.
+int blk_queue_run(struct blk_queue *q);
+
+void blk_get_stats(struct blk_stats *stats);
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef BLOCKDEV_H
+#define BLOCKDEV_H
+
+#include <stdint.h>
+
+#define SECTOR_SIZE 512
+
+// A run of sectors in one buffer; a single device command can gather
+// several of them
+struct blk_segment {
+	void *buffer;
+	uint32_t count; // sectors
+};
+
+// A sector-addressed storage device (ATA disk, RAM disk)
+struct blockdev {
+	const char *name;
+	uint32_t sector_count;
+	// Synchronous I/O; writes are on stable storage when these return
+	int (*read)(struct blockdev *dev, uint32_t sector, uint32_t count,
+	            void *buffer);
+	int (*write)(struct blockdev *dev, uint32_t sector, uint32_t count,
+	             const void *buffer);
+	// Optional: one command over consecutive sectors scattered across
+	// buffers, at most max_sectors long, without a cache flush
+	int (*transfer)(struct blockdev *dev, uint32_t sector,
+	                const struct blk_segment *segs, uint32_t nsegs,
+	                int write);
+	// Optional: commit the device's write cache
+	int (*flush)(struct blockdev *dev);
+	uint32_t max_sectors;
+	// Elevator position: the sector after the last dispatched command
+	uint32_t head_sector;
+	void *priv;
+};
+
+#endif
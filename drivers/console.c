@@ -0,0 +1,270 @@
+#include "console.h"
+#include "../kernel/interrupt.h"
+#include "../kernel/sched.h"
+#include "../lib/printf.h"
+#include "keyboard.h"
+#include "serial.h"
+#include "vga.h"
+
+// Serial output is translated in chunks of this size
+#define SERIAL_CHUNK 128
+// Room for the longest SGR sequence, ESC [ 97 ; 107 m, and a NUL
+#define SGR_MAX 12
+
+// kprintf() formats into a stack buffer of this size, so most calls reach
+// the console as a single write
+#define KPRINTF_BUFFER 512
+
+// VGA color index to ANSI color number
+static const uint8_t vga_to_ansi[8] = {0, 4, 2, 6, 1, 5, 3, 7};
+
+static uint8_t serial_color = VGA_COLOR_LIGHT_GREY | (VGA_COLOR_BLACK << 4);
+// Last serial input byte was '\r', so a following '\n' is the same Enter
+static int serial_cr = 0;
+
+// Threads blocked in console_getchar()
+static struct wait_queue input_wait;
+
+static void serial_puts(const char *str)
+{
+	int len = 0;
+
+	while (str[len])
+		len++;
+	serial_write(str, len);
+}
+
+// SGR sequence switching the terminal to a VGA attribute, or nothing if
+// it already shows it. Bright VGA colors map to the aixterm bright range
+// (90-97, 100-107). Returns the length written to out.
+static int serial_sgr(char *out, uint8_t color)
+{
+	uint8_t fg = color & 0x0F, bg = color >> 4;
+
+	if (color == serial_color)
+		return 0;
+	serial_color = color;
+
+	if (fg == VGA_COLOR_LIGHT_GREY && bg == VGA_COLOR_BLACK)
+		return ksnprintf(out, SGR_MAX, "\x1b[0m");
+	return ksnprintf(out, SGR_MAX, "\x1b[%u;%um",
+	                 (fg & 8 ? 90 : 30) + vga_to_ansi[fg & 7],
+	                 (bg & 8 ? 100 : 40) + vga_to_ansi[bg & 7]);
+}
+
+// Terminal newlines need a carriage return, a backspace must erase and
+// color escapes become SGR sequences; anything the VGA screen would not
+// draw is dropped
+static void serial_text(const char *buf, int len)
+{
+	char out[SERIAL_CHUNK + SGR_MAX];
+	int n = 0;
+
+	for (int i = 0; i < len; i++) {
+		char c = buf[i];
+
+		if (c == '\n') {
+			out[n++] = '\r';
+			out[n++] = '\n';
+		} else if (c == '\b') {
+			out[n++] = '\b';
+			out[n++] = ' ';
+			out[n++] = '\b';
+		} else if (c == VGA_ESC) {
+			int color = vga_parse_escape(buf + i, len - i);
+			if (color >= 0) {
+				n += serial_sgr(out + n, color);
+				i += VGA_ESC_LEN - 1;
+			}
+		} else if (c >= 32 && c <= 126) {
+			out[n++] = c;
+		}
+
+		if (n >= SERIAL_CHUNK) {
+			serial_write(out, n);
+			n = 0;
+		}
+	}
+	serial_write(out, n);
+}
+
+void console_init(void)
+{
+	vga_init();
+	serial_init();
+}
+
+void console_clear(void)
+{
+	vga_clear();
+	if (serial_present())
+		serial_puts("\x1b[2J\x1b[H");
+}
+
+void console_putch(char c)
+{
+	vga_putch(c);
+	if (serial_present())
+		serial_text(&c, 1);
+}
+
+void console_puts(const char *str)
+{
+	int len = 0;
+
+	while (str[len])
+		len++;
+	console_write(str, len);
+}
+
+void console_write(const char *buf, int len)
+{
+	vga_write(buf, len);
+	if (serial_present())
+		serial_text(buf, len);
+}
+
+void console_set_color(uint8_t fg, uint8_t bg)
+{
+	char sgr[SGR_MAX];
+
+	vga_set_color(fg, bg);
+	if (serial_present())
+		serial_write(sgr, serial_sgr(sgr, fg | (bg << 4)));
+}
+
+int kprintf(const char *fmt, ...)
+{
+	char buf[KPRINTF_BUFFER];
+	va_list ap;
+
+	va_start(ap, fmt);
+	int len = kvformat(buf, sizeof(buf), console_write, fmt, ap);
+	va_end(ap);
+	return len;
+}
+
+void console_print_int(int num)
+{
+	kprintf("%d", num);
+}
+
+void console_print_hex(uint32_t num)
+{
+	kprintf("0x%08X", num);
+}
+
+void console_clear_eol(void)
+{
+	vga_clear_eol();
+	if (serial_present())
+		serial_puts("\x1b[K");
+}
+
+int console_get_cursor_col(void)
+{
+	return vga_get_cursor_col();
+}
+
+int console_get_cursor_row(void)
+{
+	return vga_get_cursor_row();
+}
+
+// The terminal's rows don't line up with the VGA screen's, so the serial
+// side moves relative to where the VGA cursor is now
+void console_set_cursor(int row, int col)
+{
+	if (serial_present()) {
+		int up = vga_get_cursor_row() - row;
+		char seq[24];
+		int n = 0;
+
+		if (up)
+			n = ksnprintf(seq, sizeof(seq), "\x1b[%d%c",
+			              up > 0 ? up : -up, up > 0 ? 'A' : 'B');
+		n += ksnprintf(seq + n, sizeof(seq) - n, "\x1b[%dG", col + 1);
+		serial_write(seq, n);
+	}
+	vga_set_cursor(row, col);
+}
+
+void console_input_ready(void)
+{
+	wait_queue_wake_all(&input_wait);
+}
+
+// Next character from either input, or -1
+static int console_read(void)
+{
+	int c = keyboard_read();
+
+	if (c >= 0)
+		return c;
+
+	while ((c = serial_read()) >= 0) {
+		int cr = serial_cr;
+
+		serial_cr = c == '\r';
+		if (c == '\n' && cr)
+			continue;
+		if (c == '\r')
+			return '\n';
+		if (c == 0x7F)
+			return '\b';
+		return c;
+	}
+	return -1;
+}
+
+char console_getchar(void)
+{
+	while (1) {
+		int c = console_read();
+
+		if (c >= 0)
+			return c;
+
+		wait_event(&input_wait,
+		           keyboard_has_input() || serial_has_input());
+	}
+}
+
+void console_readline(char *buffer, int max_len)
+{
+	console_readline_complete(buffer, max_len, 0);
+}
+
+void console_readline_complete(char *buffer, int max_len,
+                               console_complete_fn complete)
+{
+	int pos = 0;
+
+	while (1) {
+		char c = console_getchar();
+
+		if (c == '\n') {
+			buffer[pos] = '\0';
+			console_putch('\n');
+			return;
+		}
+
+		if (c == '\b') {
+			if (pos > 0) {
+				pos--;
+				console_putch('\b');
+			}
+			continue;
+		}
+
+		if (c == '\t' && complete) {
+			pos = complete(buffer, pos, max_len);
+			continue;
+		}
+
+		if (pos < max_len - 1 && c >= 32 && c <= 126) {
+			buffer[pos++] = c;
+			console_putch(c);
+		}
+	}
+}
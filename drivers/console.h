@@ -0,0 +1,52 @@
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include <stdint.h>
+
+// The system console: output goes to the VGA screen and, when COM1 is
+// present, to the serial line as ANSI text; input comes from either the
+// keyboard or the serial line. The VGA screen owns the cursor position.
+void console_init(void);
+
+// Color escapes for console_write() and kprintf() text (see VGA_ESC).
+// They are string literals, so they paste into format strings:
+// kprintf(CON_RED "%s: not found\n" CON_NORMAL, name)
+#define CON_NORMAL "\x1b" "70"
+#define CON_DARK_GREY "\x1b" "80"
+#define CON_BLUE "\x1b" "90"
+#define CON_GREEN "\x1b" "a0"
+#define CON_CYAN "\x1b" "b0"
+#define CON_RED "\x1b" "c0"
+#define CON_YELLOW "\x1b" "e0"
+#define CON_WHITE "\x1b" "f0"
+
+void console_clear(void);
+void console_putch(char c);
+void console_puts(const char *str);
+void console_write(const char *buf, int len);
+void console_set_color(uint8_t fg, uint8_t bg);
+// Formatted output (see lib/printf.h), handed to the console as one
+// write for all but the longest lines
+int kprintf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+void console_print_int(int num);
+void console_print_hex(uint32_t num);
+void console_clear_eol(void);
+
+int console_get_cursor_col(void);
+int console_get_cursor_row(void);
+void console_set_cursor(int row, int col);
+
+// Block until a character arrives from either input, sleeping in
+// between. Serial Enter and Delete arrive as '\n' and '\b'.
+char console_getchar(void);
+void console_readline(char *buffer, int max_len);
+// Tab handler for console_readline_complete(): given the len characters
+// typed so far, it may add more (keeping below max_len), echoes what it
+// adds or prints, and returns the new length
+typedef int (*console_complete_fn)(char *buffer, int len, int max_len);
+void console_readline_complete(char *buffer, int max_len,
+                               console_complete_fn complete);
+// Called by the keyboard and serial IRQ handlers when input arrives
+void console_input_ready(void);
+
+#endif
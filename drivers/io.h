@@ -0,0 +1,65 @@
+#ifndef IO_H
+#define IO_H
+
+#include <stdint.h>
+
+static inline uint8_t inb(uint16_t port)
+{
+	uint8_t value;
+	__asm__ volatile("inb %1, %0" : "=a"(value) : "Nd"(port));
+	return value;
+}
+
+static inline void outb(uint16_t port, uint8_t value)
+{
+	__asm__ volatile("outb %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static inline uint16_t inw(uint16_t port)
+{
+	uint16_t value;
+	__asm__ volatile("inw %1, %0" : "=a"(value) : "Nd"(port));
+	return value;
+}
+
+static inline void outw(uint16_t port, uint16_t value)
+{
+	__asm__ volatile("outw %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static inline uint32_t inl(uint16_t port)
+{
+	uint32_t value;
+	__asm__ volatile("inl %1, %0" : "=a"(value) : "Nd"(port));
+	return value;
+}
+
+static inline void outl(uint16_t port, uint32_t value)
+{
+	__asm__ volatile("outl %0, %1" : : "a"(value), "Nd"(port));
+}
+
+// Block transfers of 16-bit words (ATA PIO data port)
+static inline void insw(uint16_t port, void *buffer, uint32_t count)
+{
+	__asm__ volatile("rep insw"
+	                 : "+D"(buffer), "+c"(count)
+	                 : "d"(port)
+	                 : "memory");
+}
+
+static inline void outsw(uint16_t port, const void *buffer, uint32_t count)
+{
+	__asm__ volatile("rep outsw"
+	                 : "+S"(buffer), "+c"(count)
+	                 : "d"(port)
+	                 : "memory");
+}
+
+// Give slow ISA devices (e.g. the 8259) time to settle between writes
+static inline void io_wait(void)
+{
+	outb(0x80, 0);
+}
+
+#endif
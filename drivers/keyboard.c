@@ -1,4 +1,7 @@
 #include "keyboard.h"
+#include "../kernel/interrupt.h"
+#include "console.h"
+#include "io.h"
 #include "vga.h"
 
 // Scancode to ASCII mapping (without shift)
@@ -18,38 +21,123 @@ static const char scancode_to_ascii_shift[128] = {
     'B', 'N', 'M',  '<',  '>',  '?', 0,   '*', 0,   ' '};
 
 static uint8_t shift_pressed = 0;
+// CTRL_LEFT | CTRL_RIGHT for the Ctrl keys held down
 static uint8_t ctrl_pressed = 0;
+// Last scancode was the 0xE0 prefix of an extended key
+static uint8_t extended = 0;
 
 #define KEY_LSHIFT 0x2A
 #define KEY_RSHIFT 0x36
 #define KEY_LCTRL 0x1D
 #define KEY_RELEASE 0x80
+#define KEY_EXTENDED 0xE0
 
-static inline uint8_t inb(uint16_t port)
+#define CTRL_LEFT 0x01
+#define CTRL_RIGHT 0x02
+
+// Second byte of extended (0xE0-prefixed) keys
+#define KEY_EXT_PGUP 0x49
+#define KEY_EXT_PGDN 0x51
+
+#define SCROLLBACK_STEP 12 // half a screen, like Shift+PgUp on Linux
+
+#define KBD_DATA_PORT 0x60
+#define KBD_STATUS_PORT 0x64
+#define KBD_IRQ 1
+
+// Scancode ring filled by the IRQ1 handler (single producer) and drained
+// by keyboard_read() (single consumer). Each side only ever writes its
+// own index, so no lock is needed. Size must be a power of two.
+#define KBD_BUFFER_SIZE 256
+
+static volatile uint8_t kbd_buffer[KBD_BUFFER_SIZE];
+static volatile uint32_t kbd_head = 0;
+static volatile uint32_t kbd_tail = 0;
+
+static void keyboard_irq(struct regs *r)
 {
-	uint8_t value;
-	__asm__ volatile("inb %1, %0" : "=a"(value) : "Nd"(port));
-	return value;
+	(void)r;
+	uint8_t scancode = inb(KBD_DATA_PORT);
+	uint32_t head = kbd_head;
+
+	// Drop the key rather than overwrite unread input
+	if (head - kbd_tail >= KBD_BUFFER_SIZE)
+		return;
+
+	kbd_buffer[head & (KBD_BUFFER_SIZE - 1)] = scancode;
+	__asm__ volatile("" ::: "memory");
+	kbd_head = head + 1;
+	console_input_ready();
+}
+
+// Next scancode from the ring, or -1 if it is empty
+static int keyboard_read_scancode(void)
+{
+	uint32_t tail = kbd_tail;
+
+	if (tail == kbd_head)
+		return -1;
+
+	uint8_t scancode = kbd_buffer[tail & (KBD_BUFFER_SIZE - 1)];
+	__asm__ volatile("" ::: "memory");
+	kbd_tail = tail + 1;
+	return scancode;
 }
 
 void keyboard_init(void)
 {
-	while (inb(0x64) & 1)
-		inb(0x60);
+	while (inb(KBD_STATUS_PORT) & 1)
+		inb(KBD_DATA_PORT);
+
+	kbd_head = 0;
+	kbd_tail = 0;
+	irq_register(KBD_IRQ, keyboard_irq);
 }
 
 int keyboard_has_input(void)
 {
-	return (inb(0x64) & 1);
+	return kbd_head != kbd_tail;
 }
 
-char keyboard_getchar(void)
+// Keys behind the 0xE0 prefix. Only right Ctrl and Shift+PgUp/PgDn mean
+// anything here; the fake shift presses some keyboards wrap around the
+// grey keys (E0 2A, E0 AA, ...) must not touch the real shift state.
+static void handle_extended(uint8_t scancode)
 {
-	while (1) {
-		if (!keyboard_has_input())
-			continue;
+	uint8_t key = scancode & ~KEY_RELEASE;
+
+	if (key == KEY_LCTRL) {
+		if (scancode & KEY_RELEASE)
+			ctrl_pressed &= ~CTRL_RIGHT;
+		else
+			ctrl_pressed |= CTRL_RIGHT;
+		return;
+	}
+	if (!shift_pressed || (scancode & KEY_RELEASE))
+		return;
+
+	if (key == KEY_EXT_PGUP)
+		vga_scroll_view(SCROLLBACK_STEP);
+	else if (key == KEY_EXT_PGDN)
+		vga_scroll_view(-SCROLLBACK_STEP);
+}
+
+int keyboard_read(void)
+{
+	int code;
 
-		uint8_t scancode = inb(0x60);
+	while ((code = keyboard_read_scancode()) >= 0) {
+		uint8_t scancode = code;
+
+		if (scancode == KEY_EXTENDED) {
+			extended = 1;
+			continue;
+		}
+		if (extended) {
+			extended = 0;
+			handle_extended(scancode);
+			continue;
+		}
 
 		// Handle key release
 		if (scancode & KEY_RELEASE) {
@@ -58,7 +146,7 @@ char keyboard_getchar(void)
 				shift_pressed = 0;
 			}
 			if (scancode == KEY_LCTRL) {
-				ctrl_pressed = 0;
+				ctrl_pressed &= ~CTRL_LEFT;
 			}
 			continue;
 		}
@@ -71,7 +159,7 @@ char keyboard_getchar(void)
 
 		// Handle ctrl press
 		if (scancode == KEY_LCTRL) {
-			ctrl_pressed = 1;
+			ctrl_pressed |= CTRL_LEFT;
 			continue;
 		}
 
@@ -94,42 +182,10 @@ char keyboard_getchar(void)
 				return c;
 		}
 	}
-}
-
-char keyboard_getchar_with_ctrl(void)
-{
-	return keyboard_getchar();
+	return -1;
 }
 
 int keyboard_ctrl_pressed(void)
 {
-	return ctrl_pressed;
-}
-
-void keyboard_readline(char *buffer, int max_len)
-{
-	int pos = 0;
-
-	while (1) {
-		char c = keyboard_getchar();
-
-		if (c == '\n') {
-			buffer[pos] = '\0';
-			vga_putch('\n');
-			return;
-		}
-
-		if (c == '\b') {
-			if (pos > 0) {
-				pos--;
-				vga_putch('\b');
-			}
-			continue;
-		}
-
-		if (pos < max_len - 1 && c >= 32 && c <= 126) {
-			buffer[pos++] = c;
-			vga_putch(c);
-		}
-	}
+	return ctrl_pressed != 0;
 }
@@ -4,8 +4,10 @@
 #include <stdint.h>
 
 void keyboard_init(void);
-char keyboard_getchar(void);
+// Next character typed, or -1 if none is pending. Never blocks; see
+// console_getchar() for the blocking read.
+int keyboard_read(void);
+// Scancodes are pending (not necessarily a whole character)
 int keyboard_has_input(void);
-void keyboard_readline(char *buffer, int max_len);
 
 #endif
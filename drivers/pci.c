@@ -0,0 +1,90 @@
+#include "pci.h"
+#include "io.h"
+
+// Configuration mechanism #1
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA 0xCFC
+
+#define PCI_REG_VENDOR 0x00
+#define PCI_REG_CLASS 0x08
+#define PCI_REG_HEADER 0x0C
+
+#define PCI_HEADER_MULTIFUNCTION 0x80
+
+static uint32_t config_address(uint8_t bus, uint8_t slot, uint8_t func,
+                               uint8_t offset)
+{
+	return 0x80000000u | ((uint32_t)bus << 16) | ((uint32_t)slot << 11) |
+	       ((uint32_t)func << 8) | (offset & 0xFC);
+}
+
+static uint32_t config_read(uint8_t bus, uint8_t slot, uint8_t func,
+                            uint8_t offset)
+{
+	outl(PCI_CONFIG_ADDRESS, config_address(bus, slot, func, offset));
+	return inl(PCI_CONFIG_DATA);
+}
+
+uint32_t pci_read32(const struct pci_device *dev, uint8_t offset)
+{
+	return config_read(dev->bus, dev->slot, dev->func, offset);
+}
+
+void pci_write32(const struct pci_device *dev, uint8_t offset, uint32_t value)
+{
+	outl(PCI_CONFIG_ADDRESS,
+	     config_address(dev->bus, dev->slot, dev->func, offset));
+	outl(PCI_CONFIG_DATA, value);
+}
+
+uint16_t pci_read16(const struct pci_device *dev, uint8_t offset)
+{
+	return pci_read32(dev, offset) >> ((offset & 2) * 8);
+}
+
+void pci_write16(const struct pci_device *dev, uint8_t offset, uint16_t value)
+{
+	uint32_t shift = (offset & 2) * 8;
+	uint32_t old = pci_read32(dev, offset);
+
+	pci_write32(dev, offset,
+	            (old & ~(0xFFFFu << shift)) | ((uint32_t)value << shift));
+}
+
+int pci_find_class(uint8_t class_code, uint8_t subclass,
+                   struct pci_device *out)
+{
+	for (uint32_t bus = 0; bus < 256; bus++) {
+		for (uint8_t slot = 0; slot < 32; slot++) {
+			if ((config_read(bus, slot, 0, PCI_REG_VENDOR) & 0xFFFF) ==
+			    0xFFFF)
+				continue;
+
+			uint8_t header = config_read(bus, slot, 0, PCI_REG_HEADER) >> 16;
+			uint8_t funcs = (header & PCI_HEADER_MULTIFUNCTION) ? 8 : 1;
+
+			for (uint8_t func = 0; func < funcs; func++) {
+				uint32_t id = config_read(bus, slot, func, PCI_REG_VENDOR);
+				if ((id & 0xFFFF) == 0xFFFF)
+					continue;
+
+				uint32_t class_reg =
+				    config_read(bus, slot, func, PCI_REG_CLASS);
+				if ((class_reg >> 24) != class_code ||
+				    ((class_reg >> 16) & 0xFF) != subclass)
+					continue;
+
+				out->bus = bus;
+				out->slot = slot;
+				out->func = func;
+				out->vendor_id = id & 0xFFFF;
+				out->device_id = id >> 16;
+				out->class_code = class_code;
+				out->subclass = subclass;
+				out->prog_if = (class_reg >> 8) & 0xFF;
+				return 0;
+			}
+		}
+	}
+	return -1;
+}
@@ -0,0 +1,36 @@
+#ifndef PCI_H
+#define PCI_H
+
+#include <stdint.h>
+
+#define PCI_REG_COMMAND 0x04
+#define PCI_REG_BAR0 0x10
+
+#define PCI_COMMAND_IO 0x0001
+#define PCI_COMMAND_MEMORY 0x0002
+#define PCI_COMMAND_MASTER 0x0004
+
+#define PCI_CLASS_STORAGE 0x01
+#define PCI_SUBCLASS_IDE 0x01
+
+struct pci_device {
+	uint8_t bus;
+	uint8_t slot;
+	uint8_t func;
+	uint8_t prog_if;
+	uint16_t vendor_id;
+	uint16_t device_id;
+	uint8_t class_code;
+	uint8_t subclass;
+};
+
+uint32_t pci_read32(const struct pci_device *dev, uint8_t offset);
+void pci_write32(const struct pci_device *dev, uint8_t offset, uint32_t value);
+uint16_t pci_read16(const struct pci_device *dev, uint8_t offset);
+void pci_write16(const struct pci_device *dev, uint8_t offset, uint16_t value);
+
+// Find the first function with the given class and subclass; 0 if found
+int pci_find_class(uint8_t class_code, uint8_t subclass,
+                   struct pci_device *out);
+
+#endif
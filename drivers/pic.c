@@ -0,0 +1,80 @@
+#include "pic.h"
+#include "io.h"
+
+#define PIC1_CMD 0x20
+#define PIC1_DATA 0x21
+#define PIC2_CMD 0xA0
+#define PIC2_DATA 0xA1
+
+#define PIC_EOI 0x20
+#define PIC_READ_ISR 0x0B
+#define ICW1_INIT 0x11
+#define ICW4_8086 0x01
+
+void pic_remap(void)
+{
+	// ICW1: start init sequence, expect ICW4
+	outb(PIC1_CMD, ICW1_INIT);
+	io_wait();
+	outb(PIC2_CMD, ICW1_INIT);
+	io_wait();
+
+	// ICW2: vector offsets
+	outb(PIC1_DATA, PIC_IRQ_BASE);
+	io_wait();
+	outb(PIC2_DATA, PIC_IRQ_BASE + 8);
+	io_wait();
+
+	// ICW3: slave on IRQ2
+	outb(PIC1_DATA, 0x04);
+	io_wait();
+	outb(PIC2_DATA, 0x02);
+	io_wait();
+
+	outb(PIC1_DATA, ICW4_8086);
+	io_wait();
+	outb(PIC2_DATA, ICW4_8086);
+	io_wait();
+
+	// Mask everything except the cascade; drivers unmask their own line
+	outb(PIC1_DATA, 0xFB);
+	outb(PIC2_DATA, 0xFF);
+}
+
+void pic_mask(uint8_t irq)
+{
+	uint16_t port = (irq < 8) ? PIC1_DATA : PIC2_DATA;
+	outb(port, inb(port) | (1 << (irq & 7)));
+}
+
+void pic_unmask(uint8_t irq)
+{
+	uint16_t port = (irq < 8) ? PIC1_DATA : PIC2_DATA;
+	outb(port, inb(port) & ~(1 << (irq & 7)));
+}
+
+void pic_eoi(uint8_t irq)
+{
+	if (irq >= 8)
+		outb(PIC2_CMD, PIC_EOI);
+	outb(PIC1_CMD, PIC_EOI);
+}
+
+// IRQ7/IRQ15 fire spuriously when a request is withdrawn before the CPU
+// acknowledges it; the in-service bit tells the two apart.
+int pic_is_spurious(uint8_t irq)
+{
+	if (irq == 7) {
+		outb(PIC1_CMD, PIC_READ_ISR);
+		return !(inb(PIC1_CMD) & 0x80);
+	}
+	if (irq == 15) {
+		outb(PIC2_CMD, PIC_READ_ISR);
+		if (!(inb(PIC2_CMD) & 0x80)) {
+			// The master still saw the cascade line
+			outb(PIC1_CMD, PIC_EOI);
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,15 @@
+#ifndef PIC_H
+#define PIC_H
+
+#include <stdint.h>
+
+// IRQ 0-15 are remapped to vectors 32-47
+#define PIC_IRQ_BASE 32
+
+void pic_remap(void);
+void pic_mask(uint8_t irq);
+void pic_unmask(uint8_t irq);
+void pic_eoi(uint8_t irq);
+int pic_is_spurious(uint8_t irq);
+
+#endif
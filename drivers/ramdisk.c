@@ -0,0 +1,55 @@
+#include "ramdisk.h"
+#include "../kernel/kmalloc.h"
+#include "../lib/string.h"
+
+#define RAMDISK_MAX 2
+
+struct ramdisk {
+	struct blockdev dev;
+	uint8_t *base;
+};
+
+static struct ramdisk ramdisks[RAMDISK_MAX];
+static int ramdisk_count = 0;
+
+static int ramdisk_read(struct blockdev *dev, uint32_t sector, uint32_t count,
+                        void *buffer)
+{
+	struct ramdisk *rd = dev->priv;
+
+	if (sector + count > dev->sector_count)
+		return -1;
+	memcpy(buffer, rd->base + sector * SECTOR_SIZE, count * SECTOR_SIZE);
+	return 0;
+}
+
+static int ramdisk_write(struct blockdev *dev, uint32_t sector,
+                         uint32_t count, const void *buffer)
+{
+	struct ramdisk *rd = dev->priv;
+
+	if (sector + count > dev->sector_count)
+		return -1;
+	memcpy(rd->base + sector * SECTOR_SIZE, buffer, count * SECTOR_SIZE);
+	return 0;
+}
+
+struct blockdev *ramdisk_create(const char *name, void *base, uint32_t size)
+{
+	if (ramdisk_count >= RAMDISK_MAX)
+		return 0;
+
+	if (!base)
+		base = kmalloc(size);
+	if (!base)
+		return 0;
+
+	struct ramdisk *rd = &ramdisks[ramdisk_count++];
+	rd->base = base;
+	rd->dev.name = name;
+	rd->dev.sector_count = size / SECTOR_SIZE;
+	rd->dev.read = ramdisk_read;
+	rd->dev.write = ramdisk_write;
+	rd->dev.priv = rd;
+	return &rd->dev;
+}
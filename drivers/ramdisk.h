@@ -0,0 +1,10 @@
+#ifndef RAMDISK_H
+#define RAMDISK_H
+
+#include "blockdev.h"
+
+// Wrap memory as a block device. With base == 0 the backing store is a
+// demand-zero kernel allocation, so untouched sectors cost no RAM.
+struct blockdev *ramdisk_create(const char *name, void *base, uint32_t size);
+
+#endif
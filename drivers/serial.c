@@ -0,0 +1,254 @@
+#include "serial.h"
+#include "../kernel/interrupt.h"
+#include "../kernel/sched.h"
+#include "../kernel/spinlock.h"
+#include "../lib/string.h"
+#include "console.h"
+#include "io.h"
+
+#define COM1_PORT 0x3F8
+#define COM1_IRQ 4
+
+// 16550 registers, as offsets from the base port
+#define UART_DATA 0 // RBR/THR; divisor low byte when DLAB is set
+#define UART_IER 1  // divisor high byte when DLAB is set
+#define UART_FCR 2  // IIR when read
+#define UART_IIR 2
+#define UART_LCR 3
+#define UART_MCR 4
+#define UART_LSR 5
+
+#define IER_RX 0x01
+#define IER_THRE 0x02
+
+// Enable and clear both FIFOs, RX interrupt at 14 bytes
+#define FCR_INIT 0xC7
+
+#define IIR_NONE 0x01 // no interrupt pending
+
+#define LCR_8N1 0x03
+#define LCR_DLAB 0x80
+
+#define MCR_DTR 0x01
+#define MCR_RTS 0x02
+#define MCR_OUT2 0x08 // gates the IRQ line on PC serial ports
+#define MCR_LOOP 0x10
+
+#define LSR_DATA 0x01
+#define LSR_THRE 0x20 // transmit FIFO empty
+
+#define UART_CLOCK 115200
+#define SERIAL_BAUD 115200
+#define UART_FIFO_SIZE 16
+
+// Both rings are single producer, single consumer: each side only ever
+// writes its own index. TX is filled by serial_write() and drained by the
+// IRQ handler; 16 KB is over a second of output at 115200. Writers on
+// different CPUs, and the drain, are serialized by tx_lock. RX is filled
+// by the IRQ handler. Sizes must be powers of two.
+#define TX_BUFFER_SIZE 16384
+#define RX_BUFFER_SIZE 256
+
+static spinlock_t tx_lock = SPINLOCK_INIT;
+static char tx_buffer[TX_BUFFER_SIZE];
+static volatile uint32_t tx_head = 0;
+static volatile uint32_t tx_tail = 0;
+
+static volatile char rx_buffer[RX_BUFFER_SIZE];
+static volatile uint32_t rx_head = 0;
+static volatile uint32_t rx_tail = 0;
+
+// Writers waiting for room in the TX ring
+static struct wait_queue tx_wait;
+
+static int present = 0;
+static int irq_ready = 0;
+static uint8_t ier = 0;
+
+static void set_ier(uint8_t value)
+{
+	if (value != ier) {
+		ier = value;
+		outb(COM1_PORT + UART_IER, value);
+	}
+}
+
+// Refill the transmit FIFO from the ring if it has run dry, and keep the
+// THRE interrupt armed for as long as the ring holds data. Runs with
+// interrupts off and tx_lock held.
+static void tx_kick(void)
+{
+	uint32_t tail = tx_tail;
+
+	if (inb(COM1_PORT + UART_LSR) & LSR_THRE) {
+		for (int i = 0; i < UART_FIFO_SIZE && tail != tx_head; i++)
+			outb(COM1_PORT + UART_DATA,
+			     tx_buffer[tail++ & (TX_BUFFER_SIZE - 1)]);
+		tx_tail = tail;
+	}
+
+	if (irq_ready)
+		set_ier(tail != tx_head ? IER_RX | IER_THRE : IER_RX);
+}
+
+static void rx_drain(void)
+{
+	while (inb(COM1_PORT + UART_LSR) & LSR_DATA) {
+		char c = inb(COM1_PORT + UART_DATA);
+		uint32_t head = rx_head;
+
+		// Drop the byte rather than overwrite unread input
+		if (head - rx_tail >= RX_BUFFER_SIZE)
+			continue;
+		rx_buffer[head & (RX_BUFFER_SIZE - 1)] = c;
+		__asm__ volatile("" ::: "memory");
+		rx_head = head + 1;
+	}
+}
+
+// IRQ4 is edge triggered, so keep going until the UART has nothing left
+// to report; otherwise a cause raised meanwhile would never interrupt
+// again.
+static void serial_irq(struct regs *r)
+{
+	(void)r;
+	uint32_t rx_before = rx_head;
+
+	spin_lock_raw(&tx_lock);
+	while (!(inb(COM1_PORT + UART_IIR) & IIR_NONE)) {
+		rx_drain();
+		tx_kick();
+	}
+	spin_unlock_raw(&tx_lock);
+
+	wait_queue_wake_all(&tx_wait);
+	if (rx_head != rx_before)
+		console_input_ready();
+}
+
+int serial_init(void)
+{
+	uint16_t divisor = UART_CLOCK / SERIAL_BAUD;
+
+	outb(COM1_PORT + UART_IER, 0);
+	outb(COM1_PORT + UART_LCR, LCR_DLAB);
+	outb(COM1_PORT + UART_DATA, divisor & 0xFF);
+	outb(COM1_PORT + UART_IER, divisor >> 8);
+	outb(COM1_PORT + UART_LCR, LCR_8N1);
+	outb(COM1_PORT + UART_FCR, FCR_INIT);
+
+	// A byte sent in loopback mode must come straight back
+	outb(COM1_PORT + UART_MCR, MCR_RTS | MCR_OUT2 | MCR_LOOP);
+	outb(COM1_PORT + UART_DATA, 0xAE);
+	for (int i = 0; i < 1000 && !(inb(COM1_PORT + UART_LSR) & LSR_DATA);
+	     i++)
+		io_wait();
+	if (inb(COM1_PORT + UART_DATA) != 0xAE)
+		return -1;
+
+	outb(COM1_PORT + UART_MCR, MCR_DTR | MCR_RTS | MCR_OUT2);
+	present = 1;
+	return 0;
+}
+
+int serial_present(void)
+{
+	return present;
+}
+
+void serial_enable_irq(void)
+{
+	if (!present)
+		return;
+
+	irq_register(COM1_IRQ, serial_irq);
+	irq_ready = 1;
+	set_ier(IER_RX);
+}
+
+// Write out whatever is still queued, then buf, by polling the UART
+static void write_polled(const char *buf, int len)
+{
+	int flags = spin_lock_irqsave(&tx_lock);
+
+	while (tx_tail != tx_head) {
+		while (!(inb(COM1_PORT + UART_LSR) & LSR_THRE))
+			;
+		tx_kick();
+	}
+
+	while (len > 0) {
+		while (!(inb(COM1_PORT + UART_LSR) & LSR_THRE))
+			;
+		for (int i = 0; i < UART_FIFO_SIZE && len > 0; i++, len--)
+			outb(COM1_PORT + UART_DATA, *buf++);
+	}
+	spin_unlock_irqrestore(&tx_lock, flags);
+}
+
+void serial_write(const char *buf, int len)
+{
+	if (!present || len <= 0)
+		return;
+
+	if (!irq_ready || !interrupts_enabled()) {
+		write_polled(buf, len);
+		return;
+	}
+
+	while (len > 0) {
+		int flags = spin_lock_irqsave(&tx_lock);
+		uint32_t head = tx_head;
+		uint32_t space = TX_BUFFER_SIZE - (head - tx_tail);
+
+		if (space == 0) {
+			spin_unlock_irqrestore(&tx_lock, flags);
+			// The THRE interrupt is armed while the ring is
+			// non-empty, so this wakes as soon as room frees up
+			wait_event(&tx_wait, tx_head - tx_tail < TX_BUFFER_SIZE);
+			continue;
+		}
+
+		uint32_t offset = head & (TX_BUFFER_SIZE - 1);
+		uint32_t n = (uint32_t)len < space ? (uint32_t)len : space;
+		if (n > TX_BUFFER_SIZE - offset)
+			n = TX_BUFFER_SIZE - offset;
+
+		memcpy(tx_buffer + offset, buf, n);
+		__asm__ volatile("" ::: "memory");
+		tx_head = head + n;
+		buf += n;
+		len -= n;
+
+		tx_kick();
+		spin_unlock_irqrestore(&tx_lock, flags);
+	}
+}
+
+// Until the IRQ handler owns the receive side, poll for it here
+static void rx_poll(void)
+{
+	if (present && (!irq_ready || !interrupts_enabled()))
+		rx_drain();
+}
+
+int serial_read(void)
+{
+	rx_poll();
+
+	uint32_t tail = rx_tail;
+
+	if (tail == rx_head)
+		return -1;
+
+	char c = rx_buffer[tail & (RX_BUFFER_SIZE - 1)];
+	__asm__ volatile("" ::: "memory");
+	rx_tail = tail + 1;
+	return (uint8_t)c;
+}
+
+int serial_has_input(void)
+{
+	rx_poll();
+	return rx_head != rx_tail;
+}
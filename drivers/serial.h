@@ -0,0 +1,24 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include <stdint.h>
+
+// COM1 at 115200 8N1 with the 16550 FIFOs enabled. serial_init() returns
+// -1 when no UART answers; every other call is then a no-op.
+int serial_init(void);
+int serial_present(void);
+
+// Switch from polling to the IRQ4-driven rings. Needs interrupt_init().
+void serial_enable_irq(void);
+
+// Queue bytes for transmission. Returns once they are in the TX ring,
+// waiting only while it is full; with interrupts off (or before
+// serial_enable_irq()) the bytes are written out by polling instead.
+// Not for use from interrupt handlers.
+void serial_write(const char *buf, int len);
+
+// Next received byte, or -1 if none has arrived. Never blocks.
+int serial_read(void);
+int serial_has_input(void);
+
+#endif
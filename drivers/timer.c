@@ -0,0 +1,136 @@
+#include "timer.h"
+#include "../kernel/cpu.h"
+#include "../kernel/interrupt.h"
+#include "../kernel/sched.h"
+#include "../lib/math64.h"
+#include "io.h"
+
+#define PIT_FREQ 1193182
+#define PIT_CH0 0x40
+#define PIT_CH2 0x42
+#define PIT_CMD 0x43
+#define PIT_GATE 0x61 // channel 2 gate + output status (port B)
+#define PIT_IRQ 0
+
+#define NS_PER_TICK (1000000000u / TIMER_HZ)
+
+// Length of the channel 2 one-shot used to measure the TSC; must fit the
+// 16-bit counter (max ~54 ms)
+#define CALIBRATE_MS 50
+
+static volatile uint64_t ticks = 0;
+
+static uint32_t tsc_khz = 0;
+static uint64_t tsc_base = 0;
+// ns = (tsc - tsc_base) * tsc_mult >> tsc_shift
+static uint32_t tsc_mult = 0;
+static uint32_t tsc_shift = 0;
+
+static void timer_irq(struct regs *r)
+{
+	(void)r;
+	ticks++;
+	sched_wake_sleepers(ticks);
+	sched_tick();
+}
+
+static void pit_set_frequency(uint32_t hz)
+{
+	uint32_t divisor = PIT_FREQ / hz;
+
+	outb(PIT_CMD, 0x36); // channel 0, lobyte/hibyte, rate generator
+	outb(PIT_CH0, divisor & 0xFF);
+	outb(PIT_CH0, (divisor >> 8) & 0xFF);
+}
+
+// Count TSC cycles across a PIT channel 2 one-shot. Polls the output pin,
+// so it works before interrupts are enabled.
+static uint32_t tsc_calibrate(void)
+{
+	uint32_t latch = PIT_FREQ / 1000 * CALIBRATE_MS;
+
+	// Gate high, speaker off
+	outb(PIT_GATE, (inb(PIT_GATE) & ~0x02) | 0x01);
+	outb(PIT_CMD, 0xB0); // channel 2, lobyte/hibyte, interrupt on terminal
+	outb(PIT_CH2, latch & 0xFF);
+	outb(PIT_CH2, (latch >> 8) & 0xFF);
+
+	uint64_t start = rdtsc();
+	while (!(inb(PIT_GATE) & 0x20))
+		;
+	uint64_t end = rdtsc();
+
+	return (uint32_t)div64_u32(end - start, CALIBRATE_MS, 0);
+}
+
+// Pick the largest shift for which the cycles->ns multiplier still fits
+// in 32 bits, for the best precision
+static void tsc_set_scale(uint32_t khz)
+{
+	uint32_t shift = 32;
+	uint64_t mult;
+
+	do {
+		mult = div64_u32(1000000ull << shift, khz, 0);
+	} while ((mult >> 32) && --shift);
+
+	tsc_mult = (uint32_t)mult;
+	tsc_shift = shift;
+}
+
+void timer_init(void)
+{
+	if (cpu_has_feature_edx(CPUID_EDX_TSC)) {
+		tsc_khz = tsc_calibrate();
+		if (tsc_khz)
+			tsc_set_scale(tsc_khz);
+	}
+
+	ticks = 0;
+	tsc_base = tsc_khz ? rdtsc() : 0;
+	pit_set_frequency(TIMER_HZ);
+	irq_register(PIT_IRQ, timer_irq);
+}
+
+uint64_t timer_ticks(void)
+{
+	uint64_t a, b;
+
+	// A 64-bit load is two instructions; retry if IRQ0 split it
+	do {
+		a = ticks;
+		b = ticks;
+	} while (a != b);
+	return a;
+}
+
+uint64_t timer_now_ns(void)
+{
+	if (!tsc_khz)
+		return timer_ticks() * NS_PER_TICK;
+	return mul_u64_u32_shr(rdtsc() - tsc_base, tsc_mult, tsc_shift);
+}
+
+void timer_sleep_ms(uint32_t ms)
+{
+	if (sched_running()) {
+		thread_sleep_ms(ms);
+		return;
+	}
+
+	uint64_t deadline =
+	    timer_ticks() + div64_u32((uint64_t)ms * TIMER_HZ, 1000, 0);
+
+	while (1) {
+		interrupts_disable();
+		if (ticks >= deadline)
+			break;
+		interrupts_wait();
+	}
+	interrupts_enable();
+}
+
+uint32_t timer_tsc_khz(void)
+{
+	return tsc_khz;
+}
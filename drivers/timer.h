@@ -0,0 +1,24 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+
+// PIT interrupt rate; one tick per millisecond
+#define TIMER_HZ 1000
+
+void timer_init(void);
+
+// Ticks since timer_init()
+uint64_t timer_ticks(void);
+
+// Monotonic nanoseconds since timer_init(), TSC-backed when available
+uint64_t timer_now_ns(void);
+
+// Sleep for at least ms milliseconds; before the scheduler is up, by
+// halting the CPU
+void timer_sleep_ms(uint32_t ms);
+
+// Calibrated TSC frequency in kHz, or 0 if the CPU has no TSC
+uint32_t timer_tsc_khz(void);
+
+#endif
@@ -1,30 +1,215 @@
 #include "vga.h"
+#include "io.h"
+#include "../kernel/kmalloc.h"
+#include "../lib/string.h"
 
 #define VGA_WIDTH 80
 #define VGA_HEIGHT 25
 #define VGA_MEMORY ((uint16_t *)0xB8000)
+// Rows of the 32 KB text window at 0xB8000, used as a scrolling ring
+#define VRAM_ROWS (0x8000 / (VGA_WIDTH * 2))
+
+#define VGA_CRTC_INDEX 0x3D4
+#define VGA_CRTC_DATA 0x3D5
+#define CRTC_CURSOR_HIGH 0x0E
+#define CRTC_CURSOR_LOW 0x0F
+#define CRTC_START_HIGH 0x0C
+#define CRTC_START_LOW 0x0D
+
+// Lines kept in the scrollback ring, screen included (640 KB, allocated
+// from the lazy heap so only the part that was written costs memory)
+#define SCROLLBACK_LINES 4096
 
 static uint8_t vga_color = (VGA_COLOR_LIGHT_GREY | (VGA_COLOR_BLACK << 4));
 static int cursor_row = 0;
 static int cursor_col = 0;
 
-static inline void outb(uint16_t port, uint8_t value)
-{
-	__asm__ volatile("outb %0, %1" : : "a"(value), "Nd"(port));
-}
+// Output is drawn into a ring of rows and copied to video memory by
+// vga_flush(), which every public drawing function calls once when it is
+// done. The screen is the last VGA_HEIGHT rows of the ring and the rows
+// before it are the scrollback. Video memory is a ring of rows too: screen
+// row 0 is ring row screen_top and video memory row vram_top, so
+// scrolling moves no cells.
+//
+// Until vga_init_scrollback() the ring is just the screen.
+static uint16_t boot_rows[VGA_HEIGHT * VGA_WIDTH];
+static uint16_t *rows = boot_rows;
+static int ring_rows = VGA_HEIGHT;
+static int screen_top = 0;
+static int vram_top = 0;
+// Rows above the screen that can be scrolled back to
+static int history = 0;
+// Rows the view is scrolled back by; 0 shows the live screen
+static int view_back = 0;
+// Columns [dirty_start, dirty_end) of each screen row differ from video memory
+static uint8_t dirty_start[VGA_HEIGHT];
+static uint8_t dirty_end[VGA_HEIGHT];
+// Values last written to the CRTC
+static uint16_t hw_cursor = 0xFFFF;
+static uint16_t hw_start = 0xFFFF;
 
 static uint16_t vga_entry(char c, uint8_t color)
 {
 	return (uint16_t)c | ((uint16_t)color << 8);
 }
 
+// Port I/O is slow (a VM exit under virtualization), so the CRTC is only
+// touched when the cursor actually moved
 static void update_cursor(void)
 {
-	uint16_t pos = cursor_row * VGA_WIDTH + cursor_col;
-	outb(0x3D4, 14);
-	outb(0x3D5, (pos >> 8) & 0xFF);
-	outb(0x3D4, 15);
-	outb(0x3D5, pos & 0xFF);
+	uint16_t start = vram_top * VGA_WIDTH;
+	uint16_t pos = start + cursor_row * VGA_WIDTH + cursor_col;
+
+	// Hide the cursor below the visible page while scrolled back
+	if (view_back)
+		pos = start + VGA_HEIGHT * VGA_WIDTH;
+
+	if (start != hw_start) {
+		hw_start = start;
+		outb(VGA_CRTC_INDEX, CRTC_START_HIGH);
+		outb(VGA_CRTC_DATA, (start >> 8) & 0xFF);
+		outb(VGA_CRTC_INDEX, CRTC_START_LOW);
+		outb(VGA_CRTC_DATA, start & 0xFF);
+	}
+
+	if (pos == hw_cursor)
+		return;
+	hw_cursor = pos;
+
+	outb(VGA_CRTC_INDEX, CRTC_CURSOR_HIGH);
+	outb(VGA_CRTC_DATA, (pos >> 8) & 0xFF);
+	outb(VGA_CRTC_INDEX, CRTC_CURSOR_LOW);
+	outb(VGA_CRTC_DATA, pos & 0xFF);
+}
+
+// Ring row holding screen row `row`; negative rows are scrollback
+static inline int ring_row(int row)
+{
+	row += screen_top;
+	if (row >= ring_rows)
+		return row - ring_rows;
+	return row < 0 ? row + ring_rows : row;
+}
+
+static inline uint16_t *row_cells(int row)
+{
+	return &rows[ring_row(row) * VGA_WIDTH];
+}
+
+static inline void mark_dirty(int row, int start, int end)
+{
+	if (start < dirty_start[row])
+		dirty_start[row] = start;
+	if (end > dirty_end[row])
+		dirty_end[row] = end;
+}
+
+static void mark_all_dirty(void)
+{
+	for (int y = 0; y < VGA_HEIGHT; y++)
+		mark_dirty(y, 0, VGA_WIDTH);
+}
+
+static inline void put_cell(int row, int col, uint16_t cell)
+{
+	row_cells(row)[col] = cell;
+	mark_dirty(row, col, col + 1);
+}
+
+void vga_flush(void)
+{
+	// New output always brings the live screen back
+	if (view_back) {
+		view_back = 0;
+		mark_all_dirty();
+	}
+
+	for (int y = 0; y < VGA_HEIGHT; y++) {
+		int start = dirty_start[y];
+		int end = dirty_end[y];
+		if (start >= end)
+			continue;
+
+		memcpy(&VGA_MEMORY[(vram_top + y) * VGA_WIDTH + start],
+		       row_cells(y) + start, (end - start) * 2);
+		dirty_start[y] = VGA_WIDTH;
+		dirty_end[y] = 0;
+	}
+	update_cursor();
+}
+
+// Scroll up one line, keeping the old top row as scrollback. Only the new
+// bottom row is written out; the CRTC start address moves down a row
+// instead. When the start address would run past the end of video memory
+// the screen is rewritten at the top.
+static void scroll(void)
+{
+	screen_top = ring_row(1);
+	if (history < ring_rows - VGA_HEIGHT)
+		history++;
+
+	uint16_t *last = row_cells(VGA_HEIGHT - 1);
+	for (int x = 0; x < VGA_WIDTH; x++)
+		last[x] = vga_entry(' ', vga_color);
+
+	if (vram_top + VGA_HEIGHT < VRAM_ROWS) {
+		vram_top++;
+		for (int y = 0; y < VGA_HEIGHT - 1; y++) {
+			dirty_start[y] = dirty_start[y + 1];
+			dirty_end[y] = dirty_end[y + 1];
+		}
+		dirty_start[VGA_HEIGHT - 1] = 0;
+		dirty_end[VGA_HEIGHT - 1] = VGA_WIDTH;
+	} else {
+		vram_top = 0;
+		mark_all_dirty();
+	}
+}
+
+void vga_init_scrollback(void)
+{
+	uint16_t *ring = kmalloc(SCROLLBACK_LINES * VGA_WIDTH * sizeof(*ring));
+	if (!ring)
+		return;
+
+	for (int y = 0; y < VGA_HEIGHT; y++)
+		memcpy(&ring[y * VGA_WIDTH], row_cells(y), VGA_WIDTH * 2);
+	rows = ring;
+	ring_rows = SCROLLBACK_LINES;
+	screen_top = 0;
+	history = 0;
+}
+
+void vga_scroll_view(int lines)
+{
+	int back = view_back + lines;
+	if (back > history)
+		back = history;
+	if (back < 0)
+		back = 0;
+	if (back == view_back)
+		return;
+
+	if (back == 0) {
+		vga_flush();
+		return;
+	}
+	view_back = back;
+
+	// The page is contiguous in the ring unless it straddles the end
+	int first = ring_row(-back);
+	int count = ring_rows - first;
+	if (count > VGA_HEIGHT)
+		count = VGA_HEIGHT;
+
+	uint16_t *page = &VGA_MEMORY[vram_top * VGA_WIDTH];
+	memcpy(page, &rows[first * VGA_WIDTH], count * VGA_WIDTH * 2);
+	if (count < VGA_HEIGHT)
+		memcpy(page + count * VGA_WIDTH, rows,
+		       (VGA_HEIGHT - count) * VGA_WIDTH * 2);
+
+	// vga_flush() rewrites the live screen when the view returns
+	update_cursor();
 }
 
 void vga_set_color(uint8_t fg, uint8_t bg)
@@ -34,33 +219,38 @@ void vga_set_color(uint8_t fg, uint8_t bg)
 
 void vga_clear(void)
 {
+	uint16_t blank = vga_entry(' ', vga_color);
+
 	for (int y = 0; y < VGA_HEIGHT; y++) {
-		for (int x = 0; x < VGA_WIDTH; x++) {
-			VGA_MEMORY[y * VGA_WIDTH + x] =
-			    vga_entry(' ', vga_color);
-		}
+		uint16_t *cells = row_cells(y);
+		for (int x = 0; x < VGA_WIDTH; x++)
+			cells[x] = blank;
 	}
+	mark_all_dirty();
 	cursor_row = 0;
 	cursor_col = 0;
-	update_cursor();
+	vga_flush();
 }
 
 void vga_init(void)
 {
 	vga_color = VGA_COLOR_LIGHT_GREY | (VGA_COLOR_BLACK << 4);
+	for (int y = 0; y < VGA_HEIGHT; y++) {
+		dirty_start[y] = VGA_WIDTH;
+		dirty_end[y] = 0;
+	}
 	vga_clear();
 }
 
-void vga_putch(char c)
+// Draw one character into the ring without flushing
+static void put_char(char c)
 {
 	if (c == '\b') {
 		// BACKSPACE - FIX FINAL
 		if (cursor_col > 0) {
 			cursor_col--;
 			// Tulis spasi untuk menghapus karakter
-			VGA_MEMORY[cursor_row * VGA_WIDTH + cursor_col] =
-			    vga_entry(' ', vga_color);
-			update_cursor();
+			put_cell(cursor_row, cursor_col, vga_entry(' ', vga_color));
 		}
 		return;
 	}
@@ -69,8 +259,7 @@ void vga_putch(char c)
 		cursor_col = 0;
 		cursor_row++;
 	} else if (c >= 32 && c <= 126) {
-		VGA_MEMORY[cursor_row * VGA_WIDTH + cursor_col] =
-		    vga_entry(c, vga_color);
+		put_cell(cursor_row, cursor_col, vga_entry(c, vga_color));
 		cursor_col++;
 
 		if (cursor_col >= VGA_WIDTH) {
@@ -80,29 +269,60 @@ void vga_putch(char c)
 	}
 
 	if (cursor_row >= VGA_HEIGHT) {
-		// Scroll up
-		for (int y = 0; y < VGA_HEIGHT - 1; y++) {
-			for (int x = 0; x < VGA_WIDTH; x++) {
-				VGA_MEMORY[y * VGA_WIDTH + x] =
-				    VGA_MEMORY[(y + 1) * VGA_WIDTH + x];
-			}
-		}
-		// Clear last line
-		for (int x = 0; x < VGA_WIDTH; x++) {
-			VGA_MEMORY[(VGA_HEIGHT - 1) * VGA_WIDTH + x] =
-			    vga_entry(' ', vga_color);
-		}
+		scroll();
 		cursor_row = VGA_HEIGHT - 1;
 	}
+}
 
-	update_cursor();
+void vga_putch(char c)
+{
+	put_char(c);
+	vga_flush();
 }
 
 void vga_puts(const char *str)
 {
 	while (*str) {
-		vga_putch(*str++);
+		put_char(*str++);
+	}
+	vga_flush();
+}
+
+static int hex_digit(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
+}
+
+int vga_parse_escape(const char *p, int len)
+{
+	if (len < VGA_ESC_LEN || p[0] != VGA_ESC)
+		return -1;
+
+	int fg = hex_digit(p[1]);
+	int bg = hex_digit(p[2]);
+	if (fg < 0 || bg < 0)
+		return -1;
+	return fg | (bg << 4);
+}
+
+void vga_write(const char *buf, int len)
+{
+	for (int i = 0; i < len; i++) {
+		if (buf[i] == VGA_ESC) {
+			int color = vga_parse_escape(buf + i, len - i);
+			if (color >= 0) {
+				vga_color = color;
+				i += VGA_ESC_LEN - 1;
+			}
+			continue;
+		}
+		put_char(buf[i]);
 	}
+	vga_flush();
 }
 
 void vga_print_int(int num)
@@ -113,7 +333,7 @@ void vga_print_int(int num)
 	}
 
 	if (num < 0) {
-		vga_putch('-');
+		put_char('-');
 		num = -num;
 	}
 
@@ -126,17 +346,20 @@ void vga_print_int(int num)
 	}
 
 	while (i > 0) {
-		vga_putch(buffer[--i]);
+		put_char(buffer[--i]);
 	}
+	vga_flush();
 }
 
 void vga_print_hex(uint32_t num)
 {
-	vga_puts("0x");
+	put_char('0');
+	put_char('x');
 	const char hex[] = "0123456789ABCDEF";
 	for (int i = 28; i >= 0; i -= 4) {
-		vga_putch(hex[(num >> i) & 0xF]);
+		put_char(hex[(num >> i) & 0xF]);
 	}
+	vga_flush();
 }
 
 int vga_get_cursor_col(void)
@@ -153,15 +376,18 @@ void vga_set_cursor(int row, int col)
 {
 	cursor_row = row;
 	cursor_col = col;
-	update_cursor();
+	vga_flush();
 }
 
 void vga_clear_eol(void)
 {
+	uint16_t *cells = row_cells(cursor_row);
+
 	for (int x = cursor_col; x < VGA_WIDTH; x++) {
-		VGA_MEMORY[cursor_row * VGA_WIDTH + x] =
-		    vga_entry(' ', vga_color);
+		cells[x] = vga_entry(' ', vga_color);
 	}
+	mark_dirty(cursor_row, cursor_col, VGA_WIDTH);
+	vga_flush();
 }
 
 void vga_draw_box(int row, int col, int width, int height, uint8_t fg,
@@ -170,24 +396,28 @@ void vga_draw_box(int row, int col, int width, int height, uint8_t fg,
 	uint8_t old_color = vga_color;
 	vga_color = fg | (bg << 4);
 
-	vga_set_cursor(row, col);
-	vga_putch('+');
+	cursor_row = row;
+	cursor_col = col;
+	put_char('+');
 	for (int i = 0; i < width - 2; i++)
-		vga_putch('-');
-	vga_putch('+');
+		put_char('-');
+	put_char('+');
 
 	for (int y = 1; y < height - 1; y++) {
-		vga_set_cursor(row + y, col);
-		vga_putch('|');
-		vga_set_cursor(row + y, col + width - 1);
-		vga_putch('|');
+		cursor_row = row + y;
+		cursor_col = col;
+		put_char('|');
+		cursor_col = col + width - 1;
+		put_char('|');
 	}
 
-	vga_set_cursor(row + height - 1, col);
-	vga_putch('+');
+	cursor_row = row + height - 1;
+	cursor_col = col;
+	put_char('+');
 	for (int i = 0; i < width - 2; i++)
-		vga_putch('-');
-	vga_putch('+');
+		put_char('-');
+	put_char('+');
 
 	vga_color = old_color;
+	vga_flush();
 }
@@ -8,7 +8,19 @@ void vga_init(void);
 void vga_clear(void);
 void vga_putch(char c);
 void vga_puts(const char *str);
+// Like vga_puts() for a counted buffer, and also applies color escapes
+void vga_write(const char *buf, int len);
 void vga_set_color(uint8_t fg, uint8_t bg);
+// Copy pending changes to video memory and move the hardware cursor.
+// The functions here flush on return; callers never need to.
+void vga_flush(void);
+
+// Scrollback: until vga_init_scrollback() (which needs kmalloc and
+// paging) only the visible screen is kept. vga_scroll_view() moves the
+// view back (positive) or forward through it; any output returns to the
+// live screen.
+void vga_init_scrollback(void);
+void vga_scroll_view(int lines);
 
 // Cursor functions
 int vga_get_cursor_col(void);
@@ -22,6 +34,15 @@ void vga_clear_eol(void);
 void vga_draw_box(int row, int col, int width, int height, uint8_t fg,
                   uint8_t bg);
 
+// Color escape in vga_write() text: ESC, then the foreground and
+// background color as lowercase hex digits, e.g. "\x1b" "c0" for light
+// red on black
+#define VGA_ESC '\x1b'
+#define VGA_ESC_LEN 3
+// Attribute byte of the escape starting at p (len bytes available), or
+// -1 if it is malformed or cut short
+int vga_parse_escape(const char *p, int len);
+
 // VGA Color definitions
 #define VGA_COLOR_BLACK 0
 #define VGA_COLOR_BLUE 1
@@ -0,0 +1,373 @@
+#include "bcache.h"
+#include "minifs.h"
+#include "../drivers/timer.h"
+#include "../kernel/kmalloc.h"
+#include "../kernel/mutex.h"
+#include "../lib/string.h"
+
+#define BCACHE_HASH_SIZE 1024
+#define SECTORS_PER_BLOCK (MINIFS_BLOCK_SIZE / SECTOR_SIZE)
+// Most blocks read by one bcache_prefetch() call
+#define BCACHE_PREFETCH_MAX 128
+
+// Guards the hash table, LRU list, buffer headers and counters. Reads
+// and write-back hold it across the I/O, so a second thread asking for
+// a block being read waits for it instead of reading it again. Buffer
+// contents are not covered: they belong to whoever has the block
+// referenced, and every change to them is followed by bdirty(), which
+// waits out a write-back in progress and marks the buffer again.
+static struct mutex cache_lock;
+static struct kmem_cache *buf_cache = 0;
+static struct kmem_cache *data_cache = 0;
+static struct buf *hash_table[BCACHE_HASH_SIZE];
+
+// LRU list: head is the most recently used buffer
+static struct buf *lru_head = 0;
+static struct buf *lru_tail = 0;
+
+static uint32_t max_buffers = 0;
+static uint32_t buffer_count = 0;
+static uint32_t dirty_count = 0;
+// Tick at which the cache last went from clean to dirty
+static uint64_t dirty_since = 0;
+
+static uint32_t stat_hits = 0;
+static uint32_t stat_misses = 0;
+static uint32_t stat_reads = 0;
+static uint32_t stat_writes = 0;
+
+static inline uint32_t hash_slot(struct blockdev *dev, uint32_t blockno)
+{
+	return (blockno ^ (uint32_t)((unsigned long)dev >> 4)) &
+	       (BCACHE_HASH_SIZE - 1);
+}
+
+static void lru_unlink(struct buf *b)
+{
+	if (b->lru_prev)
+		b->lru_prev->lru_next = b->lru_next;
+	else
+		lru_head = b->lru_next;
+	if (b->lru_next)
+		b->lru_next->lru_prev = b->lru_prev;
+	else
+		lru_tail = b->lru_prev;
+}
+
+static void lru_push_front(struct buf *b)
+{
+	b->lru_prev = 0;
+	b->lru_next = lru_head;
+	if (lru_head)
+		lru_head->lru_prev = b;
+	else
+		lru_tail = b;
+	lru_head = b;
+}
+
+static void lru_push_back(struct buf *b)
+{
+	b->lru_next = 0;
+	b->lru_prev = lru_tail;
+	if (lru_tail)
+		lru_tail->lru_next = b;
+	else
+		lru_head = b;
+	lru_tail = b;
+}
+
+static struct buf *hash_lookup(struct blockdev *dev, uint32_t blockno)
+{
+	struct buf *b = hash_table[hash_slot(dev, blockno)];
+
+	while (b && (b->dev != dev || b->blockno != blockno))
+		b = b->hash_next;
+	return b;
+}
+
+static void hash_insert(struct buf *b)
+{
+	uint32_t slot = hash_slot(b->dev, b->blockno);
+
+	b->hash_next = hash_table[slot];
+	hash_table[slot] = b;
+}
+
+static void hash_remove(struct buf *b)
+{
+	struct buf **p = &hash_table[hash_slot(b->dev, b->blockno)];
+
+	while (*p && *p != b)
+		p = &(*p)->hash_next;
+	if (*p)
+		*p = b->hash_next;
+}
+
+static void set_request(struct buf *b, int write)
+{
+	b->req.sector = b->blockno * SECTORS_PER_BLOCK;
+	b->req.count = SECTORS_PER_BLOCK;
+	b->req.buffer = b->data;
+	b->req.write = write;
+}
+
+// Write back all dirty buffers of one device in a single queue run
+static int sync_device(struct blockdev *dev)
+{
+	struct blk_queue q;
+	blk_queue_init(&q, dev);
+
+	for (struct buf *b = lru_head; b; b = b->lru_next) {
+		if (b->dirty && b->dev == dev) {
+			set_request(b, 1);
+			blk_queue_add(&q, &b->req);
+		}
+	}
+
+	int ret = blk_queue_run(&q);
+
+	for (struct buf *b = lru_head; b; b = b->lru_next) {
+		if (b->dirty && b->dev == dev && b->req.status == 0) {
+			b->dirty = 0;
+			dirty_count--;
+			stat_writes++;
+		}
+	}
+	return ret;
+}
+
+// Drop a buffer whose read failed; it is reused first
+static void buf_discard(struct buf *b)
+{
+	hash_remove(b);
+	b->dev = 0;
+	b->valid = 0;
+	b->refcnt = 0;
+	lru_unlink(b);
+	lru_push_back(b);
+}
+
+// Write back every dirty buffer, one elevator pass per device
+static int sync_all(void)
+{
+	struct blockdev *failed = 0;
+	int ret = 0;
+
+	for (struct buf *b = lru_head; b && dirty_count; b = b->lru_next) {
+		if (b->dirty && b->dev != failed && sync_device(b->dev) != 0) {
+			failed = b->dev;
+			ret = -1;
+		}
+	}
+	return ret;
+}
+
+// A fresh buffer while under the limit, otherwise the least recently
+// used unreferenced one. Reaching a dirty victim writes back everything
+// dirty, so eviction under write pressure clusters the I/O.
+static struct buf *buf_alloc(void)
+{
+	if (buffer_count < max_buffers) {
+		struct buf *b = kmem_cache_alloc(buf_cache);
+		if (b) {
+			b->data = kmem_cache_alloc(data_cache);
+			if (b->data) {
+				buffer_count++;
+				lru_push_front(b);
+				return b;
+			}
+			kmem_cache_free(buf_cache, b);
+		}
+	}
+
+	int synced = 0;
+	for (struct buf *b = lru_tail; b; b = b->lru_prev) {
+		if (b->refcnt)
+			continue;
+		if (b->dirty && !synced) {
+			sync_all();
+			synced = 1;
+		}
+		if (b->dirty)
+			continue;
+		if (b->dev)
+			hash_remove(b);
+		return b;
+	}
+	return 0;
+}
+
+static struct buf *buf_get(struct blockdev *dev, uint32_t blockno, int read)
+{
+	struct buf *b = hash_lookup(dev, blockno);
+
+	if (b) {
+		stat_hits++;
+		b->refcnt++;
+		lru_unlink(b);
+		lru_push_front(b);
+		return b;
+	}
+
+	stat_misses++;
+	b = buf_alloc();
+	if (!b)
+		return 0;
+
+	b->dev = dev;
+	b->blockno = blockno;
+	b->dirty = 0;
+	b->valid = 0;
+	b->refcnt = 1;
+	hash_insert(b);
+	lru_unlink(b);
+	lru_push_front(b);
+
+	if (read) {
+		if (dev->read(dev, blockno * SECTORS_PER_BLOCK,
+		              SECTORS_PER_BLOCK, b->data) != 0) {
+			buf_discard(b);
+			return 0;
+		}
+		stat_reads++;
+	}
+	b->valid = 1;
+	return b;
+}
+
+void bcache_init(uint32_t buffers)
+{
+	buf_cache = kmem_cache_create("bcache-buf", sizeof(struct buf));
+	data_cache = kmem_cache_create("bcache-data", MINIFS_BLOCK_SIZE);
+	max_buffers = buffers;
+}
+
+struct buf *bread(struct blockdev *dev, uint32_t blockno)
+{
+	mutex_lock(&cache_lock);
+	struct buf *b = buf_get(dev, blockno, 1);
+	mutex_unlock(&cache_lock);
+	return b;
+}
+
+struct buf *bget(struct blockdev *dev, uint32_t blockno)
+{
+	mutex_lock(&cache_lock);
+	struct buf *b = buf_get(dev, blockno, 0);
+	mutex_unlock(&cache_lock);
+	return b;
+}
+
+void bdirty(struct buf *b)
+{
+	mutex_lock(&cache_lock);
+	if (!b->dirty) {
+		b->dirty = 1;
+		if (dirty_count++ == 0)
+			dirty_since = timer_ticks();
+	}
+	mutex_unlock(&cache_lock);
+}
+
+void brelse(struct buf *b)
+{
+	mutex_lock(&cache_lock);
+	if (b && b->refcnt)
+		b->refcnt--;
+	mutex_unlock(&cache_lock);
+}
+
+void bcache_prefetch(struct blockdev *dev, const uint32_t *blocks,
+                     uint32_t count)
+{
+	struct buf *fresh[BCACHE_PREFETCH_MAX];
+	uint32_t n = 0;
+	struct blk_queue q;
+
+	blk_queue_init(&q, dev);
+	mutex_lock(&cache_lock);
+
+	// Leave most of the cache to the buffers already in use
+	if (count > max_buffers / 2)
+		count = max_buffers / 2;
+	if (count > BCACHE_PREFETCH_MAX)
+		count = BCACHE_PREFETCH_MAX;
+
+	for (uint32_t i = 0; i < count; i++) {
+		if (hash_lookup(dev, blocks[i]))
+			continue;
+
+		struct buf *b = buf_alloc();
+		if (!b)
+			break;
+		b->dev = dev;
+		b->blockno = blocks[i];
+		b->dirty = 0;
+		b->valid = 0;
+		b->refcnt = 1; // pinned until the queue has run
+		hash_insert(b);
+		lru_unlink(b);
+		lru_push_front(b);
+
+		set_request(b, 0);
+		blk_queue_add(&q, &b->req);
+		fresh[n++] = b;
+	}
+	if (n)
+		blk_queue_run(&q);
+
+	for (uint32_t i = 0; i < n; i++) {
+		struct buf *b = fresh[i];
+		if (b->req.status != 0) {
+			buf_discard(b);
+			continue;
+		}
+		b->valid = 1;
+		b->refcnt = 0;
+		stat_reads++;
+	}
+	mutex_unlock(&cache_lock);
+}
+
+int bcache_sync(void)
+{
+	mutex_lock(&cache_lock);
+	int ret = sync_all();
+	mutex_unlock(&cache_lock);
+	return ret;
+}
+
+void bcache_writeback_tick(void)
+{
+	mutex_lock(&cache_lock);
+	if (dirty_count && timer_ticks() - dirty_since >=
+	                       (uint64_t)BCACHE_WRITEBACK_MS * TIMER_HZ / 1000) {
+		// On failure, retry after another interval
+		if (sync_all() != 0)
+			dirty_since = timer_ticks();
+	}
+	mutex_unlock(&cache_lock);
+}
+
+void bcache_lock(void)
+{
+	mutex_lock(&cache_lock);
+}
+
+void bcache_unlock(void)
+{
+	mutex_unlock(&cache_lock);
+}
+
+void bcache_get_stats(struct bcache_stats *stats)
+{
+	mutex_lock(&cache_lock);
+	stats->buffers = buffer_count;
+	stats->max_buffers = max_buffers;
+	stats->dirty = dirty_count;
+	stats->hits = stat_hits;
+	stats->misses = stat_misses;
+	stats->reads = stat_reads;
+	stats->writes = stat_writes;
+	mutex_unlock(&cache_lock);
+}
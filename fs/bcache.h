@@ -0,0 +1,62 @@
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include <stdint.h>
+#include "../drivers/blkqueue.h"
+
+// Write dirty buffers back once the oldest change is this old
+#define BCACHE_WRITEBACK_MS 5000
+
+struct buf {
+	struct blockdev *dev;
+	uint32_t blockno;
+	uint8_t valid;
+	uint8_t dirty;
+	uint16_t refcnt;
+	struct buf *hash_next;
+	struct buf *lru_prev; // towards most recently used
+	struct buf *lru_next;
+	uint8_t *data;
+	struct blk_request req; // for batched reads and write-back
+};
+
+struct bcache_stats {
+	uint32_t buffers;
+	uint32_t max_buffers;
+	uint32_t dirty;
+	uint32_t hits;
+	uint32_t misses;
+	uint32_t reads;
+	uint32_t writes;
+};
+
+void bcache_init(uint32_t max_buffers);
+
+// All calls may sleep, and are safe from several threads.
+
+// Return the buffer for a block with its contents read from disk, or 0
+// on an I/O error. Release with brelse().
+struct buf *bread(struct blockdev *dev, uint32_t blockno);
+// Like bread() but skips the read; for blocks about to be overwritten
+struct buf *bget(struct blockdev *dev, uint32_t blockno);
+void bdirty(struct buf *b);
+void brelse(struct buf *b);
+// Read the uncached blocks among these in one elevator pass so that
+// following bread() calls hit
+void bcache_prefetch(struct blockdev *dev, const uint32_t *blocks,
+                     uint32_t count);
+
+// Write every dirty buffer back, one sorted and merged pass per device;
+// returns -1 if any write failed
+int bcache_sync(void);
+// Called from idle context: sync when dirty data is older than
+// BCACHE_WRITEBACK_MS
+void bcache_writeback_tick(void);
+// Hold off every cache operation, and with it all filesystem I/O; may
+// sleep
+void bcache_lock(void);
+void bcache_unlock(void);
+
+void bcache_get_stats(struct bcache_stats *stats);
+
+#endif
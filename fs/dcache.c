@@ -0,0 +1,71 @@
+#include "dcache.h"
+#include "../lib/string.h"
+
+struct dentry {
+	uint32_t seq; // odd while an insert rewrites the entry
+	uint32_t gen;
+	inode_t *parent; // NULL = unused slot
+	inode_t *node;   // NULL = negative entry
+	uint32_t hash;
+	uint8_t len;
+	char name[MAX_FILENAME];
+};
+
+static struct dentry dcache[DCACHE_SIZE];
+
+static inline struct dentry *dcache_slot(inode_t *parent, uint32_t hash)
+{
+	uint32_t key =
+	    hash ^ (uint32_t)((unsigned long)parent >> 6) * 2654435761u;
+	return &dcache[key & (DCACHE_SIZE - 1)];
+}
+
+static inline int dentry_matches(const struct dentry *d, inode_t *parent,
+                                 uint32_t gen, const char *name,
+                                 uint32_t hash, uint8_t len)
+{
+	return d->parent == parent && d->gen == gen && d->hash == hash &&
+	       d->len == len && memcmp(d->name, name, len) == 0;
+}
+
+int dcache_lookup(inode_t *parent, uint32_t gen, const char *name,
+                  uint32_t hash, uint8_t len, inode_t **result)
+{
+	struct dentry *d = dcache_slot(parent, hash);
+	uint32_t seq = __atomic_load_n(&d->seq, __ATOMIC_ACQUIRE);
+
+	if (seq & 1)
+		return 0;
+
+	int hit = dentry_matches(d, parent, gen, name, hash, len);
+	inode_t *node = d->node;
+
+	// Only a hit if nobody rewrote the entry while it was being read
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (!hit || __atomic_load_n(&d->seq, __ATOMIC_RELAXED) != seq)
+		return 0;
+	*result = node;
+	return 1;
+}
+
+void dcache_insert(inode_t *parent, uint32_t gen, const char *name,
+                   uint32_t hash, uint8_t len, inode_t *node)
+{
+	struct dentry *d = dcache_slot(parent, hash);
+	uint32_t seq = __atomic_load_n(&d->seq, __ATOMIC_RELAXED);
+
+	// Another CPU is filling the slot; dropping this insert only costs a
+	// later miss
+	if ((seq & 1) ||
+	    !__atomic_compare_exchange_n(&d->seq, &seq, seq + 1, 0,
+	                                 __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		return;
+
+	d->parent = parent;
+	d->node = node;
+	d->gen = gen;
+	d->hash = hash;
+	d->len = len;
+	memcpy(d->name, name, len);
+	__atomic_store_n(&d->seq, seq + 2, __ATOMIC_RELEASE);
+}
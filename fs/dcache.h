@@ -0,0 +1,21 @@
+#ifndef DCACHE_H
+#define DCACHE_H
+
+#include "fs.h"
+
+// Direct-mapped cache of (parent, name) -> inode lookups. A cached NULL
+// inode is a negative entry: the name is known not to exist. Entries
+// record the parent's gen from before the lookup, so any change to the
+// directory retires all of its entries at once. Neither call takes a
+// lock; each entry has a sequence count so that a lookup never trusts
+// one that is being rewritten.
+#define DCACHE_SIZE 512
+
+// Returns 1 on a hit and stores the cached inode (possibly NULL)
+int dcache_lookup(inode_t *parent, uint32_t gen, const char *name,
+                  uint32_t hash, uint8_t len, inode_t **result);
+// gen is parent->gen as read before looking up name in the directory
+void dcache_insert(inode_t *parent, uint32_t gen, const char *name,
+                   uint32_t hash, uint8_t len, inode_t *node);
+
+#endif
@@ -1,25 +1,896 @@
 #include "fs.h"
+#include "bcache.h"
+#include "dcache.h"
+#include "../kernel/kmalloc.h"
+#include "../kernel/mutex.h"
 #include "../lib/string.h"
 
-static inode_t inodes[MAX_FILES];
+// Initial directory capacity as a shift; tables double as they fill
+#define DIR_INITIAL_SHIFT 3
+
+// Directory index entries hold slot + 1 so that zero means empty.
+// Deleted entries stay as tombstones until the next rebuild; since a slot
+// is never reused before then, the table is at most half full.
+#define INDEX_EMPTY 0
+#define INDEX_DELETED 0xFFFFFFFF
+
+// Smallest device worth formatting
+#define MINIFS_MIN_BLOCKS 64
+
+// Reads queue up to this many blocks at once: the rest of the request
+// plus a few blocks past it for the next sequential read
+#define READAHEAD_MAX_BLOCKS 64
+#define READAHEAD_EXTRA_BLOCKS 8
+
+// A directory's entries in creation order, deleted slots NULL until the
+// table is rebuilt, and an open-addressing index of slot numbers (2x
+// capacity), in one allocation. Lookups read it under rcu_read_lock();
+// the directory's writer fills free slots in place and publishes a new
+// table to grow or compact it.
+struct dir_table {
+	struct rcu_head rcu;
+	uint32_t capacity;
+	uint32_t slots; // used, including deleted ones
+	inode_t **children;
+	uint32_t index[];
+};
+
+// The allocator: block bitmaps, free disk inodes, the superblock and the
+// scan hints below. Taken inside an inode's lock, never around one, and
+// around buffer cache calls only. Those can wait on the disk, so it is a
+// sleeping lock.
+static struct mutex alloc_lock;
+static struct kmem_cache *inode_cache = 0;
+static struct blockdev *fs_dev = 0;
+static struct minifs_super sb;
+// The free counts in sb change on every allocation; block 0 is only
+// brought up to date by fs_sync() and fs_writeback_tick()
+static int sb_dirty = 0;
 static inode_t *root = 0;
 static inode_t *cwd = 0;
+// Directory generations come from one counter, so an inode that reuses
+// a deleted directory's memory never matches its dentry cache entries
+static uint32_t last_gen = 0;
+
+// Allocation scans resume where the previous one succeeded
+static uint32_t block_hint = 0;
+static uint32_t inode_hint = 0;
+// Creation sequence for the next new inode (minifs_inode.seq)
+static uint32_t next_seq = 0;
+
+static inline uint32_t blocks_for(uint32_t size)
+{
+	return (size + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE;
+}
+
+// FNV-1a over the part of the name that fits in inode_t.name
+static uint32_t hash_name(const char *name, uint8_t *len_out)
+{
+	uint32_t hash = 2166136261u;
+	uint8_t len = 0;
+
+	while (name[len] && len < MAX_FILENAME - 1) {
+		hash ^= (uint8_t)name[len];
+		hash *= 16777619u;
+		len++;
+	}
+	*len_out = len;
+	return hash;
+}
+
+static uint32_t new_gen(void)
+{
+	return __atomic_add_fetch(&last_gen, 1, __ATOMIC_RELAXED);
+}
+
+static inode_t *alloc_inode(inode_type_t type)
+{
+	if (!inode_cache)
+		return 0;
+
+	inode_t *node = kmem_cache_alloc(inode_cache);
+	if (!node)
+		return 0;
+
+	memset(node, 0, sizeof(*node));
+	node->type = type;
+	node->refs = 1; // the directory tree's, until it is deleted
+	if (type == INODE_DIR)
+		node->gen = new_gen();
+	return node;
+}
+
+// Only for inodes no reader can have reached
+static void free_inode(inode_t *node)
+{
+	if (node->type == INODE_DIR)
+		kfree(node->table);
+	kmem_cache_free(inode_cache, node);
+}
+
+// The last reference is gone; the parent loses the one its child held
+static void free_inode_rcu(struct rcu_head *head)
+{
+	inode_t *node = rcu_entry(head, inode_t, rcu);
+	inode_t *parent = node->parent;
+
+	free_inode(node);
+	fs_put(parent);
+}
+
+// A reference to an inode found under rcu_read_lock(). Fails once the
+// last one is gone: the inode is then only waiting for the grace period.
+static inode_t *get_live(inode_t *node)
+{
+	uint32_t refs = node ? __atomic_load_n(&node->refs, __ATOMIC_RELAXED) : 0;
+
+	do {
+		if (!refs)
+			return 0;
+	} while (!__atomic_compare_exchange_n(&node->refs, &refs, refs + 1, 1,
+	                                      __ATOMIC_ACQUIRE,
+	                                      __ATOMIC_RELAXED));
+	return node;
+}
+
+void fs_put(inode_t *node)
+{
+	// Lookups that found it before the last put may still be using it
+	if (node && __atomic_sub_fetch(&node->refs, 1, __ATOMIC_ACQ_REL) == 0)
+		call_rcu(&node->rcu, free_inode_rcu);
+}
+
+static void free_table_rcu(struct rcu_head *head)
+{
+	kfree(rcu_entry(head, struct dir_table, rcu));
+}
+
+static struct dir_table *table_alloc(uint32_t capacity)
+{
+	struct dir_table *t =
+	    kzalloc(sizeof(*t) + capacity * 2 * sizeof(uint32_t) +
+	            capacity * sizeof(inode_t *));
+	if (!t)
+		return 0;
+
+	t->capacity = capacity;
+	t->children = (inode_t **)&t->index[capacity * 2];
+	return t;
+}
+
+static void table_index_insert(struct dir_table *t, uint32_t slot)
+{
+	uint32_t mask = t->capacity * 2 - 1;
+	uint32_t i = t->children[slot]->name_hash & mask;
+
+	while (t->index[i] != INDEX_EMPTY)
+		i = (i + 1) & mask;
+	__atomic_store_n(&t->index[i], slot + 1, __ATOMIC_RELEASE);
+}
+
+// Position in t->index of the entry called name, or -1; the entry goes
+// to *child (NULL if there is none). Safe against the directory's writer
+// changing t meanwhile: an entry it is adding or removing may or may not
+// be seen.
+static int table_find(struct dir_table *t, const char *name, uint32_t hash,
+                      uint8_t len, inode_t **child)
+{
+	*child = 0;
+	if (!t)
+		return -1;
+
+	uint32_t mask = t->capacity * 2 - 1;
+	uint32_t i = hash & mask;
+	uint32_t entry;
+
+	while ((entry = __atomic_load_n(&t->index[i], __ATOMIC_ACQUIRE)) !=
+	       INDEX_EMPTY) {
+		if (entry != INDEX_DELETED) {
+			inode_t *c = __atomic_load_n(&t->children[entry - 1],
+			                             __ATOMIC_ACQUIRE);
+			if (c && c->name_hash == hash && c->name_len == len &&
+			    memcmp(c->name, name, len) == 0) {
+				*child = c;
+				return i;
+			}
+		}
+		i = (i + 1) & mask;
+	}
+	return -1;
+}
+
+// Publish a directory's new table; lookups may still be in the old one
+static void dir_set_table(inode_t *dir, struct dir_table *table)
+{
+	struct dir_table *old = dir->table;
+
+	rcu_assign_pointer(dir->table, table);
+	if (old)
+		call_rcu(&old->rcu, free_table_rcu);
+}
+
+// After a create or delete: retire the directory's dentry cache entries
+static void dir_changed(inode_t *dir)
+{
+	__atomic_store_n(&dir->gen, new_gen(), __ATOMIC_RELEASE);
+}
+
+// Make room for one more slot. Compacts away deleted slots when at least
+// half are holes, otherwise doubles; either way the index is rebuilt,
+// which amortizes to O(1) per create.
+static int dir_reserve_slot(inode_t *dir)
+{
+	struct dir_table *old = dir->table;
+
+	if (old && old->slots < old->capacity)
+		return 0;
+
+	uint32_t capacity = 1u << DIR_INITIAL_SHIFT;
+	if (old) {
+		capacity = old->capacity;
+		if ((uint32_t)dir->child_count >= capacity / 2)
+			capacity *= 2;
+	}
+
+	struct dir_table *t = table_alloc(capacity);
+	if (!t)
+		return -1;
+
+	for (uint32_t i = 0; old && i < old->slots; i++) {
+		if (old->children[i])
+			t->children[t->slots++] = old->children[i];
+	}
+	for (uint32_t i = 0; i < t->slots; i++)
+		table_index_insert(t, i);
+
+	dir_set_table(dir, t);
+	return 0;
+}
+
+// Each directory's entries also form a treap ordered by name: a binary
+// search tree that is a heap on name_hash, which is as good as random,
+// so it stays balanced in expectation and inserts and deletes cost
+// O(log n) with no allocation. Subtree sizes give an entry's rank.
+
+static uint32_t tree_size(inode_t *t)
+{
+	return t ? t->name_subtree : 0;
+}
+
+static void tree_update(inode_t *t)
+{
+	t->name_subtree = 1 + tree_size(t->name_left) + tree_size(t->name_right);
+}
+
+// Name order; the address breaks ties, which only a damaged volume has
+static int tree_cmp(inode_t *a, inode_t *b)
+{
+	int cmp = strcmp(a->name, b->name);
+
+	if (cmp)
+		return cmp;
+	return a < b ? -1 : a > b;
+}
+
+static inode_t *tree_insert(inode_t *t, inode_t *node)
+{
+	if (!t) {
+		node->name_left = node->name_right = 0;
+		node->name_subtree = 1;
+		return node;
+	}
+
+	if (tree_cmp(node, t) < 0) {
+		t->name_left = tree_insert(t->name_left, node);
+		if (t->name_left->name_hash > t->name_hash) {
+			inode_t *l = t->name_left;
+			t->name_left = l->name_right;
+			l->name_right = t;
+			tree_update(t);
+			t = l;
+		}
+	} else {
+		t->name_right = tree_insert(t->name_right, node);
+		if (t->name_right->name_hash > t->name_hash) {
+			inode_t *r = t->name_right;
+			t->name_right = r->name_left;
+			r->name_left = t;
+			tree_update(t);
+			t = r;
+		}
+	}
+	tree_update(t);
+	return t;
+}
+
+// Join two treaps, every entry of a ordered before every entry of b
+static inode_t *tree_merge(inode_t *a, inode_t *b)
+{
+	if (!a || !b)
+		return a ? a : b;
+
+	if (a->name_hash > b->name_hash) {
+		a->name_right = tree_merge(a->name_right, b);
+		tree_update(a);
+		return a;
+	}
+	b->name_left = tree_merge(a, b->name_left);
+	tree_update(b);
+	return b;
+}
+
+static inode_t *tree_remove(inode_t *t, inode_t *node)
+{
+	if (!t)
+		return 0;
+	if (t == node)
+		return tree_merge(t->name_left, t->name_right);
+
+	if (tree_cmp(node, t) < 0)
+		t->name_left = tree_remove(t->name_left, node);
+	else
+		t->name_right = tree_remove(t->name_right, node);
+	tree_update(t);
+	return t;
+}
+
+// Entries whose name, cut to len characters, is below prefix (or not
+// above it, if upper)
+static uint32_t tree_rank(inode_t *t, const char *prefix, int len, int upper)
+{
+	uint32_t rank = 0;
+
+	while (t) {
+		int cmp = strncmp(t->name, prefix, len);
+		if (cmp < 0 || (upper && cmp == 0)) {
+			rank += tree_size(t->name_left) + 1;
+			t = t->name_right;
+		} else {
+			t = t->name_left;
+		}
+	}
+	return rank;
+}
+
+// The entry at position k in name order
+static inode_t *tree_at(inode_t *t, uint32_t k)
+{
+	while (t) {
+		uint32_t left = tree_size(t->name_left);
+		if (k == left)
+			return t;
+		if (k < left) {
+			t = t->name_left;
+		} else {
+			k -= left + 1;
+			t = t->name_right;
+		}
+	}
+	return 0;
+}
+
+// Append node to dir's entries and index. The node must be filled in:
+// lookups can find it as soon as it is in the index.
+static int dir_attach(inode_t *dir, inode_t *node)
+{
+	if (dir_reserve_slot(dir) != 0)
+		return -1;
+
+	struct dir_table *t = dir->table;
+	uint32_t slot = t->slots;
+
+	node->parent = dir;
+	__atomic_add_fetch(&dir->refs, 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&t->children[slot], node, __ATOMIC_RELEASE);
+	__atomic_store_n(&t->slots, slot + 1, __ATOMIC_RELEASE);
+	table_index_insert(t, slot);
+	dir->name_root = tree_insert(dir->name_root, node);
+	dir->child_count++;
+	return 0;
+}
+
+// Remove the entry at index position i; the directory's table goes once
+// it is empty
+static void dir_detach(inode_t *dir, int i)
+{
+	struct dir_table *t = dir->table;
+	uint32_t slot = t->index[i] - 1;
+
+	dir->name_root = tree_remove(dir->name_root, t->children[slot]);
+	__atomic_store_n(&t->index[i], INDEX_DELETED, __ATOMIC_RELEASE);
+	__atomic_store_n(&t->children[slot], 0, __ATOMIC_RELEASE);
+	if (--dir->child_count == 0)
+		dir_set_table(dir, 0);
+}
+
+// Copy the in-memory superblock into block 0's buffer. Under alloc_lock
+// once mounted.
+static void super_write(void)
+{
+	struct buf *b = bread(fs_dev, 0);
+	if (!b)
+		return;
+	memcpy(b->data, &sb, sizeof(sb));
+	bdirty(b);
+	brelse(b);
+	sb_dirty = 0;
+}
+
+// Disk inode ino, inside the buffer returned in *bp (release with brelse)
+static struct minifs_inode *dinode_get(uint32_t ino, struct buf **bp)
+{
+	*bp = bread(fs_dev, sb.inode_start + ino / MINIFS_INODES_PER_BLOCK);
+	if (!*bp)
+		return 0;
+	return (struct minifs_inode *)(*bp)->data +
+	       ino % MINIFS_INODES_PER_BLOCK;
+}
+
+// Mark a free block used in the bitmap; returns 0 when the disk is full.
+// Under alloc_lock.
+static uint32_t bitmap_claim(void)
+{
+	if (!sb.free_blocks)
+		return 0;
+
+	uint32_t first = block_hint / MINIFS_BITS_PER_BLOCK;
+
+	for (uint32_t i = 0; i < sb.bitmap_blocks; i++) {
+		uint32_t bm = (first + i) % sb.bitmap_blocks;
+		struct buf *b = bread(fs_dev, sb.bitmap_start + bm);
+		if (!b)
+			return 0;
+
+		uint32_t *words = (uint32_t *)b->data;
+		for (uint32_t w = 0; w < MINIFS_BLOCK_SIZE / 4; w++) {
+			if (words[w] == 0xFFFFFFFF)
+				continue;
+
+			uint32_t bit = __builtin_ctz(~words[w]);
+			uint32_t blockno = bm * MINIFS_BITS_PER_BLOCK + w * 32 + bit;
+			words[w] |= 1u << bit;
+			bdirty(b);
+			brelse(b);
+
+			sb.free_blocks--;
+			sb_dirty = 1;
+			block_hint = blockno + 1;
+			return blockno;
+		}
+		brelse(b);
+	}
+	return 0;
+}
+
+// Allocate a zeroed block; returns 0 when the disk is full
+static uint32_t balloc(void)
+{
+	mutex_lock(&alloc_lock);
+	uint32_t blockno = bitmap_claim();
+	mutex_unlock(&alloc_lock);
+
+	// Nobody else knows about the block yet
+	struct buf *data = blockno ? bget(fs_dev, blockno) : 0;
+	if (data) {
+		memset(data->data, 0, FS_BLOCK_SIZE);
+		bdirty(data);
+		brelse(data);
+	}
+	return blockno;
+}
+
+static void bfree(uint32_t blockno)
+{
+	mutex_lock(&alloc_lock);
+	struct buf *b = bread(fs_dev, sb.bitmap_start +
+	                                  blockno / MINIFS_BITS_PER_BLOCK);
+	if (b) {
+		uint32_t bit = blockno % MINIFS_BITS_PER_BLOCK;
+		((uint32_t *)b->data)[bit / 32] &= ~(1u << (bit % 32));
+		bdirty(b);
+		brelse(b);
+
+		sb.free_blocks++;
+		sb_dirty = 1;
+	}
+	mutex_unlock(&alloc_lock);
+}
+
+// Find a free disk inode number; the caller fills the inode in before
+// dropping alloc_lock
+static uint32_t ialloc(void)
+{
+	if (!sb.free_inodes)
+		return 0;
+
+	for (uint32_t i = 0; i < sb.inode_count; i++) {
+		uint32_t ino = (inode_hint + i) % sb.inode_count;
+		if (ino <= MINIFS_ROOT_INO)
+			continue;
+
+		struct buf *b;
+		struct minifs_inode *di = dinode_get(ino, &b);
+		if (!di)
+			return 0;
+		int free = di->type == MINIFS_TYPE_FREE;
+		brelse(b);
+
+		if (free) {
+			inode_hint = ino + 1;
+			return ino;
+		}
+	}
+	return 0;
+}
+
+// Follow the block pointer at *slot, which lives in owner's data, through
+// `depth` levels of indirect blocks to entry n. With alloc, missing
+// blocks along the way are allocated.
+static uint32_t bmap_walk(uint32_t *slot, struct buf *owner, uint32_t n,
+                          int depth, int alloc)
+{
+	if (!*slot) {
+		if (!alloc || !(*slot = balloc()))
+			return 0;
+		bdirty(owner);
+	}
+	if (depth == 0)
+		return *slot;
+
+	struct buf *b = bread(fs_dev, *slot);
+	if (!b)
+		return 0;
+
+	uint32_t span = (depth == 2) ? MINIFS_PTRS_PER_BLOCK : 1;
+	uint32_t blockno = bmap_walk((uint32_t *)b->data + n / span, b,
+	                             n % span, depth - 1, alloc);
+	brelse(b);
+	return blockno;
+}
+
+// Disk block holding file block n, or 0 for a hole (or a failed alloc)
+static uint32_t bmap(struct minifs_inode *di, struct buf *ib, uint32_t n,
+                     int alloc)
+{
+	if (n < MINIFS_DIRECT_BLOCKS)
+		return bmap_walk(&di->direct[n], ib, 0, 0, alloc);
+	n -= MINIFS_DIRECT_BLOCKS;
+
+	if (n < MINIFS_PTRS_PER_BLOCK)
+		return bmap_walk(&di->indirect, ib, n, 1, alloc);
+	n -= MINIFS_PTRS_PER_BLOCK;
+
+	if (n < MINIFS_PTRS_PER_BLOCK * MINIFS_PTRS_PER_BLOCK)
+		return bmap_walk(&di->double_indirect, ib, n, 2, alloc);
+	return 0;
+}
+
+// Free the blocks below *slot from relative file block `keep` on,
+// releasing the pointer itself once nothing under it is kept
+static void trunc_walk(uint32_t *slot, struct buf *owner, uint32_t keep,
+                       int depth)
+{
+	if (!*slot)
+		return;
+
+	if (depth > 0) {
+		struct buf *b = bread(fs_dev, *slot);
+		if (!b)
+			return;
+
+		uint32_t span = (depth == 2) ? MINIFS_PTRS_PER_BLOCK : 1;
+		uint32_t *ptrs = (uint32_t *)b->data;
+		for (uint32_t i = keep / span; i < MINIFS_PTRS_PER_BLOCK; i++) {
+			uint32_t first = i * span;
+			trunc_walk(&ptrs[i], b, keep > first ? keep - first : 0,
+			           depth - 1);
+		}
+		brelse(b);
+	}
+
+	if (keep == 0) {
+		bfree(*slot);
+		*slot = 0;
+		bdirty(owner);
+	}
+}
+
+// Shrink the block map to the first `keep` blocks
+static void trunc_blocks(struct minifs_inode *di, struct buf *ib,
+                         uint32_t keep)
+{
+	for (uint32_t i = 0; i < MINIFS_DIRECT_BLOCKS; i++)
+		trunc_walk(&di->direct[i], ib, keep > i, 0);
+	keep = (keep > MINIFS_DIRECT_BLOCKS) ? keep - MINIFS_DIRECT_BLOCKS : 0;
+
+	trunc_walk(&di->indirect, ib, keep, 1);
+	keep = (keep > MINIFS_PTRS_PER_BLOCK) ? keep - MINIFS_PTRS_PER_BLOCK : 0;
+
+	trunc_walk(&di->double_indirect, ib, keep, 2);
+}
+
+static int device_is_blank(struct blockdev *dev)
+{
+	struct buf *b = bread(dev, 0);
+	if (!b)
+		return 0;
+
+	int blank = 1;
+	for (uint32_t i = 0; i < FS_BLOCK_SIZE && blank; i++)
+		blank = b->data[i] == 0;
+	brelse(b);
+	return blank;
+}
+
+static void set_bitmap_bit(uint32_t blockno)
+{
+	struct buf *b = bread(fs_dev, sb.bitmap_start +
+	                                  blockno / MINIFS_BITS_PER_BLOCK);
+	if (!b)
+		return;
+	uint32_t bit = blockno % MINIFS_BITS_PER_BLOCK;
+	((uint32_t *)b->data)[bit / 32] |= 1u << (bit % 32);
+	bdirty(b);
+	brelse(b);
+}
+
+// Zero a range of metadata blocks without reading them first
+static int clear_blocks(uint32_t start, uint32_t count)
+{
+	for (uint32_t i = 0; i < count; i++) {
+		struct buf *b = bget(fs_dev, start + i);
+		if (!b)
+			return -1;
+		memset(b->data, 0, FS_BLOCK_SIZE);
+		bdirty(b);
+		brelse(b);
+	}
+	return 0;
+}
+
+static int format(void)
+{
+	uint32_t total = fs_dev->sector_count / (FS_BLOCK_SIZE / SECTOR_SIZE);
+	if (total < MINIFS_MIN_BLOCKS)
+		return -1;
+
+	uint32_t inode_blocks =
+	    (total / (MINIFS_BYTES_PER_INODE / FS_BLOCK_SIZE) +
+	     MINIFS_INODES_PER_BLOCK - 1) / MINIFS_INODES_PER_BLOCK;
+
+	memset(&sb, 0, sizeof(sb));
+	sb.magic = MINIFS_MAGIC;
+	sb.version = MINIFS_VERSION;
+	sb.block_size = FS_BLOCK_SIZE;
+	sb.total_blocks = total;
+	sb.bitmap_start = 1;
+	sb.bitmap_blocks = (total + MINIFS_BITS_PER_BLOCK - 1) /
+	                   MINIFS_BITS_PER_BLOCK;
+	sb.inode_start = sb.bitmap_start + sb.bitmap_blocks;
+	sb.inode_blocks = inode_blocks;
+	sb.inode_count = inode_blocks * MINIFS_INODES_PER_BLOCK;
+	sb.data_start = sb.inode_start + inode_blocks;
+	sb.free_blocks = total - sb.data_start;
+	// Inode 0 is reserved and 1 is the root
+	sb.free_inodes = sb.inode_count - 2;
+
+	if (clear_blocks(0, sb.data_start) != 0)
+		return -1;
+
+	// Metadata and the bits past the end of the disk are never free
+	for (uint32_t i = 0; i < sb.data_start; i++)
+		set_bitmap_bit(i);
+	for (uint32_t i = total; i < sb.bitmap_blocks * MINIFS_BITS_PER_BLOCK; i++)
+		set_bitmap_bit(i);
+
+	struct buf *b;
+	struct minifs_inode *di = dinode_get(MINIFS_ROOT_INO, &b);
+	if (!di)
+		return -1;
+	strcpy(di->name, "/");
+	di->type = MINIFS_TYPE_DIR;
+	bdirty(b);
+	brelse(b);
+
+	super_write();
+	return bcache_sync();
+}
+
+static inode_t *new_memory_inode(uint32_t ino, const struct minifs_inode *di)
+{
+	inode_t *node = alloc_inode(di->type == MINIFS_TYPE_DIR ? INODE_DIR
+	                                                        : INODE_FILE);
+	if (!node)
+		return 0;
+
+	uint8_t len;
+	node->name_hash = hash_name(di->name, &len);
+	memcpy(node->name, di->name, len);
+	node->name_len = len;
+	node->ino = ino;
+	if (node->type == INODE_FILE)
+		node->size = di->size;
+	return node;
+}
+
+// What mount() keeps per inode number while it rebuilds the tree
+struct mount_entry {
+	inode_t *node;
+	uint32_t parent;
+	uint32_t seq;
+};
+
+static int created_before(const struct mount_entry *e, uint32_t a,
+                          uint32_t b)
+{
+	return (e[a].seq != e[b].seq) ? e[a].seq < e[b].seq : a < b;
+}
+
+static void sift_down(uint32_t *inos, uint32_t i, uint32_t n,
+                      const struct mount_entry *e)
+{
+	while (2 * i + 1 < n) {
+		uint32_t child = 2 * i + 1;
+		if (child + 1 < n && created_before(e, inos[child], inos[child + 1]))
+			child++;
+		if (!created_before(e, inos[i], inos[child]))
+			return;
+		uint32_t tmp = inos[i];
+		inos[i] = inos[child];
+		inos[child] = tmp;
+		i = child;
+	}
+}
 
-void fs_init(void)
+// Heapsort inode numbers into creation order, in place
+static void sort_by_creation(uint32_t *inos, uint32_t n,
+                             const struct mount_entry *e)
 {
-	for (int i = 0; i < MAX_FILES; i++) {
-		inodes[i].used = 0;
+	for (uint32_t i = n / 2; i-- > 0;)
+		sift_down(inos, i, n, e);
+	for (uint32_t end = n; end-- > 1;) {
+		uint32_t tmp = inos[0];
+		inos[0] = inos[end];
+		inos[end] = tmp;
+		sift_down(inos, 0, end, e);
 	}
+}
 
-	root = &inodes[0];
-	root->used = 1;
-	root->type = INODE_DIR;
-	strcpy(root->name, "/");
-	root->size = 0;
+static int build_tree(struct mount_entry *e, uint32_t *order)
+{
+	uint32_t used = 0;
+
+	next_seq = 0;
+	for (uint32_t ino = MINIFS_ROOT_INO; ino < sb.inode_count; ino++) {
+		struct buf *b;
+		struct minifs_inode *di = dinode_get(ino, &b);
+		if (!di)
+			return -1;
+		if (di->type != MINIFS_TYPE_FREE) {
+			e[ino].node = new_memory_inode(ino, di);
+			e[ino].parent = di->parent;
+			e[ino].seq = di->seq;
+			if (di->seq >= next_seq)
+				next_seq = di->seq + 1;
+			if (ino != MINIFS_ROOT_INO && e[ino].node)
+				order[used++] = ino;
+		}
+		brelse(b);
+	}
+
+	root = e[MINIFS_ROOT_INO].node;
+	if (!root || root->type != INODE_DIR)
+		return -1;
 	root->parent = 0;
-	root->child_count = 0;
 
+	sort_by_creation(order, used, e);
+	for (uint32_t i = 0; i < used; i++) {
+		uint32_t ino = order[i];
+		uint32_t parent = e[ino].parent;
+
+		if (parent < sb.inode_count && e[parent].node &&
+		    e[parent].node->type == INODE_DIR && parent != ino)
+			dir_attach(e[parent].node, e[ino].node);
+	}
+	return 0;
+}
+
+// Rebuild the directory tree from the inode table. Directories have no
+// on-disk entries, so every in-use inode is attached to its parent in
+// creation order, which keeps listings as they were before the remount;
+// inodes whose parent is missing are left unreachable.
+static int mount(void)
+{
+	struct mount_entry *entries = kzalloc(sb.inode_count * sizeof(*entries));
+	uint32_t *order = kmalloc(sb.inode_count * sizeof(*order));
+	int result = -1;
+
+	if (entries && order)
+		result = build_tree(entries, order);
+	kfree(order);
+	kfree(entries);
+	return result;
+}
+
+int fs_init(struct blockdev *dev)
+{
+	if (!inode_cache)
+		inode_cache = kmem_cache_create("inode", sizeof(inode_t));
+	if (!inode_cache || !dev)
+		return -1;
+
+	fs_dev = dev;
+	root = cwd = 0;
+	block_hint = inode_hint = 0;
+	sb_dirty = 0;
+
+	int result = FS_MOUNTED;
+	struct buf *b = bread(dev, 0);
+	if (!b)
+		return -1;
+	memcpy(&sb, b->data, sizeof(sb));
+	brelse(b);
+
+	if (sb.magic != MINIFS_MAGIC) {
+		if (!device_is_blank(dev) || format() != 0)
+			return -1;
+		result = FS_FORMATTED;
+	} else if (sb.version != MINIFS_VERSION ||
+	           sb.block_size != FS_BLOCK_SIZE) {
+		return -1;
+	}
+
+	if (mount() != 0)
+		return -1;
+
+	// The cwd holds a reference of its own
+	root->refs++;
 	cwd = root;
+	return result;
+}
+
+struct blockdev *fs_get_device(void)
+{
+	return fs_dev;
+}
+
+void fs_lock_device(void)
+{
+	bcache_lock();
+}
+
+void fs_unlock_device(void)
+{
+	bcache_unlock();
+}
+
+int fs_sync(void)
+{
+	mutex_lock(&alloc_lock);
+	if (sb_dirty)
+		super_write();
+	mutex_unlock(&alloc_lock);
+	return bcache_sync();
+}
+
+void fs_writeback_tick(void)
+{
+	mutex_lock(&alloc_lock);
+	if (sb_dirty)
+		super_write();
+	mutex_unlock(&alloc_lock);
+	bcache_writeback_tick();
+}
+
+void fs_get_stats(struct fs_stats *stats)
+{
+	mutex_lock(&alloc_lock);
+	stats->device = fs_dev ? fs_dev->name : "none";
+	stats->total_blocks = sb.total_blocks;
+	stats->free_blocks = sb.free_blocks;
+	stats->inode_count = sb.inode_count;
+	stats->free_inodes = sb.free_inodes;
+	mutex_unlock(&alloc_lock);
 }
 
 inode_t *fs_get_root(void)
@@ -29,105 +900,391 @@ inode_t *fs_get_root(void)
 
 inode_t *fs_get_cwd(void)
 {
-	return cwd;
+	rcu_read_lock();
+	inode_t *dir = get_live(__atomic_load_n(&cwd, __ATOMIC_ACQUIRE));
+	rcu_read_unlock();
+	return dir;
 }
 
+// Under the directory's lock, so that fs_delete() either sees the new
+// cwd or has already deleted the directory
 void fs_set_cwd(inode_t *dir)
 {
-	if (dir && dir->type == INODE_DIR) {
-		cwd = dir;
+	if (!dir || dir->type != INODE_DIR)
+		return;
+
+	inode_t *old = 0;
+	mutex_lock(&dir->lock);
+	if (dir->ino) {
+		__atomic_add_fetch(&dir->refs, 1, __ATOMIC_RELAXED);
+		old = __atomic_exchange_n(&cwd, dir, __ATOMIC_ACQ_REL);
 	}
+	mutex_unlock(&dir->lock);
+	fs_put(old);
 }
 
-static inode_t *alloc_inode(void)
+// Allocate and fill in the disk inode for a new node
+static int disk_create(inode_t *node, uint32_t parent_ino)
 {
-	for (int i = 0; i < MAX_FILES; i++) {
-		if (!inodes[i].used) {
-			inodes[i].used = 1;
-			inodes[i].child_count = 0;
-			inodes[i].size = 0;
-			memset(inodes[i].data, 0, MAX_FILE_SIZE);
-			return &inodes[i];
-		}
+	mutex_lock(&alloc_lock);
+	uint32_t ino = ialloc();
+	struct buf *b;
+	struct minifs_inode *di = ino ? dinode_get(ino, &b) : 0;
+	if (!di) {
+		mutex_unlock(&alloc_lock);
+		return -1;
 	}
+
+	memset(di, 0, sizeof(*di));
+	memcpy(di->name, node->name, node->name_len);
+	di->parent = parent_ino;
+	di->type =
+	    (node->type == INODE_DIR) ? MINIFS_TYPE_DIR : MINIFS_TYPE_FILE;
+	di->seq = next_seq++;
+	bdirty(b);
+	brelse(b);
+
+	sb.free_inodes--;
+	sb_dirty = 1;
+	mutex_unlock(&alloc_lock);
+
+	node->ino = ino;
 	return 0;
 }
 
-inode_t *fs_create_file(inode_t *parent, const char *name)
+// Free a node's blocks and disk inode, under its lock. Its ino reads 0
+// from then on, so calls still holding the inode fail.
+static int disk_delete(inode_t *node)
+{
+	struct buf *b;
+	struct minifs_inode *di = dinode_get(node->ino, &b);
+	if (!di)
+		return -1;
+
+	trunc_blocks(di, b, 0);
+
+	mutex_lock(&alloc_lock);
+	memset(di, 0, sizeof(*di));
+	bdirty(b);
+	sb.free_inodes++;
+	sb_dirty = 1;
+	mutex_unlock(&alloc_lock);
+	brelse(b);
+
+	node->ino = 0;
+	return 0;
+}
+
+static inode_t *create_node(inode_t *parent, const char *name,
+                            inode_type_t type)
 {
 	if (!parent || parent->type != INODE_DIR)
 		return 0;
-	if (parent->child_count >= MAX_FILES)
-		return 0;
-	if (fs_find_child(parent, name))
-		return 0;
 
-	inode_t *file = alloc_inode();
-	if (!file)
+	inode_t *node = alloc_inode(type);
+	if (!node)
 		return 0;
 
-	strncpy(file->name, name, MAX_FILENAME - 1);
-	file->type = INODE_FILE;
-	file->parent = parent;
+	uint8_t len;
+	node->name_hash = hash_name(name, &len);
+	memcpy(node->name, name, len);
+	node->name_len = len;
+
+	// A deleted directory takes no new entries. Room in the table comes
+	// first, so that nothing can fail once the disk inode exists.
+	inode_t *existing;
+	mutex_lock(&parent->lock);
+	int ok = parent->ino &&
+	         table_find(parent->table, name, node->name_hash, len,
+	                    &existing) < 0 &&
+	         dir_reserve_slot(parent) == 0 &&
+	         disk_create(node, parent->ino) == 0;
+	if (ok) {
+		node->refs++; // the caller's
+		dir_attach(parent, node);
+		dir_changed(parent);
+	}
+	mutex_unlock(&parent->lock);
+
+	if (!ok) {
+		free_inode(node);
+		return 0;
+	}
+	return node;
+}
 
-	parent->children[parent->child_count++] = file;
-	return file;
+inode_t *fs_create_file(inode_t *parent, const char *name)
+{
+	return create_node(parent, name, INODE_FILE);
 }
 
 inode_t *fs_create_dir(inode_t *parent, const char *name)
+{
+	return create_node(parent, name, INODE_DIR);
+}
+
+inode_t *fs_find_child(inode_t *parent, const char *name)
 {
 	if (!parent || parent->type != INODE_DIR)
 		return 0;
-	if (parent->child_count >= MAX_FILES)
-		return 0;
-	if (fs_find_child(parent, name))
-		return 0;
 
-	inode_t *dir = alloc_inode();
-	if (!dir)
+	uint8_t len;
+	uint32_t hash = hash_name(name, &len);
+	inode_t *node;
+
+	rcu_read_lock();
+	table_find(rcu_dereference(parent->table), name, hash, len, &node);
+	node = get_live(node);
+	rcu_read_unlock();
+	return node;
+}
+
+inode_t *fs_dir_next(inode_t *dir, int *pos)
+{
+	if (!dir || dir->type != INODE_DIR)
 		return 0;
 
-	strncpy(dir->name, name, MAX_FILENAME - 1);
-	dir->type = INODE_DIR;
-	dir->parent = parent;
+	inode_t *child = 0;
 
-	parent->children[parent->child_count++] = dir;
-	return dir;
+	rcu_read_lock();
+	struct dir_table *t = rcu_dereference(dir->table);
+	if (t) {
+		uint32_t slots = __atomic_load_n(&t->slots, __ATOMIC_ACQUIRE);
+		while (!child && (uint32_t)*pos < slots)
+			child = get_live(__atomic_load_n(&t->children[(*pos)++],
+			                                 __ATOMIC_ACQUIRE));
+	}
+	rcu_read_unlock();
+	return child;
 }
 
-inode_t *fs_find_child(inode_t *parent, const char *name)
+int fs_dir_match(inode_t *dir, const char *prefix, struct fs_match *matches,
+                 int max, char *common)
 {
-	if (!parent || parent->type != INODE_DIR)
+	common[0] = 0;
+	if (!dir || dir->type != INODE_DIR)
 		return 0;
 
-	for (int i = 0; i < parent->child_count; i++) {
-		if (strcmp(parent->children[i]->name, name) == 0) {
-			return parent->children[i];
+	int len = strlen(prefix);
+	mutex_lock(&dir->lock);
+	uint32_t first = tree_rank(dir->name_root, prefix, len, 0);
+	int count = tree_rank(dir->name_root, prefix, len, 1) - first;
+
+	for (int i = 0; i < count && i < max; i++) {
+		inode_t *child = tree_at(dir->name_root, first + i);
+		memcpy(matches[i].name, child->name, MAX_FILENAME);
+		matches[i].type = child->type;
+	}
+	// In name order, whatever the first and last share all the others do
+	if (count > 0) {
+		const char *a = tree_at(dir->name_root, first)->name;
+		const char *b = tree_at(dir->name_root, first + count - 1)->name;
+		int n = 0;
+		while (a[n] && a[n] == b[n]) {
+			common[n] = a[n];
+			n++;
 		}
+		common[n] = 0;
 	}
-	return 0;
+	mutex_unlock(&dir->lock);
+	return count;
+}
+
+static int write_file(inode_t *file, const char *data, uint32_t size)
+{
+	if (!file->ino)
+		return -1;
+
+	struct buf *ib;
+	struct minifs_inode *di = dinode_get(file->ino, &ib);
+	if (!di)
+		return -1;
+
+	uint32_t needed = blocks_for(size);
+	uint32_t written = 0;
+
+	while (written < needed) {
+		uint32_t offset = written * FS_BLOCK_SIZE;
+		uint32_t chunk = size - offset;
+		if (chunk > FS_BLOCK_SIZE)
+			chunk = FS_BLOCK_SIZE;
+
+		uint32_t blockno = bmap(di, ib, written, 1);
+		struct buf *b = blockno ? bget(fs_dev, blockno) : 0;
+		if (!b)
+			break;
+		memcpy(b->data, data + offset, chunk);
+		memset(b->data + chunk, 0, FS_BLOCK_SIZE - chunk);
+		bdirty(b);
+		brelse(b);
+		written++;
+	}
+
+	// On a full disk keep what fit
+	int result = size;
+	if (written < needed) {
+		size = written * FS_BLOCK_SIZE;
+		result = -1;
+	}
+
+	trunc_blocks(di, ib, written);
+	di->size = size;
+	bdirty(ib);
+	brelse(ib);
+
+	file->size = size;
+	return result;
 }
 
 int fs_write_file(inode_t *file, const char *data, uint32_t size)
 {
 	if (!file || file->type != INODE_FILE)
 		return -1;
-	if (size > MAX_FILE_SIZE)
-		size = MAX_FILE_SIZE;
 
-	memcpy(file->data, data, size);
-	file->size = size;
-	return size;
+	mutex_lock(&file->lock);
+	int result = write_file(file, data, size);
+	mutex_unlock(&file->lock);
+	return result;
 }
 
-int fs_read_file(inode_t *file, char *buffer, uint32_t size)
+// Blocks past the old end are holes or were zeroed by balloc() and
+// write_file(), so a write beyond the end leaves zeros in the gap
+static int write_at(inode_t *file, uint32_t offset, const char *data,
+                    uint32_t size)
+{
+	if (!file->ino || offset + size < offset)
+		return -1;
+
+	struct buf *ib;
+	struct minifs_inode *di = dinode_get(file->ino, &ib);
+	if (!di)
+		return -1;
+
+	uint32_t done = 0;
+	while (done < size) {
+		uint32_t pos = offset + done;
+		uint32_t block_off = pos % FS_BLOCK_SIZE;
+		uint32_t chunk = FS_BLOCK_SIZE - block_off;
+		if (chunk > size - done)
+			chunk = size - done;
+
+		uint32_t blockno = bmap(di, ib, pos / FS_BLOCK_SIZE, 1);
+		struct buf *b = 0;
+		if (blockno)
+			b = (chunk == FS_BLOCK_SIZE) ? bget(fs_dev, blockno)
+			                             : bread(fs_dev, blockno);
+		if (!b)
+			break;
+		memcpy(b->data + block_off, data + done, chunk);
+		bdirty(b);
+		brelse(b);
+		done += chunk;
+	}
+
+	if (offset + done > file->size) {
+		di->size = offset + done;
+		bdirty(ib);
+		file->size = offset + done;
+	}
+	brelse(ib);
+	return (done == size) ? (int)size : -1;
+}
+
+int fs_write_at(inode_t *file, uint32_t offset, const char *data,
+                uint32_t size)
+{
+	if (!file || file->type != INODE_FILE)
+		return -1;
+
+	mutex_lock(&file->lock);
+	int result = write_at(file, offset, data, size);
+	mutex_unlock(&file->lock);
+	return result;
+}
+
+// Queue file blocks [first, end) in one elevator pass; returns the block
+// the next readahead should start from
+static uint32_t readahead(inode_t *file, struct minifs_inode *di,
+                          struct buf *ib, uint32_t first, uint32_t end)
+{
+	uint32_t blocks[READAHEAD_MAX_BLOCKS];
+	uint32_t n = 0;
+
+	end += READAHEAD_EXTRA_BLOCKS;
+	if (end > blocks_for(file->size))
+		end = blocks_for(file->size);
+	if (end - first > READAHEAD_MAX_BLOCKS)
+		end = first + READAHEAD_MAX_BLOCKS;
+
+	for (uint32_t i = first; i < end; i++) {
+		uint32_t blockno = bmap(di, ib, i, 0);
+		if (blockno)
+			blocks[n++] = blockno;
+	}
+	bcache_prefetch(fs_dev, blocks, n);
+	return end;
+}
+
+static int read_at(inode_t *file, uint32_t offset, char *buffer,
+                   uint32_t size)
+{
+	if (!file->ino)
+		return -1;
+	if (offset >= file->size)
+		return 0;
+
+	uint32_t read_size = file->size - offset;
+	if (size < read_size)
+		read_size = size;
+
+	struct buf *ib;
+	struct minifs_inode *di = dinode_get(file->ino, &ib);
+	if (!di)
+		return -1;
+
+	uint32_t last = blocks_for(offset + read_size);
+	uint32_t queued = 0;
+	uint32_t done = 0;
+	while (done < read_size) {
+		uint32_t pos = offset + done;
+		uint32_t block_off = pos % FS_BLOCK_SIZE;
+		uint32_t chunk = FS_BLOCK_SIZE - block_off;
+		if (chunk > read_size - done)
+			chunk = read_size - done;
+
+		if (pos / FS_BLOCK_SIZE >= queued)
+			queued = readahead(file, di, ib, pos / FS_BLOCK_SIZE, last);
+
+		uint32_t blockno = bmap(di, ib, pos / FS_BLOCK_SIZE, 0);
+		if (blockno) {
+			struct buf *b = bread(fs_dev, blockno);
+			if (!b)
+				break;
+			memcpy(buffer + done, b->data + block_off, chunk);
+			brelse(b);
+		} else {
+			memset(buffer + done, 0, chunk);
+		}
+		done += chunk;
+	}
+	brelse(ib);
+	return (done == read_size) ? (int)read_size : -1;
+}
+
+int fs_read_at(inode_t *file, uint32_t offset, char *buffer, uint32_t size)
 {
 	if (!file || file->type != INODE_FILE)
 		return -1;
 
-	uint32_t read_size = (size < file->size) ? size : file->size;
-	memcpy(buffer, file->data, read_size);
-	return read_size;
+	mutex_lock(&file->lock);
+	int result = read_at(file, offset, buffer, size);
+	mutex_unlock(&file->lock);
+	return result;
+}
+
+int fs_read_file(inode_t *file, char *buffer, uint32_t size)
+{
+	return fs_read_at(file, 0, buffer, size);
 }
 
 int fs_delete(inode_t *parent, const char *name)
@@ -135,27 +1292,148 @@ int fs_delete(inode_t *parent, const char *name)
 	if (!parent || parent->type != INODE_DIR)
 		return -1;
 
-	for (int i = 0; i < parent->child_count; i++) {
-		if (strcmp(parent->children[i]->name, name) == 0) {
-			inode_t *node = parent->children[i];
+	uint8_t len;
+	uint32_t hash = hash_name(name, &len);
+	inode_t *node;
+	int result = -1;
 
-			if (node->type == INODE_DIR && node->child_count > 0) {
-				return -1;
-			}
+	mutex_lock(&parent->lock);
+	int i = table_find(parent->table, name, hash, len, &node);
+	if (i >= 0) {
+		// Parent before child, like every path that takes both. The
+		// child's lock keeps out creates in it, fs_set_cwd() and I/O
+		// on its data.
+		mutex_lock(&node->lock);
+		if (node->type != INODE_DIR ||
+		    (node->child_count == 0 && node != cwd))
+			result = disk_delete(node);
+		mutex_unlock(&node->lock);
+	}
+	if (result == 0) {
+		dir_detach(parent, i);
+		dir_changed(parent);
+	}
+	mutex_unlock(&parent->lock);
 
-			node->used = 0;
+	// Drop the directory tree's reference
+	if (result == 0)
+		fs_put(node);
+	return result;
+}
 
-			for (int j = i; j < parent->child_count - 1; j++) {
-				parent->children[j] = parent->children[j + 1];
-			}
-			parent->child_count--;
+// One path component, through the dentry cache. Called under
+// rcu_read_lock().
+static inode_t *lookup_component(inode_t *dir, const char *name)
+{
+	if (strcmp(name, ".") == 0)
+		return dir;
+	if (strcmp(name, "..") == 0)
+		return dir->parent ? dir->parent : dir;
+
+	uint8_t len;
+	uint32_t hash = hash_name(name, &len);
+	uint32_t gen = __atomic_load_n(&dir->gen, __ATOMIC_ACQUIRE);
+	inode_t *node;
+
+	if (dcache_lookup(dir, gen, name, hash, len, &node))
+		return node;
+
+	table_find(rcu_dereference(dir->table), name, hash, len, &node);
+	dcache_insert(dir, gen, name, hash, len, node);
+	return node;
+}
+
+// Copy the next component of *path into name (truncated to fit) and
+// advance past it and any following slashes; returns 0 at the end
+static int next_component(const char **path, char *name)
+{
+	const char *p = *path;
+	int len = 0;
+
+	while (*p == '/')
+		p++;
+	if (!*p)
+		return 0;
+
+	while (*p && *p != '/') {
+		if (len < MAX_FILENAME - 1)
+			name[len++] = *p;
+		p++;
+	}
+	name[len] = '\0';
+
+	while (*p == '/')
+		p++;
+	*path = p;
+	return 1;
+}
+
+static inode_t *resolve_path(const char *path)
+{
+	if (!path || !root)
+		return 0;
+
+	inode_t *node =
+	    (path[0] == '/') ? root : __atomic_load_n(&cwd, __ATOMIC_ACQUIRE);
+	char name[MAX_FILENAME];
+
+	while (next_component(&path, name)) {
+		if (node->type != INODE_DIR)
+			return 0;
+		node = lookup_component(node, name);
+		if (!node)
 			return 0;
-		}
 	}
-	return -1;
+	return node;
 }
 
-void fs_get_path(inode_t *node, char *buffer)
+inode_t *fs_resolve_path(const char *path)
+{
+	rcu_read_lock();
+	inode_t *node = get_live(resolve_path(path));
+	rcu_read_unlock();
+	return node;
+}
+
+static inode_t *resolve_parent(const char *path, char *leaf)
+{
+	if (!path || !root)
+		return 0;
+
+	inode_t *node =
+	    (path[0] == '/') ? root : __atomic_load_n(&cwd, __ATOMIC_ACQUIRE);
+	char name[MAX_FILENAME];
+
+	if (!next_component(&path, name))
+		return 0;
+
+	// Stay one component behind so the last one is left in name
+	while (*path) {
+		if (node->type != INODE_DIR)
+			return 0;
+		node = lookup_component(node, name);
+		if (!node)
+			return 0;
+		next_component(&path, name);
+	}
+
+	if (node->type != INODE_DIR || strcmp(name, ".") == 0 ||
+	    strcmp(name, "..") == 0)
+		return 0;
+
+	strcpy(leaf, name);
+	return node;
+}
+
+inode_t *fs_resolve_parent(const char *path, char *leaf)
+{
+	rcu_read_lock();
+	inode_t *node = get_live(resolve_parent(path, leaf));
+	rcu_read_unlock();
+	return node;
+}
+
+static void get_path(inode_t *node, char *buffer)
 {
 	if (!node) {
 		buffer[0] = '\0';
@@ -182,3 +1460,10 @@ void fs_get_path(inode_t *node, char *buffer)
 
 	strcpy(buffer, temp);
 }
+
+void fs_get_path(inode_t *node, char *buffer)
+{
+	rcu_read_lock();
+	get_path(node, buffer);
+	rcu_read_unlock();
+}
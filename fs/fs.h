@@ -2,36 +2,134 @@
 #define FS_H
 
 #include <stdint.h>
+#include "../drivers/blockdev.h"
+#include "../kernel/mutex.h"
+#include "../kernel/rcu.h"
+#include "minifs.h"
 
-#define MAX_FILES 64
-#define MAX_FILENAME 32
-#define MAX_FILE_SIZE 4096
+#define MAX_FILENAME MINIFS_NAME_LEN
 #define MAX_PATH 256
 
+#define FS_BLOCK_SIZE MINIFS_BLOCK_SIZE
+
+// fs_init() results
+#define FS_MOUNTED 0
+#define FS_FORMATTED 1
+
 typedef enum { INODE_FILE, INODE_DIR } inode_type_t;
 
+struct dir_table;
+
+// In-memory view of an on-disk inode. Path lookups run without locks
+// (RCU) and only touch the first cache line; the second holds what
+// writers use, so their lock traffic stays off it. The block map stays
+// on disk and is read through the buffer cache.
 typedef struct inode {
 	char name[MAX_FILENAME];
-	inode_type_t type;
-	uint32_t size;
-	char data[MAX_FILE_SIZE];
 	struct inode *parent;
-	struct inode *children[MAX_FILES];
-	int child_count;
-	uint8_t used;
-} inode_t;
+	uint32_t name_hash;
+	uint32_t ino; // 0 once deleted
+	uint8_t name_len;
+	uint8_t type; // inode_type_t
+	uint16_t reserved;
+	union {
+		struct { // INODE_FILE
+			uint32_t size;
+		};
+		struct { // INODE_DIR
+			// Entries and their hash index, replaced as a whole
+			// when they grow; NULL while the directory is empty
+			struct dir_table *table;
+			// Changes on every create or delete in the directory;
+			// dentry cache entries from an older one are stale
+			uint32_t gen;
+		};
+	};
+
+	// INODE_DIR: serializes creates and deletes in the directory.
+	// INODE_FILE: serializes reads and writes of the data. Deleting an
+	// inode takes its parent's lock, then its own.
+	struct mutex lock __attribute__((aligned(64)));
+	int child_count; // live entries
+	// See fs_put(); an inode also holds one on its parent until freed
+	uint32_t refs;
+	// INODE_DIR: root of the live entries' treap in name order, for
+	// prefix matching; changed and read under the lock
+	struct inode *name_root;
+	// This inode's place in its parent's treap: children, and the
+	// number of entries in its subtree, itself included
+	struct inode *name_left;
+	struct inode *name_right;
+	uint32_t name_subtree;
+	struct rcu_head rcu; // deferred free after the last fs_put()
+} __attribute__((aligned(64))) inode_t;
+
+struct fs_stats {
+	const char *device;
+	uint32_t total_blocks;
+	uint32_t free_blocks;
+	uint32_t inode_count;
+	uint32_t free_inodes;
+};
 
-void fs_init(void);
+// Mount the minifs volume on dev, formatting it first if the device is
+// blank. Returns FS_MOUNTED, FS_FORMATTED or -1.
+int fs_init(struct blockdev *dev);
+// Write all cached changes to the device
+int fs_sync(void);
+// Periodic write-back: the superblock, then buffers dirty for longer
+// than BCACHE_WRITEBACK_MS
+void fs_writeback_tick(void);
+struct blockdev *fs_get_device(void);
+// Keep the filesystem off its device, e.g. while something else does
+// raw I/O on it; may sleep
+void fs_lock_device(void);
+void fs_unlock_device(void);
+void fs_get_stats(struct fs_stats *stats);
+// The root is never freed, so it comes without a reference
 inode_t *fs_get_root(void);
 inode_t *fs_get_cwd(void);
 void fs_set_cwd(inode_t *dir);
 
+// Safe to call from several threads. Every inode returned by the
+// creates and lookups here, fs_resolve_*() and fs_get_cwd() comes with
+// a reference that keeps it, and the directories above it, allocated
+// until dropped with fs_put(); that may be after it is deleted, but
+// calls made with a deleted inode fail.
+void fs_put(inode_t *node);
 inode_t *fs_create_file(inode_t *parent, const char *name);
 inode_t *fs_create_dir(inode_t *parent, const char *name);
 inode_t *fs_find_child(inode_t *parent, const char *name);
+// Iterate a directory in creation order; start with *pos = 0. Entries
+// created or deleted during the walk may be skipped.
+inode_t *fs_dir_next(inode_t *dir, int *pos);
 int fs_write_file(inode_t *file, const char *data, uint32_t size);
+// Overwrite or extend in place; a gap past the old end reads as zeros
+int fs_write_at(inode_t *file, uint32_t offset, const char *data,
+                uint32_t size);
 int fs_read_file(inode_t *file, char *buffer, uint32_t size);
+int fs_read_at(inode_t *file, uint32_t offset, char *buffer, uint32_t size);
 int fs_delete(inode_t *parent, const char *name);
+
+// One entry found by fs_dir_match()
+struct fs_match {
+	char name[MAX_FILENAME];
+	uint8_t type; // inode_type_t
+};
+
+// Entries of dir whose names start with prefix, in name order; costs
+// O(log n) per entry copied, however large the directory. The
+// first max go to matches, and common (MAX_FILENAME bytes) receives the
+// longest prefix all of them share. Returns how many there are.
+int fs_dir_match(inode_t *dir, const char *prefix, struct fs_match *matches,
+                 int max, char *common);
+
+// Walk an absolute or cwd-relative path ("a/b/../c", "/x/./y");
+// returns 0 if a component is missing or not a directory
+inode_t *fs_resolve_path(const char *path);
+// Resolve all but the last component and copy that into leaf
+// (MAX_FILENAME bytes); fails for paths ending in "." or ".."
+inode_t *fs_resolve_parent(const char *path, char *leaf);
 void fs_get_path(inode_t *node, char *buffer);
 
 #endif
@@ -0,0 +1,62 @@
+#ifndef MINIFS_H
+#define MINIFS_H
+
+#include <stdint.h>
+
+// On-disk layout, in MINIFS_BLOCK_SIZE blocks:
+//   0                 superblock
+//   bitmap_start      block allocation bitmap (1 bit per block)
+//   inode_start       inode table (MINIFS_INODE_SIZE bytes per inode)
+//   data_start        file data and indirect blocks
+// Directories have no data blocks: each inode records its parent and
+// creation sequence, and the tree is rebuilt in memory at mount time.
+
+#define MINIFS_MAGIC 0x464E494D // "MINF"
+#define MINIFS_VERSION 1
+#define MINIFS_BLOCK_SIZE 1024
+#define MINIFS_ROOT_INO 1 // inode 0 is never used
+
+#define MINIFS_NAME_LEN 32
+#define MINIFS_DIRECT_BLOCKS 18
+#define MINIFS_INODE_SIZE 128
+#define MINIFS_INODES_PER_BLOCK (MINIFS_BLOCK_SIZE / MINIFS_INODE_SIZE)
+#define MINIFS_PTRS_PER_BLOCK (MINIFS_BLOCK_SIZE / 4)
+#define MINIFS_BITS_PER_BLOCK (MINIFS_BLOCK_SIZE * 8)
+// One inode per this many bytes of disk when formatting
+#define MINIFS_BYTES_PER_INODE 4096
+
+#define MINIFS_TYPE_FREE 0
+#define MINIFS_TYPE_FILE 1
+#define MINIFS_TYPE_DIR 2
+
+struct minifs_super {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t block_size;
+	uint32_t total_blocks;
+	uint32_t inode_count;
+	uint32_t bitmap_start;
+	uint32_t bitmap_blocks;
+	uint32_t inode_start;
+	uint32_t inode_blocks;
+	uint32_t data_start;
+	uint32_t free_blocks;
+	uint32_t free_inodes;
+};
+
+struct minifs_inode {
+	char name[MINIFS_NAME_LEN];
+	uint32_t parent;
+	uint32_t size;
+	uint8_t type;
+	uint8_t reserved[3];
+	uint32_t direct[MINIFS_DIRECT_BLOCKS];
+	uint32_t indirect;
+	uint32_t double_indirect;
+	uint32_t seq; // creation order; listings keep it across a remount
+};
+
+_Static_assert(sizeof(struct minifs_inode) == MINIFS_INODE_SIZE,
+               "inode table stride");
+
+#endif
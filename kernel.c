@@ -1,80 +1,219 @@
+#include "drivers/ata.h"
+#include "drivers/console.h"
 #include "drivers/keyboard.h"
+#include "drivers/ramdisk.h"
+#include "drivers/serial.h"
+#include "drivers/timer.h"
 #include "drivers/vga.h"
+#include "fs/bcache.h"
 #include "fs/fs.h"
+#include "kernel/bootinfo.h"
+#include "kernel/cpu.h"
+#include "kernel/gdt.h"
+#include "kernel/interrupt.h"
+#include "kernel/kmalloc.h"
+#include "kernel/paging.h"
+#include "kernel/pmm.h"
+#include "kernel/rcu.h"
+#include "kernel/sched.h"
+#include "kernel/smp.h"
+#include "kernel/syscall.h"
+#include "lib/string.h"
 #include "shell/shell.h"
 
-static inline uint8_t inb(uint16_t port)
-{
-	uint8_t value;
-	__asm__ volatile("inb %1, %0" : "=a"(value) : "Nd"(port));
-	return value;
-}
+// Pause before the shell takes over the screen; override with
+// `make BOOT_DELAY_MS=4000`
+#ifndef BOOT_DELAY_MS
+#define BOOT_DELAY_MS 0
+#endif
+
+// Fallback volume when there is no usable data disk
+#define RAMDISK_SIZE (4 * 1024 * 1024)
 
-static inline void outb(uint16_t port, uint8_t value)
+// How often the writeback thread looks for buffers dirty for longer than
+// BCACHE_WRITEBACK_MS
+#define WRITEBACK_POLL_MS 1000
+#define WRITEBACK_PRIORITY (SCHED_PRIO_DEFAULT + 4)
+
+// Buffer cache size: 1/256 of RAM in 1 KB buffers, within these limits
+#define BCACHE_MIN_BUFFERS 128
+#define BCACHE_MAX_BUFFERS 8192
+
+static void init_bcache(void)
 {
-	__asm__ volatile("outb %0, %1" : : "a"(value), "Nd"(port));
+	uint32_t buffers = pmm_total_pages() / 64;
+
+	if (buffers < BCACHE_MIN_BUFFERS)
+		buffers = BCACHE_MIN_BUFFERS;
+	if (buffers > BCACHE_MAX_BUFFERS)
+		buffers = BCACHE_MAX_BUFFERS;
+	bcache_init(buffers);
 }
 
-static uint8_t get_second(void)
+// Mount a filesystem image passed as a boot module in place, else the
+// secondary ATA disk, else a RAM disk. Only one volume is mounted, so a
+// module hides the disk; GRUB passes one only from its "initrd root"
+// menu entry.
+static struct blockdev *mount_root(int *result)
 {
-	uint8_t sec, sec2;
-	do {
-		outb(0x70, 0x00);
-		sec = inb(0x71);
-		outb(0x70, 0x00);
-		sec2 = inb(0x71);
-	} while (sec != sec2);
-	return sec;
+	const struct boot_info *boot = boot_info_get();
+	struct blockdev *dev;
+
+	ata_init();
+	init_bcache();
+
+	if (boot->module_count) {
+		const struct boot_module *m = &boot->modules[0];
+		dev = ramdisk_create("initrd", (void *)m->start, m->end - m->start);
+		if (dev && (*result = fs_init(dev)) >= 0)
+			return dev;
+	}
+
+	dev = ata_get_device(ATA_DRIVE_SLAVE);
+	if (dev && (*result = fs_init(dev)) >= 0)
+		return dev;
+
+	dev = ramdisk_create("ram0", 0, RAMDISK_SIZE);
+	if (dev && (*result = fs_init(dev)) >= 0)
+		return dev;
+	return 0;
 }
 
-static void delay_4_seconds(void)
+// Runs below the shell's priority; fs_writeback_tick() takes the
+// filesystem lock, so it can share the disk with the shell on any CPU
+static void writeback_thread(void *arg)
 {
-	uint8_t start_sec = get_second();
-	int count = 0;
-
-	while (count < 4) {
-		uint8_t current_sec = get_second();
-		if (current_sec != start_sec) {
-			count++;
-			start_sec = current_sec;
-		}
+	(void)arg;
+	for (;;) {
+		fs_writeback_tick();
+		thread_sleep_ms(WRITEBACK_POLL_MS);
 	}
 }
 
-void kernel_main(void)
+// magic/info come from the loader: GRUB's multiboot magic and info, or
+// boot.asm's E820 map
+void kernel_main(uint32_t magic, const void *info)
 {
-	vga_init();
-	vga_clear();
+	// Bulk copies: rep movsd, or SSE2 where rep movs is not fast
+	if (cpu_enable_sse2() && !cpu_has_erms())
+		string_enable_sse2();
+
+	console_init();
+	console_clear();
 
 	// Linux-style boot messages
-	vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
-	vga_puts("Booting MiniOS...\n");
+	console_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+	console_puts("Booting MiniOS...\n");
 
-	vga_puts("Initializing keyboard... ");
+	const struct boot_info *boot = boot_info_init(magic, info);
+	if (boot->multiboot)
+		console_puts("Loaded by multiboot loader\n");
+
+	console_puts("Initializing memory... ");
+	pmm_init(boot->memory_map);
+	kmalloc_init();
+	console_print_int((int)(pmm_ram_bytes() >> 20));
+	console_puts(" MB ");
+	console_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+	console_puts("OK\n");
+	console_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+
+	console_puts("Initializing interrupts... ");
+	gdt_init();
+	interrupt_init();
+	syscall_init();
+	console_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+	console_puts("OK\n");
+	console_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+
+	console_puts("Enabling paging... ");
+	paging_init();
+	vga_init_scrollback();
+	console_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+	console_puts("OK\n");
+	console_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+
+	console_puts("Initializing timer... ");
+	timer_init();
+	console_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+	console_puts("OK\n");
+	console_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+
+	console_puts("Starting scheduler... ");
+	sched_init();
+	console_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+	console_puts("OK\n");
+	console_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+
+	console_puts("Starting CPUs... ");
+	int cpus = smp_init();
+	console_print_int(cpus);
+	console_puts(cpus == 1 ? " CPU " : " CPUs ");
+	console_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+	console_puts("OK\n");
+	console_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+
+	console_puts("Initializing keyboard... ");
 	keyboard_init();
-	vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
-	vga_puts("OK\n");
-	vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+	console_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+	console_puts("OK\n");
+	console_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+
+	console_puts("Initializing serial console... ");
+	if (serial_present()) {
+		serial_enable_irq();
+		console_puts("COM1 ");
+		console_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+		console_puts("OK\n");
+	} else {
+		console_set_color(VGA_COLOR_YELLOW, VGA_COLOR_BLACK);
+		console_puts("not present\n");
+	}
+	console_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
 
-	vga_puts("Initializing filesystem... ");
-	fs_init();
-	vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
-	vga_puts("OK\n");
-	vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+	console_puts("Initializing filesystem... ");
+	int fs_result = -1;
+	struct blockdev *root_dev = mount_root(&fs_result);
+	if (root_dev) {
+		console_puts(root_dev->name);
+		if (root_dev == ata_get_device(ATA_DRIVE_SLAVE) &&
+		    ata_uses_dma(root_dev))
+			console_puts(" DMA");
+		console_puts(fs_result == FS_FORMATTED ? " (formatted) " : " ");
+		console_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+		console_puts("OK\n");
+	} else {
+		console_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
+		console_puts("FAILED\n");
+	}
+	struct blockdev *disk = ata_get_device(ATA_DRIVE_SLAVE);
+	if (root_dev && disk && root_dev != disk) {
+		console_set_color(VGA_COLOR_YELLOW, VGA_COLOR_BLACK);
+		console_puts(disk->name);
+		console_puts(" not mounted: changes are lost at reboot\n");
+	}
+	console_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
 
-	vga_puts("Starting system services... ");
-	vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
-	vga_puts("OK\n\n");
-	vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+	console_puts("Starting system services... ");
+	thread_create("writeback", writeback_thread, 0, WRITEBACK_PRIORITY);
+	rcu_init();
+	interrupts_enable();
+	console_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
+	console_puts("OK\n\n");
+	console_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
 
-	vga_set_color(VGA_COLOR_YELLOW, VGA_COLOR_BLACK);
-	vga_puts("Booting will continue in 4 seconds...");
-	vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+	if (BOOT_DELAY_MS > 0) {
+		console_set_color(VGA_COLOR_YELLOW, VGA_COLOR_BLACK);
+		console_puts("Booting will continue in ");
+		console_print_int(BOOT_DELAY_MS);
+		console_puts(" ms...");
+		console_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
 
-	delay_4_seconds();
+		timer_sleep_ms(BOOT_DELAY_MS);
+	}
 
 	// Clear screen before showing welcome message
-	vga_clear();
+	console_clear();
 
 	shell_init();
 	shell_run();
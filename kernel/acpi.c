@@ -0,0 +1,199 @@
+#include "acpi.h"
+#include "paging.h"
+#include "pmm.h"
+#include "../lib/string.h"
+
+// The RSDP sits on a 16-byte boundary in the first KB of the EBDA or in
+// the BIOS area
+#define BDA_EBDA_SEGMENT 0x40E
+#define EBDA_SEARCH_LEN 1024
+#define BIOS_AREA_START 0xE0000
+#define BIOS_AREA_END 0x100000
+#define RSDP_V1_LEN 20
+
+#define MADT_LAPIC 0
+#define MADT_IOAPIC 1
+#define MADT_ISO 2 // interrupt source override
+#define MADT_LAPIC_ENABLED 0x1
+
+struct rsdp {
+	char signature[8];
+	uint8_t checksum;
+	char oem_id[6];
+	uint8_t revision;
+	uint32_t rsdt_addr;
+} __attribute__((packed));
+
+struct sdt_header {
+	char signature[4];
+	uint32_t length;
+	uint8_t revision;
+	uint8_t checksum;
+	char oem_id[6];
+	char oem_table_id[8];
+	uint32_t oem_revision;
+	uint32_t creator_id;
+	uint32_t creator_revision;
+} __attribute__((packed));
+
+struct madt {
+	struct sdt_header header;
+	uint32_t lapic_addr;
+	uint32_t flags;
+} __attribute__((packed));
+
+struct madt_entry {
+	uint8_t type;
+	uint8_t length;
+} __attribute__((packed));
+
+struct madt_lapic {
+	struct madt_entry h;
+	uint8_t processor_id;
+	uint8_t apic_id;
+	uint32_t flags;
+} __attribute__((packed));
+
+struct madt_ioapic {
+	struct madt_entry h;
+	uint8_t ioapic_id;
+	uint8_t reserved;
+	uint32_t addr;
+	uint32_t gsi_base;
+} __attribute__((packed));
+
+struct madt_iso {
+	struct madt_entry h;
+	uint8_t bus;
+	uint8_t source; // ISA IRQ
+	uint32_t gsi;
+	uint16_t flags;
+} __attribute__((packed));
+
+static uint8_t checksum(const void *p, uint32_t len)
+{
+	const uint8_t *b = p;
+	uint8_t sum = 0;
+
+	while (len--)
+		sum += *b++;
+	return sum;
+}
+
+static const struct rsdp *scan_rsdp(uint32_t start, uint32_t end)
+{
+	for (uint32_t addr = start; addr + RSDP_V1_LEN <= end; addr += 16) {
+		const struct rsdp *r = (const void *)addr;
+		if (memcmp(r->signature, "RSD PTR ", 8) == 0 &&
+		    checksum(r, RSDP_V1_LEN) == 0)
+			return r;
+	}
+	return 0;
+}
+
+// Firmware tables live at the top of RAM, past what the page allocator
+// (and so the identity map) covers
+static int map_table(uint32_t phys, uint32_t len)
+{
+	uint32_t end = phys + len;
+
+	for (uint32_t page = phys & ~(PAGE_SIZE - 1); page < end;
+	     page += PAGE_SIZE) {
+		if (!paging_virt_to_phys((const void *)page) &&
+		    paging_map(page, page, 0) != 0)
+			return -1;
+	}
+	return 0;
+}
+
+static const struct sdt_header *map_sdt(uint32_t phys)
+{
+	const struct sdt_header *h = (const void *)phys;
+
+	if (!phys || map_table(phys, sizeof(*h)) != 0 ||
+	    map_table(phys, h->length) != 0 || checksum(h, h->length) != 0)
+		return 0;
+	return h;
+}
+
+// Page 0 is left unmapped to catch NULL pointers; map it just long enough
+// to read the EBDA segment from the BIOS data area
+static uint32_t ebda_base(void)
+{
+	uint32_t addr = BDA_EBDA_SEGMENT;
+	uint32_t segment;
+
+	if (paging_map(0, 0, 0) != 0)
+		return 0;
+	// Hide the constant from GCC, which takes it for a NULL dereference
+	__asm__("" : "+r"(addr));
+	segment = *(volatile const uint16_t *)addr;
+	paging_unmap(0);
+	return segment << 4;
+}
+
+static const struct madt *find_madt(void)
+{
+	uint32_t ebda = ebda_base();
+	const struct rsdp *rsdp = 0;
+
+	if (ebda)
+		rsdp = scan_rsdp(ebda, ebda + EBDA_SEARCH_LEN);
+	if (!rsdp)
+		rsdp = scan_rsdp(BIOS_AREA_START, BIOS_AREA_END);
+	if (!rsdp)
+		return 0;
+
+	const struct sdt_header *rsdt = map_sdt(rsdp->rsdt_addr);
+	if (!rsdt || memcmp(rsdt->signature, "RSDT", 4) != 0)
+		return 0;
+
+	const uint32_t *tables = (const uint32_t *)(rsdt + 1);
+	uint32_t count = (rsdt->length - sizeof(*rsdt)) / sizeof(uint32_t);
+	for (uint32_t i = 0; i < count; i++) {
+		const struct sdt_header *h = map_sdt(tables[i]);
+		if (h && memcmp(h->signature, "APIC", 4) == 0)
+			return (const struct madt *)h;
+	}
+	return 0;
+}
+
+int acpi_parse_madt(struct acpi_madt_info *info)
+{
+	const struct madt *madt = find_madt();
+
+	if (!madt)
+		return -1;
+
+	memset(info, 0, sizeof(*info));
+	info->lapic_base = madt->lapic_addr;
+	for (uint32_t i = 0; i < ACPI_ISA_IRQS; i++)
+		info->isa_gsi[i] = i;
+
+	const uint8_t *p = (const uint8_t *)(madt + 1);
+	const uint8_t *end = (const uint8_t *)madt + madt->header.length;
+	while (p + sizeof(struct madt_entry) <= end) {
+		const struct madt_entry *e = (const void *)p;
+		if (e->length < sizeof(*e))
+			break;
+
+		if (e->type == MADT_LAPIC) {
+			const struct madt_lapic *l = (const void *)e;
+			if ((l->flags & MADT_LAPIC_ENABLED) &&
+			    info->cpu_count < ACPI_MAX_CPUS)
+				info->cpu_apic_ids[info->cpu_count++] = l->apic_id;
+		} else if (e->type == MADT_IOAPIC && !info->ioapic_base) {
+			const struct madt_ioapic *io = (const void *)e;
+			info->ioapic_base = io->addr;
+			info->ioapic_gsi_base = io->gsi_base;
+		} else if (e->type == MADT_ISO) {
+			const struct madt_iso *iso = (const void *)e;
+			if (iso->bus == 0 && iso->source < ACPI_ISA_IRQS) {
+				info->isa_gsi[iso->source] = iso->gsi;
+				info->isa_flags[iso->source] = iso->flags;
+			}
+		}
+		p += e->length;
+	}
+	return 0;
+}
@@ -0,0 +1,29 @@
+#ifndef ACPI_H
+#define ACPI_H
+
+#include <stdint.h>
+
+#define ACPI_MAX_CPUS 16
+#define ACPI_ISA_IRQS 16
+
+// MPS INTI flags of an interrupt source override
+#define ACPI_IRQ_ACTIVE_LOW 0x2
+#define ACPI_IRQ_LEVEL 0x8
+
+// What the MADT says about the interrupt hardware
+struct acpi_madt_info {
+	uint32_t lapic_base;
+	uint32_t cpu_count;
+	uint8_t cpu_apic_ids[ACPI_MAX_CPUS]; // enabled CPUs, BSP included
+	uint32_t ioapic_base; // first IO-APIC; 0 if there is none
+	uint32_t ioapic_gsi_base;
+	// ISA IRQ n arrives on IO-APIC input isa_gsi[n] with isa_flags[n]
+	uint32_t isa_gsi[ACPI_ISA_IRQS];
+	uint16_t isa_flags[ACPI_ISA_IRQS];
+};
+
+// Find the MADT through the RSDP and RSDT. Tables outside the identity
+// map get mapped, so call after paging_init(). Returns -1 without ACPI.
+int acpi_parse_madt(struct acpi_madt_info *info);
+
+#endif
@@ -0,0 +1,221 @@
+#include "apic.h"
+#include "../drivers/pic.h"
+#include "../drivers/timer.h"
+#include "cpu.h"
+#include "interrupt.h"
+#include "paging.h"
+
+// Local APIC registers, as byte offsets from its base
+#define LAPIC_ID 0x020
+#define LAPIC_TPR 0x080
+#define LAPIC_EOI 0x0B0
+#define LAPIC_SVR 0x0F0
+#define LAPIC_ICR_LOW 0x300
+#define LAPIC_ICR_HIGH 0x310
+#define LAPIC_LVT_TIMER 0x320
+#define LAPIC_LVT_LINT0 0x350
+#define LAPIC_TIMER_INIT 0x380
+#define LAPIC_TIMER_COUNT 0x390
+#define LAPIC_TIMER_DIV 0x3E0
+
+#define SVR_ENABLE 0x100
+#define LVT_MASKED (1u << 16)
+#define LVT_TIMER_PERIODIC (1u << 17)
+#define TIMER_DIV_16 0x3
+
+#define ICR_INIT 0x500
+#define ICR_STARTUP 0x600
+#define ICR_PENDING (1u << 12) // delivery status
+#define ICR_ASSERT (1u << 14)
+#define ICR_ALL_BUT_SELF (3u << 18)
+
+#define MSR_APIC_BASE 0x1B
+#define APIC_BASE_ENABLE (1u << 11)
+
+// IO-APIC: an index register selects what the data window shows
+#define IOAPIC_REGSEL 0x00
+#define IOAPIC_WINDOW 0x10
+#define IOAPIC_VER 0x01
+#define IOAPIC_REDIR 0x10 // two registers per input
+
+#define REDIR_ACTIVE_LOW (1u << 13)
+#define REDIR_LEVEL (1u << 15)
+#define REDIR_MASKED (1u << 16)
+
+// The cascade input never fires; its pin usually carries the PIT instead
+#define ISA_IRQ_CASCADE 2
+
+#define CALIBRATE_MS 10
+
+static volatile uint32_t *lapic = 0;
+static volatile uint32_t *ioapic = 0;
+static uint32_t timer_count_per_tick = 0;
+
+// IO-APIC input for each ISA IRQ, or -1 if it has none
+static int isa_pin[ACPI_ISA_IRQS];
+
+static inline uint32_t lapic_read(uint32_t reg)
+{
+	return lapic[reg / 4];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t value)
+{
+	lapic[reg / 4] = value;
+}
+
+static int map_mmio(uint32_t phys)
+{
+	return paging_map(phys, phys, PTE_WRITE | PTE_PCD);
+}
+
+int lapic_init(uint32_t phys_base)
+{
+	if (map_mmio(phys_base) != 0)
+		return -1;
+	lapic = (volatile uint32_t *)phys_base;
+	return 0;
+}
+
+void lapic_enable(void)
+{
+	wrmsr(MSR_APIC_BASE, rdmsr(MSR_APIC_BASE) | APIC_BASE_ENABLE);
+
+	// Every IRQ comes through the IO-APIC, none through the PIC's
+	// virtual wire
+	lapic_write(LAPIC_LVT_LINT0, LVT_MASKED);
+	lapic_write(LAPIC_TPR, 0);
+	lapic_write(LAPIC_SVR, SVR_ENABLE | APIC_SPURIOUS_VECTOR);
+}
+
+uint8_t lapic_id(void)
+{
+	return lapic ? lapic_read(LAPIC_ID) >> 24 : 0;
+}
+
+void lapic_eoi(void)
+{
+	lapic_write(LAPIC_EOI, 0);
+}
+
+// The ICR is two registers, so an IRQ handler sending an IPI must not
+// get in between the writes
+static void send_icr(uint8_t apic_id, uint32_t low)
+{
+	int was_enabled = interrupts_enabled();
+
+	interrupts_disable();
+	lapic_write(LAPIC_ICR_HIGH, (uint32_t)apic_id << 24);
+	lapic_write(LAPIC_ICR_LOW, low);
+	while (lapic_read(LAPIC_ICR_LOW) & ICR_PENDING)
+		;
+	if (was_enabled)
+		interrupts_enable();
+}
+
+void lapic_send_ipi(uint8_t apic_id, uint8_t vector)
+{
+	send_icr(apic_id, ICR_ASSERT | vector);
+}
+
+void lapic_send_ipi_others(uint8_t vector)
+{
+	send_icr(0, ICR_ALL_BUT_SELF | ICR_ASSERT | vector);
+}
+
+void lapic_send_init(uint8_t apic_id)
+{
+	send_icr(apic_id, ICR_INIT | ICR_ASSERT);
+}
+
+void lapic_send_startup(uint8_t apic_id, uint32_t entry_phys)
+{
+	send_icr(apic_id, ICR_STARTUP | ICR_ASSERT | (entry_phys >> 12));
+}
+
+// Count the timer down across CALIBRATE_MS of TSC time. All APIC timers
+// run off the same bus clock, so one measurement serves every CPU.
+int lapic_timer_calibrate(void)
+{
+	if (!timer_tsc_khz())
+		return -1;
+
+	lapic_write(LAPIC_TIMER_DIV, TIMER_DIV_16);
+	lapic_write(LAPIC_LVT_TIMER, LVT_MASKED);
+	lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+
+	uint64_t end = timer_now_ns() + CALIBRATE_MS * 1000000ull;
+	while (timer_now_ns() < end)
+		;
+	uint32_t elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_COUNT);
+	lapic_write(LAPIC_TIMER_INIT, 0);
+
+	timer_count_per_tick = elapsed / CALIBRATE_MS * 1000 / TIMER_HZ;
+	return timer_count_per_tick ? 0 : -1;
+}
+
+void lapic_timer_start(void)
+{
+	lapic_write(LAPIC_TIMER_DIV, TIMER_DIV_16);
+	lapic_write(LAPIC_LVT_TIMER, LVT_TIMER_PERIODIC | APIC_TIMER_VECTOR);
+	lapic_write(LAPIC_TIMER_INIT, timer_count_per_tick);
+}
+
+static uint32_t ioapic_read(uint32_t reg)
+{
+	ioapic[IOAPIC_REGSEL / 4] = reg;
+	return ioapic[IOAPIC_WINDOW / 4];
+}
+
+static void ioapic_write(uint32_t reg, uint32_t value)
+{
+	ioapic[IOAPIC_REGSEL / 4] = reg;
+	ioapic[IOAPIC_WINDOW / 4] = value;
+}
+
+int ioapic_init(const struct acpi_madt_info *madt, uint8_t apic_id)
+{
+	if (!madt->ioapic_base || map_mmio(madt->ioapic_base) != 0)
+		return -1;
+	ioapic = (volatile uint32_t *)madt->ioapic_base;
+
+	uint32_t pins = ((ioapic_read(IOAPIC_VER) >> 16) & 0xFF) + 1;
+
+	for (int irq = 0; irq < ACPI_ISA_IRQS; irq++) {
+		uint32_t pin = madt->isa_gsi[irq] - madt->ioapic_gsi_base;
+		uint32_t low = (PIC_IRQ_BASE + irq) | REDIR_MASKED;
+
+		isa_pin[irq] = -1;
+		if (irq == ISA_IRQ_CASCADE || pin >= pins)
+			continue;
+
+		if (madt->isa_flags[irq] & ACPI_IRQ_ACTIVE_LOW)
+			low |= REDIR_ACTIVE_LOW;
+		if (madt->isa_flags[irq] & ACPI_IRQ_LEVEL)
+			low |= REDIR_LEVEL;
+		ioapic_write(IOAPIC_REDIR + pin * 2 + 1, (uint32_t)apic_id << 24);
+		ioapic_write(IOAPIC_REDIR + pin * 2, low);
+		isa_pin[irq] = pin;
+	}
+	return 0;
+}
+
+static void ioapic_set_masked(uint8_t irq, int masked)
+{
+	if (irq >= ACPI_ISA_IRQS || isa_pin[irq] < 0)
+		return;
+
+	uint32_t reg = IOAPIC_REDIR + isa_pin[irq] * 2;
+	uint32_t low = ioapic_read(reg);
+	ioapic_write(reg, masked ? low | REDIR_MASKED : low & ~REDIR_MASKED);
+}
+
+void ioapic_mask(uint8_t irq)
+{
+	ioapic_set_masked(irq, 1);
+}
+
+void ioapic_unmask(uint8_t irq)
+{
+	ioapic_set_masked(irq, 0);
+}
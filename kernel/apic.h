@@ -0,0 +1,38 @@
+#ifndef APIC_H
+#define APIC_H
+
+#include <stdint.h>
+#include "acpi.h"
+
+// Vectors raised by the local APIC itself; IRQs keep 32-47 when they
+// arrive through the IO-APIC
+#define APIC_TIMER_VECTOR 48
+#define IPI_RESCHED_VECTOR 49
+#define IPI_TLB_VECTOR 50
+#define APIC_SPURIOUS_VECTOR 0xFF
+
+// Map the local APIC and enable it on the calling CPU; every CPU runs
+// lapic_enable() for itself once lapic_init() has mapped the registers
+int lapic_init(uint32_t phys_base);
+void lapic_enable(void);
+uint8_t lapic_id(void);
+void lapic_eoi(void);
+
+void lapic_send_ipi(uint8_t apic_id, uint8_t vector);
+void lapic_send_ipi_others(uint8_t vector);
+// AP start-up: INIT, then STARTUP with the page the AP begins at
+void lapic_send_init(uint8_t apic_id);
+void lapic_send_startup(uint8_t apic_id, uint32_t entry_phys);
+
+// Measure the APIC timer against the TSC once (BSP), then run it
+// periodically at TIMER_HZ on the calling CPU
+int lapic_timer_calibrate(void);
+void lapic_timer_start(void);
+
+// Route the ISA IRQs through the IO-APIC to apic_id, all masked; the
+// 8259 PICs must be masked first
+int ioapic_init(const struct acpi_madt_info *madt, uint8_t apic_id);
+void ioapic_mask(uint8_t irq);
+void ioapic_unmask(uint8_t irq);
+
+#endif
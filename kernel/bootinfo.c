@@ -0,0 +1,79 @@
+#include "bootinfo.h"
+#include "multiboot.h"
+#include "../lib/string.h"
+
+#define BOOT_E820_MAX 32
+
+static struct boot_info boot;
+
+// The multiboot memory map rewritten in boot.asm's E820 layout
+static struct {
+	uint32_t count;
+	uint32_t reserved;
+	struct e820_entry entries[BOOT_E820_MAX];
+} __attribute__((packed)) e820;
+
+static void add_region(uint64_t base, uint64_t length, uint32_t type)
+{
+	if (e820.count >= BOOT_E820_MAX)
+		return;
+	e820.entries[e820.count].base = base;
+	e820.entries[e820.count].length = length;
+	e820.entries[e820.count].type = type;
+	e820.entries[e820.count].acpi = 1;
+	e820.count++;
+}
+
+static void parse_multiboot(const struct multiboot_info *mbi)
+{
+	if (mbi->flags & MULTIBOOT_INFO_MEM_MAP) {
+		uint32_t addr = mbi->mmap_addr;
+		uint32_t end = addr + mbi->mmap_length;
+
+		while (addr < end) {
+			const struct multiboot_mmap_entry *e = (const void *)addr;
+			add_region(e->base_addr, e->length, e->type);
+			addr += e->size + sizeof(e->size);
+		}
+	} else if (mbi->flags & MULTIBOOT_INFO_MEMORY) {
+		add_region(0, (uint64_t)mbi->mem_lower << 10, E820_USABLE);
+		add_region(0x100000, (uint64_t)mbi->mem_upper << 10, E820_USABLE);
+	}
+	if (e820.count)
+		boot.memory_map = (const struct e820_map *)&e820;
+
+	if (!(mbi->flags & MULTIBOOT_INFO_MODS))
+		return;
+
+	const struct multiboot_module *mods = (const void *)mbi->mods_addr;
+	for (uint32_t i = 0; i < mbi->mods_count && i < BOOT_MAX_MODULES; i++) {
+		struct boot_module *m = &boot.modules[boot.module_count++];
+
+		m->start = mods[i].mod_start;
+		m->end = mods[i].mod_end;
+		if (mods[i].string) {
+			strncpy(m->cmdline, (const char *)mods[i].string,
+			        BOOT_CMDLINE_LEN - 1);
+			m->cmdline[BOOT_CMDLINE_LEN - 1] = '\0';
+		}
+		pmm_reserve(m->start, m->end);
+	}
+}
+
+const struct boot_info *boot_info_init(uint32_t magic, const void *info)
+{
+	memset(&boot, 0, sizeof(boot));
+
+	if (magic == MULTIBOOT_BOOTLOADER_MAGIC) {
+		boot.multiboot = 1;
+		parse_multiboot(info);
+	} else {
+		boot.memory_map = info;
+	}
+	return &boot;
+}
+
+const struct boot_info *boot_info_get(void)
+{
+	return &boot;
+}
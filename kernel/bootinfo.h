@@ -0,0 +1,30 @@
+#ifndef BOOTINFO_H
+#define BOOTINFO_H
+
+#include <stdint.h>
+#include "pmm.h"
+
+#define BOOT_MAX_MODULES 4
+#define BOOT_CMDLINE_LEN 64
+
+// A file loaded next to the kernel, left in place in physical memory
+struct boot_module {
+	uint32_t start;
+	uint32_t end;
+	char cmdline[BOOT_CMDLINE_LEN];
+};
+
+struct boot_info {
+	int multiboot; // loaded by GRUB rather than boot.asm
+	const struct e820_map *memory_map;
+	uint32_t module_count;
+	struct boot_module modules[BOOT_MAX_MODULES];
+};
+
+// Normalize what the loader passed in eax/ebx (GRUB's multiboot info or
+// boot.asm's E820 map) and keep module memory away from the page
+// allocator. Call before pmm_init().
+const struct boot_info *boot_info_init(uint32_t magic, const void *info);
+const struct boot_info *boot_info_get(void);
+
+#endif
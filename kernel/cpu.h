@@ -0,0 +1,92 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include <stdint.h>
+
+// CPUID leaf 1 EDX feature bits
+#define CPUID_EDX_PSE (1 << 3)
+#define CPUID_EDX_TSC (1 << 4)
+#define CPUID_EDX_SEP (1 << 11) // sysenter/sysexit
+#define CPUID_EDX_FXSR (1 << 24)
+#define CPUID_EDX_SSE (1 << 25)
+#define CPUID_EDX_SSE2 (1 << 26)
+
+// CPUID leaf 7 EBX: enhanced rep movsb/stosb
+#define CPUID7_EBX_ERMS (1 << 9)
+
+#define CR0_MP (1u << 1)
+#define CR0_EM (1u << 2)
+#define CR4_OSFXSR (1u << 9)
+#define CR4_OSXMMEXCPT (1u << 10)
+
+static inline void cpuid(uint32_t leaf, uint32_t *eax, uint32_t *ebx,
+                         uint32_t *ecx, uint32_t *edx)
+{
+	__asm__ volatile("cpuid"
+	                 : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+	                 : "a"(leaf), "c"(0));
+}
+
+static inline int cpu_has_feature_edx(uint32_t bit)
+{
+	uint32_t eax, ebx, ecx, edx;
+	cpuid(1, &eax, &ebx, &ecx, &edx);
+	return (edx & bit) != 0;
+}
+
+// CPUs with ERMS run rep movs/stos at full cache bandwidth, so SSE2 copy
+// loops are no faster there
+static inline int cpu_has_erms(void)
+{
+	uint32_t eax, ebx, ecx, edx;
+	cpuid(0, &eax, &ebx, &ecx, &edx);
+	if (eax < 7)
+		return 0;
+	cpuid(7, &eax, &ebx, &ecx, &edx);
+	return (ebx & CPUID7_EBX_ERMS) != 0;
+}
+
+// Allow SSE instructions: no x87 emulation trap, and FXSAVE/SIMD exception
+// support declared in CR4. Returns 0, leaving the CPU untouched, when
+// SSE2 is missing.
+static inline int cpu_enable_sse2(void)
+{
+	uint32_t need = CPUID_EDX_FXSR | CPUID_EDX_SSE | CPUID_EDX_SSE2;
+	uint32_t eax, ebx, ecx, edx, cr0, cr4;
+
+	cpuid(1, &eax, &ebx, &ecx, &edx);
+	if ((edx & need) != need)
+		return 0;
+
+	__asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+	__asm__ volatile("mov %0, %%cr0" : : "r"((cr0 & ~CR0_EM) | CR0_MP));
+	__asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+	__asm__ volatile("mov %0, %%cr4"
+	                 :
+	                 : "r"(cr4 | CR4_OSFXSR | CR4_OSXMMEXCPT));
+	return 1;
+}
+
+static inline uint64_t rdtsc(void)
+{
+	uint32_t low, high;
+	__asm__ volatile("rdtsc" : "=a"(low), "=d"(high));
+	return ((uint64_t)high << 32) | low;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value)
+{
+	__asm__ volatile("wrmsr"
+	                 :
+	                 : "c"(msr), "a"((uint32_t)value),
+	                   "d"((uint32_t)(value >> 32)));
+}
+
+static inline uint64_t rdmsr(uint32_t msr)
+{
+	uint32_t low, high;
+	__asm__ volatile("rdmsr" : "=a"(low), "=d"(high) : "c"(msr));
+	return ((uint64_t)high << 32) | low;
+}
+
+#endif
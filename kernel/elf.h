@@ -0,0 +1,48 @@
+#ifndef ELF_H
+#define ELF_H
+
+#include <stdint.h>
+
+// The parts of the ELF32 format the program loader uses
+
+#define EI_NIDENT 16
+#define EI_CLASS 4
+#define EI_DATA 5
+#define ELF_MAGIC 0x464C457Fu // "\x7FELF", little-endian
+#define ELFCLASS32 1
+#define ELFDATA2LSB 1
+#define ET_EXEC 2
+#define EM_386 3
+
+#define PT_LOAD 1
+#define PF_W 0x2
+
+struct elf32_ehdr {
+	uint8_t e_ident[EI_NIDENT];
+	uint16_t e_type;
+	uint16_t e_machine;
+	uint32_t e_version;
+	uint32_t e_entry;
+	uint32_t e_phoff;
+	uint32_t e_shoff;
+	uint32_t e_flags;
+	uint16_t e_ehsize;
+	uint16_t e_phentsize;
+	uint16_t e_phnum;
+	uint16_t e_shentsize;
+	uint16_t e_shnum;
+	uint16_t e_shstrndx;
+} __attribute__((packed));
+
+struct elf32_phdr {
+	uint32_t p_type;
+	uint32_t p_offset;
+	uint32_t p_vaddr;
+	uint32_t p_paddr;
+	uint32_t p_filesz;
+	uint32_t p_memsz;
+	uint32_t p_flags;
+	uint32_t p_align;
+} __attribute__((packed));
+
+#endif
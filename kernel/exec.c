@@ -0,0 +1,118 @@
+#include "exec.h"
+#include "../lib/string.h"
+#include "elf.h"
+#include "pmm.h"
+#include "syscall.h"
+#include "user.h"
+
+// Grown on demand below USER_STACK_TOP
+#define EXEC_STACK_SIZE (64 * 1024)
+#define EXEC_STACK_BOTTOM (USER_STACK_TOP - EXEC_STACK_SIZE)
+#define EXEC_MAX_PHDRS 16
+// The argument strings may fill at most this much of the first stack page
+#define EXEC_MAX_ARG_BYTES (PAGE_SIZE / 2)
+
+static int elf_valid(const struct elf32_ehdr *eh)
+{
+	return *(const uint32_t *)eh->e_ident == ELF_MAGIC &&
+	       eh->e_ident[EI_CLASS] == ELFCLASS32 &&
+	       eh->e_ident[EI_DATA] == ELFDATA2LSB && eh->e_type == ET_EXEC &&
+	       eh->e_machine == EM_386 && eh->e_entry >= USER_BASE &&
+	       eh->e_entry < EXEC_STACK_BOTTOM &&
+	       eh->e_phentsize == sizeof(struct elf32_phdr) &&
+	       eh->e_phnum <= EXEC_MAX_PHDRS;
+}
+
+// Record the PT_LOAD segments; each must lie in the user range below the
+// stack and within the file
+static int load_segments(struct user_task *task, inode_t *file,
+                         const struct elf32_ehdr *eh)
+{
+	struct elf32_phdr ph[EXEC_MAX_PHDRS];
+	int size = eh->e_phnum * sizeof(ph[0]);
+
+	if (fs_read_at(file, eh->e_phoff, (char *)ph, size) != size)
+		return -1;
+
+	for (int i = 0; i < eh->e_phnum; i++) {
+		if (ph[i].p_type != PT_LOAD || !ph[i].p_memsz)
+			continue;
+		if (task->segment_count == USER_MAX_SEGMENTS ||
+		    ph[i].p_filesz > ph[i].p_memsz || ph[i].p_vaddr < USER_BASE ||
+		    ph[i].p_vaddr > EXEC_STACK_BOTTOM ||
+		    ph[i].p_memsz > EXEC_STACK_BOTTOM - ph[i].p_vaddr ||
+		    ph[i].p_offset > file->size ||
+		    ph[i].p_filesz > file->size - ph[i].p_offset)
+			return -1;
+
+		struct user_segment *seg = &task->segments[task->segment_count++];
+		seg->vaddr = ph[i].p_vaddr;
+		seg->memsz = ph[i].p_memsz;
+		seg->offset = ph[i].p_offset;
+		seg->filesz = ph[i].p_filesz;
+		seg->writable = (ph[i].p_flags & PF_W) != 0;
+	}
+	return task->segment_count ? 0 : -1;
+}
+
+// Map the top stack page and lay out what the program starts with (see
+// syscall.h): the argument strings at the very top, the argv array below
+// them, then argc, argv and the feature bits. Returns the initial esp.
+static uint32_t setup_stack(int argc, char *const argv[])
+{
+	uint32_t base = USER_STACK_TOP - PAGE_SIZE;
+	uint8_t *page = user_alloc_page(base);
+	uint32_t ptrs[EXEC_MAX_ARGS + 1];
+	uint32_t sp = USER_STACK_TOP;
+
+	if (!page)
+		return 0;
+
+	for (int i = argc - 1; i >= 0; i--) {
+		uint32_t len = strlen(argv[i]) + 1;
+		if (len > sp - (USER_STACK_TOP - EXEC_MAX_ARG_BYTES))
+			return 0;
+		sp -= len;
+		memcpy(page + (sp - base), argv[i], len);
+		ptrs[i] = sp;
+	}
+	ptrs[argc] = 0;
+
+	sp = (sp & ~15u) - (argc + 1) * sizeof(uint32_t);
+	memcpy(page + (sp - base), ptrs, (argc + 1) * sizeof(uint32_t));
+	uint32_t argv_addr = sp;
+
+	sp -= 3 * sizeof(uint32_t);
+	uint32_t *start = (uint32_t *)(page + (sp - base));
+	start[0] = argc;
+	start[1] = argv_addr;
+	start[2] = syscall_have_sysenter() ? SYSCALL_FEATURE_SYSENTER : 0;
+	return sp;
+}
+
+int exec_run(inode_t *file, int argc, char *const argv[], int *status)
+{
+	struct elf32_ehdr eh;
+
+	if (!file || file->type != INODE_FILE || argc > EXEC_MAX_ARGS ||
+	    fs_read_at(file, 0, (char *)&eh, sizeof(eh)) != (int)sizeof(eh) ||
+	    !elf_valid(&eh))
+		return -1;
+
+	struct user_task *task = user_task_create();
+	if (!task)
+		return -1;
+	task->image = file;
+	task->stack_bottom = EXEC_STACK_BOTTOM;
+
+	uint32_t sp;
+	int ret = -1;
+	if (load_segments(task, file, &eh) == 0 &&
+	    (sp = setup_stack(argc, argv)) != 0 &&
+	    user_start(task, file->name, eh.e_entry, sp) == 0) {
+		*status = user_wait(task);
+		ret = 0;
+	}
+	user_task_destroy(task);
+	return ret;
+}
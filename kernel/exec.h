@@ -0,0 +1,16 @@
+#ifndef EXEC_H
+#define EXEC_H
+
+#include "../fs/fs.h"
+
+// Most arguments a program can be started with
+#define EXEC_MAX_ARGS 32
+
+// Run a static ELF32 i386 executable linked inside the user range (see
+// user/user.ld) and wait for it to finish. Nothing is read up front but
+// the headers; pages come in from the file as the program touches them.
+// Returns -1 if file is not such an executable, another program is
+// running or memory ran out, else 0 with its exit status in *status.
+int exec_run(inode_t *file, int argc, char *const argv[], int *status);
+
+#endif
@@ -0,0 +1,118 @@
+#include "gdt.h"
+#include "smp.h"
+#include "../lib/string.h"
+
+// null, kernel code, kernel data, user code, user data, then the TSSs
+#define GDT_TSS_FIRST 5
+#define GDT_ENTRIES (GDT_TSS_FIRST + SMP_MAX_CPUS)
+
+// Access bytes: present, DPL, code/data or system, type
+#define ACCESS_KERNEL_CODE 0x9A
+#define ACCESS_KERNEL_DATA 0x92
+#define ACCESS_USER_CODE 0xFA
+#define ACCESS_USER_DATA 0xF2
+#define ACCESS_TSS 0x89 // 32-bit TSS, not busy
+// 4 KB granularity, 32-bit
+#define FLAGS_FLAT 0xC
+
+struct gdt_entry {
+	uint16_t limit_low;
+	uint16_t base_low;
+	uint8_t base_mid;
+	uint8_t access;
+	uint8_t limit_high_flags;
+	uint8_t base_high;
+} __attribute__((packed));
+
+struct gdt_ptr {
+	uint16_t limit;
+	uint32_t base;
+} __attribute__((packed));
+
+// Only esp0/ss0 matter: there is no hardware task switching, and an I/O
+// map offset past the end denies ring 3 every port
+struct tss {
+	uint32_t prev_task;
+	uint32_t esp0, ss0;
+	uint32_t esp1, ss1;
+	uint32_t esp2, ss2;
+	uint32_t cr3, eip, eflags;
+	uint32_t eax, ecx, edx, ebx, esp, ebp, esi, edi;
+	uint32_t es, cs, ss, ds, fs, gs, ldt;
+	uint16_t trap;
+	uint16_t iomap_base;
+} __attribute__((packed));
+
+static struct gdt_entry gdt[GDT_ENTRIES];
+// Aligned so that no TSS straddles a page
+static struct tss tss[SMP_MAX_CPUS] __attribute__((aligned(128)));
+
+static void set_entry(int i, uint32_t base, uint32_t limit, uint8_t access,
+                      uint8_t flags)
+{
+	gdt[i].limit_low = limit & 0xFFFF;
+	gdt[i].base_low = base & 0xFFFF;
+	gdt[i].base_mid = (base >> 16) & 0xFF;
+	gdt[i].access = access;
+	gdt[i].limit_high_flags = ((limit >> 16) & 0x0F) | (flags << 4);
+	gdt[i].base_high = (base >> 24) & 0xFF;
+}
+
+static void gdt_load(int cpu)
+{
+	struct gdt_ptr ptr;
+
+	ptr.limit = sizeof(gdt) - 1;
+	ptr.base = (uint32_t)gdt;
+	__asm__ volatile("lgdt %0" : : "m"(ptr));
+
+	// Reload every segment register so none keeps a descriptor cached
+	// from the loader's GDT
+	__asm__ volatile("ljmp %0, $1f\n"
+	                 "1:\n"
+	                 "mov %1, %%ds\n"
+	                 "mov %1, %%es\n"
+	                 "mov %1, %%fs\n"
+	                 "mov %1, %%gs\n"
+	                 "mov %1, %%ss"
+	                 :
+	                 : "i"(GDT_KERNEL_CODE), "r"((uint32_t)GDT_KERNEL_DATA)
+	                 : "memory");
+
+	uint16_t tss_sel = (GDT_TSS_FIRST + cpu) * sizeof(struct gdt_entry);
+	__asm__ volatile("ltr %0" : : "r"(tss_sel));
+}
+
+void gdt_init(void)
+{
+	memset(gdt, 0, sizeof(gdt));
+	set_entry(1, 0, 0xFFFFF, ACCESS_KERNEL_CODE, FLAGS_FLAT);
+	set_entry(2, 0, 0xFFFFF, ACCESS_KERNEL_DATA, FLAGS_FLAT);
+	set_entry(3, 0, 0xFFFFF, ACCESS_USER_CODE, FLAGS_FLAT);
+	set_entry(4, 0, 0xFFFFF, ACCESS_USER_DATA, FLAGS_FLAT);
+
+	memset(tss, 0, sizeof(tss));
+	for (int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+		tss[cpu].ss0 = GDT_KERNEL_DATA;
+		tss[cpu].iomap_base = sizeof(struct tss);
+		set_entry(GDT_TSS_FIRST + cpu, (uint32_t)&tss[cpu],
+		          sizeof(struct tss) - 1, ACCESS_TSS, 0);
+	}
+
+	gdt_load(0);
+}
+
+void gdt_init_ap(int cpu)
+{
+	gdt_load(cpu);
+}
+
+void tss_set_kernel_stack(int cpu, uint32_t esp0)
+{
+	tss[cpu].esp0 = esp0;
+}
+
+uint32_t tss_kernel_stack_slot(int cpu)
+{
+	return (uint32_t)&tss[cpu].esp0;
+}
@@ -0,0 +1,25 @@
+#ifndef GDT_H
+#define GDT_H
+
+#include <stdint.h>
+
+// Segment selectors. The kernel ones match the boot and trampoline GDTs;
+// the user ones carry RPL 3.
+#define GDT_KERNEL_CODE 0x08
+#define GDT_KERNEL_DATA 0x10
+#define GDT_USER_CODE 0x1B
+#define GDT_USER_DATA 0x23
+
+// Build the GDT (flat kernel and user segments plus a TSS per CPU) and
+// load it on the boot CPU
+void gdt_init(void);
+// Load it on an application processor, with that CPU's TSS
+void gdt_init_ap(int cpu);
+
+// Stack the CPU switches to when an interrupt or system call arrives
+// from ring 3; set for each thread it switches to
+void tss_set_kernel_stack(int cpu, uint32_t esp0);
+// Address of the CPU's esp0 field, for the SYSENTER stack MSR
+uint32_t tss_kernel_stack_slot(int cpu);
+
+#endif
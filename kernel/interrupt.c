@@ -0,0 +1,188 @@
+#include "interrupt.h"
+#include "../drivers/pic.h"
+#include "../drivers/console.h"
+#include "../drivers/vga.h"
+#include "apic.h"
+#include "gdt.h"
+#include "sched.h"
+#include "syscall.h"
+#include "user.h"
+
+#define IDT_GATE_INT32 0x8E // present, ring 0, 32-bit interrupt gate
+#define IDT_GATE_USER_INT32 0xEE // the same, but ring 3 may use int on it
+#define EXCEPTION_COUNT 32
+// Exceptions, IRQs, then the local APIC vectors (isr.asm)
+#define ISR_STUB_COUNT 51
+
+struct idt_entry {
+	uint16_t base_low;
+	uint16_t selector;
+	uint8_t zero;
+	uint8_t flags;
+	uint16_t base_high;
+} __attribute__((packed));
+
+struct idt_ptr {
+	uint16_t limit;
+	uint32_t base;
+} __attribute__((packed));
+
+extern uint32_t isr_stub_table[];
+extern char isr_spurious[];
+extern char isr128[];
+
+static struct idt_entry idt[IDT_ENTRIES];
+static interrupt_handler_t handlers[IDT_ENTRIES];
+// IRQs come from the IO-APIC and are acknowledged at the local APIC
+static int use_ioapic = 0;
+
+static const char *exception_names[EXCEPTION_COUNT] = {
+    "Divide Error",         "Debug",
+    "NMI",                  "Breakpoint",
+    "Overflow",             "Bound Range Exceeded",
+    "Invalid Opcode",       "Device Not Available",
+    "Double Fault",         "Coprocessor Segment Overrun",
+    "Invalid TSS",          "Segment Not Present",
+    "Stack-Segment Fault",  "General Protection Fault",
+    "Page Fault",           "Reserved",
+    "x87 FPU Error",        "Alignment Check",
+    "Machine Check",        "SIMD Floating-Point",
+    "Virtualization",       "Control Protection",
+};
+
+static void idt_set_gate(uint8_t vector, uint32_t base, uint8_t flags)
+{
+	idt[vector].base_low = base & 0xFFFF;
+	idt[vector].selector = GDT_KERNEL_CODE;
+	idt[vector].zero = 0;
+	idt[vector].flags = flags;
+	idt[vector].base_high = (base >> 16) & 0xFFFF;
+}
+
+static void idt_load(void)
+{
+	struct idt_ptr ptr;
+
+	ptr.limit = sizeof(idt) - 1;
+	ptr.base = (uint32_t)idt;
+	__asm__ volatile("lidt %0" : : "m"(ptr));
+}
+
+void interrupt_init(void)
+{
+	pic_remap();
+
+	for (int i = 0; i < ISR_STUB_COUNT; i++)
+		idt_set_gate(i, isr_stub_table[i], IDT_GATE_INT32);
+	idt_set_gate(APIC_SPURIOUS_VECTOR, (uint32_t)isr_spurious,
+	             IDT_GATE_INT32);
+	idt_set_gate(SYSCALL_VECTOR, (uint32_t)isr128, IDT_GATE_USER_INT32);
+
+	idt_load();
+}
+
+void interrupt_init_ap(void)
+{
+	idt_load();
+}
+
+void interrupt_register(uint8_t vector, interrupt_handler_t handler)
+{
+	handlers[vector] = handler;
+}
+
+void irq_register(uint8_t irq, interrupt_handler_t handler)
+{
+	handlers[PIC_IRQ_BASE + irq] = handler;
+	if (use_ioapic)
+		ioapic_unmask(irq);
+	else
+		pic_unmask(irq);
+}
+
+void irq_use_ioapic(void)
+{
+	for (int irq = 0; irq < IRQ_COUNT; irq++)
+		pic_mask(irq);
+
+	use_ioapic = 1;
+	for (int irq = 0; irq < IRQ_COUNT; irq++) {
+		if (handlers[PIC_IRQ_BASE + irq])
+			ioapic_unmask(irq);
+	}
+}
+
+void interrupt_panic(struct regs *r)
+{
+	// In ring 3 it only ends the program; this is its thread's context
+	if ((r->cs & 3) == 3) {
+		interrupts_enable();
+		kprintf(CON_RED "%s: %s at 0x%x\n" CON_NORMAL,
+		        thread_current()->name,
+		        r->int_no < EXCEPTION_COUNT && exception_names[r->int_no]
+		            ? exception_names[r->int_no]
+		            : "Unknown exception",
+		        r->eip);
+		user_exit(-1);
+	}
+
+	console_set_color(VGA_COLOR_WHITE, VGA_COLOR_RED);
+	console_puts("\nKERNEL PANIC: ");
+	if (r->int_no < EXCEPTION_COUNT && exception_names[r->int_no])
+		console_puts(exception_names[r->int_no]);
+	else
+		console_puts("Unknown exception");
+	console_puts("\n  vector=");
+	console_print_int(r->int_no);
+	console_puts(" err=");
+	console_print_hex(r->err_code);
+	console_puts(" eip=");
+	console_print_hex(r->eip);
+	if (r->int_no == 14) {
+		uint32_t cr2;
+		__asm__ volatile("mov %%cr2, %0" : "=r"(cr2));
+		console_puts(" addr=");
+		console_print_hex(cr2);
+	}
+	console_putch('\n');
+
+	for (;;)
+		__asm__ volatile("cli; hlt");
+}
+
+void interrupt_dispatch(struct regs *r)
+{
+	if (r->int_no < EXCEPTION_COUNT) {
+		if (handlers[r->int_no])
+			handlers[r->int_no](r);
+		else
+			interrupt_panic(r);
+		return;
+	}
+
+	if (r->int_no == SYSCALL_VECTOR) {
+		syscall_dispatch(r);
+		sched_irq_exit();
+		return;
+	}
+
+	if (r->int_no >= PIC_IRQ_BASE + IRQ_COUNT) {
+		if (handlers[r->int_no])
+			handlers[r->int_no](r);
+		lapic_eoi();
+		sched_irq_exit();
+		return;
+	}
+
+	uint8_t irq = r->int_no - PIC_IRQ_BASE;
+	if (!use_ioapic && pic_is_spurious(irq))
+		return;
+
+	if (handlers[r->int_no])
+		handlers[r->int_no](r);
+	if (use_ioapic)
+		lapic_eoi();
+	else
+		pic_eoi(irq);
+	sched_irq_exit();
+}
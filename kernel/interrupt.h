@@ -0,0 +1,60 @@
+#ifndef INTERRUPT_H
+#define INTERRUPT_H
+
+#include <stdint.h>
+
+#define IDT_ENTRIES 256
+#define IRQ_COUNT 16
+
+// Stack layout built by isr_common in isr.asm
+struct regs {
+	uint32_t gs, fs, es, ds;
+	uint32_t edi, esi, ebp, esp, ebx, edx, ecx, eax;
+	uint32_t int_no, err_code;
+	uint32_t eip, cs, eflags, useresp, ss;
+};
+
+typedef void (*interrupt_handler_t)(struct regs *r);
+
+void interrupt_init(void);
+// Load the shared IDT on an application processor
+void interrupt_init_ap(void);
+void interrupt_register(uint8_t vector, interrupt_handler_t handler);
+void irq_register(uint8_t irq, interrupt_handler_t handler);
+// Mask the 8259s and take IRQs from the IO-APIC from now on, keeping the
+// lines that already have handlers enabled (see ioapic_init())
+void irq_use_ioapic(void);
+
+// Report a fatal exception and halt; one raised in ring 3 ends just that
+// program (user_exit())
+void interrupt_panic(struct regs *r);
+
+// Entry point from isr_common
+void interrupt_dispatch(struct regs *r);
+
+static inline void interrupts_enable(void)
+{
+	__asm__ volatile("sti");
+}
+
+static inline void interrupts_disable(void)
+{
+	__asm__ volatile("cli");
+}
+
+static inline int interrupts_enabled(void)
+{
+	uint32_t flags;
+	__asm__ volatile("pushf; pop %0" : "=r"(flags));
+	return (flags >> 9) & 1; // IF
+}
+
+// Atomically re-enable interrupts and sleep until the next one arrives.
+// sti only takes effect after the following instruction, so an IRQ that
+// is already pending cannot slip in between the check and the hlt.
+static inline void interrupts_wait(void)
+{
+	__asm__ volatile("sti; hlt");
+}
+
+#endif
@@ -0,0 +1,150 @@
+; isr.asm - exception, IRQ and system call entry stubs
+bits 32
+extern interrupt_dispatch
+
+GDT_KERNEL_DATA equ 0x10        ; gdt.h
+GDT_USER_CODE   equ 0x1B
+GDT_USER_DATA   equ 0x23
+SYSCALL_VECTOR  equ 0x80        ; syscall.h
+
+; Exceptions that push no error code get a dummy one so every frame
+; has the same layout (struct regs in interrupt.h)
+%macro ISR_NOERR 1
+isr%1:
+    push dword 0
+    push dword %1
+    jmp isr_common
+%endmacro
+
+%macro ISR_ERR 1
+isr%1:
+    push dword %1
+    jmp isr_common
+%endmacro
+
+section .text
+
+ISR_NOERR 0
+ISR_NOERR 1
+ISR_NOERR 2
+ISR_NOERR 3
+ISR_NOERR 4
+ISR_NOERR 5
+ISR_NOERR 6
+ISR_NOERR 7
+ISR_ERR   8
+ISR_NOERR 9
+ISR_ERR   10
+ISR_ERR   11
+ISR_ERR   12
+ISR_ERR   13
+ISR_ERR   14
+ISR_NOERR 15
+ISR_NOERR 16
+ISR_ERR   17
+ISR_NOERR 18
+ISR_NOERR 19
+ISR_NOERR 20
+ISR_ERR   21
+%assign i 22
+%rep 10
+ISR_NOERR %[i]
+%assign i i+1
+%endrep
+
+; IRQ 0-15 after PIC remap, then the local APIC's timer and IPI vectors
+%assign i 32
+%rep 19
+ISR_NOERR %[i]
+%assign i i+1
+%endrep
+
+; APIC spurious interrupt; kept out of the table so it can stay short
+global isr_spurious
+isr_spurious:
+    iret
+
+; int 0x80, the system call gate ring 3 may use (interrupt.c)
+global isr128
+ISR_NOERR 128
+
+; SYSENTER from ring 3: eax = call number, ebx/esi/edi = arguments,
+; ecx = the stack and edx = the address to return to. The CPU loads
+; cs/ss from MSRs, and esp from one pointing at this CPU's TSS esp0
+; (syscall.c). Builds the same frame as an int 0x80 so that
+; interrupt_dispatch() handles both alike, then leaves with SYSEXIT,
+; which takes the return eip from edx and the stack from ecx.
+global sysenter_entry
+sysenter_entry:
+    mov esp, [esp]
+    push dword GDT_USER_DATA    ; ss
+    push ecx                    ; useresp
+    pushf
+    or dword [esp], 0x200       ; SYSENTER cleared IF; ring 3 always has it
+    push dword GDT_USER_CODE    ; cs
+    push edx                    ; eip
+    push dword 0
+    push dword SYSCALL_VECTOR
+    pusha
+    push ds
+    push es
+    push fs
+    push gs
+
+    mov ax, GDT_KERNEL_DATA
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    cld
+
+    push esp
+    call interrupt_dispatch
+    add esp, 4
+
+    pop gs
+    pop fs
+    pop es
+    pop ds
+    popa
+    add esp, 8                  ; int_no + err_code
+    pop edx                     ; eip
+    add esp, 4                  ; cs
+    popf
+    pop ecx                     ; useresp
+    sysexit
+
+isr_common:
+    pusha
+    push ds
+    push es
+    push fs
+    push gs
+
+    mov ax, GDT_KERNEL_DATA
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    cld
+
+    push esp                    ; struct regs *
+    call interrupt_dispatch
+    add esp, 4
+
+    pop gs
+    pop fs
+    pop es
+    pop ds
+    popa
+    add esp, 8                  ; int_no + err_code
+    iret
+
+section .rodata
+global isr_stub_table
+isr_stub_table:
+%assign i 0
+%rep 51
+    dd isr%[i]
+%assign i i+1
+%endrep
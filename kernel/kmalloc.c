@@ -0,0 +1,278 @@
+#include "kmalloc.h"
+#include "paging.h"
+#include "pmm.h"
+#include "spinlock.h"
+#include "../lib/string.h"
+
+#define KMEM_MAX_CACHES 32
+#define KMALLOC_MIN_SHIFT 4 // smallest class is 16 bytes
+#define KMALLOC_CLASSES 8   // 16 .. 2048
+
+#define OBJ_ALIGN 8
+// Grow small-object slabs up to 32 KB until at least this many objects fit
+#define SLAB_MIN_OBJS 8
+#define SLAB_MAX_ORDER 3
+
+struct slab {
+	struct kmem_cache *cache;
+	struct slab *next;
+	struct slab *prev;
+	void *free_list;
+	uint32_t in_use;
+};
+
+#define SLAB_HEADER_SIZE                                                       \
+	((sizeof(struct slab) + OBJ_ALIGN - 1) & ~(OBJ_ALIGN - 1))
+
+static const char *class_names[KMALLOC_CLASSES] = {
+    "kmalloc-16",  "kmalloc-32",  "kmalloc-64",   "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1024", "kmalloc-2048"};
+
+// One lock for every cache and page_owner[]; slab operations are short
+static spinlock_t kmem_lock = SPINLOCK_INIT;
+static struct kmem_cache cache_pool[KMEM_MAX_CACHES];
+static int cache_pool_used = 0;
+static struct kmem_cache *caches = 0;
+static struct kmem_cache *size_caches[KMALLOC_CLASSES];
+
+// Maps each page frame to the slab covering it
+static uint32_t *page_owner;
+
+static unsigned int pages_to_order(uint32_t pages)
+{
+	unsigned int order = 0;
+	while ((1u << order) < pages)
+		order++;
+	return order;
+}
+
+static void slab_list_add(struct slab **head, struct slab *s)
+{
+	s->prev = 0;
+	s->next = *head;
+	if (s->next)
+		s->next->prev = s;
+	*head = s;
+}
+
+static void slab_list_remove(struct slab **head, struct slab *s)
+{
+	if (s->prev)
+		s->prev->next = s->next;
+	else
+		*head = s->next;
+	if (s->next)
+		s->next->prev = s->prev;
+}
+
+static struct slab *slab_create(struct kmem_cache *cache)
+{
+	uint32_t addr = pmm_alloc_pages(cache->order);
+	if (!addr)
+		return 0;
+
+	struct slab *s = (struct slab *)addr;
+	s->cache = cache;
+	s->in_use = 0;
+	s->free_list = 0;
+
+	// Thread the free list back to front so objects come out in order
+	char *base = (char *)addr + cache->obj_offset;
+	for (int i = cache->objs_per_slab - 1; i >= 0; i--) {
+		void **obj = (void **)(base + i * cache->obj_size);
+		*obj = s->free_list;
+		s->free_list = obj;
+	}
+
+	uint32_t pfn = addr >> PAGE_SHIFT;
+	for (uint32_t i = 0; i < (1u << cache->order); i++)
+		page_owner[pfn + i] = addr;
+
+	cache->slabs++;
+	return s;
+}
+
+static void slab_destroy(struct slab *s)
+{
+	struct kmem_cache *cache = s->cache;
+	uint32_t pfn = (uint32_t)s >> PAGE_SHIFT;
+
+	for (uint32_t i = 0; i < (1u << cache->order); i++)
+		page_owner[pfn + i] = 0;
+
+	cache->slabs--;
+	pmm_free_pages((uint32_t)s, cache->order);
+}
+
+void kmalloc_init(void)
+{
+	uint32_t bytes = pmm_max_pfn() * sizeof(uint32_t);
+	unsigned int order =
+	    pages_to_order((bytes + PAGE_SIZE - 1) >> PAGE_SHIFT);
+
+	page_owner = (uint32_t *)pmm_alloc_pages(order);
+	if (!page_owner)
+		return;
+	memset(page_owner, 0, PAGE_SIZE << order);
+
+	for (int i = 0; i < KMALLOC_CLASSES; i++) {
+		size_caches[i] = kmem_cache_create(
+		    class_names[i], 1u << (KMALLOC_MIN_SHIFT + i));
+	}
+}
+
+struct kmem_cache *kmem_cache_create(const char *name, uint32_t size)
+{
+	if (size < sizeof(void *))
+		size = sizeof(void *);
+	size = (size + OBJ_ALIGN - 1) & ~(OBJ_ALIGN - 1);
+
+	uint32_t align = (size % KMEM_CACHE_LINE) ? OBJ_ALIGN : KMEM_CACHE_LINE;
+	uint32_t offset = (SLAB_HEADER_SIZE + align - 1) & ~(align - 1);
+
+	uint32_t order = 0;
+	uint32_t objs = (PAGE_SIZE - offset) / size;
+	while ((objs < SLAB_MIN_OBJS && order < SLAB_MAX_ORDER) ||
+	       (objs == 0 && order < PMM_MAX_ORDER)) {
+		order++;
+		objs = ((PAGE_SIZE << order) - offset) / size;
+	}
+	if (objs == 0)
+		return 0;
+
+	int flags = spin_lock_irqsave(&kmem_lock);
+	if (cache_pool_used >= KMEM_MAX_CACHES) {
+		spin_unlock_irqrestore(&kmem_lock, flags);
+		return 0;
+	}
+	struct kmem_cache *cache = &cache_pool[cache_pool_used++];
+	memset(cache, 0, sizeof(*cache));
+	cache->name = name;
+	cache->obj_size = size;
+	cache->obj_offset = offset;
+	cache->order = order;
+	cache->objs_per_slab = objs;
+
+	// Keep the list in creation order for stable statistics output
+	struct kmem_cache **tail = &caches;
+	while (*tail)
+		tail = &(*tail)->next;
+	*tail = cache;
+	spin_unlock_irqrestore(&kmem_lock, flags);
+	return cache;
+}
+
+static void *cache_alloc(struct kmem_cache *cache)
+{
+	struct slab *s = cache->partial;
+
+	if (!s) {
+		s = cache->empty;
+		if (s)
+			cache->empty = 0;
+		else
+			s = slab_create(cache);
+		if (!s)
+			return 0;
+		slab_list_add(&cache->partial, s);
+	}
+
+	void **obj = s->free_list;
+	s->free_list = *obj;
+	s->in_use++;
+
+	if (s->in_use == cache->objs_per_slab) {
+		slab_list_remove(&cache->partial, s);
+		slab_list_add(&cache->full, s);
+	}
+
+	cache->in_use++;
+	cache->allocs++;
+	return obj;
+}
+
+void *kmem_cache_alloc(struct kmem_cache *cache)
+{
+	int flags = spin_lock_irqsave(&kmem_lock);
+	void *obj = cache_alloc(cache);
+	spin_unlock_irqrestore(&kmem_lock, flags);
+	return obj;
+}
+
+static void cache_free(struct kmem_cache *cache, void *obj)
+{
+	struct slab *s = (struct slab *)page_owner[(uint32_t)obj >> PAGE_SHIFT];
+
+	if (!s || s->cache != cache)
+		return;
+
+	int was_full = (s->in_use == cache->objs_per_slab);
+
+	*(void **)obj = s->free_list;
+	s->free_list = obj;
+	s->in_use--;
+	cache->in_use--;
+	cache->frees++;
+
+	if (s->in_use == 0) {
+		slab_list_remove(was_full ? &cache->full : &cache->partial, s);
+		if (cache->empty)
+			slab_destroy(s);
+		else
+			cache->empty = s;
+	} else if (was_full) {
+		slab_list_remove(&cache->full, s);
+		slab_list_add(&cache->partial, s);
+	}
+}
+
+void kmem_cache_free(struct kmem_cache *cache, void *obj)
+{
+	int flags = spin_lock_irqsave(&kmem_lock);
+	cache_free(cache, obj);
+	spin_unlock_irqrestore(&kmem_lock, flags);
+}
+
+void *kmalloc(uint32_t size)
+{
+	if (size == 0)
+		return 0;
+
+	if (size <= KMALLOC_MAX_SLAB) {
+		int idx = 0;
+		while ((1u << (KMALLOC_MIN_SHIFT + idx)) < size)
+			idx++;
+		return kmem_cache_alloc(size_caches[idx]);
+	}
+
+	// Large buffers are demand-zero: pages are only committed on touch
+	return vmm_alloc_lazy(size);
+}
+
+void *kzalloc(uint32_t size)
+{
+	void *ptr = kmalloc(size);
+	if (ptr && size <= KMALLOC_MAX_SLAB)
+		memset(ptr, 0, size);
+	return ptr;
+}
+
+void kfree(void *ptr)
+{
+	if (!ptr)
+		return;
+
+	if (vmm_is_lazy(ptr)) {
+		vmm_free_lazy(ptr);
+		return;
+	}
+
+	uint32_t owner = page_owner[(uint32_t)ptr >> PAGE_SHIFT];
+	if (owner)
+		kmem_cache_free(((struct slab *)owner)->cache, ptr);
+}
+
+struct kmem_cache *kmem_cache_list(void)
+{
+	return caches;
+}
@@ -0,0 +1,48 @@
+#ifndef KMALLOC_H
+#define KMALLOC_H
+
+#include <stdint.h>
+
+// Requests above this size bypass the slabs and get a demand-zero region
+// (see vmm_alloc_lazy); paging_init() must have run first
+#define KMALLOC_MAX_SLAB 2048
+
+struct slab;
+
+// Object cache: fixed-size objects carved out of buddy-allocated slabs
+struct kmem_cache {
+	const char *name;
+	uint32_t obj_size;
+	uint32_t obj_offset; // first object, aligned past the slab header
+	uint32_t order; // slab is PAGE_SIZE << order bytes
+	uint32_t objs_per_slab;
+	struct slab *partial; // slabs with at least one free object
+	struct slab *full;
+	struct slab *empty; // at most one, kept to absorb alloc/free churn
+
+	// Statistics
+	uint32_t slabs;
+	uint32_t in_use;
+	uint32_t allocs;
+	uint32_t frees;
+
+	struct kmem_cache *next;
+};
+
+void kmalloc_init(void);
+
+void *kmalloc(uint32_t size);
+void *kzalloc(uint32_t size);
+void kfree(void *ptr);
+
+// Objects whose size is a multiple of KMEM_CACHE_LINE are also aligned to it
+#define KMEM_CACHE_LINE 64
+
+struct kmem_cache *kmem_cache_create(const char *name, uint32_t size);
+void *kmem_cache_alloc(struct kmem_cache *cache);
+void kmem_cache_free(struct kmem_cache *cache, void *obj);
+
+// Walk all caches for statistics
+struct kmem_cache *kmem_cache_list(void);
+
+#endif
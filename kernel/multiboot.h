@@ -0,0 +1,43 @@
+#ifndef MULTIBOOT_H
+#define MULTIBOOT_H
+
+#include <stdint.h>
+
+// Multiboot 0.6.96: what a compliant loader (GRUB) hands the kernel
+
+#define MULTIBOOT_BOOTLOADER_MAGIC 0x2BADB002
+
+#define MULTIBOOT_INFO_MEMORY (1 << 0)
+#define MULTIBOOT_INFO_CMDLINE (1 << 2)
+#define MULTIBOOT_INFO_MODS (1 << 3)
+#define MULTIBOOT_INFO_MEM_MAP (1 << 6)
+
+struct multiboot_info {
+	uint32_t flags;
+	uint32_t mem_lower; // KB below 1 MB
+	uint32_t mem_upper; // KB above 1 MB
+	uint32_t boot_device;
+	uint32_t cmdline;
+	uint32_t mods_count;
+	uint32_t mods_addr;
+	uint32_t syms[4];
+	uint32_t mmap_length;
+	uint32_t mmap_addr;
+} __attribute__((packed));
+
+struct multiboot_module {
+	uint32_t mod_start;
+	uint32_t mod_end;
+	uint32_t string;
+	uint32_t reserved;
+} __attribute__((packed));
+
+// `size` does not count itself; the next entry is at +size+4
+struct multiboot_mmap_entry {
+	uint32_t size;
+	uint64_t base_addr;
+	uint64_t length;
+	uint32_t type;
+} __attribute__((packed));
+
+#endif
@@ -0,0 +1,16 @@
+#include "mutex.h"
+
+void mutex_lock(struct mutex *m)
+{
+	while (__atomic_exchange_n(&m->locked, 1, __ATOMIC_ACQUIRE))
+		wait_event(&m->wait,
+		           !__atomic_load_n(&m->locked, __ATOMIC_RELAXED));
+}
+
+// Every waiter wakes and races for the lock; contention is rare enough
+// that handing it over in order is not worth the bookkeeping
+void mutex_unlock(struct mutex *m)
+{
+	__atomic_store_n(&m->locked, 0, __ATOMIC_RELEASE);
+	wait_queue_wake_all(&m->wait);
+}
@@ -0,0 +1,18 @@
+#ifndef MUTEX_H
+#define MUTEX_H
+
+#include "sched.h"
+
+// Sleeping lock, for sections that wait on a device: a thread that finds
+// it taken gives up its CPU rather than spinning for the whole I/O.
+// Threads only, and never taken with a spinlock held; the holder may
+// sleep. Zero initialized (static storage) is unlocked.
+struct mutex {
+	volatile int locked;
+	struct wait_queue wait;
+};
+
+void mutex_lock(struct mutex *m);
+void mutex_unlock(struct mutex *m);
+
+#endif
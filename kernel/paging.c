@@ -0,0 +1,377 @@
+#include "paging.h"
+#include "cpu.h"
+#include "interrupt.h"
+#include "pmm.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "user.h"
+#include "../lib/string.h"
+
+#define PAGE_FAULT_VECTOR 14
+#define PF_PROTECTION 0x1 // fault on a present page
+#define PF_USER 0x4 // raised in ring 3
+
+#define LARGE_PAGE_SIZE 0x400000u
+#define PDE_INDEX(v) ((v) >> 22)
+#define PTE_INDEX(v) (((v) >> PAGE_SHIFT) & 0x3FF)
+
+#define CR0_WP (1u << 16)
+#define CR0_PG (1u << 31)
+#define CR4_PSE (1u << 4)
+
+#define VMM_MAX_REGIONS 128
+
+// Lazily backed region; the page after it is a guard and never mapped
+struct lazy_region {
+	uint32_t base;
+	uint32_t pages;
+};
+
+static uint32_t kernel_pd[1024] __attribute__((aligned(PAGE_SIZE)));
+static uint32_t low_pt[1024] __attribute__((aligned(PAGE_SIZE)));
+
+// Guards the lazy regions and their page tables
+static spinlock_t vmm_lock = SPINLOCK_INIT;
+// Sorted by base so faults can binary-search them
+static struct lazy_region regions[VMM_MAX_REGIONS];
+static int region_count = 0;
+static uint32_t reserved_pages = 0;
+static uint32_t resident_pages = 0;
+
+static inline void invlpg(uint32_t virt)
+{
+	__asm__ volatile("invlpg (%0)" : : "r"(virt) : "memory");
+}
+
+static uint32_t *page_table(uint32_t virt, int create)
+{
+	uint32_t *pde = &kernel_pd[PDE_INDEX(virt)];
+
+	if (!(*pde & PTE_PRESENT)) {
+		if (!create)
+			return 0;
+		uint32_t pt = pmm_alloc_page();
+		if (!pt)
+			return 0;
+		memset((void *)pt, 0, PAGE_SIZE);
+		*pde = pt | PTE_PRESENT | PTE_WRITE;
+		// The PTEs decide what ring 3 can reach
+		if (virt >= USER_BASE && virt < USER_END)
+			*pde |= PTE_USER;
+	}
+	if (*pde & PTE_LARGE)
+		return 0;
+	// Page tables come from identity-mapped RAM
+	return (uint32_t *)(*pde & ~0xFFFu);
+}
+
+int paging_map(uint32_t virt, uint32_t phys, uint32_t flags)
+{
+	uint32_t *pt = page_table(virt, 1);
+	if (!pt)
+		return -1;
+
+	pt[PTE_INDEX(virt)] = (phys & ~0xFFFu) | flags | PTE_PRESENT;
+	invlpg(virt);
+	return 0;
+}
+
+uint32_t paging_unmap(uint32_t virt)
+{
+	uint32_t *pt = page_table(virt, 0);
+	if (!pt)
+		return 0;
+
+	uint32_t pte = pt[PTE_INDEX(virt)];
+	if (!(pte & PTE_PRESENT))
+		return 0;
+
+	pt[PTE_INDEX(virt)] = 0;
+	invlpg(virt);
+	return pte & ~0xFFFu;
+}
+
+int paging_user_accessible(uint32_t addr, uint32_t len, int write)
+{
+	uint32_t need = PTE_PRESENT | PTE_USER | (write ? PTE_WRITE : 0);
+
+	if (addr < USER_BASE || addr > USER_END || len > USER_END - addr)
+		return 0;
+
+	for (uint32_t page = addr & ~(PAGE_SIZE - 1); page < addr + len;
+	     page += PAGE_SIZE) {
+		uint32_t *pt = page_table(page, 0);
+		if (!pt || (pt[PTE_INDEX(page)] & need) != need)
+			return 0;
+	}
+	return 1;
+}
+
+void paging_unmap_user(void)
+{
+	uint32_t freed = 0; // frames and page tables chained as in vmm_free_lazy()
+
+	spin_lock(&vmm_lock);
+	for (uint32_t pdi = PDE_INDEX(USER_BASE); pdi < PDE_INDEX(USER_END);
+	     pdi++) {
+		if (!(kernel_pd[pdi] & PTE_PRESENT))
+			continue;
+
+		uint32_t *pt = (uint32_t *)(kernel_pd[pdi] & ~0xFFFu);
+		for (int i = 0; i < 1024; i++) {
+			if (pt[i] & PTE_PRESENT) {
+				uint32_t phys = pt[i] & ~0xFFFu;
+				*(uint32_t *)phys = freed;
+				freed = phys;
+			}
+		}
+		kernel_pd[pdi] = 0;
+		*pt = freed;
+		freed = (uint32_t)pt;
+	}
+	spin_unlock(&vmm_lock);
+
+	// Dropping whole page tables needs a full flush here as well
+	uint32_t cr3;
+	__asm__ volatile("mov %%cr3, %0; mov %0, %%cr3" : "=r"(cr3) : : "memory");
+	smp_tlb_shootdown();
+	while (freed) {
+		uint32_t next = *(uint32_t *)freed;
+		pmm_free_page(freed);
+		freed = next;
+	}
+}
+
+static struct lazy_region *find_region(uint32_t addr)
+{
+	int lo = 0, hi = region_count - 1;
+
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+		struct lazy_region *r = &regions[mid];
+
+		if (addr < r->base)
+			hi = mid - 1;
+		else if (addr >= r->base + r->pages * PAGE_SIZE)
+			lo = mid + 1;
+		else
+			return r;
+	}
+	return 0;
+}
+
+static uint32_t translate(uint32_t addr)
+{
+	uint32_t pde = kernel_pd[PDE_INDEX(addr)];
+
+	if (!(pde & PTE_PRESENT))
+		return 0;
+	if (pde & PTE_LARGE)
+		return (pde & ~(LARGE_PAGE_SIZE - 1)) | (addr & (LARGE_PAGE_SIZE - 1));
+
+	uint32_t pte = ((uint32_t *)(pde & ~0xFFFu))[PTE_INDEX(addr)];
+	if (!(pte & PTE_PRESENT))
+		return 0;
+	return (pte & ~0xFFFu) | (addr & (PAGE_SIZE - 1));
+}
+
+// Back a not-present page inside a lazy region with a fresh zero page
+static int lazy_fault_locked(uint32_t addr)
+{
+	if (!find_region(addr))
+		return 0;
+	// Another CPU may have faulted on the same page first
+	if (translate(addr))
+		return 1;
+
+	uint32_t frame = pmm_alloc_page();
+	if (!frame)
+		return 0;
+	memset((void *)frame, 0, PAGE_SIZE);
+
+	if (paging_map(addr & ~(PAGE_SIZE - 1), frame, PTE_WRITE) != 0) {
+		pmm_free_page(frame);
+		return 0;
+	}
+	resident_pages++;
+	return 1;
+}
+
+static int lazy_fault(uint32_t addr)
+{
+	if (addr < VMM_LAZY_BASE || addr >= VMM_LAZY_END)
+		return 0;
+
+	spin_lock(&vmm_lock);
+	int ok = lazy_fault_locked(addr);
+	spin_unlock(&vmm_lock);
+	return ok;
+}
+
+uint32_t paging_virt_to_phys(const void *virt)
+{
+	uint32_t addr = (uint32_t)virt;
+	uint32_t phys = translate(addr);
+
+	if (!phys && lazy_fault(addr))
+		phys = translate(addr);
+	return phys;
+}
+
+static void page_fault_handler(struct regs *r)
+{
+	uint32_t addr;
+	__asm__ volatile("mov %%cr2, %0" : "=r"(addr));
+
+	// Lazy regions are kernel memory; ring 3 must not populate them
+	if (!(r->err_code & (PF_PROTECTION | PF_USER)) && lazy_fault(addr))
+		return;
+
+	// A program's own pages; reading them in may sleep, which is fine
+	// on the program's thread
+	if ((r->err_code & (PF_PROTECTION | PF_USER)) == PF_USER &&
+	    addr >= USER_BASE && addr < USER_END) {
+		interrupts_enable();
+		int ok = user_page_in(addr);
+		interrupts_disable();
+		if (ok)
+			return;
+	}
+	interrupt_panic(r);
+}
+
+void paging_init(void)
+{
+	uint32_t limit = pmm_max_pfn() << PAGE_SHIFT;
+	int pse = cpu_has_feature_edx(CPUID_EDX_PSE);
+
+	memset(kernel_pd, 0, sizeof(kernel_pd));
+
+	// First 4 MB (kernel, stack, VGA) in 4 KB pages so that page 0 can
+	// stay unmapped and catch NULL dereferences
+	low_pt[0] = 0;
+	for (uint32_t i = 1; i < 1024; i++)
+		low_pt[i] = (i << PAGE_SHIFT) | PTE_PRESENT | PTE_WRITE;
+	kernel_pd[0] = (uint32_t)low_pt | PTE_PRESENT | PTE_WRITE;
+
+	// The rest of RAM is identity-mapped with 4 MB pages when the CPU
+	// supports PSE
+	for (uint32_t addr = LARGE_PAGE_SIZE; addr && addr < limit;
+	     addr += LARGE_PAGE_SIZE) {
+		if (pse) {
+			kernel_pd[PDE_INDEX(addr)] =
+			    addr | PTE_PRESENT | PTE_WRITE | PTE_LARGE;
+			continue;
+		}
+		uint32_t *pt = page_table(addr, 1);
+		if (!pt)
+			break;
+		for (uint32_t i = 0; i < 1024; i++)
+			pt[i] = (addr + (i << PAGE_SHIFT)) | PTE_PRESENT |
+			        PTE_WRITE;
+	}
+
+	interrupt_register(PAGE_FAULT_VECTOR, page_fault_handler);
+
+	uint32_t cr0, cr4;
+	if (pse) {
+		__asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+		__asm__ volatile("mov %0, %%cr4" : : "r"(cr4 | CR4_PSE));
+	}
+	__asm__ volatile("mov %0, %%cr3" : : "r"(kernel_pd));
+	__asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+	__asm__ volatile("mov %0, %%cr0" : : "r"(cr0 | CR0_PG | CR0_WP));
+}
+
+static void *alloc_region(uint32_t pages)
+{
+	uint32_t span = (pages + 1) * PAGE_SIZE;
+	uint32_t cursor = VMM_LAZY_BASE;
+	int i;
+
+	if (region_count >= VMM_MAX_REGIONS)
+		return 0;
+
+	// First fit between existing regions (and their guard pages)
+	for (i = 0; i < region_count; i++) {
+		if (regions[i].base - cursor >= span)
+			break;
+		cursor = regions[i].base + (regions[i].pages + 1) * PAGE_SIZE;
+	}
+	if (i == region_count && VMM_LAZY_END - cursor < span)
+		return 0;
+
+	for (int j = region_count; j > i; j--)
+		regions[j] = regions[j - 1];
+	regions[i].base = cursor;
+	regions[i].pages = pages;
+	region_count++;
+	reserved_pages += pages;
+
+	return (void *)cursor;
+}
+
+void *vmm_alloc_lazy(uint32_t size)
+{
+	uint32_t pages = (size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+
+	if (!pages)
+		return 0;
+
+	spin_lock(&vmm_lock);
+	void *addr = alloc_region(pages);
+	spin_unlock(&vmm_lock);
+	return addr;
+}
+
+void vmm_free_lazy(void *addr)
+{
+	uint32_t freed = 0; // frames chained through their first word
+
+	spin_lock(&vmm_lock);
+	struct lazy_region *r = find_region((uint32_t)addr);
+	if (!r || r->base != (uint32_t)addr) {
+		spin_unlock(&vmm_lock);
+		return;
+	}
+
+	for (uint32_t i = 0; i < r->pages; i++) {
+		uint32_t phys = paging_unmap(r->base + i * PAGE_SIZE);
+		if (phys) {
+			*(uint32_t *)phys = freed;
+			freed = phys;
+			resident_pages--;
+		}
+	}
+	reserved_pages -= r->pages;
+
+	int idx = r - regions;
+	for (int j = idx; j < region_count - 1; j++)
+		regions[j] = regions[j + 1];
+	region_count--;
+	spin_unlock(&vmm_lock);
+
+	// Other CPUs may still hold the old translations; the frames can only
+	// be reused once those are gone
+	smp_tlb_shootdown();
+	while (freed) {
+		uint32_t next = *(uint32_t *)freed;
+		pmm_free_page(freed);
+		freed = next;
+	}
+}
+
+int vmm_is_lazy(const void *addr)
+{
+	return (uint32_t)addr >= VMM_LAZY_BASE && (uint32_t)addr < VMM_LAZY_END;
+}
+
+uint32_t vmm_lazy_reserved_pages(void)
+{
+	return reserved_pages;
+}
+
+uint32_t vmm_lazy_resident_pages(void)
+{
+	return resident_pages;
+}
@@ -0,0 +1,47 @@
+#ifndef PAGING_H
+#define PAGING_H
+
+#include <stdint.h>
+
+#define PTE_PRESENT 0x001
+#define PTE_WRITE 0x002
+#define PTE_USER 0x004
+#define PTE_PCD 0x010 // cache disable
+#define PTE_LARGE 0x080 // 4 MB page (PDE only)
+
+// RAM is identity-mapped below this; lazily backed regions live above
+#define PAGING_IDENTITY_LIMIT 0xC0000000u
+// Ring 3 sees only this range: the running user program's pages, mapped
+// with PTE_USER. One program owns it at a time (see user.h).
+#define USER_BASE 0xC0000000u
+#define USER_END 0xD0000000u
+#define VMM_LAZY_BASE 0xD0000000u
+#define VMM_LAZY_END 0xF0000000u
+
+void paging_init(void);
+
+// Map a single 4 KB page; page tables are allocated as needed
+int paging_map(uint32_t virt, uint32_t phys, uint32_t flags);
+// Unmap a page and return its physical address (0 if it was not mapped)
+uint32_t paging_unmap(uint32_t virt);
+
+// Whether ring 3 may touch [addr, addr + len): inside the user range and
+// mapped with PTE_USER (and PTE_WRITE if write is set)
+int paging_user_accessible(uint32_t addr, uint32_t len, int write);
+// Unmap and free every page in the user range, and its page tables
+void paging_unmap_user(void);
+
+// Physical address behind a kernel virtual address, faulting in lazy
+// pages first (for DMA); 0 if nothing is mapped there
+uint32_t paging_virt_to_phys(const void *virt);
+
+// Reserve address space that is backed by zero-filled pages on first
+// touch. Each region is followed by an unmapped guard page.
+void *vmm_alloc_lazy(uint32_t size);
+void vmm_free_lazy(void *addr);
+int vmm_is_lazy(const void *addr);
+
+uint32_t vmm_lazy_reserved_pages(void);
+uint32_t vmm_lazy_resident_pages(void);
+
+#endif
@@ -0,0 +1,298 @@
+#include "pmm.h"
+#include "paging.h"
+#include "spinlock.h"
+#include "../lib/string.h"
+
+// Real-mode memory holds boot data and BIOS areas; only frames above 1 MB
+// are handed out
+#define PMM_LOW_LIMIT 0x100000
+// Assumed RAM size when the BIOS gives no E820 map
+#define PMM_FALLBACK_END 0x1000000
+// Frames must be reachable through the kernel's identity map
+#define PMM_ADDR_LIMIT ((uint64_t)PAGING_IDENTITY_LIMIT)
+
+// frame_info[] flags: free block head + its order
+#define FRAME_FREE 0x80
+#define FRAME_ORDER_MASK 0x0F
+
+// Kernel image, frame_info[] and boot modules
+#define MAX_RESERVED 8
+
+// Free blocks are linked through their own first bytes
+struct free_block {
+	struct free_block *next;
+	struct free_block *prev;
+};
+
+struct range {
+	uint32_t start_pfn;
+	uint32_t end_pfn;
+};
+
+extern char __kernel_start[], __kernel_end[];
+
+// Guards the free lists and frame_info[] once other CPUs are up; frames
+// are freed from IRQ handlers too
+static spinlock_t pmm_lock = SPINLOCK_INIT;
+static struct free_block *free_lists[PMM_MAX_ORDER + 1];
+static uint8_t *frame_info;
+static uint32_t max_pfn = 0;
+static uint32_t total_pages = 0;
+static uint32_t free_pages = 0;
+static uint64_t ram_bytes = 0;
+
+static struct range reserved[MAX_RESERVED];
+static int reserved_count = 0;
+
+static inline struct free_block *pfn_to_block(uint32_t pfn)
+{
+	return (struct free_block *)(pfn << PAGE_SHIFT);
+}
+
+static inline uint32_t block_to_pfn(struct free_block *block)
+{
+	return (uint32_t)block >> PAGE_SHIFT;
+}
+
+static void list_push(uint32_t pfn, unsigned int order)
+{
+	struct free_block *block = pfn_to_block(pfn);
+
+	block->prev = 0;
+	block->next = free_lists[order];
+	if (block->next)
+		block->next->prev = block;
+	free_lists[order] = block;
+	frame_info[pfn] = FRAME_FREE | order;
+}
+
+static void list_remove(uint32_t pfn, unsigned int order)
+{
+	struct free_block *block = pfn_to_block(pfn);
+
+	if (block->prev)
+		block->prev->next = block->next;
+	else
+		free_lists[order] = block->next;
+	if (block->next)
+		block->next->prev = block->prev;
+	frame_info[pfn] = 0;
+}
+
+// Return a block to the free lists, coalescing with its buddy as far up
+// as possible: O(PMM_MAX_ORDER)
+static void free_block(uint32_t pfn, unsigned int order)
+{
+	free_pages += 1u << order;
+
+	while (order < PMM_MAX_ORDER) {
+		uint32_t buddy = pfn ^ (1u << order);
+
+		if (buddy >= max_pfn || frame_info[buddy] != (FRAME_FREE | order))
+			break;
+		list_remove(buddy, order);
+		pfn &= ~(1u << order);
+		order++;
+	}
+	list_push(pfn, order);
+}
+
+// Seed the allocator with [start, end) in the largest aligned blocks
+static void free_range(uint32_t start_pfn, uint32_t end_pfn)
+{
+	while (start_pfn < end_pfn) {
+		unsigned int order = 0;
+
+		while (order < PMM_MAX_ORDER &&
+		       !(start_pfn & ((2u << order) - 1)) &&
+		       start_pfn + (2u << order) <= end_pfn)
+			order++;
+
+		total_pages += 1u << order;
+		free_block(start_pfn, order);
+		start_pfn += 1u << order;
+	}
+}
+
+// Add a usable range minus any reserved ranges from index i on
+static void add_usable(uint32_t start_pfn, uint32_t end_pfn, int i)
+{
+	for (; i < reserved_count; i++) {
+		struct range *r = &reserved[i];
+
+		if (r->end_pfn <= start_pfn || r->start_pfn >= end_pfn)
+			continue;
+		if (start_pfn < r->start_pfn)
+			add_usable(start_pfn, r->start_pfn, i + 1);
+		if (r->end_pfn < end_pfn)
+			add_usable(r->end_pfn, end_pfn, i + 1);
+		return;
+	}
+	if (start_pfn < end_pfn)
+		free_range(start_pfn, end_pfn);
+}
+
+void pmm_reserve(uint32_t start, uint32_t end)
+{
+	if (reserved_count >= MAX_RESERVED || end <= start)
+		return;
+	reserved[reserved_count].start_pfn = start >> PAGE_SHIFT;
+	reserved[reserved_count].end_pfn = (end + PAGE_SIZE - 1) >> PAGE_SHIFT;
+	reserved_count++;
+}
+
+// Move start past every reserved range that [start, start + size) hits
+static uint32_t skip_reserved(uint32_t start, uint32_t size)
+{
+	for (int i = 0; i < reserved_count; i++) {
+		uint32_t r_start = reserved[i].start_pfn << PAGE_SHIFT;
+		uint32_t r_end = reserved[i].end_pfn << PAGE_SHIFT;
+
+		if (start < r_end && start + size > r_start) {
+			start = r_end;
+			i = -1; // rescan from the first range
+		}
+	}
+	return start;
+}
+
+// Clip an E820 entry to the managed window; returns 0 if nothing is left
+static int usable_range(const struct e820_entry *e, uint32_t *start_pfn,
+                        uint32_t *end_pfn)
+{
+	uint64_t start = e->base;
+	uint64_t end = e->base + e->length;
+
+	if (e->type != E820_USABLE)
+		return 0;
+	if (start < PMM_LOW_LIMIT)
+		start = PMM_LOW_LIMIT;
+	if (end > PMM_ADDR_LIMIT)
+		end = PMM_ADDR_LIMIT;
+	if (start >= end)
+		return 0;
+
+	*start_pfn = (uint32_t)((start + PAGE_SIZE - 1) >> PAGE_SHIFT);
+	*end_pfn = (uint32_t)(end >> PAGE_SHIFT);
+	return *start_pfn < *end_pfn;
+}
+
+void pmm_init(const struct e820_map *map)
+{
+	static const struct e820_entry fallback = {0, PMM_FALLBACK_END,
+	                                           E820_USABLE, 1};
+	const struct e820_entry *entries = &fallback;
+	uint32_t count = 1;
+	uint32_t start_pfn, end_pfn;
+
+	if (map && map->count > 0) {
+		entries = map->entries;
+		count = map->count;
+	}
+
+	for (uint32_t i = 0; i < count; i++) {
+		if (entries[i].type != E820_USABLE)
+			continue;
+		uint64_t end = entries[i].base + entries[i].length;
+		if (end > PMM_ADDR_LIMIT)
+			end = PMM_ADDR_LIMIT;
+		if (end > entries[i].base)
+			ram_bytes += end - entries[i].base;
+		if ((uint32_t)(end >> PAGE_SHIFT) > max_pfn)
+			max_pfn = (uint32_t)(end >> PAGE_SHIFT);
+	}
+
+	// frame_info[] goes in the first usable spot past the kernel image
+	uint32_t meta_size = (max_pfn + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+	uint32_t meta_min = (uint32_t)__kernel_end;
+	if (meta_min < PMM_LOW_LIMIT)
+		meta_min = PMM_LOW_LIMIT;
+	meta_min = (meta_min + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+
+	frame_info = 0;
+	for (uint32_t i = 0; i < count && !frame_info; i++) {
+		if (!usable_range(&entries[i], &start_pfn, &end_pfn))
+			continue;
+		uint32_t start = start_pfn << PAGE_SHIFT;
+		if (start < meta_min)
+			start = meta_min;
+		start = skip_reserved(start, meta_size);
+		if (start < (end_pfn << PAGE_SHIFT) &&
+		    (end_pfn << PAGE_SHIFT) - start >= meta_size)
+			frame_info = (uint8_t *)start;
+	}
+	if (!frame_info)
+		return;
+	memset(frame_info, 0, meta_size);
+
+	pmm_reserve((uint32_t)__kernel_start, (uint32_t)__kernel_end);
+	pmm_reserve((uint32_t)frame_info, (uint32_t)frame_info + meta_size);
+
+	for (uint32_t i = 0; i < count; i++) {
+		if (usable_range(&entries[i], &start_pfn, &end_pfn))
+			add_usable(start_pfn, end_pfn, 0);
+	}
+}
+
+uint32_t pmm_alloc_pages(unsigned int order)
+{
+	unsigned int o = order;
+
+	if (order > PMM_MAX_ORDER)
+		return 0;
+
+	int flags = spin_lock_irqsave(&pmm_lock);
+	while (o <= PMM_MAX_ORDER && !free_lists[o])
+		o++;
+	if (o > PMM_MAX_ORDER) {
+		spin_unlock_irqrestore(&pmm_lock, flags);
+		return 0;
+	}
+
+	uint32_t pfn = block_to_pfn(free_lists[o]);
+	list_remove(pfn, o);
+
+	// Split down, returning the upper halves to the free lists
+	while (o > order) {
+		o--;
+		list_push(pfn + (1u << o), o);
+	}
+
+	frame_info[pfn] = order;
+	free_pages -= 1u << order;
+	spin_unlock_irqrestore(&pmm_lock, flags);
+	return pfn << PAGE_SHIFT;
+}
+
+void pmm_free_pages(uint32_t addr, unsigned int order)
+{
+	uint32_t pfn = addr >> PAGE_SHIFT;
+
+	if (!addr || pfn >= max_pfn)
+		return;
+
+	int flags = spin_lock_irqsave(&pmm_lock);
+	if (!(frame_info[pfn] & FRAME_FREE))
+		free_block(pfn, order);
+	spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+uint64_t pmm_ram_bytes(void)
+{
+	return ram_bytes;
+}
+
+uint32_t pmm_total_pages(void)
+{
+	return total_pages;
+}
+
+uint32_t pmm_max_pfn(void)
+{
+	return max_pfn;
+}
+
+uint32_t pmm_free_page_count(void)
+{
+	return free_pages;
+}
@@ -0,0 +1,55 @@
+#ifndef PMM_H
+#define PMM_H
+
+#include <stdint.h>
+
+#define PAGE_SIZE 4096
+#define PAGE_SHIFT 12
+
+// Largest buddy block is 2^PMM_MAX_ORDER pages (4 MB)
+#define PMM_MAX_ORDER 10
+
+#define E820_USABLE 1
+
+struct e820_entry {
+	uint64_t base;
+	uint64_t length;
+	uint32_t type;
+	uint32_t acpi;
+} __attribute__((packed));
+
+// Layout written by boot.asm at physical 0x500
+struct e820_map {
+	uint32_t count;
+	uint32_t reserved;
+	struct e820_entry entries[];
+} __attribute__((packed));
+
+// Keep [start, end) out of the allocator (boot modules); only effective
+// before pmm_init()
+void pmm_reserve(uint32_t start, uint32_t end);
+void pmm_init(const struct e820_map *map);
+
+// Allocate 2^order physically contiguous, naturally aligned pages.
+// Returns the physical address, or 0 when out of memory.
+uint32_t pmm_alloc_pages(unsigned int order);
+void pmm_free_pages(uint32_t addr, unsigned int order);
+
+static inline uint32_t pmm_alloc_page(void)
+{
+	return pmm_alloc_pages(0);
+}
+
+static inline void pmm_free_page(uint32_t addr)
+{
+	pmm_free_pages(addr, 0);
+}
+
+// Usable RAM reported by the firmware, in bytes (capped at 3 GB)
+uint64_t pmm_ram_bytes(void);
+uint32_t pmm_total_pages(void);
+// One past the highest page frame number the allocator knows about
+uint32_t pmm_max_pfn(void);
+uint32_t pmm_free_page_count(void);
+
+#endif
@@ -0,0 +1,94 @@
+#include "rcu.h"
+#include "sched.h"
+#include "smp.h"
+#include "spinlock.h"
+
+// Below the shell, like the writeback thread: reclaiming memory is never
+// urgent
+#define RCU_PRIORITY (SCHED_PRIO_DEFAULT + 4)
+
+// Callbacks move through three lists: queued by call_rcu() until a grace
+// period starts, waiting until it ends, then done until the rcu thread
+// runs them. Only one grace period is in progress at a time; callbacks
+// queued during it wait for the next one.
+static spinlock_t rcu_lock;
+static struct rcu_head *next_list;
+static struct rcu_head *wait_list;
+static struct rcu_head *done_list;
+// CPUs that have not passed a quiescent state in this grace period; zero
+// when none is in progress
+static volatile uint32_t gp_pending;
+
+static struct wait_queue done_wait;
+
+// rcu_lock held
+static void start_grace_period(void)
+{
+	wait_list = next_list;
+	next_list = 0;
+	gp_pending = smp_online_mask();
+}
+
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *head))
+{
+	int was_enabled = spin_lock_irqsave(&rcu_lock);
+
+	head->func = func;
+	head->next = next_list;
+	next_list = head;
+	if (!gp_pending)
+		start_grace_period();
+	spin_unlock_irqrestore(&rcu_lock, was_enabled);
+}
+
+void rcu_quiescent_state(int cpu)
+{
+	uint32_t bit = 1u << cpu;
+
+	if (!(gp_pending & bit))
+		return;
+
+	spin_lock_raw(&rcu_lock);
+	gp_pending &= ~bit;
+	int finished = !gp_pending;
+	if (finished) {
+		while (wait_list) {
+			struct rcu_head *head = wait_list;
+			wait_list = head->next;
+			head->next = done_list;
+			done_list = head;
+		}
+		if (next_list)
+			start_grace_period();
+	}
+	spin_unlock_raw(&rcu_lock);
+
+	if (finished)
+		wait_queue_wake_all(&done_wait);
+}
+
+// Callbacks free memory, which can mean flushing other CPUs' TLBs, so
+// they run here rather than in the timer IRQ that ends the grace period
+static void rcu_thread(void *arg)
+{
+	(void)arg;
+	for (;;) {
+		wait_event(&done_wait, done_list != 0);
+
+		int was_enabled = spin_lock_irqsave(&rcu_lock);
+		struct rcu_head *list = done_list;
+		done_list = 0;
+		spin_unlock_irqrestore(&rcu_lock, was_enabled);
+
+		while (list) {
+			struct rcu_head *head = list;
+			list = head->next;
+			head->func(head);
+		}
+	}
+}
+
+void rcu_init(void)
+{
+	thread_create("rcu", rcu_thread, 0, RCU_PRIORITY);
+}
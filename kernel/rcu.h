@@ -0,0 +1,53 @@
+#ifndef RCU_H
+#define RCU_H
+
+#include <stdint.h>
+
+// Read-copy-update for read-mostly data. Readers take no locks: between
+// rcu_read_lock() and rcu_read_unlock() they may follow pointers loaded
+// with rcu_dereference(), and whatever those point to stays allocated.
+// Writers publish new versions with rcu_assign_pointer() and hand the
+// old ones to call_rcu(), which frees them after a grace period: once
+// every CPU has been seen outside a read-side section.
+//
+// A read-side section is a preemption-disabled region, so it must not
+// block. A timer tick that finds its CPU with preemption enabled counts
+// as that CPU's quiescent state.
+
+struct rcu_head {
+	struct rcu_head *next;
+	void (*func)(struct rcu_head *head);
+};
+
+#define rcu_dereference(p) __atomic_load_n(&(p), __ATOMIC_CONSUME)
+#define rcu_assign_pointer(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+// The object a struct rcu_head is embedded in, for callbacks
+#define rcu_entry(head, type, member)                                          \
+	((type *)((char *)(head) - __builtin_offsetof(type, member)))
+
+// sched.c
+void sched_preempt_disable(void);
+void sched_preempt_enable(void);
+
+static inline void rcu_read_lock(void)
+{
+	sched_preempt_disable();
+}
+
+static inline void rcu_read_unlock(void)
+{
+	sched_preempt_enable();
+}
+
+// Run func(head) from the rcu thread after a grace period. Safe from any
+// context, including before rcu_init().
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *head));
+
+// Start the thread that runs finished callbacks. Needs the scheduler.
+void rcu_init(void);
+
+// Timer tick on a CPU that is not in a read-side section
+void rcu_quiescent_state(int cpu);
+
+#endif
@@ -0,0 +1,646 @@
+#include "sched.h"
+#include "../drivers/timer.h"
+#include "../lib/math64.h"
+#include "../lib/string.h"
+#include "gdt.h"
+#include "interrupt.h"
+#include "kmalloc.h"
+#include "pmm.h"
+#include "rcu.h"
+#include "smp.h"
+
+#define THREAD_STACK_SIZE (PAGE_SIZE << THREAD_STACK_ORDER)
+#define TIMESLICE_TICKS (SCHED_TIMESLICE_MS * TIMER_HZ / 1000)
+
+// switch.asm: save callee-saved registers and the stack pointer in
+// *old_esp, then resume the thread whose stack pointer is new_esp
+void switch_context(uint32_t *old_esp, uint32_t new_esp);
+
+// Per-CPU scheduler state. The idle thread is not queued; it runs when
+// the queues are empty and there is nothing to steal. The lock is held
+// across switch_context() and released by the thread switched to, so no
+// other CPU can pick up a thread whose registers are still being saved.
+struct runqueue {
+	spinlock_t lock;
+	uint32_t cpu;
+	int online;
+	struct thread *current;
+	struct thread *idle;
+	struct thread *head[SCHED_PRIORITIES];
+	struct thread *tail[SCHED_PRIORITIES];
+	uint32_t ready_mask; // bit p set while run queue p is non-empty
+	uint32_t nr_ready;
+	volatile int need_resched;
+	struct thread *prev; // switched out, until finish_switch()
+	uint64_t switch_ns; // when current was switched in
+	uint64_t online_ns;
+	uint64_t idle_ns;
+	uint32_t steals;
+} __attribute__((aligned(64)));
+
+static struct runqueue runqueues[SMP_MAX_CPUS];
+
+static struct kmem_cache *thread_cache;
+static spinlock_t threads_lock; // all_threads and next_tid
+static struct thread *all_threads;
+static uint32_t next_tid;
+
+// Threads in thread_sleep_ms(), soonest wake_tick first
+static spinlock_t sleep_lock;
+static struct thread *sleepers;
+
+// Only meaningful while the caller cannot move to another CPU
+static inline struct runqueue *this_rq(void)
+{
+	return &runqueues[smp_cpu_id()];
+}
+
+static void runqueue_push(struct runqueue *rq, struct thread *t)
+{
+	uint32_t p = t->priority;
+
+	t->next = 0;
+	if (rq->tail[p])
+		rq->tail[p]->next = t;
+	else
+		rq->head[p] = t;
+	rq->tail[p] = t;
+	rq->ready_mask |= 1u << p;
+	rq->nr_ready++;
+}
+
+static struct thread *runqueue_pop(struct runqueue *rq)
+{
+	uint32_t p = __builtin_ctz(rq->ready_mask);
+	struct thread *t = rq->head[p];
+
+	rq->head[p] = t->next;
+	if (!rq->head[p]) {
+		rq->tail[p] = 0;
+		rq->ready_mask &= ~(1u << p);
+	}
+	rq->nr_ready--;
+	return t;
+}
+
+// t was just queued on rq: have that CPU switch if t is more urgent
+static void preempt_check(struct runqueue *rq, struct thread *t)
+{
+	if (!rq->current || t->priority >= rq->current->priority)
+		return;
+	rq->need_resched = 1;
+	if (rq != this_rq())
+		smp_send_resched(rq->cpu);
+}
+
+// Queue a thread that is neither queued nor running on the CPU it last
+// ran on. Interrupts off.
+static void enqueue(struct thread *t)
+{
+	struct runqueue *rq = &runqueues[t->cpu];
+
+	spin_lock_raw(&rq->lock);
+	t->state = THREAD_READY;
+	runqueue_push(rq, t);
+	preempt_check(rq, t);
+	spin_unlock_raw(&rq->lock);
+}
+
+// A thread that has not got off its CPU yet (between the two halves of a
+// wait) is only marked READY; block_current() sees that and carries on.
+// Interrupts off.
+static void wake_thread(struct thread *t)
+{
+	struct runqueue *rq = &runqueues[t->cpu];
+
+	spin_lock_raw(&rq->lock);
+	if (t->state == THREAD_SLEEPING) {
+		t->state = THREAD_READY;
+		if (!t->on_cpu) {
+			runqueue_push(rq, t);
+			preempt_check(rq, t);
+		}
+	}
+	spin_unlock_raw(&rq->lock);
+}
+
+// Take the most urgent queued thread from the CPU with the most waiting.
+// Only tries the lock: the victim may be doing the same to us.
+static struct thread *steal_work(struct runqueue *rq)
+{
+	struct runqueue *victim = 0;
+
+	for (int i = 0; i < SMP_MAX_CPUS; i++) {
+		struct runqueue *other = &runqueues[i];
+		if (other != rq && other->online && other->nr_ready &&
+		    (!victim || other->nr_ready > victim->nr_ready))
+			victim = other;
+	}
+	if (!victim || !spin_trylock_raw(&victim->lock))
+		return 0;
+
+	struct thread *t = victim->nr_ready ? runqueue_pop(victim) : 0;
+	spin_unlock_raw(&victim->lock);
+	if (t) {
+		t->cpu = rq->cpu;
+		rq->steals++;
+	}
+	return t;
+}
+
+static int work_to_steal(struct runqueue *rq)
+{
+	for (int i = 0; i < SMP_MAX_CPUS; i++) {
+		if (&runqueues[i] != rq && runqueues[i].nr_ready)
+			return 1;
+	}
+	return 0;
+}
+
+static void reap(struct thread *dead)
+{
+	spin_lock_raw(&threads_lock);
+	struct thread **link = &all_threads;
+	while (*link != dead)
+		link = &(*link)->all_next;
+	*link = dead->all_next;
+	spin_unlock_raw(&threads_lock);
+
+	pmm_free_pages(dead->stack, THREAD_STACK_ORDER);
+	kmem_cache_free(thread_cache, dead);
+}
+
+// Second half of a switch, run by the thread switched to. Its CPU may
+// not be the one it last ran on.
+static void finish_switch(void)
+{
+	struct runqueue *rq = this_rq();
+	struct thread *prev = rq->prev;
+
+	prev->on_cpu = 0;
+	spin_unlock_raw(&rq->lock);
+
+	// A thread that has exited cannot free the stack it is running on
+	if (prev->state == THREAD_DEAD)
+		reap(prev);
+}
+
+// Pick the next thread and switch to it. Runs with interrupts off and
+// rq->lock held; the current thread goes back on the run queue unless it
+// is blocking.
+static void schedule_locked(struct runqueue *rq)
+{
+	struct thread *prev = rq->current;
+
+	if (prev->state == THREAD_RUNNING && prev != rq->idle) {
+		prev->state = THREAD_READY;
+		runqueue_push(rq, prev);
+	}
+
+	struct thread *next = rq->ready_mask ? runqueue_pop(rq) : 0;
+	if (!next)
+		next = steal_work(rq);
+	if (!next)
+		next = rq->idle;
+
+	rq->need_resched = 0;
+	next->state = THREAD_RUNNING;
+	if (!next->slice)
+		next->slice = TIMESLICE_TICKS;
+	if (next == prev) {
+		spin_unlock_raw(&rq->lock);
+		return;
+	}
+
+	uint64_t now = timer_now_ns();
+	prev->cpu_ns += now - rq->switch_ns;
+	if (prev == rq->idle)
+		rq->idle_ns += now - rq->switch_ns;
+	rq->switch_ns = now;
+
+	// Interrupts and system calls from ring 3 start on the top of the
+	// thread's own kernel stack
+	if (next->stack)
+		tss_set_kernel_stack(rq->cpu, next->stack + THREAD_STACK_SIZE);
+
+	next->cpu = rq->cpu;
+	next->on_cpu = 1;
+	rq->current = next;
+	rq->prev = prev;
+	switch_context(&prev->esp, next->esp);
+	finish_switch();
+}
+
+static void schedule(void)
+{
+	struct runqueue *rq = this_rq();
+
+	spin_lock_raw(&rq->lock);
+	schedule_locked(rq);
+}
+
+// End of a section that ran with interrupts off: if it woke a more
+// urgent thread, switch to it before turning interrupts back on
+static void irq_restore(int was_enabled)
+{
+	if (!was_enabled)
+		return;
+
+	struct runqueue *rq = this_rq();
+	if (rq->current && rq->need_resched && !rq->current->preempt_count)
+		schedule();
+	interrupts_enable();
+}
+
+// Second half of a wait: sleep unless a wake-up already came in since
+// the thread marked itself SLEEPING. Gives back the preemption count the
+// first half took.
+static void block_current(void)
+{
+	int was_enabled = interrupts_enabled();
+
+	interrupts_disable();
+	struct runqueue *rq = this_rq();
+	struct thread *self = rq->current;
+
+	spin_lock_raw(&rq->lock);
+	self->preempt_count--;
+	if (self->state == THREAD_SLEEPING) {
+		schedule_locked(rq);
+	} else {
+		self->state = THREAD_RUNNING;
+		spin_unlock_raw(&rq->lock);
+	}
+	irq_restore(was_enabled);
+}
+
+// First code a new thread runs, "returned" to by switch_context()
+static void thread_start(void)
+{
+	finish_switch();
+	interrupts_enable();
+
+	struct thread *self = thread_current();
+	self->entry(self->arg);
+	thread_exit();
+}
+
+static void idle_loop(void *arg)
+{
+	(void)arg;
+	for (;;)
+		interrupts_wait();
+}
+
+static struct thread *thread_alloc(const char *name,
+                                   void (*entry)(void *arg), void *arg,
+                                   uint32_t priority)
+{
+	struct thread *t = kmem_cache_alloc(thread_cache);
+	uint32_t stack = pmm_alloc_pages(THREAD_STACK_ORDER);
+
+	if (!t || !stack) {
+		if (t)
+			kmem_cache_free(thread_cache, t);
+		if (stack)
+			pmm_free_pages(stack, THREAD_STACK_ORDER);
+		return 0;
+	}
+
+	memset(t, 0, sizeof(*t));
+	strncpy(t->name, name, THREAD_NAME_LEN - 1);
+	t->priority = priority < SCHED_PRIORITIES ? priority : SCHED_PRIO_IDLE;
+	t->stack = stack;
+	t->entry = entry;
+	t->arg = arg;
+
+	// Frame for switch_context() to pop: edi, esi, ebx, ebp, then the
+	// return address, plus a dummy return address for thread_start()
+	uint32_t *sp = (uint32_t *)(stack + THREAD_STACK_SIZE);
+	*--sp = 0;
+	*--sp = (uint32_t)thread_start;
+	for (int i = 0; i < 4; i++)
+		*--sp = 0;
+	t->esp = (uint32_t)sp;
+	return t;
+}
+
+// Give t a tid and put it on the thread list
+static void thread_publish(struct thread *t)
+{
+	int was_enabled = spin_lock_irqsave(&threads_lock);
+
+	t->tid = next_tid++;
+	t->all_next = all_threads;
+	all_threads = t;
+	spin_unlock_irqrestore(&threads_lock, was_enabled);
+}
+
+void sched_init(void)
+{
+	struct runqueue *rq = &runqueues[0];
+
+	thread_cache = kmem_cache_create("thread", sizeof(struct thread));
+
+	struct thread *t = kmem_cache_alloc(thread_cache);
+	memset(t, 0, sizeof(*t));
+	strcpy(t->name, "main");
+	t->state = THREAD_RUNNING;
+	t->priority = SCHED_PRIO_DEFAULT;
+	t->slice = TIMESLICE_TICKS;
+	t->on_cpu = 1;
+	thread_publish(t);
+
+	rq->idle = thread_alloc("idle", idle_loop, 0, SCHED_PRIO_IDLE);
+	thread_publish(rq->idle);
+	rq->switch_ns = rq->online_ns = timer_now_ns();
+	rq->online = 1;
+	rq->current = t;
+}
+
+int sched_running(void)
+{
+	return this_rq()->current != 0;
+}
+
+uint32_t sched_ap_prepare(int cpu)
+{
+	struct thread *idle =
+	    thread_alloc("idle", idle_loop, 0, SCHED_PRIO_IDLE);
+
+	if (!idle)
+		return 0;
+	idle->cpu = cpu;
+	runqueues[cpu].cpu = cpu;
+	runqueues[cpu].idle = idle;
+	return idle->stack + THREAD_STACK_SIZE;
+}
+
+void sched_ap_enter(void)
+{
+	struct runqueue *rq = this_rq();
+	struct thread *idle = rq->idle;
+
+	thread_publish(idle);
+	idle->state = THREAD_RUNNING;
+	idle->on_cpu = 1;
+	rq->switch_ns = rq->online_ns = timer_now_ns();
+	rq->current = idle;
+	rq->online = 1;
+
+	interrupts_enable();
+	idle_loop(0);
+	for (;;)
+		;
+}
+
+struct thread *thread_create(const char *name, void (*entry)(void *arg),
+                             void *arg, uint32_t priority)
+{
+	struct thread *t = thread_alloc(name, entry, arg, priority);
+
+	if (!t)
+		return 0;
+	thread_publish(t);
+
+	// Start on this CPU; an idle one will take it if this one is busy
+	int was_enabled = interrupts_enabled();
+	interrupts_disable();
+	t->cpu = this_rq()->cpu;
+	enqueue(t);
+	irq_restore(was_enabled);
+	return t;
+}
+
+void thread_exit(void)
+{
+	interrupts_disable();
+	struct runqueue *rq = this_rq();
+
+	spin_lock_raw(&rq->lock);
+	rq->current->state = THREAD_DEAD;
+	schedule_locked(rq);
+	for (;;)
+		;
+}
+
+struct thread *thread_current(void)
+{
+	int was_enabled = interrupts_enabled();
+
+	interrupts_disable();
+	struct thread *t = this_rq()->current;
+	if (was_enabled)
+		interrupts_enable();
+	return t;
+}
+
+void thread_yield(void)
+{
+	int was_enabled = interrupts_enabled();
+
+	interrupts_disable();
+	schedule();
+	if (was_enabled)
+		interrupts_enable();
+}
+
+void thread_sleep_ms(uint32_t ms)
+{
+	uint64_t wake =
+	    timer_ticks() + div64_u32((uint64_t)ms * TIMER_HZ, 1000, 0);
+
+	sched_preempt_disable();
+	struct thread *self = thread_current();
+
+	int was_enabled = spin_lock_irqsave(&sleep_lock);
+	self->wake_tick = wake;
+	self->state = THREAD_SLEEPING;
+
+	struct thread **link = &sleepers;
+	while (*link && (*link)->wake_tick <= wake)
+		link = &(*link)->next;
+	self->next = *link;
+	*link = self;
+	spin_unlock_irqrestore(&sleep_lock, was_enabled);
+
+	block_current();
+}
+
+// Preemption stays off until block_current() or wait_queue_finish(): a
+// thread switched out while marked SLEEPING would not be requeued, and
+// could miss a wake-up that came before it
+void wait_queue_prepare(struct wait_queue *wq)
+{
+	if (!sched_running()) {
+		interrupts_disable();
+		return;
+	}
+
+	sched_preempt_disable();
+	struct thread *self = thread_current();
+
+	int was_enabled = spin_lock_irqsave(&wq->lock);
+	self->state = THREAD_SLEEPING;
+	self->wq = wq;
+	self->next = 0;
+	if (wq->tail)
+		wq->tail->next = self;
+	else
+		wq->head = self;
+	wq->tail = self;
+	spin_unlock_irqrestore(&wq->lock, was_enabled);
+}
+
+void wait_queue_sleep(struct wait_queue *wq)
+{
+	(void)wq;
+	if (!sched_running()) {
+		interrupts_wait();
+		return;
+	}
+	// Whoever wakes the thread also takes it off wq
+	block_current();
+}
+
+void wait_queue_finish(struct wait_queue *wq)
+{
+	if (!sched_running()) {
+		interrupts_enable();
+		return;
+	}
+
+	struct thread *self = thread_current();
+	int was_enabled = spin_lock_irqsave(&wq->lock);
+
+	if (self->wq == wq) {
+		struct thread **link = &wq->head;
+		struct thread *prev = 0;
+		while (*link != self) {
+			prev = *link;
+			link = &(*link)->next;
+		}
+		*link = self->next;
+		if (wq->tail == self)
+			wq->tail = prev;
+		self->wq = 0;
+	}
+	spin_unlock_raw(&wq->lock);
+
+	struct runqueue *rq = this_rq();
+	spin_lock_raw(&rq->lock);
+	self->state = THREAD_RUNNING;
+	spin_unlock_raw(&rq->lock);
+	if (was_enabled)
+		interrupts_enable();
+
+	sched_preempt_enable();
+}
+
+void wait_queue_wake_all(struct wait_queue *wq)
+{
+	int was_enabled = spin_lock_irqsave(&wq->lock);
+	struct thread *t = wq->head;
+
+	wq->head = wq->tail = 0;
+	while (t) {
+		struct thread *next = t->next;
+		t->wq = 0;
+		wake_thread(t);
+		t = next;
+	}
+	spin_unlock_raw(&wq->lock);
+	irq_restore(was_enabled);
+}
+
+void sched_preempt_disable(void)
+{
+	struct thread *self = thread_current();
+
+	if (self)
+		self->preempt_count++;
+}
+
+void sched_preempt_enable(void)
+{
+	struct thread *self = thread_current();
+
+	if (!self || --self->preempt_count || !interrupts_enabled())
+		return;
+	interrupts_disable();
+	irq_restore(1);
+}
+
+void sched_wake_sleepers(uint64_t now)
+{
+	spin_lock_raw(&sleep_lock);
+	while (sleepers && sleepers->wake_tick <= now) {
+		struct thread *t = sleepers;
+		sleepers = t->next;
+		wake_thread(t);
+	}
+	spin_unlock_raw(&sleep_lock);
+}
+
+void sched_tick(void)
+{
+	struct runqueue *rq = this_rq();
+	struct thread *t = rq->current;
+
+	if (!t)
+		return;
+	// Read-side sections run with preemption off
+	if (!t->preempt_count)
+		rcu_quiescent_state(rq->cpu);
+	if (t == rq->idle) {
+		if (work_to_steal(rq))
+			rq->need_resched = 1;
+	} else if (t->slice && --t->slice == 0) {
+		rq->need_resched = 1;
+	}
+}
+
+void sched_irq_exit(void)
+{
+	struct runqueue *rq = this_rq();
+
+	if (rq->current && rq->need_resched && !rq->current->preempt_count)
+		schedule();
+}
+
+int thread_snapshot(struct thread_info *info, int max)
+{
+	uint64_t now = timer_now_ns();
+	int count = 0;
+	int was_enabled = spin_lock_irqsave(&threads_lock);
+
+	for (struct thread *t = all_threads; t && count < max;
+	     t = t->all_next, count++) {
+		info[count].tid = t->tid;
+		strcpy(info[count].name, t->name);
+		info[count].state = t->state;
+		info[count].priority = t->priority;
+		info[count].cpu = t->cpu;
+		info[count].cpu_ns = t->cpu_ns;
+		if (t->on_cpu && runqueues[t->cpu].current == t)
+			info[count].cpu_ns += now - runqueues[t->cpu].switch_ns;
+	}
+	spin_unlock_irqrestore(&threads_lock, was_enabled);
+	return count;
+}
+
+int sched_cpu_stats(int cpu, struct sched_cpu_stats *stats)
+{
+	if (cpu < 0 || cpu >= SMP_MAX_CPUS || !runqueues[cpu].online)
+		return -1;
+
+	struct runqueue *rq = &runqueues[cpu];
+	uint64_t now = timer_now_ns();
+
+	stats->online_ns = now - rq->online_ns;
+	stats->idle_ns = rq->idle_ns;
+	if (rq->current == rq->idle)
+		stats->idle_ns += now - rq->switch_ns;
+	stats->steals = rq->steals;
+	return 0;
+}
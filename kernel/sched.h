@@ -0,0 +1,132 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+#include "spinlock.h"
+
+// Priority 0 is the most urgent. Each CPU has its own FIFO run queue per
+// priority; a bitmap of the non-empty ones makes picking the next thread
+// O(1). Threads of equal priority take turns every SCHED_TIMESLICE_MS.
+// A CPU with nothing to run steals from the busiest other CPU.
+#define SCHED_PRIORITIES 32
+#define SCHED_PRIO_DEFAULT 16
+#define SCHED_PRIO_IDLE (SCHED_PRIORITIES - 1)
+#define SCHED_TIMESLICE_MS 10
+
+// Kernel stacks are 2^order pages
+#define THREAD_STACK_ORDER 2
+#define THREAD_NAME_LEN 16
+
+enum thread_state {
+	THREAD_RUNNING,
+	THREAD_READY,
+	THREAD_SLEEPING,
+	THREAD_DEAD,
+};
+
+struct wait_queue;
+struct user_task;
+
+struct thread {
+	uint32_t esp; // saved by switch_context() while not running
+	uint32_t tid;
+	char name[THREAD_NAME_LEN];
+	enum thread_state state;
+	uint32_t priority;
+	uint32_t slice; // ticks left before a thread of equal priority runs
+	uint32_t cpu; // CPU it runs on, or last ran on
+	volatile int on_cpu; // registers not saved yet
+	int preempt_count;
+	uint64_t cpu_ns;
+	uint64_t wake_tick; // while in thread_sleep_ms()
+	uint32_t stack; // base of the kernel stack; 0 for the boot thread
+	void (*entry)(void *arg);
+	void *arg;
+	struct wait_queue *wq; // queue it is waiting on, if any
+	struct user_task *user; // ring-3 program it runs, if any
+	struct thread *next; // run queue, wait queue or sleep list
+	struct thread *all_next;
+};
+
+// Threads blocked until an event. Wake-ups are safe from IRQ handlers and
+// from other CPUs.
+struct wait_queue {
+	spinlock_t lock;
+	struct thread *head;
+	struct thread *tail;
+};
+
+// Sleep until cond holds. cond is checked after the thread is queued, so
+// a wake-up between the check and the sleep is not lost; the waker makes
+// cond true first, then calls wait_queue_wake_all(). Before the
+// scheduler is up this is the usual disable interrupts, check, then
+// interrupts_wait() loop.
+#define wait_event(wq, cond)                                               \
+	do {                                                                   \
+		wait_queue_prepare(wq);                                            \
+		while (!(cond)) {                                                  \
+			wait_queue_sleep(wq);                                          \
+			wait_queue_prepare(wq);                                        \
+		}                                                                  \
+		wait_queue_finish(wq);                                             \
+	} while (0)
+
+// Turn the boot context into thread "main" and give the boot CPU its
+// idle thread. Needs kmalloc; until then waits fall back to halting.
+void sched_init(void);
+int sched_running(void);
+
+// Application processors: sched_ap_prepare() (on the BSP) creates the
+// idle thread for a CPU and returns the top of its stack for the AP to
+// start on; the AP then becomes that thread with sched_ap_enter()
+uint32_t sched_ap_prepare(int cpu);
+void sched_ap_enter(void) __attribute__((noreturn));
+
+struct thread *thread_create(const char *name, void (*entry)(void *arg),
+                             void *arg, uint32_t priority);
+void thread_exit(void) __attribute__((noreturn));
+struct thread *thread_current(void);
+void thread_yield(void);
+void thread_sleep_ms(uint32_t ms);
+
+// The steps of wait_event()
+void wait_queue_prepare(struct wait_queue *wq);
+void wait_queue_sleep(struct wait_queue *wq);
+void wait_queue_finish(struct wait_queue *wq);
+void wait_queue_wake_all(struct wait_queue *wq);
+
+// Nestable. Keeps the current thread on its CPU (interrupts still run)
+// until the matching enable.
+void sched_preempt_disable(void);
+void sched_preempt_enable(void);
+
+// PIT IRQ on the boot CPU: wake threads whose sleep has ended
+void sched_wake_sleepers(uint64_t now);
+// Every CPU's timer tick: charge the running thread's time slice and
+// report an RCU quiescent state if it is not in a read-side section
+void sched_tick(void);
+// Called on the way out of every IRQ; switches threads if one is due
+void sched_irq_exit(void);
+
+// Copy of a thread's state for ps
+struct thread_info {
+	uint32_t tid;
+	char name[THREAD_NAME_LEN];
+	enum thread_state state;
+	uint32_t priority;
+	uint32_t cpu;
+	uint64_t cpu_ns; // including the current run
+};
+
+struct sched_cpu_stats {
+	uint64_t online_ns;
+	uint64_t idle_ns;
+	uint32_t steals; // threads taken from other CPUs
+};
+
+// Fill info with up to max threads; returns how many
+int thread_snapshot(struct thread_info *info, int max);
+// -1 if the CPU is not running
+int sched_cpu_stats(int cpu, struct sched_cpu_stats *stats);
+
+#endif
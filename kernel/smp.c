@@ -0,0 +1,223 @@
+#include "smp.h"
+#include "../drivers/console.h"
+#include "../drivers/timer.h"
+#include "../lib/string.h"
+#include "acpi.h"
+#include "apic.h"
+#include "gdt.h"
+#include "interrupt.h"
+#include "sched.h"
+#include "spinlock.h"
+#include "syscall.h"
+
+// Where the AP start-up code runs; must match trampoline.asm and be a
+// page below 1 MB that nothing else uses once the kernel is up
+#define TRAMPOLINE_BASE 0x8000
+
+// Intel's INIT-SIPI-SIPI timing
+#define INIT_DELAY_US 10000
+#define STARTUP_DELAY_US 200
+#define AP_START_TIMEOUT_US 100000
+
+// trampoline.asm
+extern char trampoline_start[];
+extern char trampoline_end[];
+extern char trampoline_params[];
+
+struct trampoline_params {
+	uint32_t cr3;
+	uint32_t cr4;
+	uint32_t cr0;
+	uint32_t stack;
+	uint32_t entry;
+} __attribute__((packed));
+
+static int apic_mode = 0;
+static uint8_t cpu_apic_id[SMP_MAX_CPUS];
+static uint8_t apic_to_cpu[256];
+// Bit n set once CPU n takes interrupts
+static volatile uint32_t online_mask = 1;
+static volatile int ap_started;
+
+// TLB shootdowns are numbered; each CPU records the last one it handled
+static volatile uint32_t tlb_generation;
+static volatile uint32_t tlb_done[SMP_MAX_CPUS];
+
+static void udelay(uint32_t us)
+{
+	uint64_t end = timer_now_ns() + (uint64_t)us * 1000;
+
+	while (timer_now_ns() < end)
+		cpu_relax();
+}
+
+static void apic_timer_irq(struct regs *r)
+{
+	(void)r;
+	sched_tick();
+}
+
+static void tlb_irq(struct regs *r)
+{
+	(void)r;
+	uint32_t cr3;
+
+	__asm__ volatile("mov %%cr3, %0; mov %0, %%cr3" : "=r"(cr3) : : "memory");
+	tlb_done[smp_cpu_id()] = tlb_generation;
+}
+
+// First C code on an AP, on its idle thread's stack
+static void ap_main(void)
+{
+	int cpu = smp_cpu_id();
+
+	gdt_init_ap(cpu);
+	interrupt_init_ap();
+	syscall_init_ap(cpu);
+	lapic_enable();
+	lapic_timer_start();
+
+	__atomic_or_fetch(&online_mask, 1u << cpu, __ATOMIC_SEQ_CST);
+	ap_started = 1;
+	sched_ap_enter();
+}
+
+static int start_ap(uint8_t apic_id)
+{
+	ap_started = 0;
+	lapic_send_init(apic_id);
+	udelay(INIT_DELAY_US);
+	for (int i = 0; i < 2 && !ap_started; i++) {
+		lapic_send_startup(apic_id, TRAMPOLINE_BASE);
+		udelay(STARTUP_DELAY_US);
+	}
+
+	uint64_t deadline = timer_now_ns() + AP_START_TIMEOUT_US * 1000ull;
+	while (!ap_started) {
+		if (timer_now_ns() >= deadline)
+			return -1;
+		cpu_relax();
+	}
+	return 0;
+}
+
+// Copy the start-up code into place; returns its parameter block
+static struct trampoline_params *setup_trampoline(void)
+{
+	struct trampoline_params *params =
+	    (void *)(TRAMPOLINE_BASE + (trampoline_params - trampoline_start));
+
+	memcpy((void *)TRAMPOLINE_BASE, trampoline_start,
+	       trampoline_end - trampoline_start);
+
+	__asm__ volatile("mov %%cr3, %0" : "=r"(params->cr3));
+	__asm__ volatile("mov %%cr4, %0" : "=r"(params->cr4));
+	__asm__ volatile("mov %%cr0, %0" : "=r"(params->cr0));
+	params->entry = (uint32_t)ap_main;
+	return params;
+}
+
+int smp_init(void)
+{
+	struct acpi_madt_info madt;
+
+	// The APIC timer is calibrated against the TSC
+	if (!timer_tsc_khz() || acpi_parse_madt(&madt) != 0 ||
+	    lapic_init(madt.lapic_base) != 0)
+		return 1;
+
+	uint8_t bsp = lapic_id();
+	if (ioapic_init(&madt, bsp) != 0)
+		return 1;
+
+	cpu_apic_id[0] = bsp;
+	apic_to_cpu[bsp] = 0;
+	apic_mode = 1;
+
+	lapic_enable();
+	interrupt_register(APIC_TIMER_VECTOR, apic_timer_irq);
+	interrupt_register(IPI_TLB_VECTOR, tlb_irq);
+	irq_use_ioapic();
+
+	// The boot CPU keeps the PIT for its ticks; APs use their APIC timer
+	if (lapic_timer_calibrate() != 0)
+		return 1;
+
+	struct trampoline_params *params = setup_trampoline();
+	int count = 1;
+	for (uint32_t i = 0; i < madt.cpu_count && count < SMP_MAX_CPUS; i++) {
+		uint8_t id = madt.cpu_apic_ids[i];
+		if (id == bsp)
+			continue;
+
+		uint32_t stack = sched_ap_prepare(count);
+		if (!stack)
+			break;
+		cpu_apic_id[count] = id;
+		apic_to_cpu[id] = count;
+		params->stack = stack;
+
+		// An AP that does not answer might still wake up later, so
+		// stop rather than reuse its stack and CPU number
+		if (start_ap(id) != 0)
+			break;
+		count++;
+	}
+	return count;
+}
+
+int smp_cpu_id(void)
+{
+	return apic_mode ? apic_to_cpu[lapic_id()] : 0;
+}
+
+uint32_t smp_online_mask(void)
+{
+	return online_mask;
+}
+
+int smp_cpu_count(void)
+{
+	int count = 0;
+
+	for (uint32_t mask = online_mask; mask; mask &= mask - 1)
+		count++;
+	return count;
+}
+
+// The IPI needs no handler: interrupt_dispatch() ends in
+// sched_irq_exit() like every IRQ
+void smp_send_resched(int cpu)
+{
+	lapic_send_ipi(cpu_apic_id[cpu], IPI_RESCHED_VECTOR);
+}
+
+void smp_tlb_shootdown(void)
+{
+	uint32_t others = online_mask & ~(1u << smp_cpu_id());
+
+	if (!others)
+		return;
+
+	// The wait below only ends once every other CPU takes the IPI. With
+	// interrupts off here, or a lock held that one of them may be
+	// spinning for with its own off, it never would: stop loudly instead.
+	struct thread *self = thread_current();
+	if (!interrupts_enabled() || (self && self->preempt_count)) {
+		kprintf(CON_RED "\nKERNEL PANIC: TLB shootdown with interrupts off "
+		                "or a lock held\n" CON_NORMAL);
+		for (;;)
+			__asm__ volatile("cli; hlt");
+	}
+
+	uint32_t generation =
+	    __atomic_add_fetch(&tlb_generation, 1, __ATOMIC_SEQ_CST);
+	lapic_send_ipi_others(IPI_TLB_VECTOR);
+
+	for (int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+		if (!(others & (1u << cpu)))
+			continue;
+		while ((int32_t)(tlb_done[cpu] - generation) < 0)
+			cpu_relax();
+	}
+}
@@ -0,0 +1,27 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include <stdint.h>
+
+#define SMP_MAX_CPUS 8
+
+// Find the CPUs in the ACPI MADT, switch IRQs to the IO-APIC and start
+// the application processors, each of which joins the scheduler as an
+// idle CPU. Needs paging, the timer and the scheduler; returns the
+// number of CPUs running (1 when there is no APIC or MADT).
+int smp_init(void);
+
+// Index of the calling CPU, 0 for the boot CPU
+int smp_cpu_id(void);
+int smp_cpu_count(void);
+// Bit n set for each CPU taking interrupts
+uint32_t smp_online_mask(void);
+
+// Make another CPU go through sched_irq_exit()
+void smp_send_resched(int cpu);
+// After changing a mapping that other CPUs may have cached, flush every
+// CPU's TLB. Returns once they all have; call with interrupts on and
+// no spinlock held (nor inside rcu_read_lock()), or it halts.
+void smp_tlb_shootdown(void);
+
+#endif
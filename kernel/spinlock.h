@@ -0,0 +1,91 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include <stdint.h>
+#include "interrupt.h"
+
+// Ticket lock: each CPU takes the next ticket and spins until the owner
+// count reaches it, so waiters get the lock in arrival order. Zero
+// initialized (static storage) is unlocked.
+typedef union {
+	uint32_t word;
+	struct {
+		uint16_t owner;
+		uint16_t next;
+	} t;
+} spinlock_t;
+
+#define SPINLOCK_INIT {0}
+
+// sched.c; a thread holding a spinlock must not be switched out, or the
+// next thread on that CPU to want the lock would spin forever
+void sched_preempt_disable(void);
+void sched_preempt_enable(void);
+
+static inline void cpu_relax(void)
+{
+	__asm__ volatile("pause" ::: "memory");
+}
+
+// The raw variants neither disable preemption nor interrupts; for callers
+// that already run with interrupts off
+static inline void spin_lock_raw(spinlock_t *lock)
+{
+	uint16_t ticket = __atomic_fetch_add(&lock->t.next, 1, __ATOMIC_RELAXED);
+
+	while (__atomic_load_n(&lock->t.owner, __ATOMIC_ACQUIRE) != ticket)
+		cpu_relax();
+}
+
+// Only succeeds when nobody holds or waits for the lock
+static inline int spin_trylock_raw(spinlock_t *lock)
+{
+	spinlock_t old, new;
+
+	old.word = __atomic_load_n(&lock->word, __ATOMIC_RELAXED);
+	if (old.t.owner != old.t.next)
+		return 0;
+	new = old;
+	new.t.next++;
+	return __atomic_compare_exchange_n(&lock->word, &old.word, new.word, 0,
+	                                   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static inline void spin_unlock_raw(spinlock_t *lock)
+{
+	__atomic_store_n(&lock->t.owner, lock->t.owner + 1, __ATOMIC_RELEASE);
+}
+
+// For state shared between threads only. Interrupts stay on, so a
+// waiter still takes IPIs while it spins.
+static inline void spin_lock(spinlock_t *lock)
+{
+	sched_preempt_disable();
+	spin_lock_raw(lock);
+}
+
+static inline void spin_unlock(spinlock_t *lock)
+{
+	spin_unlock_raw(lock);
+	sched_preempt_enable();
+}
+
+// For state an IRQ handler also touches. Returns the previous interrupt
+// flag for spin_unlock_irqrestore().
+static inline int spin_lock_irqsave(spinlock_t *lock)
+{
+	int was_enabled = interrupts_enabled();
+
+	interrupts_disable();
+	spin_lock_raw(lock);
+	return was_enabled;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t *lock, int was_enabled)
+{
+	spin_unlock_raw(lock);
+	if (was_enabled)
+		interrupts_enable();
+}
+
+#endif
@@ -0,0 +1,27 @@
+; switch.asm - kernel thread context switch
+bits 32
+
+section .text
+
+; void switch_context(uint32_t *old_esp, uint32_t new_esp)
+; Only the callee-saved registers need saving; the caller (schedule() in
+; sched.c) has interrupts off, and EFLAGS comes back with the thread's
+; own interrupts_enable(). There is no FPU/SSE state to save: the SSE2
+; string routines run with interrupts off and never span a switch.
+global switch_context
+switch_context:
+    mov eax, [esp + 4]
+    mov edx, [esp + 8]
+
+    push ebp
+    push ebx
+    push esi
+    push edi
+    mov [eax], esp
+
+    mov esp, edx
+    pop edi
+    pop esi
+    pop ebx
+    pop ebp
+    ret
@@ -0,0 +1,238 @@
+#include "syscall.h"
+#include "../drivers/console.h"
+#include "../drivers/timer.h"
+#include "../fs/fs.h"
+#include "../lib/string.h"
+#include "cpu.h"
+#include "gdt.h"
+#include "interrupt.h"
+#include "pmm.h"
+#include "sched.h"
+#include "user.h"
+
+#define MSR_SYSENTER_CS 0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+
+// Longest line a console read returns
+#define CONSOLE_LINE_MAX 256
+
+typedef int32_t (*syscall_fn)(uint32_t a, uint32_t b, uint32_t c);
+
+// isr.asm
+extern char sysenter_entry[];
+// userbench.asm
+extern char user_bench_start[];
+extern char user_bench_end[];
+
+static int have_sysenter = 0;
+
+void syscall_init_ap(int cpu)
+{
+	if (!have_sysenter)
+		return;
+	wrmsr(MSR_SYSENTER_CS, GDT_KERNEL_CODE);
+	wrmsr(MSR_SYSENTER_ESP, tss_kernel_stack_slot(cpu));
+	wrmsr(MSR_SYSENTER_EIP, (uint32_t)sysenter_entry);
+}
+
+void syscall_init(void)
+{
+	uint32_t eax, ebx, ecx, edx;
+
+	cpuid(1, &eax, &ebx, &ecx, &edx);
+	have_sysenter = (edx & CPUID_EDX_SEP) != 0;
+	// The Pentium Pro sets the bit without having the instructions
+	uint32_t family = (eax >> 8) & 0xF;
+	uint32_t model = (eax >> 4) & 0xF;
+	if (family == 6 && model < 3 && (eax & 0xF) < 3)
+		have_sysenter = 0;
+
+	syscall_init_ap(0);
+}
+
+int syscall_have_sysenter(void)
+{
+	return have_sysenter;
+}
+
+static struct user_file *get_file(uint32_t fd)
+{
+	struct user_task *task = user_current();
+
+	if (!task || fd >= USER_MAX_FILES || !task->files[fd].used)
+		return 0;
+	return &task->files[fd];
+}
+
+static int32_t sys_exit(uint32_t code, uint32_t b, uint32_t c)
+{
+	(void)b;
+	(void)c;
+	if (!user_current())
+		return -1;
+	user_exit((int)code);
+}
+
+static int32_t sys_read(uint32_t fd, uint32_t buf, uint32_t len)
+{
+	struct user_file *f = get_file(fd);
+
+	if (!f || (f->flags & O_ACCMODE) == O_WRONLY || !user_check(buf, len, 1))
+		return -1;
+
+	if (!f->inode) {
+		char line[CONSOLE_LINE_MAX];
+		console_readline(line, sizeof(line) - 1);
+		uint32_t n = strlen(line);
+		line[n++] = '\n';
+		if (n > len)
+			n = len;
+		memcpy((void *)buf, line, n);
+		return n;
+	}
+
+	int n = fs_read_at(f->inode, f->offset, (char *)buf, len);
+	if (n > 0)
+		f->offset += n;
+	return n;
+}
+
+static int32_t sys_write(uint32_t fd, uint32_t buf, uint32_t len)
+{
+	struct user_file *f = get_file(fd);
+
+	if (!f || (f->flags & O_ACCMODE) == O_RDONLY || !user_check(buf, len, 0))
+		return -1;
+
+	if (!f->inode) {
+		console_write((const char *)buf, len);
+		return len;
+	}
+
+	if (f->flags & O_APPEND)
+		f->offset = f->inode->size;
+	int n = fs_write_at(f->inode, f->offset, (const char *)buf, len);
+	if (n > 0)
+		f->offset += n;
+	return n;
+}
+
+static inode_t *open_node(const char *path, uint32_t flags)
+{
+	inode_t *node = fs_resolve_path(path);
+
+	if (!node && (flags & O_CREAT)) {
+		char leaf[MAX_FILENAME];
+		inode_t *parent = fs_resolve_parent(path, leaf);
+		if (parent)
+			node = fs_create_file(parent, leaf);
+		fs_put(parent);
+	}
+	if (node && (node->type != INODE_FILE ||
+	             ((flags & O_TRUNC) && (flags & O_ACCMODE) != O_RDONLY &&
+	              fs_write_file(node, "", 0) != 0))) {
+		fs_put(node);
+		return 0;
+	}
+	return node;
+}
+
+static int32_t sys_open(uint32_t path, uint32_t flags, uint32_t c)
+{
+	(void)c;
+	struct user_task *task = user_current();
+	char kpath[MAX_PATH];
+
+	if (!task || user_copy_string(kpath, path, sizeof(kpath)) < 0)
+		return -1;
+
+	int fd = USER_FIRST_FILE;
+	while (fd < USER_MAX_FILES && task->files[fd].used)
+		fd++;
+	if (fd == USER_MAX_FILES)
+		return -1;
+
+	inode_t *node = open_node(kpath, flags);
+	if (!node)
+		return -1;
+
+	struct user_file *f = &task->files[fd];
+	f->used = 1;
+	f->flags = flags;
+	f->inode = node;
+	f->offset = 0;
+	return fd;
+}
+
+static int32_t sys_close(uint32_t fd, uint32_t b, uint32_t c)
+{
+	(void)b;
+	(void)c;
+	struct user_file *f = get_file(fd);
+
+	if (!f)
+		return -1;
+	f->used = 0;
+	fs_put(f->inode);
+	f->inode = 0;
+	return 0;
+}
+
+static int32_t sys_gettid(uint32_t a, uint32_t b, uint32_t c)
+{
+	(void)a;
+	(void)b;
+	(void)c;
+	return thread_current()->tid;
+}
+
+static const syscall_fn syscalls[SYSCALL_COUNT] = {
+    [SYS_EXIT] = sys_exit,   [SYS_READ] = sys_read,
+    [SYS_WRITE] = sys_write, [SYS_OPEN] = sys_open,
+    [SYS_CLOSE] = sys_close, [SYS_GETTID] = sys_gettid,
+};
+
+void syscall_dispatch(struct regs *r)
+{
+	// Calls may block, so they run with interrupts on like any thread
+	interrupts_enable();
+	if (r->eax < SYSCALL_COUNT)
+		r->eax = syscalls[r->eax](r->ebx, r->esi, r->edi);
+	else
+		r->eax = (uint32_t)-1;
+	interrupts_disable();
+}
+
+int syscall_benchmark(uint32_t iterations, struct syscall_bench *result)
+{
+	if (!iterations || !timer_tsc_khz())
+		return -1;
+
+	struct user_task *task = user_task_create();
+	if (!task)
+		return -1;
+
+	// userbench.asm at the bottom of the user range, and a stack page at
+	// the top holding its arguments and, above them, its results
+	uint8_t *code = user_alloc_page(USER_BASE);
+	uint32_t *stack = user_alloc_page(USER_STACK_TOP - PAGE_SIZE);
+	int ret = -1;
+	if (code && stack) {
+		uint32_t *top = stack + PAGE_SIZE / 4;
+		uint64_t *cycles = (uint64_t *)(top - 4);
+		uint32_t *args = top - 8;
+
+		memcpy(code, user_bench_start, user_bench_end - user_bench_start);
+		args[0] = iterations;
+		args[1] = USER_STACK_TOP - 16;
+		args[2] = have_sysenter;
+		ret = user_start(task, "sysbench", USER_BASE, USER_STACK_TOP - 32);
+		if (ret == 0)
+			ret = user_wait(task);
+		result->int80_cycles = cycles[0];
+		result->sysenter_cycles = cycles[1];
+	}
+	user_task_destroy(task);
+	return ret;
+}
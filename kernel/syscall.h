@@ -0,0 +1,57 @@
+#ifndef SYSCALL_H
+#define SYSCALL_H
+
+#include <stdint.h>
+
+// System calls from ring 3, through either door:
+//   int 0x80              works on every CPU
+//   sysenter              faster; also set ecx = stack pointer and
+//                         edx = address to continue at
+// eax holds the call number and ebx, esi, edi the arguments; the result
+// comes back in eax, negative on failure. The int 0x80 path preserves
+// every other register, sysenter all but ecx and edx.
+#define SYSCALL_VECTOR 0x80
+
+// A program starts with [esp] = argc, [esp + 4] = argv and [esp + 8] =
+// these bits, telling it which door to use
+#define SYSCALL_FEATURE_SYSENTER 0x1
+
+#define SYS_EXIT 0 // exit(code)
+#define SYS_READ 1 // read(fd, buf, len); console reads return a line
+#define SYS_WRITE 2 // write(fd, buf, len)
+#define SYS_OPEN 3 // open(path, flags) -> fd
+#define SYS_CLOSE 4 // close(fd)
+#define SYS_GETTID 5 // gettid()
+#define SYSCALL_COUNT 6
+
+// open() flags
+#define O_RDONLY 0
+#define O_WRONLY 1
+#define O_RDWR 2
+#define O_ACCMODE 3
+#define O_CREAT 0x40
+#define O_TRUNC 0x200
+#define O_APPEND 0x400
+
+struct regs;
+
+// Point this CPU's SYSENTER MSRs at the entry stub, when it has them
+void syscall_init(void);
+void syscall_init_ap(int cpu);
+int syscall_have_sysenter(void);
+
+// From interrupt_dispatch(), for SYSCALL_VECTOR
+void syscall_dispatch(struct regs *r);
+
+// Round-trip cost of a trivial call (gettid) made from ring 3, in TSC
+// cycles summed over all iterations; sysenter_cycles stays 0 without
+// SYSENTER
+struct syscall_bench {
+	uint64_t int80_cycles;
+	uint64_t sysenter_cycles;
+};
+
+// Needs the TSC; returns 0, or -1 if the program could not run
+int syscall_benchmark(uint32_t iterations, struct syscall_bench *result);
+
+#endif
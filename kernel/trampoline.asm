@@ -0,0 +1,73 @@
+; trampoline.asm - application processor start-up code
+; smp.c copies trampoline_start..trampoline_end to TRAMPOLINE_BASE, below
+; 1 MB, and points the STARTUP IPI at it. The AP arrives in real mode,
+; loads flat segments with the kernel's selectors, turns on paging with
+; the boot CPU's control registers and calls the C entry point on the
+; stack smp.c left in trampoline_params.
+bits 16
+
+TRAMPOLINE_BASE equ 0x8000      ; must match smp.c
+%define REL(x) (TRAMPOLINE_BASE + (x) - trampoline_start)
+
+section .text
+global trampoline_start
+global trampoline_end
+global trampoline_params
+
+trampoline_start:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+    o32 lgdt [REL(gdt_ptr)]
+    mov eax, cr0
+    or eax, 1                   ; PE
+    mov cr0, eax
+    jmp dword 0x08:REL(protected_mode)
+
+bits 32
+protected_mode:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+
+    ; CR4 first: PSE must be on before paging sees 4 MB pages
+    mov eax, [REL(param_cr4)]
+    mov cr4, eax
+    mov eax, [REL(param_cr3)]
+    mov cr3, eax
+    mov eax, [REL(param_cr0)]
+    mov cr0, eax
+
+    mov esp, [REL(param_stack)]
+    mov eax, [REL(param_entry)]
+    call eax
+
+.hang:
+    cli
+    hlt
+    jmp .hang
+
+; Same layout as the boot GDT: 0x08 code, 0x10 data, both flat
+align 8
+gdt:
+    dq 0
+    dq 0x00CF9A000000FFFF
+    dq 0x00CF92000000FFFF
+gdt_ptr:
+    dw gdt_ptr - gdt - 1
+    dd REL(gdt)
+
+; struct trampoline_params in smp.c
+align 4
+trampoline_params:
+param_cr3:   dd 0
+param_cr4:   dd 0
+param_cr0:   dd 0
+param_stack: dd 0
+param_entry: dd 0
+
+trampoline_end:
@@ -0,0 +1,229 @@
+#include "user.h"
+#include "gdt.h"
+#include "interrupt.h"
+#include "kmalloc.h"
+#include "pmm.h"
+#include "sched.h"
+#include "../fs/fs.h"
+#include "../lib/string.h"
+
+#define USER_PRIORITY SCHED_PRIO_DEFAULT
+// IF and the always-one bit 1; IOPL 0 keeps ring 3 off the I/O ports
+#define USER_EFLAGS 0x202
+
+// The program holding the user range
+static struct user_task *owner;
+// Shared so that a waiter may free its task as soon as it sees it exit,
+// while the exiting thread could still be inside the wake-up
+static struct wait_queue exit_wait;
+
+struct user_start_args {
+	struct user_task *task;
+	uint32_t eip;
+	uint32_t esp;
+};
+
+struct user_task *user_task_create(void)
+{
+	struct user_task *task = kzalloc(sizeof(*task));
+	struct user_task *none = 0;
+
+	if (!task)
+		return 0;
+	if (!__atomic_compare_exchange_n(&owner, &none, task, 0,
+	                                 __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+		kfree(task);
+		return 0;
+	}
+
+	for (int fd = 0; fd < USER_FIRST_FILE; fd++)
+		task->files[fd].used = 1;
+	task->stack_bottom = USER_STACK_TOP;
+	return task;
+}
+
+void *user_alloc_page(uint32_t virt)
+{
+	uint32_t frame = pmm_alloc_page();
+
+	if (!frame)
+		return 0;
+	memset((void *)frame, 0, PAGE_SIZE);
+	if (paging_map(virt, frame, PTE_USER | PTE_WRITE) != 0) {
+		pmm_free_page(frame);
+		return 0;
+	}
+	// Frames are identity-mapped for the kernel
+	return (void *)frame;
+}
+
+// Clear the registers so nothing of the kernel's leaks, then iret into
+// ring 3
+static void __attribute__((noreturn)) enter_ring3(uint32_t eip, uint32_t esp)
+{
+	__asm__ volatile("mov %2, %%ds\n"
+	                 "mov %2, %%es\n"
+	                 "mov %2, %%fs\n"
+	                 "mov %2, %%gs\n"
+	                 "push %2\n"
+	                 "push %1\n"
+	                 "push %3\n"
+	                 "push %4\n"
+	                 "push %0\n"
+	                 "xor %%eax, %%eax\n"
+	                 "xor %%ebx, %%ebx\n"
+	                 "xor %%ecx, %%ecx\n"
+	                 "xor %%edx, %%edx\n"
+	                 "xor %%esi, %%esi\n"
+	                 "xor %%edi, %%edi\n"
+	                 "xor %%ebp, %%ebp\n"
+	                 "iret"
+	                 :
+	                 : "r"(eip), "r"(esp), "r"((uint32_t)GDT_USER_DATA),
+	                   "i"(USER_EFLAGS), "i"(GDT_USER_CODE));
+	__builtin_unreachable();
+}
+
+static void user_thread(void *arg)
+{
+	struct user_start_args args = *(struct user_start_args *)arg;
+
+	kfree(arg);
+	thread_current()->user = args.task;
+	enter_ring3(args.eip, args.esp);
+}
+
+int user_start(struct user_task *task, const char *name, uint32_t eip,
+               uint32_t esp)
+{
+	struct user_start_args *args = kmalloc(sizeof(*args));
+
+	if (!args)
+		return -1;
+	args->task = task;
+	args->eip = eip;
+	args->esp = esp;
+	if (!thread_create(name, user_thread, args, USER_PRIORITY)) {
+		kfree(args);
+		return -1;
+	}
+	return 0;
+}
+
+int user_wait(struct user_task *task)
+{
+	wait_event(&exit_wait, task->exited);
+	return task->exit_code;
+}
+
+void user_task_destroy(struct user_task *task)
+{
+	// Files the program left open
+	for (int fd = USER_FIRST_FILE; fd < USER_MAX_FILES; fd++)
+		fs_put(task->files[fd].inode);
+	paging_unmap_user();
+	__atomic_store_n(&owner, (struct user_task *)0, __ATOMIC_RELEASE);
+	kfree(task);
+}
+
+struct user_task *user_current(void)
+{
+	return thread_current()->user;
+}
+
+void user_exit(int code)
+{
+	struct thread *self = thread_current();
+	struct user_task *task = self->user;
+
+	self->user = 0;
+	task->exit_code = code;
+	__atomic_store_n(&task->exited, 1, __ATOMIC_RELEASE);
+	wait_queue_wake_all(&exit_wait);
+	thread_exit();
+}
+
+// Fill frame, the page at virt, from the parts of segments in the file
+static int read_segments(struct user_task *task, uint32_t virt,
+                         uint8_t *frame)
+{
+	for (int i = 0; i < task->segment_count; i++) {
+		struct user_segment *seg = &task->segments[i];
+		uint32_t start = seg->vaddr > virt ? seg->vaddr : virt;
+		uint32_t end = seg->vaddr + seg->filesz;
+		if (end > virt + PAGE_SIZE)
+			end = virt + PAGE_SIZE;
+		if (start >= end)
+			continue;
+
+		uint32_t len = end - start;
+		if (fs_read_at(task->image, seg->offset + (start - seg->vaddr),
+		               (char *)frame + (start - virt), len) != (int)len)
+			return -1;
+	}
+	return 0;
+}
+
+int user_page_in(uint32_t addr)
+{
+	struct user_task *task = user_current();
+	uint32_t virt = addr & ~(PAGE_SIZE - 1);
+	int backed = 0, writable = 0;
+
+	if (!task)
+		return 0;
+	if (virt >= task->stack_bottom && virt < USER_STACK_TOP)
+		backed = writable = 1;
+	// Segments need not be page-aligned, so a page can hold parts of
+	// two; it is writable if either is
+	for (int i = 0; i < task->segment_count; i++) {
+		struct user_segment *seg = &task->segments[i];
+		if (virt < seg->vaddr + seg->memsz && seg->vaddr < virt + PAGE_SIZE) {
+			backed = 1;
+			writable |= seg->writable;
+		}
+	}
+	if (!backed || paging_user_accessible(virt, 1, 0))
+		return 0;
+
+	uint32_t frame = pmm_alloc_page();
+	if (!frame)
+		return 0;
+	memset((void *)frame, 0, PAGE_SIZE);
+	if (read_segments(task, virt, (uint8_t *)frame) != 0 ||
+	    paging_map(virt, frame, PTE_USER | (writable ? PTE_WRITE : 0)) != 0) {
+		pmm_free_page(frame);
+		return 0;
+	}
+	return 1;
+}
+
+int user_check(uint32_t addr, uint32_t len, int write)
+{
+	if (addr < USER_BASE || addr > USER_END || len > USER_END - addr)
+		return 0;
+
+	// Page by page, so that the kernel never faults on the program's
+	// behalf: it may be holding a lock when it touches the memory
+	for (uint32_t page = addr & ~(PAGE_SIZE - 1); page < addr + len;
+	     page += PAGE_SIZE) {
+		if (!paging_user_accessible(page, 1, write) &&
+		    !(user_page_in(page) && paging_user_accessible(page, 1, write)))
+			return 0;
+	}
+	return 1;
+}
+
+int user_copy_string(char *dst, uint32_t src, uint32_t max)
+{
+	for (uint32_t i = 0; i < max; i++) {
+		// One check per page is enough
+		if ((i == 0 || ((src + i) & (PAGE_SIZE - 1)) == 0) &&
+		    !user_check(src + i, 1, 0))
+			return -1;
+		dst[i] = *(const char *)(src + i);
+		if (!dst[i])
+			return i;
+	}
+	return -1;
+}
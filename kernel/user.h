@@ -0,0 +1,76 @@
+#ifndef USER_H
+#define USER_H
+
+#include <stdint.h>
+#include "paging.h"
+
+// A program running in ring 3 on a kernel thread of its own. Its pages
+// live in the user range of the shared address space, so only one
+// program exists at a time: whoever created it waits for it to exit
+// and then destroys it, which frees those pages.
+
+#define USER_MAX_FILES 16
+// Descriptors 0-2 are the console
+#define USER_FIRST_FILE 3
+#define USER_MAX_SEGMENTS 8
+#define USER_STACK_TOP USER_END
+
+struct inode;
+
+// Part of the address space backed by an executable: filesz bytes from
+// the file, then zeros up to memsz. Pages are read in on first touch.
+struct user_segment {
+	uint32_t vaddr;
+	uint32_t memsz;
+	uint32_t offset; // in the file
+	uint32_t filesz;
+	int writable;
+};
+
+struct user_file {
+	int used;
+	int flags; // open() flags (syscall.h)
+	struct inode *inode; // 0 for the console; a reference (fs_put())
+	uint32_t offset;
+};
+
+struct user_task {
+	struct user_file files[USER_MAX_FILES];
+	struct inode *image; // file the segments come from; not a reference
+	struct user_segment segments[USER_MAX_SEGMENTS];
+	int segment_count;
+	// [stack_bottom, USER_STACK_TOP) fills with zero pages on first touch
+	uint32_t stack_bottom;
+	volatile int exited;
+	int exit_code;
+};
+
+// Claim the user range for a new program; 0 if one is already running
+struct user_task *user_task_create(void);
+// Map a zeroed, writable user page at virt; returns the kernel's view of
+// it for filling in, or 0 when out of memory
+void *user_alloc_page(uint32_t virt);
+// Start running at eip in ring 3 with the given stack pointer
+int user_start(struct user_task *task, const char *name, uint32_t eip,
+               uint32_t esp);
+// Sleep until the program exits; returns its exit code
+int user_wait(struct user_task *task);
+// Free the program's pages and release the user range
+void user_task_destroy(struct user_task *task);
+
+// For system calls: the calling thread's program (0 for kernel threads)
+struct user_task *user_current(void);
+// End the calling thread's program
+void user_exit(int code) __attribute__((noreturn));
+
+// Page fault in ring 3 on a page that is not mapped: back it from the
+// program's segments or stack. Returns 0 if addr is outside them.
+int user_page_in(uint32_t addr);
+// Whether the program may read (or write) [addr, addr + len), paging in
+// what it has not touched yet
+int user_check(uint32_t addr, uint32_t len, int write);
+// Copy a NUL-terminated string of at most max - 1 characters in from
+// the program; returns its length, or -1 if it is unreadable or too long
+int user_copy_string(char *dst, uint32_t src, uint32_t max);
+
+#endif
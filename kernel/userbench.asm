@@ -0,0 +1,66 @@
+; userbench.asm - ring-3 half of the system call benchmark
+; syscall_benchmark() copies user_bench_start..user_bench_end into a user
+; page and starts it with [esp] = iterations, [esp + 4] = address of two
+; uint64_t cycle totals (int 0x80, then sysenter) and [esp + 8] nonzero
+; if the sysenter loop should run. Position independent, since it runs
+; wherever it was copied to.
+bits 32
+
+SYS_EXIT   equ 0                ; syscall.h
+SYS_GETTID equ 5
+
+section .text
+global user_bench_start
+global user_bench_end
+
+user_bench_start:
+    mov ebp, esp
+    mov ebx, [ebp + 4]
+
+    ; int 0x80 keeps every register but eax
+    mov ecx, [ebp]
+    rdtsc
+    mov esi, eax
+    mov edi, edx
+.gate_loop:
+    mov eax, SYS_GETTID
+    int 0x80
+    dec ecx
+    jnz .gate_loop
+    rdtsc
+    sub eax, esi
+    sbb edx, edi
+    mov [ebx], eax
+    mov [ebx + 4], edx
+
+    cmp dword [ebp + 8], 0
+    je .done
+
+    ; SYSEXIT returns to edx with esp = ecx, so both are set every time
+    call .here
+.here:
+    pop edi
+    add edi, .sysenter_ret - .here
+    mov esi, [ebp]
+    rdtsc
+    mov [ebx + 8], eax
+    mov [ebx + 12], edx
+.sysenter_loop:
+    mov eax, SYS_GETTID
+    mov ecx, esp
+    mov edx, edi
+    sysenter
+.sysenter_ret:
+    dec esi
+    jnz .sysenter_loop
+    rdtsc
+    sub eax, [ebx + 8]
+    sbb edx, [ebx + 12]
+    mov [ebx + 8], eax
+    mov [ebx + 12], edx
+
+.done:
+    mov eax, SYS_EXIT
+    xor ebx, ebx
+    int 0x80
+user_bench_end:
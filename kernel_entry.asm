@@ -1,24 +1,72 @@
 ; kernel_entry.asm
 bits 32
 extern kernel_main
+extern __kernel_start
+extern __load_end
+extern __bss_start
+extern __bss_end
+
+; Multiboot header. kernel.bin is a flat binary, so the a.out kludge
+; (flag 16) tells the loader where each part goes.
+MB_MAGIC equ 0x1BADB002
+MB_FLAGS equ (1 << 0) | (1 << 1) | (1 << 16) ; page-align modules, memory info, addresses
+MB_CHECKSUM equ -(MB_MAGIC + MB_FLAGS)
+
+STACK_SIZE equ 16384
 
 section .text.entry
 global kernel_entry
 
 kernel_entry:
+    ; boot.asm jumps to the first byte of the image
+    jmp start
+
+align 4
+multiboot_header:
+    dd MB_MAGIC
+    dd MB_FLAGS
+    dd MB_CHECKSUM
+    dd multiboot_header         ; header_addr
+    dd __kernel_start           ; load_addr
+    dd __load_end               ; load_end_addr
+    dd __bss_end                ; bss_end_addr
+    dd start                    ; entry_addr
+
+start:
     ; set up segments and stack (protected mode)
+    cli
+    mov edx, eax                ; multiboot magic when loaded by GRUB
     mov ax, 0x10
     mov ds, ax
     mov es, ax
     mov fs, ax
     mov gs, ax
     mov ss, ax
-    mov esp, 0x9FC00
+    mov esp, stack_top
+
+    ; .bss is not part of kernel.bin; clear it before any C code runs
+    ; (ebx holds the boot info pointer and is left alone)
+    cld
+    mov edi, __bss_start
+    mov ecx, __bss_end
+    sub ecx, edi
+    shr ecx, 2
+    xor eax, eax
+    rep stosd
 
-    ; call C kernel entry
+    ; call C kernel entry with the loader's magic and info pointer:
+    ; GRUB's multiboot info, or the E820 map from boot.asm
+    push ebx
+    push edx
     call kernel_main
 
 .hang:
     cli
     hlt
     jmp .hang
+
+section .bss
+align 16
+stack_bottom:
+    resb STACK_SIZE
+stack_top:
@@ -0,0 +1,40 @@
+#ifndef MATH64_H
+#define MATH64_H
+
+#include <stdint.h>
+
+// 64-bit helpers that avoid pulling in libgcc's __udivdi3/__umoddi3,
+// which are not available with -nostdlib.
+
+// Divide a 64-bit value by a 32-bit one, optionally returning the remainder
+static inline uint64_t div64_u32(uint64_t n, uint32_t d, uint32_t *rem)
+{
+	uint32_t high = (uint32_t)(n >> 32);
+	uint32_t low = (uint32_t)n;
+	uint32_t q_high = 0;
+	uint32_t r;
+
+	if (high >= d) {
+		q_high = high / d;
+		high %= d;
+	}
+	__asm__("divl %4" : "=a"(low), "=d"(r) : "0"(low), "1"(high), "rm"(d));
+	if (rem)
+		*rem = r;
+	return ((uint64_t)q_high << 32) | low;
+}
+
+// (a * mul) >> shift without overflowing the 64-bit intermediate; shift <= 32
+static inline uint64_t mul_u64_u32_shr(uint64_t a, uint32_t mul,
+                                       unsigned int shift)
+{
+	uint32_t ah = (uint32_t)(a >> 32);
+	uint32_t al = (uint32_t)a;
+	uint64_t ret = ((uint64_t)al * mul) >> shift;
+
+	if (ah)
+		ret += ((uint64_t)ah * mul) << (32 - shift);
+	return ret;
+}
+
+#endif
@@ -0,0 +1,172 @@
+#include "printf.h"
+#include "string.h"
+
+#define ESC '\x1b'
+#define ESC_LEN 3
+
+struct kformat_out {
+	char *buf;
+	int size;
+	int len;
+	int total;
+	kformat_flush_t flush;
+};
+
+static void out_char(struct kformat_out *o, char c)
+{
+	int need = c == ESC ? ESC_LEN : 1;
+
+	if (o->flush && o->len + need > o->size) {
+		o->flush(o->buf, o->len);
+		o->len = 0;
+	}
+	if (o->len < o->size)
+		o->buf[o->len++] = c;
+	o->total++;
+}
+
+static void out_pad(struct kformat_out *o, char c, int n)
+{
+	while (n-- > 0)
+		out_char(o, c);
+}
+
+static void out_field(struct kformat_out *o, const char *s, int len,
+                      int width, int left, char pad)
+{
+	if (!left)
+		out_pad(o, pad, width - len);
+	for (int i = 0; i < len; i++)
+		out_char(o, s[i]);
+	if (left)
+		out_pad(o, ' ', width - len);
+}
+
+static void out_number(struct kformat_out *o, uint32_t n, int negative,
+                       uint32_t base, int upper, int width, int left,
+                       char pad)
+{
+	const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+	char tmp[12];
+	int i = sizeof(tmp);
+
+	do {
+		tmp[--i] = digits[n % base];
+		n /= base;
+	} while (n);
+
+	// The sign goes ahead of zero padding, after space padding
+	if (negative) {
+		if (pad == '0' && !left) {
+			out_char(o, '-');
+			width--;
+		} else {
+			tmp[--i] = '-';
+		}
+	}
+	out_field(o, tmp + i, sizeof(tmp) - i, width, left, pad);
+}
+
+int kvformat(char *buf, int size, kformat_flush_t flush, const char *fmt,
+             va_list ap)
+{
+	struct kformat_out o = {buf, size, 0, 0, flush};
+
+	for (; *fmt; fmt++) {
+		if (*fmt != '%') {
+			out_char(&o, *fmt);
+			continue;
+		}
+		fmt++;
+
+		int left = 0, width = 0;
+		char pad = ' ';
+
+		for (;; fmt++) {
+			if (*fmt == '-')
+				left = 1;
+			else if (*fmt == '0')
+				pad = '0';
+			else
+				break;
+		}
+		if (*fmt == '*') {
+			// A negative width is a '-' flag with its magnitude
+			width = va_arg(ap, int);
+			if (width < 0) {
+				left = 1;
+				width = -width;
+			}
+			fmt++;
+		}
+		while (*fmt >= '0' && *fmt <= '9')
+			width = width * 10 + *fmt++ - '0';
+		while (*fmt == 'l')
+			fmt++;
+
+		switch (*fmt) {
+		case 'd': {
+			int v = va_arg(ap, int);
+			out_number(&o, v < 0 ? -(uint32_t)v : (uint32_t)v, v < 0,
+			           10, 0, width, left, pad);
+			break;
+		}
+		case 'u':
+			out_number(&o, va_arg(ap, uint32_t), 0, 10, 0, width, left,
+			           pad);
+			break;
+		case 'x':
+		case 'X':
+			out_number(&o, va_arg(ap, uint32_t), 0, 16, *fmt == 'X',
+			           width, left, pad);
+			break;
+		case 's': {
+			const char *s = va_arg(ap, const char *);
+			if (!s)
+				s = "(null)";
+			out_field(&o, s, strlen(s), width, left, ' ');
+			break;
+		}
+		case 'c': {
+			char c = va_arg(ap, int);
+			out_field(&o, &c, 1, width, left, ' ');
+			break;
+		}
+		case '%':
+			out_char(&o, '%');
+			break;
+		case '\0':
+			// Lone '%' at the end of the format
+			fmt--;
+			break;
+		default:
+			out_char(&o, '%');
+			out_char(&o, *fmt);
+			break;
+		}
+	}
+
+	if (flush && o.len)
+		flush(buf, o.len);
+	return o.total;
+}
+
+int kvsnprintf(char *buf, int size, const char *fmt, va_list ap)
+{
+	if (size <= 0)
+		return kvformat(buf, 0, 0, fmt, ap);
+
+	int len = kvformat(buf, size - 1, 0, fmt, ap);
+	buf[len < size - 1 ? len : size - 1] = '\0';
+	return len;
+}
+
+int ksnprintf(char *buf, int size, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	int len = kvsnprintf(buf, size, fmt, ap);
+	va_end(ap);
+	return len;
+}
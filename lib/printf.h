@@ -0,0 +1,26 @@
+#ifndef PRINTF_H
+#define PRINTF_H
+
+#include <stdarg.h>
+
+// Conversions: %d %u %x %X %s %c %%, each with optional '-' (left
+// justify), '0' (zero pad) and a field width, which may be '*' to take
+// it from the arguments. 'l' is accepted and ignored since long is 32
+// bits; there is no 64-bit support.
+
+// Called with each full buffer and with whatever is left at the end
+typedef void (*kformat_flush_t)(const char *buf, int len);
+
+// Format into buf (size bytes, not NUL-terminated), handing it to flush
+// whenever it fills. Color escapes (ESC and two hex digits) are never
+// split across calls. Returns the number of characters produced.
+int kvformat(char *buf, int size, kformat_flush_t flush, const char *fmt,
+             va_list ap);
+
+// Like snprintf: always NUL-terminates (if size > 0) and returns the
+// length the output would have had
+int kvsnprintf(char *buf, int size, const char *fmt, va_list ap);
+int ksnprintf(char *buf, int size, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+#endif
@@ -1,15 +1,75 @@
 #include "string.h"
 
-int strlen(const char *str)
+// The bulk routines read and write four bytes at a time through char
+// pointers, so the word type must be allowed to alias anything
+typedef uint32_t __attribute__((may_alias)) word_t;
+
+#define ONES 0x01010101u
+#define HIGHS 0x80808080u
+// Nonzero when some byte of v is zero
+#define HAS_ZERO(v) (((v) - ONES) & ~(v) & HIGHS)
+
+// The aligned word loads in strlen/strcmp can read up to three bytes past
+// the terminator. That is harmless, but AddressSanitizer (host tests)
+// would report it.
+#define WORD_OVERREAD __attribute__((no_sanitize_address))
+
+// Below this a byte loop is cheaper than setting up rep movs/stos
+#define REP_MIN_BYTES 16
+// From this size up, copies and fills use 16-byte SSE2 moves if enabled
+#define SSE2_MIN_BYTES 512
+// SSE2 moves run with interrupts off, at most this many bytes at a time
+#define SSE2_CHUNK 4096
+
+// The host test build (tests/) and user programs (user/) run in ring 3,
+// where cli would fault
+#if defined(HOST_BUILD) || defined(USER_BUILD)
+#define IRQ_OFF ""
+#else
+#define IRQ_OFF "cli\n\t"
+#endif
+
+static int sse2_enabled = 0;
+
+void string_enable_sse2(void)
 {
-	int len = 0;
-	while (str[len])
-		len++;
-	return len;
+	sse2_enabled = 1;
+}
+
+WORD_OVERREAD int strlen(const char *str)
+{
+	const char *p = str;
+
+	// Aligned word loads never run into the next (maybe unmapped) page
+	while ((unsigned long)p & 3) {
+		if (!*p)
+			return p - str;
+		p++;
+	}
+
+	const word_t *w = (const word_t *)p;
+	while (!HAS_ZERO(*w))
+		w++;
+
+	p = (const char *)w;
+	while (*p)
+		p++;
+	return p - str;
 }
 
-int strcmp(const char *s1, const char *s2)
+WORD_OVERREAD int strcmp(const char *s1, const char *s2)
 {
+	if ((((unsigned long)s1 | (unsigned long)s2) & 3) == 0) {
+		const word_t *w1 = (const word_t *)s1;
+		const word_t *w2 = (const word_t *)s2;
+		while (*w1 == *w2 && !HAS_ZERO(*w1)) {
+			w1++;
+			w2++;
+		}
+		s1 = (const char *)w1;
+		s2 = (const char *)w2;
+	}
+
 	while (*s1 && (*s1 == *s2)) {
 		s1++;
 		s2++;
@@ -49,19 +109,25 @@ char *strncpy(char *dest, const char *src, int n)
 
 char *strcat(char *dest, const char *src)
 {
-	char *ret = dest;
-	while (*dest)
-		dest++;
-	while ((*dest++ = *src++))
-		;
-	return ret;
+	strcpy(dest + strlen(dest), src);
+	return dest;
 }
 
 int memcmp(const void *s1, const void *s2, int n)
 {
 	const unsigned char *p1 = s1;
 	const unsigned char *p2 = s2;
-	while (n--) {
+
+	// Skip the equal prefix a word at a time, then find the byte
+	if ((((unsigned long)p1 | (unsigned long)p2) & 3) == 0) {
+		while (n >= 4 && *(const word_t *)p1 == *(const word_t *)p2) {
+			p1 += 4;
+			p2 += 4;
+			n -= 4;
+		}
+	}
+
+	while (n-- > 0) {
 		if (*p1 != *p2)
 			return *p1 - *p2;
 		p1++;
@@ -70,19 +136,131 @@ int memcmp(const void *s1, const void *s2, int n)
 	return 0;
 }
 
+static inline void copy_rep(void *dest, const void *src, uint32_t n)
+{
+	uint32_t ecx;
+	void *edi;
+	const void *esi;
+	__asm__ volatile("rep movsl\n\t"
+	                 "movl %4, %%ecx\n\t"
+	                 "rep movsb"
+	                 : "=&c"(ecx), "=&D"(edi), "=&S"(esi)
+	                 : "0"(n >> 2), "g"(n & 3), "1"(dest), "2"(src)
+	                 : "memory");
+}
+
+static inline void fill_rep(void *dest, uint32_t v, uint32_t n)
+{
+	uint32_t ecx;
+	void *edi;
+	__asm__ volatile("rep stosl\n\t"
+	                 "movl %4, %%ecx\n\t"
+	                 "rep stosb"
+	                 : "=&c"(ecx), "=&D"(edi)
+	                 : "0"(n >> 2), "a"(v), "g"(n & 3), "1"(dest)
+	                 : "memory");
+}
+
+// The compiler never emits SSE code here (no -msse), and nothing saves the
+// XMM registers across an interrupt. Each chunk therefore runs with
+// interrupts off, so a handler that copies cannot clobber a copy in
+// progress, and XMM state never has to survive between asm statements.
+
+static void copy_sse2(char *d, const char *s, uint32_t n)
+{
+	uint32_t head = -(unsigned long)d & 15;
+	copy_rep(d, s, head);
+	d += head;
+	s += head;
+	n -= head;
+
+	while (n >= 64) {
+		uint32_t chunk = n & ~63u;
+		if (chunk > SSE2_CHUNK)
+			chunk = SSE2_CHUNK;
+		n -= chunk;
+
+		__asm__ volatile("pushf\n\t" IRQ_OFF
+		                 "1:\n\t"
+		                 "movdqu (%1), %%xmm0\n\t"
+		                 "movdqu 16(%1), %%xmm1\n\t"
+		                 "movdqu 32(%1), %%xmm2\n\t"
+		                 "movdqu 48(%1), %%xmm3\n\t"
+		                 "movdqa %%xmm0, (%0)\n\t"
+		                 "movdqa %%xmm1, 16(%0)\n\t"
+		                 "movdqa %%xmm2, 32(%0)\n\t"
+		                 "movdqa %%xmm3, 48(%0)\n\t"
+		                 "add $64, %0\n\t"
+		                 "add $64, %1\n\t"
+		                 "sub $64, %2\n\t"
+		                 "jnz 1b\n\t"
+		                 "popf"
+		                 : "+r"(d), "+r"(s), "+r"(chunk)
+		                 :
+		                 : "memory", "cc");
+	}
+	copy_rep(d, s, n);
+}
+
+static void fill_sse2(char *d, uint32_t v, uint32_t n)
+{
+	uint32_t head = -(unsigned long)d & 15;
+	fill_rep(d, v, head);
+	d += head;
+	n -= head;
+
+	while (n >= 64) {
+		uint32_t chunk = n & ~63u;
+		if (chunk > SSE2_CHUNK)
+			chunk = SSE2_CHUNK;
+		n -= chunk;
+
+		__asm__ volatile("pushf\n\t" IRQ_OFF
+		                 "movd %2, %%xmm0\n\t"
+		                 "pshufd $0, %%xmm0, %%xmm0\n"
+		                 "1:\n\t"
+		                 "movdqa %%xmm0, (%0)\n\t"
+		                 "movdqa %%xmm0, 16(%0)\n\t"
+		                 "movdqa %%xmm0, 32(%0)\n\t"
+		                 "movdqa %%xmm0, 48(%0)\n\t"
+		                 "add $64, %0\n\t"
+		                 "sub $64, %1\n\t"
+		                 "jnz 1b\n\t"
+		                 "popf"
+		                 : "+r"(d), "+r"(chunk)
+		                 : "r"(v)
+		                 : "memory", "cc");
+	}
+	fill_rep(d, v, n);
+}
+
 void *memcpy(void *dest, const void *src, int n)
 {
-	char *d = dest;
-	const char *s = src;
-	while (n--)
-		*d++ = *s++;
+	if (n < REP_MIN_BYTES) {
+		char *d = dest;
+		const char *s = src;
+		while (n-- > 0)
+			*d++ = *s++;
+	} else if (sse2_enabled && n >= SSE2_MIN_BYTES) {
+		copy_sse2(dest, src, n);
+	} else {
+		copy_rep(dest, src, n);
+	}
 	return dest;
 }
 
 void *memset(void *s, int c, int n)
 {
-	unsigned char *p = s;
-	while (n--)
-		*p++ = (unsigned char)c;
+	uint32_t v = (unsigned char)c * ONES;
+
+	if (n < REP_MIN_BYTES) {
+		unsigned char *p = s;
+		while (n-- > 0)
+			*p++ = (unsigned char)c;
+	} else if (sse2_enabled && n >= SSE2_MIN_BYTES) {
+		fill_sse2(s, v, n);
+	} else {
+		fill_rep(s, v, n);
+	}
 	return s;
 }
@@ -13,4 +13,7 @@ int memcmp(const void *s1, const void *s2, int n);
 void *memcpy(void *dest, const void *src, int n);
 void *memset(void *s, int c, int n);
 
+// Use SSE2 for large memcpy/memset; call once the CPU has SSE enabled
+void string_enable_sse2(void);
+
 #endif
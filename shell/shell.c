@@ -1,221 +1,225 @@
 #include "shell.h"
-#include "../drivers/keyboard.h"
+#include "../drivers/blkqueue.h"
+#include "../drivers/console.h"
+#include "../drivers/io.h"
+#include "../drivers/timer.h"
 #include "../drivers/vga.h"
+#include "../fs/bcache.h"
 #include "../fs/fs.h"
+#include "../kernel/exec.h"
+#include "../kernel/kmalloc.h"
+#include "../kernel/paging.h"
+#include "../kernel/pmm.h"
+#include "../kernel/sched.h"
+#include "../kernel/smp.h"
+#include "../kernel/syscall.h"
+#include "../lib/math64.h"
+#include "../lib/printf.h"
 #include "../lib/string.h"
 
 #define CMD_BUFFER_SIZE 256
+#define EDITOR_BUFFER_SIZE 32768
+#define CAT_CHUNK_SIZE 256
+// Where commands that are not built in are looked up
+#define PROGRAM_DIR "/bin"
+// Threads ps can list
+#define PS_MAX_THREADS 64
+
+// iobench: the first 8 MB of the filesystem device, read and written
+// back in 1 KB requests (sequential) and 4 KB requests at random offsets
+#define IOBENCH_REGION_SECTORS 16384
+#define IOBENCH_SEQ_BATCH 128
+#define IOBENCH_SEQ_SECTORS 2
+#define IOBENCH_RAND_BATCH 32
+#define IOBENCH_RAND_SECTORS 8
+#define IOBENCH_RAND_REQUESTS 1024
+
+// sysbench: system calls per entry method unless given on the command line
+#define SYSBENCH_ITERATIONS 100000
+
+// Tab lists at most this many candidates
+#define COMPLETE_MAX_SHOWN 64
+
+struct command {
+	const char *name;
+	const char *usage;
+	const char *help;
+	void (*run)(const char *args);
+};
 
 static char cmd_buffer[CMD_BUFFER_SIZE];
 
-static inline uint8_t inb(uint16_t port)
+static void show_welcome(void)
 {
-	uint8_t value;
-	__asm__ volatile("inb %1, %0" : "=a"(value) : "Nd"(port));
-	return value;
+	kprintf(CON_CYAN "================================\n"
+	        "     Welcome to MiniOS v1.1     \n"
+	        "================================\n\n" CON_NORMAL
+	        "Type 'help'\n\n");
 }
 
-static inline void outb(uint16_t port, uint8_t value)
+// Path of the cwd into path (MAX_PATH bytes)
+static void cwd_path(char *path)
 {
-	__asm__ volatile("outb %0, %1" : : "a"(value), "Nd"(port));
-}
+	inode_t *dir = fs_get_cwd();
 
-static void show_welcome(void)
-{
-	vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
-	vga_puts("================================\n");
-	vga_puts("     Welcome to MiniOS v1.1     \n");
-	vga_puts("================================\n\n");
-	vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
-	vga_puts("Type 'help'\n\n");
+	fs_get_path(dir, path);
+	fs_put(dir);
 }
 
 static void print_prompt(void)
 {
 	char path[MAX_PATH];
-	fs_get_path(fs_get_cwd(), path);
-
-	vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
-	vga_puts("minios");
-	vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
-	vga_puts(":");
-	vga_set_color(VGA_COLOR_LIGHT_BLUE, VGA_COLOR_BLACK);
-	vga_puts(path);
-	vga_set_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
-	vga_puts("$ ");
-	vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
-}
-
-static void print_help(void)
-{
-	vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
-	vga_puts("\nMiniOS Shell Commands:\n\n");
-	vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
-	vga_puts("  help          - Show this help\n");
-	vga_puts("  clear         - Clear screen\n");
-	vga_puts("  ls            - List files\n");
-	vga_puts("  pwd           - Print working directory\n");
-	vga_puts("  cd <path>     - Change directory\n");
-	vga_puts("  mkdir <name>  - Create directory\n");
-	vga_puts("  touch <file>  - Create file\n");
-	vga_puts("  cat <file>    - Display file (press 'q' to exit)\n");
-	vga_puts("  echo <text> > <file> - Write to file\n");
-	vga_puts("  write <file>  - Edit file (Ctrl+S save, Ctrl+Q exit)\n");
-	vga_puts("  rm <name>     - Remove file/dir\n");
-	vga_puts("  tree          - Show directory tree\n");
-	vga_puts("  info          - System information\n");
-	vga_puts("  reboot        - Reboot system\n\n");
-}
-
-static void cmd_ls(void)
+	cwd_path(path);
+
+	kprintf(CON_GREEN "minios" CON_WHITE ":" CON_BLUE "%s" CON_WHITE
+	        "$ " CON_NORMAL,
+	        path);
+}
+
+static void cmd_ls(const char *path)
 {
-	inode_t *dir = fs_get_cwd();
+	inode_t *dir = path[0] ? fs_resolve_path(path) : fs_get_cwd();
+
+	if (!dir || dir->type != INODE_DIR) {
+		kprintf(CON_RED "ls: no such directory\n" CON_NORMAL);
+		fs_put(dir);
+		return;
+	}
 
 	if (dir->child_count == 0) {
-		vga_puts("(empty)\n");
+		console_puts("(empty)\n");
+		fs_put(dir);
 		return;
 	}
 
-	for (int i = 0; i < dir->child_count; i++) {
-		inode_t *child = dir->children[i];
-
-		if (child->type == INODE_DIR) {
-			vga_set_color(VGA_COLOR_LIGHT_BLUE, VGA_COLOR_BLACK);
-			vga_puts(child->name);
-			vga_puts("/\n");
-		} else {
-			vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
-			vga_puts(child->name);
-			vga_set_color(VGA_COLOR_DARK_GREY, VGA_COLOR_BLACK);
-			vga_puts(" (");
-			vga_print_int(child->size);
-			vga_puts(" bytes)\n");
-		}
+	inode_t *child;
+	int pos = 0;
+
+	while ((child = fs_dir_next(dir, &pos))) {
+		if (child->type == INODE_DIR)
+			kprintf(CON_BLUE "%s/\n" CON_NORMAL, child->name);
+		else
+			kprintf("%s" CON_DARK_GREY " (%u bytes)\n" CON_NORMAL,
+			        child->name, child->size);
+		fs_put(child);
 	}
-	vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+	fs_put(dir);
 }
 
-static void cmd_pwd(void)
+static void cmd_pwd(const char *args)
 {
+	(void)args;
 	char path[MAX_PATH];
-	fs_get_path(fs_get_cwd(), path);
-	vga_puts(path);
-	vga_putch('\n');
+	cwd_path(path);
+	kprintf("%s\n", path);
 }
 
 static void cmd_cd(const char *path)
 {
-	if (strcmp(path, "..") == 0) {
-		inode_t *parent = fs_get_cwd()->parent;
-		if (parent)
-			fs_set_cwd(parent);
-		return;
-	}
-
-	if (strcmp(path, "/") == 0) {
+	if (path[0] == '\0') {
 		fs_set_cwd(fs_get_root());
 		return;
 	}
 
-	inode_t *dir = fs_find_child(fs_get_cwd(), path);
+	inode_t *dir = fs_resolve_path(path);
 	if (!dir) {
-		vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
-		vga_puts("cd: no such directory\n");
-		vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
-		return;
-	}
-
-	if (dir->type != INODE_DIR) {
-		vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
-		vga_puts("cd: not a directory\n");
-		vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+		kprintf(CON_RED "cd: no such directory\n" CON_NORMAL);
 		return;
 	}
 
-	fs_set_cwd(dir);
+	if (dir->type != INODE_DIR)
+		kprintf(CON_RED "cd: not a directory\n" CON_NORMAL);
+	else
+		fs_set_cwd(dir);
+	fs_put(dir);
 }
 
 static void cmd_mkdir(const char *name)
 {
 	if (!name || name[0] == '\0') {
-		vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
-		vga_puts("mkdir: missing name\n");
-		vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+		kprintf(CON_RED "mkdir: missing name\n" CON_NORMAL);
 		return;
 	}
 
-	inode_t *dir = fs_create_dir(fs_get_cwd(), name);
+	char leaf[MAX_FILENAME];
+	inode_t *parent = fs_resolve_parent(name, leaf);
+	inode_t *dir = parent ? fs_create_dir(parent, leaf) : 0;
 	if (!dir) {
-		vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
-		vga_puts("mkdir: cannot create directory\n");
-		vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+		kprintf(CON_RED "mkdir: cannot create directory\n" CON_NORMAL);
 	}
+	fs_put(dir);
+	fs_put(parent);
 }
 
 static void cmd_touch(const char *name)
 {
 	if (!name || name[0] == '\0') {
-		vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
-		vga_puts("touch: missing name\n");
-		vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+		kprintf(CON_RED "touch: missing name\n" CON_NORMAL);
 		return;
 	}
 
-	inode_t *file = fs_create_file(fs_get_cwd(), name);
+	char leaf[MAX_FILENAME];
+	inode_t *parent = fs_resolve_parent(name, leaf);
+	inode_t *file = parent ? fs_create_file(parent, leaf) : 0;
 	if (!file) {
-		vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
-		vga_puts("touch: cannot create file\n");
-		vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+		kprintf(CON_RED "touch: cannot create file\n" CON_NORMAL);
 	}
+	fs_put(file);
+	fs_put(parent);
 }
 
 static void cmd_cat(const char *name)
 {
 	if (!name || name[0] == '\0') {
-		vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
-		vga_puts("cat: missing filename\n");
-		vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+		kprintf(CON_RED "cat: missing filename\n" CON_NORMAL);
 		return;
 	}
 
-	inode_t *file = fs_find_child(fs_get_cwd(), name);
+	inode_t *file = fs_resolve_path(name);
 	if (!file) {
-		vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
-		vga_puts("cat: file not found\n");
-		vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+		kprintf(CON_RED "cat: file not found\n" CON_NORMAL);
 		return;
 	}
 
 	if (file->type != INODE_FILE) {
-		vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
-		vga_puts("cat: is a directory\n");
-		vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+		kprintf(CON_RED "cat: is a directory\n" CON_NORMAL);
+		fs_put(file);
 		return;
 	}
 
-	vga_putch('\n');
-	vga_set_color(VGA_COLOR_YELLOW, VGA_COLOR_BLACK);
-	for (uint32_t i = 0; i < file->size; i++) {
-		vga_putch(file->data[i]);
-	}
-	if (file->size > 0 && file->data[file->size - 1] != '\n') {
-		vga_putch('\n');
-	}
-	vga_set_color(VGA_COLOR_DARK_GREY, VGA_COLOR_BLACK);
-	vga_puts("\n[Press 'q' to exit]\n");
-	vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+	char chunk[CAT_CHUNK_SIZE];
+	uint32_t offset = 0;
+	char last = '\n';
+	int n;
 
-	while (1) {
-		char c = keyboard_getchar();
-		if (c == 'q' || c == 'Q')
-			break;
+	kprintf("\n" CON_YELLOW);
+	while ((n = fs_read_at(file, offset, chunk, CAT_CHUNK_SIZE)) > 0) {
+		console_write(chunk, n);
+		last = chunk[n - 1];
+		offset += n;
 	}
+	kprintf("%s" CON_NORMAL, last != '\n' ? "\n" : "");
+	fs_put(file);
+}
+
+// Resolve path, creating an empty file if only the last component is missing
+static inode_t *open_or_create(const char *path)
+{
+	inode_t *file = fs_resolve_path(path);
+	if (file)
+		return file;
+
+	char leaf[MAX_FILENAME];
+	inode_t *parent = fs_resolve_parent(path, leaf);
+	file = parent ? fs_create_file(parent, leaf) : 0;
+	fs_put(parent);
+	return file;
 }
 
 static void cmd_echo(const char *args)
 {
 	char text[256];
-	char filename[MAX_FILENAME];
+	char filename[MAX_PATH];
 	int i = 0, j = 0;
 
 	while (args[i] && args[i] != '>') {
@@ -229,8 +233,7 @@ static void cmd_echo(const char *args)
 	text[j] = '\0';
 
 	if (args[i] != '>') {
-		vga_puts(text);
-		vga_putch('\n');
+		kprintf("%s\n", text);
 		return;
 	}
 
@@ -238,104 +241,53 @@ static void cmd_echo(const char *args)
 	while (args[i] == ' ')
 		i++;
 	j = 0;
-	while (args[i] && j < MAX_FILENAME - 1) {
+	while (args[i] && j < MAX_PATH - 1) {
 		filename[j++] = args[i++];
 	}
 	filename[j] = '\0';
 
 	if (filename[0] == '\0') {
-		vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
-		vga_puts("echo: missing filename\n");
-		vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+		kprintf(CON_RED "echo: missing filename\n" CON_NORMAL);
 		return;
 	}
 
-	inode_t *file = fs_find_child(fs_get_cwd(), filename);
-	if (!file) {
-		file = fs_create_file(fs_get_cwd(), filename);
-	}
-
-	if (!file) {
-		vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
-		vga_puts("echo: cannot write\n");
-		vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
-		return;
-	}
-
-	fs_write_file(file, text, strlen(text));
+	inode_t *file = open_or_create(filename);
+	if (!file || file->type != INODE_FILE)
+		kprintf(CON_RED "echo: cannot write\n" CON_NORMAL);
+	else
+		fs_write_file(file, text, strlen(text));
+	fs_put(file);
 }
 
-static void cmd_write(const char *name)
+// Editor loop; returns when the user saves, quits or fills the buffer
+static void editor_run(inode_t *file, char *buffer)
 {
-	if (!name || name[0] == '\0') {
-		vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
-		vga_puts("write: missing filename\n");
-		vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
-		return;
-	}
-
-	inode_t *file = fs_find_child(fs_get_cwd(), name);
-	if (!file) {
-		file = fs_create_file(fs_get_cwd(), name);
-	}
-
-	if (!file || file->type != INODE_FILE) {
-		vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
-		vga_puts("write: cannot create file\n");
-		vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
-		return;
-	}
+	int pos = fs_read_file(file, buffer, EDITOR_BUFFER_SIZE - 1);
 
-	vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
-	vga_puts("\n======== WR - Editor ========\n");
-	vga_puts("File: ");
-	vga_set_color(VGA_COLOR_YELLOW, VGA_COLOR_BLACK);
-	vga_puts(name);
-	vga_putch('\n');
-	vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
-	vga_puts("Commands:\n");
-	vga_puts("  Ctrl+S  - Save file\n");
-	vga_puts("  Ctrl+Q  - Quit without saving\n");
-	vga_puts("=================================\n\n");
-	vga_set_color(VGA_COLOR_YELLOW, VGA_COLOR_BLACK);
-
-	char buffer[MAX_FILE_SIZE];
-	int pos = 0;
+	if (pos < 0)
+		pos = 0;
+	for (int i = 0; i < pos; i++)
+		console_putch(buffer[i]);
 
-	if (file->size > 0) {
-		for (uint32_t i = 0; i < file->size && i < MAX_FILE_SIZE - 1;
-		     i++) {
-			buffer[pos++] = file->data[i];
-			vga_putch(file->data[i]);
-		}
-	}
-
-	while (pos < MAX_FILE_SIZE - 1) {
-		char c = keyboard_getchar();
+	while (pos < EDITOR_BUFFER_SIZE - 1) {
+		char c = console_getchar();
 
 		if (c == 19) {
 			buffer[pos] = '\0';
 			fs_write_file(file, buffer, pos);
-			vga_putch('\n');
-			vga_set_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK);
-			vga_puts("\n[File saved! ");
-			vga_print_int(pos);
-			vga_puts(" bytes]\n\n");
-			vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+			kprintf("\n" CON_GREEN "\n[File saved! %d bytes]\n\n" CON_NORMAL,
+			        pos);
 			return;
 		}
 
 		if (c == 17) {
-			vga_putch('\n');
-			vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
-			vga_puts("\n[Quit without saving]\n\n");
-			vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+			kprintf("\n" CON_RED "\n[Quit without saving]\n\n" CON_NORMAL);
 			return;
 		}
 
 		if (c == '\n') {
 			buffer[pos++] = '\n';
-			vga_putch('\n');
+			console_putch('\n');
 			continue;
 		}
 
@@ -343,7 +295,7 @@ static void cmd_write(const char *name)
 			if (pos > 0) {
 				pos--;
 				if (buffer[pos] == '\n') {
-					int row = vga_get_cursor_row();
+					int row = console_get_cursor_row();
 					int col = 0;
 					int temp = pos - 1;
 					while (temp >= 0 &&
@@ -352,11 +304,11 @@ static void cmd_write(const char *name)
 						temp--;
 					}
 					if (row > 0) {
-						vga_set_cursor(row - 1, col);
-						vga_clear_eol();
+						console_set_cursor(row - 1, col);
+						console_clear_eol();
 					}
 				} else {
-					vga_putch('\b');
+					console_putch('\b');
 				}
 			}
 			continue;
@@ -364,75 +316,332 @@ static void cmd_write(const char *name)
 
 		if (c >= 32 && c <= 126) {
 			buffer[pos++] = c;
-			vga_putch(c);
+			console_putch(c);
 		}
 	}
 
-	vga_putch('\n');
-	vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
-	vga_puts("\n[Buffer full!]\n\n");
-	vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+	kprintf("\n" CON_RED "\n[Buffer full!]\n\n" CON_NORMAL);
 }
 
-static void cmd_rm(const char *name)
+static void cmd_write(const char *name)
 {
 	if (!name || name[0] == '\0') {
-		vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
-		vga_puts("rm: missing name\n");
-		vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+		kprintf(CON_RED "write: missing filename\n" CON_NORMAL);
 		return;
 	}
 
-	if (fs_delete(fs_get_cwd(), name) != 0) {
-		vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
-		vga_puts("rm: cannot remove\n");
-		vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+	inode_t *file = open_or_create(name);
+	if (!file || file->type != INODE_FILE) {
+		kprintf(CON_RED "write: cannot create file\n" CON_NORMAL);
+		fs_put(file);
+		return;
 	}
+
+	char *buffer = kmalloc(EDITOR_BUFFER_SIZE);
+	if (!buffer) {
+		kprintf(CON_RED "write: out of memory\n" CON_NORMAL);
+		fs_put(file);
+		return;
+	}
+
+	kprintf(CON_CYAN "\n======== WR - Editor ========\n"
+	        "File: " CON_YELLOW "%s\n" CON_CYAN
+	        "Commands:\n"
+	        "  Ctrl+S  - Save file\n"
+	        "  Ctrl+Q  - Quit without saving\n"
+	        "=================================\n\n" CON_YELLOW,
+	        name);
+
+	editor_run(file, buffer);
+	kfree(buffer);
+	fs_put(file);
 }
 
-static void tree_recursive(inode_t *node, int depth)
+static void cmd_rm(const char *name)
 {
-	for (int i = 0; i < depth; i++) {
-		vga_puts("  ");
+	if (!name || name[0] == '\0') {
+		kprintf(CON_RED "rm: missing name\n" CON_NORMAL);
+		return;
+	}
+
+	char leaf[MAX_FILENAME];
+	inode_t *parent = fs_resolve_parent(name, leaf);
+	if (!parent || fs_delete(parent, leaf) != 0) {
+		kprintf(CON_RED "rm: cannot remove\n" CON_NORMAL);
 	}
+	fs_put(parent);
+}
 
+static void tree_recursive(inode_t *node, int depth)
+{
 	if (node->type == INODE_DIR) {
-		vga_set_color(VGA_COLOR_LIGHT_BLUE, VGA_COLOR_BLACK);
-		vga_puts(node->name);
-		vga_puts("/\n");
-		vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
+		kprintf("%*s" CON_BLUE "%s/\n" CON_NORMAL, depth * 2, "",
+		        node->name);
+
+		inode_t *child;
+		int pos = 0;
 
-		for (int i = 0; i < node->child_count; i++) {
-			tree_recursive(node->children[i], depth + 1);
+		while ((child = fs_dir_next(node, &pos))) {
+			tree_recursive(child, depth + 1);
+			fs_put(child);
 		}
 	} else {
-		vga_puts(node->name);
-		vga_putch('\n');
+		kprintf("%*s%s\n", depth * 2, "", node->name);
 	}
 }
 
-static void cmd_tree(void)
+static void cmd_tree(const char *args)
 {
+	(void)args;
 	tree_recursive(fs_get_root(), 0);
 }
 
-static void cmd_info(void)
+static void cmd_info(const char *args)
+{
+	(void)args;
+	struct fs_stats fs;
+	fs_get_stats(&fs);
+
+	kprintf(CON_CYAN "\n=== MiniOS System Information ===\n\n" CON_NORMAL
+	        "OS Name:      MiniOS\n"
+	        "Version:      1.1\n"
+	        "Architecture: x86 (32-bit)\n");
+	if (timer_tsc_khz())
+		kprintf("CPU clock:    %u MHz (TSC)\n", timer_tsc_khz() / 1000);
+	kprintf("CPUs:         %d\n", smp_cpu_count());
+	for (int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+		struct sched_cpu_stats stats;
+		if (sched_cpu_stats(cpu, &stats) != 0)
+			continue;
+
+		uint32_t online_ms = (uint32_t)div64_u32(stats.online_ns, 1000000, 0);
+		uint32_t idle_ms = (uint32_t)div64_u32(stats.idle_ns, 1000000, 0);
+		uint32_t busy = 0;
+		if (online_ms > idle_ms)
+			busy = (uint32_t)div64_u32(
+			    (uint64_t)(online_ms - idle_ms) * 100, online_ms, 0);
+		kprintf("  CPU%d:        %u%% busy, %u threads stolen\n", cpu, busy,
+		        stats.steals);
+	}
+	kprintf("Uptime:       %u s\n"
+	        "Memory:       %u MB (%u MB free)\n"
+	        "Filesystem:   minifs on %s (%u of %u KB free)\n"
+	        "Display:      VGA Text Mode (80x25)\n"
+	        "Author:       Davanico (GitHub: danko1122)\n\n",
+	        (uint32_t)div64_u32(timer_now_ns(), 1000000000u, 0),
+	        (uint32_t)(pmm_ram_bytes() >> 20),
+	        pmm_free_page_count() >> (20 - PAGE_SHIFT), fs.device,
+	        fs.free_blocks * (FS_BLOCK_SIZE / 1024),
+	        fs.total_blocks * (FS_BLOCK_SIZE / 1024));
+}
+
+static void cmd_meminfo(const char *args)
+{
+	(void)args;
+	kprintf(CON_CYAN "\n%-14s%6s%7s%8s%8s%7s\n" CON_NORMAL, "cache", "size",
+	        "slabs", "in-use", "allocs", "frees");
+	for (struct kmem_cache *c = kmem_cache_list(); c; c = c->next)
+		kprintf("%-14s%6u%7u%8u%8u%7u\n", c->name, c->obj_size, c->slabs,
+		        c->in_use, c->allocs, c->frees);
+
+	kprintf("\nLazy regions:      %u of %u pages resident\n"
+	        "Free pages:        %u of %u\n\n",
+	        vmm_lazy_resident_pages(), vmm_lazy_reserved_pages(),
+	        pmm_free_page_count(), pmm_total_pages());
+}
+
+static void cmd_ps(const char *args)
+{
+	(void)args;
+	static const char *const state_names[] = {"run", "ready", "sleep",
+	                                          "dead"};
+	// Copy first: threads can exit while the output is being printed
+	static struct thread_info ps[PS_MAX_THREADS];
+	int count = thread_snapshot(ps, PS_MAX_THREADS);
+
+	kprintf(CON_CYAN "\n%5s  %-16s%-7s%4s%4s%11s\n" CON_NORMAL, "TID",
+	        "NAME", "STATE", "PRI", "CPU", "CPU(ms)");
+	for (int i = count - 1; i >= 0; i--)
+		kprintf("%5u  %-16s%-7s%4u%4u%11u\n", ps[i].tid, ps[i].name,
+		        state_names[ps[i].state], ps[i].priority, ps[i].cpu,
+		        (uint32_t)div64_u32(ps[i].cpu_ns, 1000000, 0));
+	kprintf("\n");
+}
+
+static void cmd_sync(const char *args)
+{
+	(void)args;
+	if (fs_sync() != 0) {
+		kprintf(CON_RED "sync: write error\n" CON_NORMAL);
+		return;
+	}
+
+	struct bcache_stats stats;
+	bcache_get_stats(&stats);
+	kprintf("Buffer cache: %u of %u buffers, %u hits, %u misses, %u reads, "
+	        "%u writes\n",
+	        stats.buffers, stats.max_buffers, stats.hits, stats.misses,
+	        stats.reads, stats.writes);
+}
+
+static uint32_t bench_seed = 2463534242u;
+
+static uint32_t bench_random(void)
+{
+	// xorshift32
+	bench_seed ^= bench_seed << 13;
+	bench_seed ^= bench_seed >> 17;
+	bench_seed ^= bench_seed << 5;
+	return bench_seed;
+}
+
+// Queue n requests in one direction and time the run
+static int bench_run(struct blockdev *dev, struct blk_request *reqs,
+                     uint32_t n, int write, uint64_t *ns)
+{
+	struct blk_queue q;
+	blk_queue_init(&q, dev);
+
+	for (uint32_t i = 0; i < n; i++) {
+		reqs[i].write = write;
+		blk_queue_add(&q, &reqs[i]);
+	}
+
+	uint64_t start = timer_now_ns();
+	int ret = blk_queue_run(&q);
+	*ns += timer_now_ns() - start;
+	return ret;
+}
+
+static void print_rate(const char *label, uint64_t bytes, uint64_t ns)
+{
+	uint32_t us = (uint32_t)div64_u32(ns, 1000, 0);
+	if (!us)
+		us = 1;
+	uint32_t kbps = (uint32_t)div64_u32((bytes >> 10) * 1000000ull, us, 0);
+
+	kprintf("%s%u.%u MB/s\n", label, kbps / 1024, (kbps % 1024) * 10 / 1024);
+}
+
+// Every write puts back the data just read, so the filesystem is left
+// as it was; it stays off the device meanwhile, or a write-back between
+// a read and its write would be undone
+static void cmd_iobench(const char *args)
+{
+	(void)args;
+	struct blockdev *dev = fs_get_device();
+	uint32_t seq_bytes = IOBENCH_SEQ_BATCH * IOBENCH_SEQ_SECTORS * SECTOR_SIZE;
+	uint8_t *buffer = kmalloc(seq_bytes);
+	struct blk_request *reqs =
+	    kmalloc(IOBENCH_SEQ_BATCH * sizeof(struct blk_request));
+
+	if (!dev || !buffer || !reqs || fs_sync() != 0) {
+		console_puts("iobench: no usable device\n");
+		kfree(buffer);
+		kfree(reqs);
+		return;
+	}
+
+	uint32_t region = dev->sector_count;
+	if (region > IOBENCH_REGION_SECTORS)
+		region = IOBENCH_REGION_SECTORS;
+
+	struct blk_stats before, after;
+	uint64_t read_ns = 0, write_ns = 0, bytes = 0;
+	int err = 0;
+
+	fs_lock_device();
+	blk_get_stats(&before);
+	kprintf("Device: %s\n", dev->name);
+
+	for (uint32_t base = 0;
+	     !err && base + IOBENCH_SEQ_BATCH * IOBENCH_SEQ_SECTORS <= region;
+	     base += IOBENCH_SEQ_BATCH * IOBENCH_SEQ_SECTORS) {
+		for (uint32_t i = 0; i < IOBENCH_SEQ_BATCH; i++) {
+			reqs[i].sector = base + i * IOBENCH_SEQ_SECTORS;
+			reqs[i].count = IOBENCH_SEQ_SECTORS;
+			reqs[i].buffer = buffer + i * IOBENCH_SEQ_SECTORS * SECTOR_SIZE;
+		}
+		err = bench_run(dev, reqs, IOBENCH_SEQ_BATCH, 0, &read_ns) ||
+		      bench_run(dev, reqs, IOBENCH_SEQ_BATCH, 1, &write_ns);
+		bytes += seq_bytes;
+	}
+	if (!err) {
+		print_rate("Sequential read:  ", bytes, read_ns);
+		print_rate("Sequential write: ", bytes, write_ns);
+	}
+
+	read_ns = write_ns = bytes = 0;
+	for (uint32_t done = 0; !err && done < IOBENCH_RAND_REQUESTS;
+	     done += IOBENCH_RAND_BATCH) {
+		for (uint32_t i = 0; i < IOBENCH_RAND_BATCH; i++) {
+			uint32_t slot = bench_random() % (region / IOBENCH_RAND_SECTORS);
+			reqs[i].sector = slot * IOBENCH_RAND_SECTORS;
+			reqs[i].count = IOBENCH_RAND_SECTORS;
+			reqs[i].buffer =
+			    buffer + i * IOBENCH_RAND_SECTORS * SECTOR_SIZE;
+		}
+		err = bench_run(dev, reqs, IOBENCH_RAND_BATCH, 0, &read_ns) ||
+		      bench_run(dev, reqs, IOBENCH_RAND_BATCH, 1, &write_ns);
+		bytes += IOBENCH_RAND_BATCH * IOBENCH_RAND_SECTORS * SECTOR_SIZE;
+	}
+	if (!err) {
+		print_rate("Random read:      ", bytes, read_ns);
+		print_rate("Random write:     ", bytes, write_ns);
+	}
+
+	blk_get_stats(&after);
+	fs_unlock_device();
+	if (err) {
+		kprintf(CON_RED "iobench: I/O error\n" CON_NORMAL);
+	}
+	kprintf("%u requests merged into %u commands\n",
+	        after.requests - before.requests, after.commands - before.commands);
+
+	kfree(buffer);
+	kfree(reqs);
+}
+
+static void print_syscall_cost(const char *label, uint64_t cycles,
+                               uint32_t iterations)
 {
-	vga_set_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK);
-	vga_puts("\n=== MiniOS System Information ===\n\n");
-	vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
-	vga_puts("OS Name:      MiniOS\n");
-	vga_puts("Version:      1.1\n");
-	vga_puts("Architecture: x86 (32-bit)\n");
-	vga_puts("Memory:       64 MB\n");
-	vga_puts("Filesystem:   In-memory\n");
-	vga_puts("Display:      VGA Text Mode (80x25)\n");
-	vga_puts("Author:       Davanico (GitHub: danko1122)\n\n");
+	uint64_t ns = div64_u32(cycles * 1000000ull, timer_tsc_khz(), 0);
+	uint32_t tenths = (uint32_t)div64_u32(ns * 10, iterations, 0);
+
+	kprintf("%s%u cycles, %u.%u ns per call\n", label,
+	        (uint32_t)div64_u32(cycles, iterations, 0), tenths / 10,
+	        tenths % 10);
 }
 
-static void cmd_reboot(void)
+// Each method makes n gettid calls from ring 3 and times them with the
+// TSC, which includes the loop around them
+static void cmd_sysbench(const char *args)
 {
-	vga_puts("Rebooting...\n");
+	uint32_t iterations = SYSBENCH_ITERATIONS;
+	struct syscall_bench result;
+
+	if (*args) {
+		iterations = 0;
+		while (*args >= '0' && *args <= '9')
+			iterations = iterations * 10 + (*args++ - '0');
+	}
+	if (!iterations || syscall_benchmark(iterations, &result) != 0) {
+		kprintf(CON_RED "sysbench: cannot run\n" CON_NORMAL);
+		return;
+	}
+
+	print_syscall_cost("int 0x80: ", result.int80_cycles, iterations);
+	if (syscall_have_sysenter())
+		print_syscall_cost("sysenter: ", result.sysenter_cycles, iterations);
+	else
+		kprintf("sysenter: not supported by this CPU\n");
+}
+
+static void cmd_reboot(const char *args)
+{
+	(void)args;
+	console_puts("Rebooting...\n");
+	fs_sync();
 	uint8_t temp;
 	__asm__ volatile("cli");
 	do {
@@ -445,6 +654,258 @@ static void cmd_reboot(void)
 		__asm__ volatile("hlt");
 }
 
+static void cmd_clear(const char *args)
+{
+	(void)args;
+	console_clear();
+	show_welcome();
+}
+
+static void cmd_help(const char *args);
+
+// Built-in commands, sorted by name for the binary searches below
+static const struct command commands[] = {
+    {"cat", "cat <file>", "Display file (Shift+PgUp to scroll back)", cmd_cat},
+    {"cd", "cd <path>", "Change directory", cmd_cd},
+    {"clear", "clear", "Clear screen", cmd_clear},
+    {"echo", "echo <text> > <file>", "Write to file", cmd_echo},
+    {"help", "help", "Show this help", cmd_help},
+    {"info", "info", "System information", cmd_info},
+    {"iobench", "iobench", "Disk throughput benchmark", cmd_iobench},
+    {"ls", "ls [path]", "List files", cmd_ls},
+    {"meminfo", "meminfo", "Kernel heap statistics", cmd_meminfo},
+    {"mkdir", "mkdir <name>", "Create directory", cmd_mkdir},
+    {"ps", "ps", "List threads and their CPU time", cmd_ps},
+    {"pwd", "pwd", "Print working directory", cmd_pwd},
+    {"reboot", "reboot", "Reboot system", cmd_reboot},
+    {"rm", "rm <name>", "Remove file/dir", cmd_rm},
+    {"sync", "sync", "Write cached data to disk", cmd_sync},
+    {"sysbench", "sysbench [n]", "System call latency, int 0x80 vs sysenter",
+     cmd_sysbench},
+    {"touch", "touch <file>", "Create file", cmd_touch},
+    {"tree", "tree", "Show directory tree", cmd_tree},
+    {"write", "write <file>", "Edit file (Ctrl+S save, Ctrl+Q exit)",
+     cmd_write},
+};
+
+#define COMMAND_COUNT ((int)(sizeof(commands) / sizeof(commands[0])))
+
+static void cmd_help(const char *args)
+{
+	(void)args;
+	kprintf(CON_CYAN "\nMiniOS Shell Commands:\n\n" CON_NORMAL);
+	for (int i = 0; i < COMMAND_COUNT; i++)
+		kprintf("  %-13s - %s\n", commands[i].usage, commands[i].help);
+	kprintf("  <program> [args] - Run " PROGRAM_DIR
+	        "/<program>, or a path\n"
+	        "  Tab completes commands and file names\n\n");
+}
+
+// First command whose name, cut to len characters, is not below prefix
+// (above it, if upper)
+static int command_bound(const char *prefix, int len, int upper)
+{
+	int lo = 0, hi = COMMAND_COUNT;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		int cmp = strncmp(commands[mid].name, prefix, len);
+		if (cmp < 0 || (upper && cmp == 0))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static const struct command *find_command(const char *name)
+{
+	int i = command_bound(name, strlen(name) + 1, 0);
+
+	if (i < COMMAND_COUNT && strcmp(commands[i].name, name) == 0)
+		return &commands[i];
+	return 0;
+}
+
+// A command that is not built in names a program: a path, or a file in
+// PROGRAM_DIR. Returns 0 if there is no such file.
+static int run_program(const char *command, char *args)
+{
+	char path[MAX_PATH];
+	const char *p = command;
+
+	while (*p && *p != '/')
+		p++;
+	if (!*p) {
+		ksnprintf(path, sizeof(path), PROGRAM_DIR "/%s", command);
+		command = path;
+	}
+	inode_t *file = fs_resolve_path(command);
+	if (!file || file->type != INODE_FILE) {
+		fs_put(file);
+		return 0;
+	}
+
+	// Split the arguments in place
+	char *argv[EXEC_MAX_ARGS];
+	int argc = 0;
+	argv[argc++] = file->name;
+	while (*args && argc < EXEC_MAX_ARGS) {
+		argv[argc++] = args;
+		while (*args && *args != ' ')
+			args++;
+		while (*args == ' ')
+			*args++ = '\0';
+	}
+
+	int status;
+	if (*args || exec_run(file, argc, argv, &status) != 0)
+		kprintf(CON_RED "%s: cannot run\n" CON_NORMAL, file->name);
+	else if (status != 0)
+		kprintf("%s: exit status %d\n", file->name, status);
+	fs_put(file);
+	return 1;
+}
+
+// Candidates for the word being completed, gathered from the command
+// table and directories
+struct completion {
+	int count;
+	int shown; // those in names
+	char common[MAX_FILENAME]; // longest prefix all candidates share
+	struct fs_match names[COMPLETE_MAX_SHOWN];
+};
+
+// Account for count more candidates sharing common, the first of which
+// are already in c->names
+static void completion_merge(struct completion *c, int count,
+                             const char *common)
+{
+	if (!count)
+		return;
+	if (!c->count) {
+		strcpy(c->common, common);
+	} else {
+		int n = 0;
+		while (c->common[n] && c->common[n] == common[n])
+			n++;
+		c->common[n] = '\0';
+	}
+	c->count += count;
+	c->shown += count < COMPLETE_MAX_SHOWN - c->shown
+	                ? count
+	                : COMPLETE_MAX_SHOWN - c->shown;
+}
+
+static void complete_commands(struct completion *c, const char *prefix)
+{
+	int len = strlen(prefix);
+	int first = command_bound(prefix, len, 0);
+	int count = command_bound(prefix, len, 1) - first;
+
+	for (int i = 0; i < count && c->shown + i < COMPLETE_MAX_SHOWN; i++) {
+		strcpy(c->names[c->shown + i].name, commands[first + i].name);
+		c->names[c->shown + i].type = INODE_FILE;
+	}
+	if (count > 0) {
+		// The table is sorted too, so the first and last bound the rest
+		const char *a = commands[first].name;
+		const char *b = commands[first + count - 1].name;
+		char common[MAX_FILENAME];
+		int n = 0;
+		while (a[n] && a[n] == b[n] && n < MAX_FILENAME - 1) {
+			common[n] = a[n];
+			n++;
+		}
+		common[n] = '\0';
+		completion_merge(c, count, common);
+	}
+}
+
+static void complete_names(struct completion *c, inode_t *dir,
+                           const char *prefix)
+{
+	char common[MAX_FILENAME];
+	int count = fs_dir_match(dir, prefix, c->names + c->shown,
+	                         COMPLETE_MAX_SHOWN - c->shown, common);
+
+	completion_merge(c, count, common);
+}
+
+// Tab: complete the last word on the line. The first names a command or
+// program, later ones a file or directory, relative to the cwd unless
+// they hold a path. Adds what all candidates share; when that is
+// nothing, lists them and redraws the line.
+static int complete_line(char *buffer, int len, int max_len)
+{
+	static struct completion c;
+	int start = len;
+
+	while (start > 0 && buffer[start - 1] != ' ')
+		start--;
+	int first_word = 1;
+	for (int i = 0; i < start; i++) {
+		if (buffer[i] != ' ')
+			first_word = 0;
+	}
+
+	buffer[len] = '\0';
+	const char *word = buffer + start;
+	const char *prefix = word;
+	for (const char *p = word; *p; p++) {
+		if (*p == '/')
+			prefix = p + 1;
+	}
+
+	memset(&c, 0, sizeof(c));
+	inode_t *dir;
+	if (prefix != word) {
+		char path[MAX_PATH];
+		int n = prefix - word;
+		if (n >= MAX_PATH)
+			return len;
+		memcpy(path, word, n);
+		path[n] = '\0';
+		dir = fs_resolve_path(path);
+	} else if (first_word) {
+		complete_commands(&c, prefix);
+		dir = fs_resolve_path(PROGRAM_DIR);
+	} else {
+		dir = fs_get_cwd();
+	}
+	if (dir && dir->type == INODE_DIR)
+		complete_names(&c, dir, prefix);
+	fs_put(dir);
+	if (!c.count)
+		return len;
+
+	int typed = len - (prefix - buffer);
+	int common_len = strlen(c.common);
+	if (common_len > typed || c.count == 1) {
+		int old = len;
+		for (int i = typed; i < common_len && len < max_len - 1; i++)
+			buffer[len++] = c.common[i];
+		if (c.count == 1 && len < max_len - 1)
+			buffer[len++] = c.names[0].type == INODE_DIR ? '/' : ' ';
+		console_write(buffer + old, len - old);
+		return len;
+	}
+
+	console_putch('\n');
+	for (int i = 0; i < c.shown; i++) {
+		if (c.names[i].type == INODE_DIR)
+			kprintf(CON_BLUE "%s/  " CON_NORMAL, c.names[i].name);
+		else
+			kprintf("%s  ", c.names[i].name);
+	}
+	if (c.count > c.shown)
+		kprintf(CON_DARK_GREY "(%d more)" CON_NORMAL, c.count - c.shown);
+	console_putch('\n');
+	print_prompt();
+	console_write(buffer, len);
+	return len;
+}
+
 static void parse_and_execute(const char *cmd)
 {
 	if (cmd[0] == '\0')
@@ -468,43 +929,16 @@ static void parse_and_execute(const char *cmd)
 	while (cmd[i]) {
 		args[j++] = cmd[i++];
 	}
+	// Tab completion leaves a space after the last word
+	while (j > 0 && args[j - 1] == ' ')
+		j--;
 	args[j] = '\0';
 
-	if (strcmp(command, "help") == 0) {
-		print_help();
-	} else if (strcmp(command, "clear") == 0) {
-		vga_clear();
-		show_welcome();
-	} else if (strcmp(command, "ls") == 0) {
-		cmd_ls();
-	} else if (strcmp(command, "pwd") == 0) {
-		cmd_pwd();
-	} else if (strcmp(command, "cd") == 0) {
-		cmd_cd(args);
-	} else if (strcmp(command, "mkdir") == 0) {
-		cmd_mkdir(args);
-	} else if (strcmp(command, "touch") == 0) {
-		cmd_touch(args);
-	} else if (strcmp(command, "cat") == 0) {
-		cmd_cat(args);
-	} else if (strcmp(command, "echo") == 0) {
-		cmd_echo(args);
-	} else if (strcmp(command, "write") == 0) {
-		cmd_write(args);
-	} else if (strcmp(command, "rm") == 0) {
-		cmd_rm(args);
-	} else if (strcmp(command, "tree") == 0) {
-		cmd_tree();
-	} else if (strcmp(command, "info") == 0) {
-		cmd_info();
-	} else if (strcmp(command, "reboot") == 0) {
-		cmd_reboot();
-	} else {
-		vga_set_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK);
-		vga_puts(command);
-		vga_puts(": command not found\n");
-		vga_set_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK);
-	}
+	const struct command *builtin = find_command(command);
+	if (builtin)
+		builtin->run(args);
+	else if (!run_program(command, args))
+		kprintf(CON_RED "%s: command not found\n" CON_NORMAL, command);
 }
 
 void shell_init(void)
@@ -515,11 +949,11 @@ void shell_init(void)
 void shell_run(void)
 {
 	// Ensure we start on a fresh line after welcome message
-	vga_putch('\n');
+	console_putch('\n');
 
 	while (1) {
 		print_prompt();
-		keyboard_readline(cmd_buffer, CMD_BUFFER_SIZE);
+		console_readline_complete(cmd_buffer, CMD_BUFFER_SIZE, complete_line);
 		parse_and_execute(cmd_buffer);
 	}
 }
@@ -0,0 +1,120 @@
+// fs/ operations at scale on a RAM disk: create, lookup, path resolution,
+// path building, delete and file I/O through the buffer cache
+#include "../drivers/ramdisk.h"
+#include "../fs/bcache.h"
+#include "../fs/fs.h"
+#include "harness.h"
+
+#define DISK_SIZE (64 << 20)
+#define FILES 10000
+#define DEPTH 24
+#define FILE_SIZE (1 << 20)
+
+static char names[FILES][MAX_FILENAME];
+
+static void bench_dir(void)
+{
+	inode_t *dir = fs_create_dir(fs_get_root(), "bench");
+	char path[MAX_PATH];
+	int found = 0;
+
+	for (int i = 0; i < FILES; i++)
+		snprintf(names[i], MAX_FILENAME, "file_%05d.txt", i);
+
+	uint64_t start = now_ns();
+	for (int i = 0; i < FILES; i++)
+		fs_create_file(dir, names[i]);
+	bench_report("fs", "create", FILES, now_ns() - start, 0);
+
+	start = now_ns();
+	for (int i = 0; i < FILES; i++)
+		found += fs_find_child(dir, names[i]) != 0;
+	bench_report("fs", "find_child", FILES, now_ns() - start, 0);
+
+	start = now_ns();
+	for (int i = 0; i < FILES; i++) {
+		snprintf(path, sizeof(path), "/bench/%.*s", MAX_FILENAME, names[i]);
+		found += fs_resolve_path(path) != 0;
+	}
+	bench_report("fs", "resolve_path", FILES, now_ns() - start, 0);
+
+	start = now_ns();
+	for (int i = 0; i < FILES; i++)
+		found += fs_find_child(dir, "no_such_file") != 0;
+	bench_report("fs", "find_child_miss", FILES, now_ns() - start, 0);
+
+	start = now_ns();
+	for (int i = 0; i < FILES; i++)
+		fs_delete(dir, names[i]);
+	bench_report("fs", "delete", FILES, now_ns() - start, 0);
+
+	if (found != 2 * FILES)
+		fprintf(stderr, "bench_fs: only %d of %d lookups hit\n", found,
+		        2 * FILES);
+	fs_delete(fs_get_root(), "bench");
+}
+
+static void bench_deep_path(void)
+{
+	inode_t *node = fs_get_root();
+	char path[MAX_PATH] = "";
+	char name[16];
+	uint64_t ops = 100000;
+
+	for (int d = 0; d < DEPTH; d++) {
+		snprintf(name, sizeof(name), "d%02d", d);
+		node = fs_create_dir(node, name);
+	}
+
+	uint64_t start = now_ns();
+	for (uint64_t n = 0; n < ops; n++)
+		fs_get_path(node, path);
+	bench_report("fs", "get_path_depth24", ops, now_ns() - start, 0);
+
+	start = now_ns();
+	for (uint64_t n = 0; n < ops; n++)
+		fs_resolve_path(path);
+	bench_report("fs", "resolve_path_depth24", ops, now_ns() - start, 0);
+}
+
+static void bench_io(void)
+{
+	char *data = malloc(FILE_SIZE);
+	char *back = malloc(FILE_SIZE);
+	inode_t *file = fs_create_file(fs_get_root(), "io");
+	int rounds = 20;
+
+	for (int i = 0; i < FILE_SIZE; i++)
+		data[i] = i;
+
+	uint64_t start = now_ns();
+	for (int i = 0; i < rounds; i++)
+		fs_write_file(file, data, FILE_SIZE);
+	fs_sync();
+	bench_report("fs", "write_1M", rounds, now_ns() - start, FILE_SIZE);
+
+	start = now_ns();
+	for (int i = 0; i < rounds; i++)
+		fs_read_at(file, 0, back, FILE_SIZE);
+	bench_report("fs", "read_1M", rounds, now_ns() - start, FILE_SIZE);
+
+	fs_delete(fs_get_root(), "io");
+	free(data);
+	free(back);
+}
+
+int main(void)
+{
+	bcache_init(1024);
+
+	struct blockdev *dev = ramdisk_create("bench", 0, DISK_SIZE);
+	if (!dev || fs_init(dev) < 0) {
+		fprintf(stderr, "bench_fs: cannot format RAM disk\n");
+		return 1;
+	}
+
+	bench_dir();
+	bench_deep_path();
+	bench_io();
+	return 0;
+}
@@ -0,0 +1,70 @@
+// memcpy/memset throughput across sizes, for the rep movs/stos and SSE2
+// paths of lib/string.c, plus the word-at-a-time string routines
+#include "harness.h"
+
+// Enough total work per size to take a few milliseconds
+#define BENCH_BYTES (256u << 20)
+#define BUF_SIZE (1 << 20)
+
+static char *dst, *src;
+// Keeps results live so the loops are not optimized away
+static volatile int sink;
+
+static void bench_sizes(const char *mode)
+{
+	static const int sizes[] = {16, 64, 256, 1024, 4096, 65536, BUF_SIZE};
+	char name[64];
+
+	for (unsigned i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		int size = sizes[i];
+		uint64_t ops = BENCH_BYTES / size;
+
+		uint64_t start = now_ns();
+		for (uint64_t n = 0; n < ops; n++)
+			k_memcpy(dst, src, size);
+		snprintf(name, sizeof(name), "memcpy_%s_%d", mode, size);
+		bench_report("string", name, ops, now_ns() - start, size);
+
+		start = now_ns();
+		for (uint64_t n = 0; n < ops; n++)
+			k_memset(dst, n, size);
+		snprintf(name, sizeof(name), "memset_%s_%d", mode, size);
+		bench_report("string", name, ops, now_ns() - start, size);
+	}
+}
+
+// File-name sized strings, as compared during directory lookups
+static void bench_str(void)
+{
+	char a[32] __attribute__((aligned(4))) = "a_typical_file_name.txt";
+	char b[32] __attribute__((aligned(4))) = "a_typical_file_name.txx";
+	uint64_t ops = 10000000;
+
+	uint64_t start = now_ns();
+	for (uint64_t n = 0; n < ops; n++)
+		sink += k_strlen(a);
+	bench_report("string", "strlen_23", ops, now_ns() - start, 0);
+
+	start = now_ns();
+	for (uint64_t n = 0; n < ops; n++)
+		sink += k_strcmp(a, b);
+	bench_report("string", "strcmp_23", ops, now_ns() - start, 0);
+}
+
+int main(void)
+{
+	dst = aligned_alloc(64, BUF_SIZE);
+	src = aligned_alloc(64, BUF_SIZE);
+	for (int i = 0; i < BUF_SIZE; i++)
+		src[i] = i;
+
+	bench_sizes("rep");
+	bench_str();
+
+	string_enable_sse2();
+	bench_sizes("sse2");
+
+	free(dst);
+	free(src);
+	return 0;
+}
@@ -0,0 +1,64 @@
+// Host-side test and benchmark support. The kernel modules under test are
+// built natively with their libc-clashing names prefixed (memcpy ->
+// k_memcpy, see HOST_RENAME in the Makefile) and linked with shim.c.
+#ifndef HARNESS_H
+#define HARNESS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// lib/string.c as built for the host
+int k_strlen(const char *str);
+int k_strcmp(const char *s1, const char *s2);
+int k_strncmp(const char *s1, const char *s2, int n);
+char *k_strcpy(char *dest, const char *src);
+char *k_strcat(char *dest, const char *src);
+int k_memcmp(const void *s1, const void *s2, int n);
+void *k_memcpy(void *dest, const void *src, int n);
+void *k_memset(void *s, int c, int n);
+void string_enable_sse2(void);
+
+static int check_failures;
+
+// Report a failed condition and keep going; the test exits nonzero at the end
+#define CHECK(cond)                                                        \
+	do {                                                                   \
+		if (!(cond)) {                                                     \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__,       \
+			        __LINE__, #cond);                                      \
+			check_failures++;                                              \
+		}                                                                  \
+	} while (0)
+
+static inline int test_finish(const char *name)
+{
+	printf("%s: %s\n", name, check_failures ? "FAILED" : "ok");
+	return check_failures ? 1 : 0;
+}
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+// One JSON object per line, so runs can be diffed or collected by a script.
+// bytes is the data moved per op, 0 when throughput means nothing.
+static inline void bench_report(const char *suite, const char *name,
+                                uint64_t ops, uint64_t ns, uint64_t bytes)
+{
+	double per_op = ops ? (double)ns / ops : 0;
+
+	printf("{\"suite\":\"%s\",\"bench\":\"%s\",\"ops\":%llu,"
+	       "\"ns_per_op\":%.1f",
+	       suite, name, (unsigned long long)ops, per_op);
+	if (bytes && ns)
+		printf(",\"mb_per_s\":%.1f",
+		       (double)bytes * ops * 1000.0 / ns);
+	printf("}\n");
+}
+
+#endif
@@ -0,0 +1,80 @@
+// Kernel services the host-built modules link against
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../drivers/timer.h"
+#include "../kernel/mutex.h"
+#include "../kernel/rcu.h"
+
+struct kmem_cache;
+
+// The kernel's large allocations are demand-zero, and ramdisk.c relies on
+// it, so everything comes back zeroed here
+void *kmalloc(uint32_t size)
+{
+	return calloc(1, size);
+}
+
+void *kzalloc(uint32_t size)
+{
+	return calloc(1, size);
+}
+
+void kfree(void *ptr)
+{
+	free(ptr);
+}
+
+// The cache handle just remembers the object size
+struct kmem_cache *kmem_cache_create(const char *name, uint32_t size)
+{
+	(void)name;
+	uint32_t *cache = malloc(sizeof(*cache));
+	*cache = size;
+	return (struct kmem_cache *)cache;
+}
+
+void *kmem_cache_alloc(struct kmem_cache *cache)
+{
+	return malloc(*(uint32_t *)cache);
+}
+
+void kmem_cache_free(struct kmem_cache *cache, void *obj)
+{
+	(void)cache;
+	free(obj);
+}
+
+uint64_t timer_ticks(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * TIMER_HZ +
+	       ts.tv_nsec / (1000000000 / TIMER_HZ);
+}
+
+// Single-threaded: the filesystem's locks have nothing to keep off the
+// CPU, and no reader can be left holding what call_rcu() frees
+void sched_preempt_disable(void)
+{
+}
+
+void sched_preempt_enable(void)
+{
+}
+
+void mutex_lock(struct mutex *m)
+{
+	(void)m;
+}
+
+void mutex_unlock(struct mutex *m)
+{
+	(void)m;
+}
+
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *head))
+{
+	func(head);
+}
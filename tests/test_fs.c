@@ -0,0 +1,279 @@
+// fs/ on a RAM disk: format, remount, file data across the direct,
+// indirect and double-indirect ranges, path resolution, directory growth,
+// inode references, name-order prefix matching, listing order and block
+// accounting
+#include <string.h>
+
+#include "../drivers/ramdisk.h"
+#include "../fs/bcache.h"
+#include "../fs/fs.h"
+#include "harness.h"
+
+#define DISK_SIZE (16 << 20)
+#define BIG_FILE (600 * 1024)
+
+static void test_paths(void)
+{
+	inode_t *root = fs_get_root();
+	inode_t *a = fs_create_dir(root, "a");
+	inode_t *b = fs_create_dir(a, "b");
+	inode_t *f = fs_create_file(b, "file.txt");
+	char path[MAX_PATH];
+	char leaf[MAX_FILENAME];
+
+	CHECK(a && b && f);
+	CHECK(fs_create_file(b, "file.txt") == 0);
+	CHECK(fs_find_child(a, "b") == b);
+	CHECK(fs_find_child(a, "missing") == 0);
+
+	CHECK(fs_resolve_path("/a/b/file.txt") == f);
+	CHECK(fs_resolve_path("/a/./b/../b/file.txt") == f);
+	CHECK(fs_resolve_path("/a/b/file.txt/x") == 0);
+	CHECK(fs_resolve_path("/..") == root);
+
+	fs_set_cwd(a);
+	CHECK(fs_resolve_path("b/file.txt") == f);
+	CHECK(fs_resolve_path("..") == root);
+	CHECK(fs_resolve_parent("b/new", leaf) == b && strcmp(leaf, "new") == 0);
+	CHECK(fs_resolve_parent("b/..", leaf) == 0);
+	fs_set_cwd(root);
+
+	fs_get_path(f, path);
+	CHECK(strcmp(path, "/a/b/file.txt") == 0);
+	fs_get_path(root, path);
+	CHECK(strcmp(path, "/") == 0);
+
+	CHECK(fs_delete(a, "b") == -1); // not empty
+	CHECK(fs_delete(b, "file.txt") == 0);
+	CHECK(fs_delete(a, "b") == 0);
+	CHECK(fs_delete(root, "a") == 0);
+	CHECK(fs_resolve_path("/a") == 0);
+}
+
+// Cached negative lookups must not outlive a create, nor cached hits a
+// delete, across table growth and compaction
+static void test_dir_changes(void)
+{
+	inode_t *root = fs_get_root();
+	inode_t *dir = fs_create_dir(root, "many");
+	char name[16];
+	char path[32];
+	int pos = 0, seen = 0;
+
+	CHECK(dir != 0);
+	CHECK(fs_resolve_path("/many/f0") == 0);
+	for (int i = 0; i < 100; i++) {
+		snprintf(name, sizeof(name), "f%d", i);
+		CHECK(fs_create_file(dir, name) != 0);
+	}
+	CHECK(fs_resolve_path("/many/f0") == fs_find_child(dir, "f0"));
+	CHECK(fs_resolve_path("/many/f99") != 0);
+
+	// Every other entry goes, then the holes are compacted away
+	for (int i = 0; i < 100; i += 2) {
+		snprintf(name, sizeof(name), "f%d", i);
+		CHECK(fs_delete(dir, name) == 0);
+	}
+	for (int i = 100; i < 140; i++) {
+		snprintf(name, sizeof(name), "f%d", i);
+		CHECK(fs_create_file(dir, name) != 0);
+	}
+	for (int i = 0; i < 140; i++) {
+		snprintf(path, sizeof(path), "/many/f%d", i);
+		CHECK((fs_resolve_path(path) != 0) == (i >= 100 || i % 2 == 1));
+	}
+	while (fs_dir_next(dir, &pos))
+		seen++;
+	CHECK(seen == 90 && dir->child_count == 90);
+
+	// The name order must have followed every create and delete
+	struct fs_match m[100];
+	char common[MAX_FILENAME];
+	CHECK(fs_dir_match(dir, "", m, 100, common) == 90);
+	for (int i = 1; i < 90; i++)
+		CHECK(strcmp(m[i - 1].name, m[i].name) < 0);
+	CHECK(fs_dir_match(dir, "f13", m, 4, common) == 11);
+	CHECK(strcmp(m[0].name, "f13") == 0 && strcmp(m[3].name, "f132") == 0);
+	CHECK(strcmp(common, "f13") == 0);
+	CHECK(fs_dir_match(dir, "f12", m, 100, common) == 10 &&
+	      strcmp(common, "f12") == 0); // f12 itself is gone
+	CHECK(fs_dir_match(dir, "f9", m, 100, common) == 6);
+	CHECK(fs_dir_match(dir, "f99", m, 100, common) == 1 &&
+	      strcmp(common, "f99") == 0 && m[0].type == INODE_FILE);
+	CHECK(fs_dir_match(dir, "g", m, 100, common) == 0 && common[0] == 0);
+
+	// Ranks stay right in a bigger directory filled out of order
+	inode_t *big = fs_create_dir(root, "big");
+	for (int i = 0; i < 1000; i++) {
+		snprintf(name, sizeof(name), "n%03d", i * 7 % 1000);
+		CHECK(fs_create_file(big, name) != 0);
+	}
+	for (int i = 0; i < 1000; i += 3) {
+		snprintf(name, sizeof(name), "n%03d", i);
+		CHECK(fs_delete(big, name) == 0);
+	}
+	CHECK(fs_dir_match(big, "n5", m, 100, common) == 67);
+	CHECK(strcmp(m[0].name, "n500") == 0 && strcmp(m[66].name, "n599") == 0);
+	CHECK(fs_dir_match(big, "n45", m, 100, common) == 6 &&
+	      strcmp(m[5].name, "n458") == 0 && strcmp(common, "n45") == 0);
+	for (int i = 0; i < 1000; i++) {
+		snprintf(name, sizeof(name), "n%03d", i);
+		fs_delete(big, name);
+	}
+	CHECK(fs_dir_match(big, "", m, 100, common) == 0);
+	CHECK(fs_delete(root, "big") == 0);
+
+	for (int i = 0; i < 140; i++) {
+		snprintf(name, sizeof(name), "f%d", i);
+		fs_delete(dir, name);
+	}
+	CHECK(dir->child_count == 0);
+	CHECK(fs_delete(root, "many") == 0);
+}
+
+// A reference keeps a deleted inode, and the directories above it,
+// allocated until it is dropped
+static void test_refs(void)
+{
+	inode_t *root = fs_get_root();
+	inode_t *dir = fs_create_dir(root, "refs");
+	inode_t *f = fs_create_file(dir, "f");
+	inode_t *again = fs_find_child(dir, "f");
+
+	CHECK(dir && f && again == f);
+	CHECK(f->refs == 3); // the tree's and two lookups'
+	fs_put(again);
+
+	CHECK(fs_delete(dir, "f") == 0);
+	CHECK(fs_find_child(dir, "f") == 0 && f->refs == 1 && f->ino == 0);
+	CHECK(fs_delete(root, "refs") == 0);
+	CHECK(dir->refs == 2); // this caller's and f's
+	fs_put(f);
+	CHECK(dir->refs == 1);
+	fs_put(dir);
+	CHECK(fs_resolve_path("/refs") == 0);
+}
+
+static void test_data(struct blockdev *dev)
+{
+	struct fs_stats before, after;
+	char *data = malloc(BIG_FILE);
+	char *back = malloc(BIG_FILE);
+
+	fs_get_stats(&before);
+	for (int i = 0; i < BIG_FILE; i++)
+		data[i] = rand();
+
+	inode_t *root = fs_get_root();
+	inode_t *dir = fs_create_dir(root, "data");
+	inode_t *big = fs_create_file(dir, "big");
+	inode_t *small = fs_create_file(root, "small");
+	CHECK(fs_write_file(big, data, BIG_FILE) == BIG_FILE);
+	CHECK(fs_write_file(small, "hello", 5) == 5);
+	CHECK(fs_sync() == 0);
+
+	// Everything must come back from the device alone
+	CHECK(fs_init(dev) == FS_MOUNTED);
+	big = fs_resolve_path("/data/big");
+	small = fs_resolve_path("/small");
+	CHECK(big && small);
+	if (!big || !small)
+		return;
+
+	CHECK(fs_read_at(big, 0, back, BIG_FILE) == BIG_FILE);
+	CHECK(memcmp(data, back, BIG_FILE) == 0);
+	CHECK(fs_read_at(big, 300000, back, 1000) == 1000);
+	CHECK(memcmp(data + 300000, back, 1000) == 0);
+	CHECK(fs_read_at(big, BIG_FILE - 10, back, 100) == 10);
+
+	char s[8] = {0};
+	CHECK(fs_read_at(small, 0, s, sizeof(s)) == 5 && strcmp(s, "hello") == 0);
+
+	// Shrinking frees the blocks past the new end
+	CHECK(fs_write_file(big, data, 5000) == 5000);
+	CHECK(fs_read_at(big, 0, back, BIG_FILE) == 5000);
+	CHECK(memcmp(data, back, 5000) == 0);
+
+	// In-place writes: across a block boundary, then past the end
+	CHECK(fs_write_at(big, 1000, "abcdef", 6) == 6);
+	CHECK(fs_read_at(big, 998, back, 10) == 10);
+	CHECK(memcmp(back + 2, "abcdef", 6) == 0 && back[8] == data[1006]);
+	CHECK(fs_write_at(big, 9000, "xyz", 3) == 3);
+	CHECK(fs_read_at(big, 4990, back, BIG_FILE) == 4013);
+	CHECK(memcmp(back, data + 4990, 10) == 0 && back[10] == 0 &&
+	      back[4009] == 0 && memcmp(back + 4010, "xyz", 3) == 0);
+
+	root = fs_get_root();
+	CHECK(fs_delete(fs_resolve_path("/data"), "big") == 0);
+	CHECK(fs_delete(root, "data") == 0);
+	CHECK(fs_delete(root, "small") == 0);
+	fs_get_stats(&after);
+	CHECK(after.free_blocks == before.free_blocks);
+	CHECK(after.free_inodes == before.free_inodes);
+
+	// A write that cannot fit fails and leaks nothing
+	uint32_t huge_size = DISK_SIZE + (1 << 20);
+	char *huge = calloc(1, huge_size);
+	inode_t *h = fs_create_file(root, "huge");
+	CHECK(fs_write_file(h, huge, huge_size) == -1);
+	CHECK(fs_delete(root, "huge") == 0);
+	fs_get_stats(&after);
+	CHECK(after.free_blocks == before.free_blocks);
+
+	CHECK(fs_sync() == 0);
+	CHECK(fs_init(dev) == FS_MOUNTED);
+	fs_get_stats(&after);
+	CHECK(after.free_blocks == before.free_blocks);
+
+	free(huge);
+	free(data);
+	free(back);
+}
+
+// Listings keep creation order across a remount, even when a newer file
+// reuses a lower inode number
+static void test_order(struct blockdev *dev)
+{
+	inode_t *root = fs_get_root();
+	CHECK(fs_create_file(root, "first") && fs_create_file(root, "second"));
+	CHECK(fs_delete(root, "first") == 0);
+	CHECK(fs_sync() == 0);
+
+	// Inode allocation starts over from the bottom after a mount
+	CHECK(fs_init(dev) == FS_MOUNTED);
+	CHECK(fs_create_file(fs_get_root(), "third") != 0);
+	CHECK(fs_sync() == 0);
+	CHECK(fs_init(dev) == FS_MOUNTED);
+
+	root = fs_get_root();
+	inode_t *second = fs_find_child(root, "second");
+	inode_t *third = fs_find_child(root, "third");
+	CHECK(second && third && second->ino > third->ino);
+
+	int pos = 0;
+	CHECK(fs_dir_next(root, &pos) == second);
+	CHECK(fs_dir_next(root, &pos) == third);
+	CHECK(fs_dir_next(root, &pos) == 0);
+
+	CHECK(fs_delete(root, "second") == 0);
+	CHECK(fs_delete(root, "third") == 0);
+}
+
+int main(void)
+{
+	srand(1);
+	bcache_init(256);
+
+	struct blockdev *dev = ramdisk_create("test", 0, DISK_SIZE);
+	CHECK(dev && fs_init(dev) == FS_FORMATTED);
+	if (!dev)
+		return test_finish("test_fs");
+
+	test_paths();
+	test_dir_changes();
+	test_refs();
+	test_data(dev);
+	test_order(dev);
+
+	return test_finish("test_fs");
+}
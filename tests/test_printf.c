@@ -0,0 +1,101 @@
+// lib/printf.c against the host snprintf for the conversions it supports,
+// plus truncation and the flush path kprintf() uses
+#include <string.h>
+
+#include "../lib/printf.h"
+#include "harness.h"
+
+static char flushed[4096];
+static int flushed_len, flush_calls;
+
+static void flush(const char *buf, int len)
+{
+	memcpy(flushed + flushed_len, buf, len);
+	flushed_len += len;
+	flush_calls++;
+}
+
+static int format_flushed(char *buf, int size, const char *fmt, ...)
+{
+	va_list ap;
+
+	flushed_len = flush_calls = 0;
+	va_start(ap, fmt);
+	int len = kvformat(buf, size, flush, fmt, ap);
+	va_end(ap);
+	flushed[flushed_len] = '\0';
+	return len;
+}
+
+#define SAME(fmt, ...)                                                      \
+	do {                                                                   \
+		char got[128], want[128];                                          \
+		int n = ksnprintf(got, sizeof(got), fmt, __VA_ARGS__);             \
+		int m = snprintf(want, sizeof(want), fmt, __VA_ARGS__);            \
+		CHECK(n == m && strcmp(got, want) == 0);                           \
+	} while (0)
+
+static void test_conversions(void)
+{
+	static const int ints[] = {0, 1, -1, 42, -42, 2147483647, -2147483647 - 1};
+
+	for (unsigned i = 0; i < sizeof(ints) / sizeof(ints[0]); i++) {
+		int v = ints[i];
+		SAME("%d|%5d|%-5d|%05d|%1d", v, v, v, v, v);
+		SAME("%u|%x|%X|%08x|%-9x|", (unsigned)v, (unsigned)v, (unsigned)v,
+		     (unsigned)v, (unsigned)v);
+	}
+
+	SAME("[%s] [%10s] [%-10s] [%2s]", "abc", "abc", "abc", "abc");
+	SAME("%c%c%3c%-3c|", 'a', 'b', 'c', 'd');
+	SAME("%*s|%-*s|%*d", 4, "x", 4, "y", 6, -12);
+	SAME("%*s|%*d|", -4, "x", -6, 12);
+	SAME("100%% %s", "done");
+	SAME("%lu %ld", 7ul, -7l);
+}
+
+static void test_truncation(void)
+{
+	char buf[8];
+
+	memset(buf, 'x', sizeof(buf));
+	CHECK(ksnprintf(buf, sizeof(buf), "%s", "hello, world") == 12);
+	CHECK(strcmp(buf, "hello, ") == 0);
+
+	buf[0] = 'x';
+	CHECK(ksnprintf(buf, 1, "%d", 123) == 3 && buf[0] == '\0');
+	CHECK(ksnprintf(0, 0, "%d", -123) == 4);
+}
+
+static void test_flush(void)
+{
+	char buf[16];
+	char want[256];
+
+	// Output longer than the buffer arrives in order, in several pieces
+	int n = format_flushed(buf, sizeof(buf), "%s-%d-%s", "first chunk",
+	                       12345, "and then some more text");
+	snprintf(want, sizeof(want), "%s-%d-%s", "first chunk", 12345,
+	         "and then some more text");
+	CHECK(n == (int)strlen(want) && strcmp(flushed, want) == 0);
+	CHECK(flush_calls == (n + 15) / 16);
+
+	// Short output is a single write
+	format_flushed(buf, sizeof(buf), "%d", 7);
+	CHECK(flush_calls == 1 && strcmp(flushed, "7") == 0);
+
+	// A color escape that would straddle a full buffer moves whole into
+	// the next one
+	char big[256];
+	format_flushed(big, 4, "ab\x1b" "c0" "d");
+	CHECK(strcmp(flushed, "ab\x1b" "c0" "d") == 0 && flush_calls == 2);
+}
+
+int main(void)
+{
+	test_conversions();
+	test_truncation();
+	test_flush();
+
+	return test_finish("test_printf");
+}
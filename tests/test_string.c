@@ -0,0 +1,91 @@
+// lib/string.c against the host libc, over sizes and alignments that hit
+// the byte, rep movs/stos and SSE2 paths
+#include <string.h>
+
+#include "harness.h"
+
+#define BUF_SIZE 8192
+
+static unsigned char src[BUF_SIZE], got[BUF_SIZE], want[BUF_SIZE];
+
+static int sign(int x)
+{
+	return (x > 0) - (x < 0);
+}
+
+static void fill_random(unsigned char *p, int n)
+{
+	for (int i = 0; i < n; i++)
+		p[i] = rand();
+}
+
+static void test_mem(void)
+{
+	for (int n = 0; n < 6000; n += n < 128 ? 1 : 61) {
+		for (int da = 0; da < 16; da++) {
+			for (int sa = 0; sa < 16; sa += 5) {
+				fill_random(src, BUF_SIZE);
+				fill_random(got, BUF_SIZE);
+				memcpy(want, got, BUF_SIZE);
+
+				k_memcpy(got + da, src + sa, n);
+				memcpy(want + da, src + sa, n);
+				CHECK(memcmp(got, want, BUF_SIZE) == 0);
+
+				k_memset(got + da, sa * 17, n);
+				memset(want + da, sa * 17, n);
+				CHECK(memcmp(got, want, BUF_SIZE) == 0);
+
+				// Differ in one byte somewhere in the range
+				memcpy(got, src, BUF_SIZE);
+				if (n)
+					got[sa + rand() % n] ^= 1 << (rand() % 8);
+				CHECK(sign(k_memcmp(src + sa, got + sa, n)) ==
+				      sign(memcmp(src + sa, got + sa, n)));
+			}
+		}
+	}
+}
+
+static void test_str(void)
+{
+	char a[512], b[512];
+
+	for (int n = 0; n < 300; n++) {
+		for (int oa = 0; oa < 8; oa++) {
+			for (int ob = 0; ob < 8; ob++) {
+				// Small alphabet so strings often share long prefixes
+				for (int i = 0; i < n; i++)
+					a[oa + i] = 'a' + rand() % 3;
+				a[oa + n] = '\0';
+				memcpy(b + ob, a + oa, n + 1);
+				if (n && rand() % 2)
+					b[ob + rand() % n] = 'a' + rand() % 3;
+				if (n && rand() % 4 == 0)
+					b[ob + rand() % n] = '\0';
+
+				CHECK(k_strlen(a + oa) == n);
+				CHECK(sign(k_strcmp(a + oa, b + ob)) ==
+				      sign(strcmp(a + oa, b + ob)));
+				CHECK(sign(k_strncmp(a + oa, b + ob, n / 2)) ==
+				      sign(strncmp(a + oa, b + ob, n / 2)));
+			}
+		}
+	}
+
+	k_strcpy(a, "hello, ");
+	k_strcat(a, "world");
+	CHECK(strcmp(a, "hello, world") == 0);
+}
+
+int main(void)
+{
+	srand(1);
+	test_mem();
+	test_str();
+
+	string_enable_sse2();
+	test_mem();
+
+	return test_finish("test_string");
+}
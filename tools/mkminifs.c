@@ -0,0 +1,199 @@
+// Build a minifs image from a host directory, for use as a GRUB module
+// (initrd). Runs on the build machine, not in the kernel.
+//
+//   mkminifs <image> <size-in-KB> [source-dir]
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "../fs/minifs.h"
+
+static uint8_t *image;
+static struct minifs_super *sb;
+static uint32_t next_block;
+static uint32_t next_ino = MINIFS_ROOT_INO + 1;
+
+static void die(const char *msg, const char *arg)
+{
+	fprintf(stderr, "mkminifs: %s%s%s\n", msg, arg ? ": " : "", arg ? arg : "");
+	exit(1);
+}
+
+static uint8_t *block(uint32_t n)
+{
+	return image + (size_t)n * MINIFS_BLOCK_SIZE;
+}
+
+static void mark_used(uint32_t n)
+{
+	block(sb->bitmap_start + n / MINIFS_BITS_PER_BLOCK)
+	    [(n % MINIFS_BITS_PER_BLOCK) / 8] |= 1u << (n % 8);
+}
+
+static uint32_t alloc_block(void)
+{
+	if (next_block >= sb->total_blocks)
+		die("image full", 0);
+	mark_used(next_block);
+	sb->free_blocks--;
+	return next_block++;
+}
+
+static struct minifs_inode *inode(uint32_t ino)
+{
+	return (struct minifs_inode *)block(sb->inode_start +
+	                                    ino / MINIFS_INODES_PER_BLOCK) +
+	       ino % MINIFS_INODES_PER_BLOCK;
+}
+
+static uint32_t alloc_inode(const char *name, uint32_t parent, uint8_t type)
+{
+	if (next_ino >= sb->inode_count)
+		die("out of inodes", name);
+
+	struct minifs_inode *di = inode(next_ino);
+	if (strlen(name) >= MINIFS_NAME_LEN)
+		fprintf(stderr, "mkminifs: truncating name: %s\n", name);
+	strncpy(di->name, name, MINIFS_NAME_LEN - 1);
+	di->parent = parent;
+	di->type = type;
+	di->seq = next_ino; // inodes are handed out in creation order
+	sb->free_inodes--;
+	return next_ino++;
+}
+
+// Slot for file block n, allocating indirect blocks on the way
+static uint32_t *block_slot(struct minifs_inode *di, uint32_t n)
+{
+	if (n < MINIFS_DIRECT_BLOCKS)
+		return &di->direct[n];
+	n -= MINIFS_DIRECT_BLOCKS;
+
+	if (n < MINIFS_PTRS_PER_BLOCK) {
+		if (!di->indirect)
+			di->indirect = alloc_block();
+		return (uint32_t *)block(di->indirect) + n;
+	}
+	n -= MINIFS_PTRS_PER_BLOCK;
+
+	if (n >= MINIFS_PTRS_PER_BLOCK * MINIFS_PTRS_PER_BLOCK)
+		die("file too large", di->name);
+	if (!di->double_indirect)
+		di->double_indirect = alloc_block();
+	uint32_t *outer = (uint32_t *)block(di->double_indirect) +
+	                  n / MINIFS_PTRS_PER_BLOCK;
+	if (!*outer)
+		*outer = alloc_block();
+	return (uint32_t *)block(*outer) + n % MINIFS_PTRS_PER_BLOCK;
+}
+
+static void add_file(const char *path, uint32_t ino)
+{
+	FILE *f = fopen(path, "rb");
+	if (!f)
+		die("cannot read", path);
+
+	struct minifs_inode *di = inode(ino);
+	uint8_t buf[MINIFS_BLOCK_SIZE];
+	size_t n;
+
+	for (uint32_t i = 0; (n = fread(buf, 1, sizeof(buf), f)) > 0; i++) {
+		uint32_t *slot = block_slot(di, i);
+		*slot = alloc_block();
+		memcpy(block(*slot), buf, n);
+		di->size += n;
+	}
+	fclose(f);
+}
+
+static void add_dir(const char *path, uint32_t parent)
+{
+	DIR *dir = opendir(path);
+	if (!dir)
+		die("cannot open directory", path);
+
+	struct dirent *e;
+	while ((e = readdir(dir))) {
+		if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0)
+			continue;
+
+		char child[4096];
+		struct stat st;
+		snprintf(child, sizeof(child), "%s/%s", path, e->d_name);
+		if (stat(child, &st) != 0)
+			die("cannot stat", child);
+
+		if (S_ISDIR(st.st_mode)) {
+			add_dir(child, alloc_inode(e->d_name, parent, MINIFS_TYPE_DIR));
+		} else if (S_ISREG(st.st_mode)) {
+			add_file(child, alloc_inode(e->d_name, parent, MINIFS_TYPE_FILE));
+		}
+	}
+	closedir(dir);
+}
+
+// Same layout as the kernel's format()
+static void format(uint32_t total)
+{
+	uint32_t inode_blocks =
+	    (total / (MINIFS_BYTES_PER_INODE / MINIFS_BLOCK_SIZE) +
+	     MINIFS_INODES_PER_BLOCK - 1) / MINIFS_INODES_PER_BLOCK;
+
+	sb = (struct minifs_super *)block(0);
+	sb->magic = MINIFS_MAGIC;
+	sb->version = MINIFS_VERSION;
+	sb->block_size = MINIFS_BLOCK_SIZE;
+	sb->total_blocks = total;
+	sb->bitmap_start = 1;
+	sb->bitmap_blocks = (total + MINIFS_BITS_PER_BLOCK - 1) /
+	                    MINIFS_BITS_PER_BLOCK;
+	sb->inode_start = sb->bitmap_start + sb->bitmap_blocks;
+	sb->inode_blocks = inode_blocks;
+	sb->inode_count = inode_blocks * MINIFS_INODES_PER_BLOCK;
+	sb->data_start = sb->inode_start + inode_blocks;
+	sb->free_blocks = total - sb->data_start;
+	sb->free_inodes = sb->inode_count - 2;
+
+	for (uint32_t i = 0; i < sb->data_start; i++)
+		mark_used(i);
+	for (uint32_t i = total; i < sb->bitmap_blocks * MINIFS_BITS_PER_BLOCK; i++)
+		mark_used(i);
+	next_block = sb->data_start;
+
+	struct minifs_inode *root = inode(MINIFS_ROOT_INO);
+	strcpy(root->name, "/");
+	root->type = MINIFS_TYPE_DIR;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 3 || argc > 4) {
+		fprintf(stderr, "usage: mkminifs <image> <size-in-KB> [source-dir]\n");
+		return 1;
+	}
+
+	uint32_t total = strtoul(argv[2], 0, 0) / (MINIFS_BLOCK_SIZE / 1024);
+	if (total < 64)
+		die("image too small", argv[2]);
+
+	image = calloc(total, MINIFS_BLOCK_SIZE);
+	if (!image)
+		die("out of memory", 0);
+
+	format(total);
+	if (argc == 4)
+		add_dir(argv[3], MINIFS_ROOT_INO);
+
+	FILE *out = fopen(argv[1], "wb");
+	if (!out || fwrite(image, MINIFS_BLOCK_SIZE, total, out) != total ||
+	    fclose(out) != 0)
+		die("cannot write", argv[1]);
+
+	printf("%s: %u KB, %u files, %u KB used\n", argv[1],
+	       total * (MINIFS_BLOCK_SIZE / 1024), next_ino - MINIFS_ROOT_INO - 1,
+	       (next_block - sb->data_start) * (MINIFS_BLOCK_SIZE / 1024));
+	return 0;
+}
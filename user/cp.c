@@ -0,0 +1,36 @@
+// cp - copy a file
+#include "ulib.h"
+
+#define CP_BUFFER_SIZE 4096
+
+int main(int argc, char **argv)
+{
+	char buf[CP_BUFFER_SIZE];
+	int n;
+
+	if (argc != 3) {
+		dprintf(STDERR, "usage: cp <from> <to>\n");
+		return 2;
+	}
+
+	int in = open(argv[1], O_RDONLY);
+	if (in < 0) {
+		dprintf(STDERR, "cp: %s: cannot open\n", argv[1]);
+		return 1;
+	}
+	int out = open(argv[2], O_WRONLY | O_CREAT | O_TRUNC);
+	if (out < 0) {
+		dprintf(STDERR, "cp: %s: cannot create\n", argv[2]);
+		return 1;
+	}
+
+	while ((n = read(in, buf, sizeof(buf))) > 0) {
+		if (write(out, buf, n) != n) {
+			dprintf(STDERR, "cp: %s: write error\n", argv[2]);
+			return 1;
+		}
+	}
+	close(in);
+	close(out);
+	return n < 0;
+}
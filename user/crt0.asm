@@ -0,0 +1,22 @@
+; crt0.asm - user program entry point
+; The kernel starts a program with [esp] = argc, [esp + 4] = argv and
+; [esp + 8] = SYSCALL_FEATURE_* bits (kernel/syscall.h); main's return
+; value becomes the exit status.
+bits 32
+extern main
+extern exit
+extern user_features
+
+section .text.start
+global _start
+
+_start:
+    mov eax, [esp + 8]
+    mov [user_features], eax
+    mov eax, [esp + 4]
+    mov ecx, [esp]
+    push eax                    ; argv
+    push ecx                    ; argc
+    call main
+    push eax
+    call exit
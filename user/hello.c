@@ -0,0 +1,12 @@
+// hello - greet from ring 3
+#include "ulib.h"
+
+int main(int argc, char **argv)
+{
+	printf("Hello from %s (thread %d, %d argument%s), calling the kernel "
+	       "with %s\n",
+	       argv[0], gettid(), argc - 1, argc == 2 ? "" : "s",
+	       (user_features & SYSCALL_FEATURE_SYSENTER) ? "sysenter"
+	                                                   : "int 0x80");
+	return 0;
+}
@@ -0,0 +1,96 @@
+#include "ulib.h"
+
+#define PRINTF_BUFFER_SIZE 128
+
+uint32_t user_features;
+
+// sysenter when the CPU has it; the kernel returns to label 1 with the
+// stack pointer it was given in ecx
+static int32_t syscall3(uint32_t nr, uint32_t a, uint32_t b, uint32_t c)
+{
+	int32_t ret;
+
+	if (user_features & SYSCALL_FEATURE_SYSENTER)
+		__asm__ volatile("mov %%esp, %%ecx\n"
+		                 "mov $1f, %%edx\n"
+		                 "sysenter\n"
+		                 "1:"
+		                 : "=a"(ret)
+		                 : "a"(nr), "b"(a), "S"(b), "D"(c)
+		                 : "ecx", "edx", "memory");
+	else
+		__asm__ volatile("int $0x80"
+		                 : "=a"(ret)
+		                 : "a"(nr), "b"(a), "S"(b), "D"(c)
+		                 : "memory");
+	return ret;
+}
+
+void exit(int code)
+{
+	syscall3(SYS_EXIT, code, 0, 0);
+	for (;;)
+		;
+}
+
+int read(int fd, void *buf, int len)
+{
+	return syscall3(SYS_READ, fd, (uint32_t)buf, len);
+}
+
+int write(int fd, const void *buf, int len)
+{
+	return syscall3(SYS_WRITE, fd, (uint32_t)buf, len);
+}
+
+int open(const char *path, int flags)
+{
+	return syscall3(SYS_OPEN, (uint32_t)path, flags, 0);
+}
+
+int close(int fd)
+{
+	return syscall3(SYS_CLOSE, fd, 0, 0);
+}
+
+int gettid(void)
+{
+	return syscall3(SYS_GETTID, 0, 0, 0);
+}
+
+// Programs are single-threaded, so the flush callback can find its
+// descriptor here
+static int printf_fd;
+
+static void printf_flush(const char *buf, int len)
+{
+	write(printf_fd, buf, len);
+}
+
+int vdprintf(int fd, const char *fmt, va_list ap)
+{
+	char buf[PRINTF_BUFFER_SIZE];
+
+	printf_fd = fd;
+	return kvformat(buf, sizeof(buf), printf_flush, fmt, ap);
+}
+
+int dprintf(int fd, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	int n = vdprintf(fd, fmt, ap);
+	va_end(ap);
+	return n;
+}
+
+int printf(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	int n = vdprintf(STDOUT, fmt, ap);
+	va_end(ap);
+	return n;
+}
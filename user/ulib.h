@@ -0,0 +1,35 @@
+#ifndef ULIB_H
+#define ULIB_H
+
+// Runtime for user programs: system call wrappers (kernel/syscall.h has
+// the ABI) plus the kernel's string and formatting routines, rebuilt to
+// run in ring 3
+
+#include <stdarg.h>
+#include <stdint.h>
+#include "../kernel/syscall.h"
+#include "../lib/printf.h"
+#include "../lib/string.h"
+
+#define STDIN 0
+#define STDOUT 1
+#define STDERR 2
+
+// SYSCALL_FEATURE_* bits the program was started with (crt0.asm)
+extern uint32_t user_features;
+
+void exit(int code) __attribute__((noreturn));
+// A read from STDIN waits for a whole line and ends it with '\n'
+int read(int fd, void *buf, int len);
+int write(int fd, const void *buf, int len);
+int open(const char *path, int flags);
+int close(int fd);
+int gettid(void);
+
+// Formatted output as in lib/printf.h, to STDOUT or to fd
+int printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+int dprintf(int fd, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+int vdprintf(int fd, const char *fmt, va_list ap);
+
+#endif
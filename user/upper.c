@@ -0,0 +1,19 @@
+// upper - echo typed lines in upper case, until an empty one
+#include "ulib.h"
+
+#define LINE_SIZE 256
+
+int main(void)
+{
+	char line[LINE_SIZE];
+	int n;
+
+	while ((n = read(STDIN, line, sizeof(line))) > 1) {
+		for (int i = 0; i < n; i++) {
+			if (line[i] >= 'a' && line[i] <= 'z')
+				line[i] -= 'a' - 'A';
+		}
+		write(STDOUT, line, n);
+	}
+	return 0;
+}
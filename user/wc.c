@@ -0,0 +1,49 @@
+// wc - count lines, words and bytes in files
+#include "ulib.h"
+
+#define WC_BUFFER_SIZE 1024
+
+static int count(const char *name)
+{
+	char buf[WC_BUFFER_SIZE];
+	uint32_t lines = 0, words = 0, bytes = 0;
+	int in_word = 0, n;
+
+	int fd = open(name, O_RDONLY);
+	if (fd < 0) {
+		dprintf(STDERR, "wc: %s: cannot open\n", name);
+		return 1;
+	}
+
+	while ((n = read(fd, buf, sizeof(buf))) > 0) {
+		bytes += n;
+		for (int i = 0; i < n; i++) {
+			char c = buf[i];
+			if (c == '\n')
+				lines++;
+			if (c == ' ' || c == '\n' || c == '\t') {
+				in_word = 0;
+			} else if (!in_word) {
+				in_word = 1;
+				words++;
+			}
+		}
+	}
+	close(fd);
+
+	printf("%7u %7u %7u %s\n", lines, words, bytes, name);
+	return n < 0;
+}
+
+int main(int argc, char **argv)
+{
+	int status = 0;
+
+	if (argc < 2) {
+		dprintf(STDERR, "usage: wc <file>...\n");
+		return 2;
+	}
+	for (int i = 1; i < argc; i++)
+		status |= count(argv[i]);
+	return status;
+}